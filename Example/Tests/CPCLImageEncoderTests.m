@@ -0,0 +1,145 @@
+//
+//  CPCLImageEncoderTests.m
+//  libPrinterSDKTests
+//
+
+@import XCTest;
+#import "CPCLImageEncoder.h"
+#import "CPCLCommand.h"
+
+@interface CPCLImageEncoderTests : XCTestCase
+
+@end
+
+@implementation CPCLImageEncoderTests
+
+/// 576 x 400 dots of diagonal stripes, no blank margins
+- (PrinterBitmap *)stripedBitmap
+{
+    int width = 576;
+    int height = 400;
+    int bytesPerRow = width / 8;
+    NSMutableData *data = [NSMutableData dataWithLength:bytesPerRow * height];
+    uint8_t *bytes = data.mutableBytes;
+    for (int y = 0; y < height; y++) {
+        for (int i = 0; i < bytesPerRow; i++) {
+            bytes[y * bytesPerRow + i] = (uint8_t)(0xF0F0 >> ((y + i) & 7));
+        }
+    }
+    return [[PrinterBitmap alloc] initWithWidth:width height:height data:data];
+}
+
+/// A 576 x 400 label image, white except for a 296 x 200 block of stripes in the middle
+- (UIImage *)labelImage
+{
+    UIGraphicsBeginImageContextWithOptions(CGSizeMake(576, 400), YES, 1.0);
+    CGContextRef context = UIGraphicsGetCurrentContext();
+    CGContextSetFillColorWithColor(context, [UIColor whiteColor].CGColor);
+    CGContextFillRect(context, CGRectMake(0, 0, 576, 400));
+    CGContextSetFillColorWithColor(context, [UIColor blackColor].CGColor);
+    for (int y = 100; y < 300; y++) {
+        for (int x = 140 + (y & 7); x < 436; x += 8) {
+            CGContextFillRect(context, CGRectMake(x, y, MIN(4, 436 - x), 1));
+        }
+    }
+    UIImage *image = UIGraphicsGetImageFromCurrentImageContext();
+    UIGraphicsEndImageContext();
+    return image;
+}
+
+- (CPCLImageEncoder *)encoderWithFormat:(CPCLGraphicFormat)format
+{
+    CPCLImageEncoder *encoder = [[CPCLImageEncoder alloc] init];
+    encoder.format = format;
+    encoder.bandHeight = 0;
+    return encoder;
+}
+
+- (void)testEGIsTwiceTheSizeOfCG
+{
+    PrinterBitmap *bitmap = [self stripedBitmap];
+    NSData *cg = [[self encoderWithFormat:CPCL_GRAPHIC_CG] drawBitmapWithx:0 y:0 bitmap:bitmap];
+    NSData *eg = [[self encoderWithFormat:CPCL_GRAPHIC_EG] drawBitmapWithx:0 y:0 bitmap:bitmap];
+
+    XCTAssertEqualObjects([cg subdataWithRange:NSMakeRange(0, 3)], [@"CG " dataUsingEncoding:NSASCIIStringEncoding]);
+    XCTAssertEqualObjects([eg subdataWithRange:NSMakeRange(0, 3)], [@"EG " dataUsingEncoding:NSASCIIStringEncoding]);
+    NSUInteger payload = bitmap.data.length;
+    XCTAssertGreaterThanOrEqual(cg.length, payload);
+    XCTAssertLessThan(cg.length, payload + 64);
+    XCTAssertGreaterThanOrEqual(eg.length, payload * 2);
+    XCTAssertLessThan(eg.length, payload * 2 + 64);
+}
+
+- (void)testTrimmedCGIsLessThanHalfOfTheExistingDrawImage
+{
+    UIImage *image = [self labelImage];
+    NSData *existing = [CPCLCommand drawImageWithx:0 y:0 image:image];
+    NSData *cg = [[self encoderWithFormat:CPCL_GRAPHIC_CG] drawImageWithx:0 y:0 image:image];
+    XCTAssertGreaterThan(existing.length, 0u);
+    XCTAssertEqualObjects([cg subdataWithRange:NSMakeRange(0, 3)], [@"CG " dataUsingEncoding:NSASCIIStringEncoding]);
+    // The stripes cover a quarter of the image; trimming and binary data keep CG well under half
+    XCTAssertLessThan(cg.length * 2, existing.length);
+}
+
+- (void)testTrimmedEGIsSmallerThanTheExistingDrawImage
+{
+    UIImage *image = [self labelImage];
+    NSData *existing = [CPCLCommand drawImageWithx:0 y:0 image:image];
+    NSData *eg = [[self encoderWithFormat:CPCL_GRAPHIC_EG] drawImageWithx:0 y:0 image:image];
+    XCTAssertEqualObjects([eg subdataWithRange:NSMakeRange(0, 3)], [@"EG " dataUsingEncoding:NSASCIIStringEncoding]);
+    XCTAssertLessThan(eg.length, existing.length);
+}
+
+- (void)testAutoSelectsEGForASCIILinks
+{
+    PrinterBitmap *bitmap = [self stripedBitmap];
+    CPCLImageEncoder *encoder = [self encoderWithFormat:CPCL_GRAPHIC_AUTO];
+    encoder.requiresASCII = YES;
+    NSData *command = [encoder drawBitmapWithx:0 y:0 bitmap:bitmap];
+    XCTAssertEqualObjects([command subdataWithRange:NSMakeRange(0, 2)], [@"EG" dataUsingEncoding:NSASCIIStringEncoding]);
+}
+
+- (void)testExistingDrawImageTime
+{
+    UIImage *image = [self labelImage];
+    [self measureBlock:^{
+        for (int i = 0; i < 20; i++) {
+            [CPCLCommand drawImageWithx:0 y:0 image:image];
+        }
+    }];
+}
+
+- (void)testCGDrawImageTime
+{
+    UIImage *image = [self labelImage];
+    CPCLImageEncoder *encoder = [self encoderWithFormat:CPCL_GRAPHIC_CG];
+    [self measureBlock:^{
+        for (int i = 0; i < 20; i++) {
+            [encoder drawImageWithx:0 y:0 image:image];
+        }
+    }];
+}
+
+- (void)testCGEncodingTime
+{
+    PrinterBitmap *bitmap = [self stripedBitmap];
+    CPCLImageEncoder *encoder = [self encoderWithFormat:CPCL_GRAPHIC_CG];
+    [self measureBlock:^{
+        for (int i = 0; i < 20; i++) {
+            [encoder drawBitmapWithx:0 y:0 bitmap:bitmap];
+        }
+    }];
+}
+
+- (void)testEGEncodingTime
+{
+    PrinterBitmap *bitmap = [self stripedBitmap];
+    CPCLImageEncoder *encoder = [self encoderWithFormat:CPCL_GRAPHIC_EG];
+    [self measureBlock:^{
+        for (int i = 0; i < 20; i++) {
+            [encoder drawBitmapWithx:0 y:0 bitmap:bitmap];
+        }
+    }];
+}
+
+@end
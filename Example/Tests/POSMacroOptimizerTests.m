@@ -0,0 +1,148 @@
+//
+//  POSMacroOptimizerTests.m
+//  libPrinterSDKTests
+//
+
+@import XCTest;
+#import "POSMacroOptimizer.h"
+
+static NSData *POSMTBytes(const char *bytes, NSUInteger length) {
+    return [NSData dataWithBytes:bytes length:length];
+}
+
+static NSData *POSMTText(NSString *text) {
+    return [text dataUsingEncoding:NSASCIIStringEncoding];
+}
+
+@interface POSMacroOptimizerTests : XCTestCase
+
+@end
+
+@implementation POSMacroOptimizerTests
+
+/// Bold separator line: ESC E 1, 32 dashes and LF, ESC E 0
+- (NSArray<NSData *> *)separator
+{
+    return @[POSMTBytes("\x1B\x45\x01", 3), POSMTText(@"--------------------------------\n"), POSMTBytes("\x1B\x45\x00", 3)];
+}
+
+/// A receipt with a header, ten items each followed by the separator, and a total
+- (PrinterJobBuffer *)receiptWithNumber:(int)number
+{
+    PrinterJobBuffer *job = [[PrinterJobBuffer alloc] init];
+    [job appendCommand:POSMTBytes("\x1B\x40", 2)];
+    [job appendCommand:POSMTBytes("\x1B\x61\x01", 3)];
+    [job appendCommand:POSMTText([NSString stringWithFormat:@"CORNER SHOP  #%04d\n", number])];
+    for (int i = 0; i < 10; i++) {
+        [job appendCommand:POSMTBytes("\x1B\x61\x00", 3)];
+        [job appendCommand:POSMTText([NSString stringWithFormat:@"Item %02d            %3d.%02d\n", i + 1, 3 + i, (number * 7 + i * 13) % 100])];
+        [job appendCommands:[self separator]];
+    }
+    [job appendCommand:POSMTText(@"TOTAL                  99.90\n")];
+    [job appendCommand:POSMTBytes("\x1D\x56\x42\x00", 4)];
+    return job;
+}
+
+/// Replaces the definition and every execution with the recorded commands, giving what the printer prints
+- (NSData *)expand:(POSMacroResult *)result
+{
+    NSData *define = POSMTBytes("\x1D\x3A", 2);
+    NSMutableData *definition = [define mutableCopy];
+    [definition appendData:result.macro ?: [NSData data]];
+    [definition appendData:define];
+    NSData *execute = POSMTBytes("\x1D\x5E\x01\x00\x00", 5);
+
+    NSMutableData *printed = [NSMutableData data];
+    NSData *data = result.job.data;
+    __block NSUInteger start = 0;
+    [result.job.commandBoundaries enumerateIndexesUsingBlock:^(NSUInteger boundary, BOOL *stop) {
+        if (boundary <= start) {
+            return;
+        }
+        NSData *command = [data subdataWithRange:NSMakeRange(start, boundary - start)];
+        if ([command isEqualToData:execute]) {
+            [printed appendData:result.macro];
+        } else if (![command isEqualToData:definition]) {
+            [printed appendData:command];
+        }
+        start = boundary;
+    }];
+    return printed;
+}
+
+- (POSMacroOptimizer *)optimizer
+{
+    POSMacroOptimizer *optimizer = [[POSMacroOptimizer alloc] init];
+    [optimizer setMacrosSupported:YES forModel:@"TM"];
+    return optimizer;
+}
+
+- (void)testReceiptDefinesAndExecutesTheSeparator
+{
+    POSMacroOptimizer *optimizer = [self optimizer];
+    PrinterJobBuffer *receipt = [self receiptWithNumber:1];
+    POSMacroResult *result = [optimizer optimizeJob:receipt model:@"TM-T20" printerID:@"printer"];
+
+    XCTAssertTrue(result.definesMacro);
+    XCTAssertGreaterThanOrEqual(result.executions, 9u);
+    XCTAssertGreaterThan(result.bytesSaved, 0);
+    XCTAssertEqual(result.bytesSaved, (NSInteger)receipt.data.length - (NSInteger)result.job.data.length);
+    XCTAssertEqual(optimizer.totalBytesSaved, (NSUInteger)result.bytesSaved);
+    XCTAssertEqualObjects([self expand:result], receipt.data);
+    // The ten separators alone, less their definition, are more than a third of the receipt
+    XCTAssertGreaterThanOrEqual(result.bytesSaved * 3, (NSInteger)receipt.data.length);
+}
+
+- (void)testEveryJobDefinesTheMacroByDefault
+{
+    POSMacroOptimizer *optimizer = [self optimizer];
+    POSMacroResult *first = [optimizer optimizeJob:[self receiptWithNumber:1] model:@"TM-T20" printerID:@"printer"];
+    PrinterJobBuffer *receipt = [self receiptWithNumber:2];
+    POSMacroResult *second = [optimizer optimizeJob:receipt model:@"TM-T20" printerID:@"printer"];
+
+    XCTAssertTrue(second.definesMacro);
+    XCTAssertEqualObjects(second.macro, first.macro);
+    XCTAssertEqual(second.bytesSaved, first.bytesSaved);
+    XCTAssertEqualObjects([self expand:second], receipt.data);
+}
+
+- (void)testHeldMacroIsNotDefinedAgain
+{
+    POSMacroOptimizer *optimizer = [self optimizer];
+    optimizer.reusesHeldMacros = YES;
+    POSMacroResult *first = [optimizer optimizeJob:[self receiptWithNumber:1] model:@"TM-T20" printerID:@"printer"];
+    PrinterJobBuffer *receipt = [self receiptWithNumber:2];
+    POSMacroResult *second = [optimizer optimizeJob:receipt model:@"TM-T20" printerID:@"printer"];
+
+    XCTAssertFalse(second.definesMacro);
+    XCTAssertEqualObjects(second.macro, first.macro);
+    // The definition is not paid again
+    XCTAssertEqual(second.bytesSaved, (NSInteger)first.macro.length + 4 + first.bytesSaved);
+    XCTAssertEqualObjects([self expand:second], receipt.data);
+    // Without the definition at least two fifths of the receipt are saved
+    XCTAssertGreaterThanOrEqual(second.bytesSaved * 5, (NSInteger)receipt.data.length * 2);
+}
+
+- (void)testInvalidatedPrinterGetsTheDefinitionAgain
+{
+    POSMacroOptimizer *optimizer = [self optimizer];
+    optimizer.reusesHeldMacros = YES;
+    [optimizer optimizeJob:[self receiptWithNumber:1] model:@"TM-T20" printerID:@"printer"];
+    [optimizer invalidatePrinter:@"printer"];
+    POSMacroResult *result = [optimizer optimizeJob:[self receiptWithNumber:2] model:@"TM-T20" printerID:@"printer"];
+    XCTAssertTrue(result.definesMacro);
+}
+
+- (void)testUnsupportedModelIsUnchanged
+{
+    POSMacroOptimizer *optimizer = [self optimizer];
+    [optimizer setMacrosSupported:NO forModel:@"TM-U"];
+    PrinterJobBuffer *receipt = [self receiptWithNumber:1];
+    POSMacroResult *result = [optimizer optimizeJob:receipt model:@"TM-U220" printerID:@"printer"];
+    XCTAssertEqual(result.job, receipt);
+    XCTAssertNil(result.macro);
+    XCTAssertEqual(result.bytesSaved, 0);
+    XCTAssertEqual([optimizer optimizeJob:receipt model:nil printerID:@"printer"].job, receipt);
+}
+
+@end
@@ -0,0 +1,314 @@
+//
+//  POSStreamOptimizerTests.m
+//  libPrinterSDKTests
+//
+
+@import XCTest;
+#import "POSStreamOptimizer.h"
+
+/// Test command the optimizer does not know: ESC DEL n
+static const uint8_t POSSTUnknown = 0x7F;
+
+/// Minimal ESC/POS printer model. It follows the settings the optimizer tracks and logs what
+/// reaches the paper: every printed line with its alignment, line spacing and per-character
+/// attributes, and the paper movement of feeds, merged like the paper does.
+@interface POSSTPrinter : NSObject
+@property (nonatomic, readonly) NSMutableArray<NSString *> *events;
+@property (nonatomic, assign) NSInteger bold;
+@property (nonatomic, assign) NSInteger alignment;
+@property (nonatomic, assign) NSInteger size;
+@property (nonatomic, assign) NSInteger font;
+@property (nonatomic, assign) NSInteger underline;
+@property (nonatomic, assign) NSInteger spacing;
+@property (nonatomic, assign) BOOL atLineStart;
+@property (nonatomic, assign) BOOL failed;
+@end
+
+@implementation POSSTPrinter {
+    NSMutableString *_line;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _events = [NSMutableArray array];
+        _line = [NSMutableString string];
+        [self reset];
+    }
+    return self;
+}
+
+/// A printer left in an arbitrary state by an earlier job, in the middle of a line
++ (instancetype)dirtyPrinter
+{
+    POSSTPrinter *printer = [[self alloc] init];
+    printer.bold = 1;
+    printer.alignment = 2;
+    printer.size = 0x11;
+    printer.font = 1;
+    printer.underline = 2;
+    printer.spacing = 60;
+    printer.atLineStart = NO;
+    return printer;
+}
+
+- (void)reset
+{
+    _bold = 0;
+    _alignment = 0;
+    _size = 0;
+    _font = 0;
+    _underline = 0;
+    _spacing = -1;
+    _atLineStart = YES;
+    [_line setString:@""];
+}
+
+- (NSString *)stateDescription
+{
+    return [NSString stringWithFormat:@"bold %ld align %ld size %ld font %ld underline %ld spacing %ld",
+            (long)_bold, (long)_alignment, (long)_size, (long)_font, (long)_underline, (long)_spacing];
+}
+
+- (void)printLine
+{
+    [_events addObject:[NSString stringWithFormat:@"line align %ld spacing %ld: %@", (long)_alignment, (long)_spacing, _line]];
+    [_line setString:@""];
+    _atLineStart = YES;
+}
+
+- (void)feed:(NSString *)unit amount:(NSInteger)amount
+{
+    if (_line.length > 0) {
+        [self printLine];
+    }
+    NSString *prefix = [NSString stringWithFormat:@"feed %@ ", unit];
+    NSString *last = _events.lastObject;
+    if ([last hasPrefix:prefix]) {
+        amount += [last substringFromIndex:prefix.length].integerValue;
+        [_events removeLastObject];
+    }
+    [_events addObject:[NSString stringWithFormat:@"%@%ld", prefix, (long)amount]];
+    _atLineStart = YES;
+}
+
+- (void)printCharacter:(uint8_t)c
+{
+    if (c == 0x0A) {
+        [self printLine];
+        return;
+    }
+    [_line appendFormat:@"%c{%ld%ld%ld%ld}", c, (long)_bold, (long)_size, (long)_font, (long)_underline];
+    _atLineStart = NO;
+}
+
+- (void)process:(NSData *)data
+{
+    const uint8_t *bytes = data.bytes;
+    NSUInteger i = 0;
+    while (i < data.length && !_failed) {
+        uint8_t c = bytes[i];
+        if (c != 0x1B && c != 0x1D) {
+            [self printCharacter:c];
+            i++;
+            continue;
+        }
+        uint8_t x = i + 1 < data.length ? bytes[i + 1] : 0;
+        NSUInteger length = (c == 0x1B && (x == '@' || x == '2')) ? 2 : 3;
+        if (i + length > data.length) {
+            _failed = YES;
+            return;
+        }
+        if (length == 2) {
+            if (x == '@') {
+                [self reset];
+            } else {
+                _spacing = -1;
+            }
+            i += 2;
+            continue;
+        }
+        uint8_t n = bytes[i + 2];
+        if (c == 0x1D && x == '!') {
+            _size = n;
+        } else if (c == 0x1B) {
+            switch (x) {
+                case 'E': _bold = n & 1; break;
+                case 'M': _font = (n >= 48) ? n - 48 : n; break;
+                case '-': _underline = (n >= 48) ? n - 48 : n; break;
+                case '3': _spacing = n; break;
+                case 'a':
+                    // Only taken at the start of a line
+                    if (_atLineStart) {
+                        _alignment = (n >= 48) ? n - 48 : n;
+                    }
+                    break;
+                case '!':
+                    _font = n & 0x01;
+                    _bold = (n >> 3) & 0x01;
+                    _size = ((n & 0x20) ? 0x10 : 0) | ((n & 0x10) ? 0x01 : 0);
+                    _underline = (n & 0x80) ? 1 : 0;
+                    break;
+                case 'd': [self feed:@"lines" amount:n]; break;
+                case 'J': [self feed:@"dots" amount:n]; break;
+                case POSSTUnknown: [_events addObject:[NSString stringWithFormat:@"unknown %u", n]]; break;
+                default: _failed = YES; return;
+            }
+        } else {
+            _failed = YES;
+            return;
+        }
+        i += 3;
+    }
+}
+
+@end
+
+static NSData *POSSTBytes(const char *bytes, NSUInteger length) {
+    return [NSData dataWithBytes:bytes length:length];
+}
+
+static NSData *POSSTText(NSString *text) {
+    return [text dataUsingEncoding:NSASCIIStringEncoding];
+}
+
+@interface POSStreamOptimizerTests : XCTestCase
+
+@end
+
+@implementation POSStreamOptimizerTests
+
+- (PrinterJobBuffer *)jobWithCommands:(NSArray<NSData *> *)commands
+{
+    PrinterJobBuffer *job = [[PrinterJobBuffer alloc] init];
+    [job appendCommands:commands];
+    return job;
+}
+
+/// Runs both streams on the same printer state and compares the paper output and the state left behind
+- (void)assertStream:(NSData *)optimized printsLike:(NSData *)original from:(POSSTPrinter * (^)(void))makePrinter
+{
+    POSSTPrinter *expected = makePrinter();
+    [expected process:original];
+    POSSTPrinter *actual = makePrinter();
+    [actual process:optimized];
+    XCTAssertFalse(expected.failed);
+    XCTAssertFalse(actual.failed);
+    XCTAssertEqualObjects(actual.events, expected.events);
+    XCTAssertEqualObjects([actual stateDescription], [expected stateDescription]);
+}
+
+/// Optimizes the commands as raw data and as a job and checks both against the original on a clean and a dirty printer
+- (void)assertEquivalentCommands:(NSArray<NSData *> *)commands
+{
+    PrinterJobBuffer *job = [self jobWithCommands:commands];
+    NSArray<POSSTPrinter * (^)(void)> *printers = @[^{ return [[POSSTPrinter alloc] init]; }, ^{ return [POSSTPrinter dirtyPrinter]; }];
+    POSStreamOptimizer *optimizer = [[POSStreamOptimizer alloc] init];
+    NSData *raw = [optimizer optimizeData:job.data];
+    NSData *optimizedJob = [optimizer optimizeJob:job].data;
+    for (POSSTPrinter * (^makePrinter)(void) in printers) {
+        [self assertStream:raw printsLike:job.data from:makePrinter];
+        [self assertStream:optimizedJob printsLike:job.data from:makePrinter];
+    }
+}
+
+- (void)testRedundantSettingsAreDropped
+{
+    NSArray<NSData *> *commands = @[
+        POSSTBytes("\x1B\x40", 2),
+        POSSTBytes("\x1B\x45\x01", 3), POSSTText(@"Bold\n"),
+        POSSTBytes("\x1B\x45\x01", 3), POSSTText(@"Still bold\n"),
+        POSSTBytes("\x1B\x45\x00", 3), POSSTBytes("\x1B\x45\x01", 3), POSSTText(@"Bold again\n"),
+        POSSTBytes("\x1B\x2D\x01", 3), POSSTBytes("\x1B\x2D\x00", 3), POSSTText(@"Plain underline\n"),
+    ];
+    [self assertEquivalentCommands:commands];
+    POSStreamOptimizer *optimizer = [[POSStreamOptimizer alloc] init];
+    [optimizer optimizeJob:[self jobWithCommands:commands]];
+    // Second and fourth ESC E 1, the ESC E 0 before it and both ESC - (underline is already off after ESC @)
+    XCTAssertEqual(optimizer.lastBytesSaved, 15u);
+    XCTAssertEqual(optimizer.lastUnrecognizedOffset, NSNotFound);
+}
+
+- (void)testAlignmentMidLineIsNotTrusted
+{
+    [self assertEquivalentCommands:@[
+        POSSTBytes("\x1B\x40", 2),
+        POSSTBytes("\x1B\x61\x01", 3), POSSTText(@"Centered "),
+        // Ignored by the printer: not at the start of a line
+        POSSTBytes("\x1B\x61\x02", 3), POSSTText(@"still centered\n"),
+        // So this one must be sent even though the stream set 2 before
+        POSSTBytes("\x1B\x61\x02", 3), POSSTText(@"Right\n"),
+        POSSTBytes("\x1B\x61\x02", 3), POSSTText(@"Right again\n"),
+    ]];
+}
+
+- (void)testPrintModeAndCharacterSizeKeepTheirOrder
+{
+    [self assertEquivalentCommands:@[
+        POSSTBytes("\x1B\x40", 2),
+        // ESC ! after GS ! resets the size
+        POSSTBytes("\x1D\x21\x11", 3), POSSTBytes("\x1B\x21\x08", 3), POSSTText(@"Bold, normal size\n"),
+        // GS ! after ESC ! overrides its size bits
+        POSSTBytes("\x1B\x21\x30", 3), POSSTBytes("\x1D\x21\x00", 3), POSSTText(@"Normal size\n"),
+        // GS ! repeating what ESC ! set
+        POSSTBytes("\x1B\x21\x30", 3), POSSTBytes("\x1D\x21\x11", 3), POSSTText(@"Double\n"),
+        // ESC ! with underline, then an explicit thickness
+        POSSTBytes("\x1B\x21\x80", 3), POSSTBytes("\x1B\x2D\x01", 3), POSSTText(@"Underlined\n"),
+    ]];
+}
+
+- (void)testFeedsAreMerged
+{
+    NSArray<NSData *> *commands = @[
+        POSSTBytes("\x1B\x40", 2),
+        POSSTText(@"Before feed"),
+        POSSTBytes("\x1B\x64\x02", 3), POSSTBytes("\x1B\x64\x03", 3),
+        POSSTBytes("\x1B\x4A\x0A", 3), POSSTBytes("\x1B\x4A\x14", 3),
+        POSSTText(@"After feed\n"),
+        POSSTBytes("\x1B\x64\x04", 3),
+    ];
+    [self assertEquivalentCommands:commands];
+    POSStreamOptimizer *optimizer = [[POSStreamOptimizer alloc] init];
+    NSData *optimized = [optimizer optimizeData:[self jobWithCommands:commands].data];
+    NSData *merged = POSSTBytes("\x1B\x64\x05\x1B\x4A\x1E", 6);
+    XCTAssertNotEqual([optimized rangeOfData:merged options:0 range:NSMakeRange(0, optimized.length)].location, NSNotFound);
+    XCTAssertEqual(optimizer.lastBytesSaved, 6u);
+}
+
+- (void)testRepeatedResetIsSentOnce
+{
+    [self assertEquivalentCommands:@[
+        POSSTBytes("\x1B\x45\x01", 3), POSSTBytes("\x1B\x40", 2), POSSTBytes("\x1B\x40", 2),
+        POSSTText(@"After reset\n"),
+    ]];
+}
+
+- (void)testUnknownCommandFallsBack
+{
+    NSArray<NSData *> *commands = @[
+        POSSTBytes("\x1B\x40", 2),
+        POSSTBytes("\x1B\x45\x01", 3), POSSTText(@"Bold\n"),
+        POSSTBytes("\x1B\x7F\x05", 3),
+        POSSTBytes("\x1B\x45\x01", 3), POSSTText(@"Bold?\n"),
+        POSSTBytes("\x1B\x45\x01", 3), POSSTText(@"Bold!\n"),
+    ];
+    [self assertEquivalentCommands:commands];
+    PrinterJobBuffer *job = [self jobWithCommands:commands];
+    NSUInteger unknownOffset = 2 + 3 + 5;
+
+    // Raw data: everything from the unknown command on is copied
+    POSStreamOptimizer *optimizer = [[POSStreamOptimizer alloc] init];
+    NSData *raw = [optimizer optimizeData:job.data];
+    XCTAssertEqual(optimizer.lastUnrecognizedOffset, unknownOffset);
+    XCTAssertEqualObjects([raw subdataWithRange:NSMakeRange(raw.length - (job.data.length - unknownOffset), job.data.length - unknownOffset)],
+                          [job.data subdataWithRange:NSMakeRange(unknownOffset, job.data.length - unknownOffset)]);
+
+    // Job: the optimizer continues at the next boundary, so the last ESC E 1 still disappears;
+    // the one right after the unknown command stays since the state is unknown there
+    PrinterJobBuffer *optimizedJob = [optimizer optimizeJob:job];
+    XCTAssertEqual(optimizer.lastUnrecognizedOffset, unknownOffset);
+    XCTAssertEqual(optimizedJob.data.length, job.data.length - 3);
+}
+
+@end
@@ -0,0 +1,309 @@
+//
+//  PrinterGatewayTests.m
+//  libPrinterSDKTests
+//
+
+@import XCTest;
+#import "PrinterGateway.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <fcntl.h>
+#import <poll.h>
+#import <unistd.h>
+
+/// Listening socket on 127.0.0.1 standing in for a printer's raw port
+static int PGTListen(UInt16 *port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr *)&address, sizeof(address));
+    listen(fd, 4);
+    socklen_t length = sizeof(address);
+    getsockname(fd, (struct sockaddr *)&address, &length);
+    *port = ntohs(address.sin_port);
+    return fd;
+}
+
+/// Accepts the gateway's printer connection, -1 if it does not come within a few seconds
+static int PGTAccept(int listener) {
+    struct pollfd pfd = {listener, POLLIN, 0};
+    if (poll(&pfd, 1, 5000) <= 0) {
+        return -1;
+    }
+    return accept(listener, NULL, NULL);
+}
+
+static int PGTConnect(UInt16 port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    return fd;
+}
+
+/// Reads until length bytes arrived, the peer closed or timeout seconds passed; returns the bytes read
+static NSData *PGTRead(int fd, NSUInteger length, NSTimeInterval timeout) {
+    NSMutableData *data = [NSMutableData data];
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:timeout];
+    uint8_t buffer[64 * 1024];
+    while (data.length < length) {
+        int remaining = (int)([deadline timeIntervalSinceNow] * 1000);
+        if (remaining <= 0) {
+            break;
+        }
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, remaining) <= 0) {
+            break;
+        }
+        ssize_t count = recv(fd, buffer, MIN(sizeof(buffer), length - data.length), 0);
+        if (count <= 0) {
+            break;
+        }
+        [data appendBytes:buffer length:(NSUInteger)count];
+    }
+    return data;
+}
+
+static NSData *PGTFrame(uint32_t jobID, UInt16 port, NSString *host, NSData *payload) {
+    NSMutableData *frame = [NSMutableData dataWithBytes:"PJ" length:2];
+    uint8_t header[7] = {(uint8_t)(jobID >> 24), (uint8_t)(jobID >> 16), (uint8_t)(jobID >> 8), (uint8_t)jobID,
+                         (uint8_t)(port >> 8), (uint8_t)port, (uint8_t)host.length};
+    [frame appendBytes:header length:sizeof(header)];
+    [frame appendData:[host dataUsingEncoding:NSUTF8StringEncoding]];
+    uint32_t length = (uint32_t)payload.length;
+    uint8_t size[4] = {(uint8_t)(length >> 24), (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length};
+    [frame appendBytes:size length:sizeof(size)];
+    [frame appendData:payload];
+    return frame;
+}
+
+static NSData *PGTReply(uint32_t jobID, PrinterGatewayJobStatus status) {
+    uint8_t reply[7] = {'P', 'R', (uint8_t)(jobID >> 24), (uint8_t)(jobID >> 16), (uint8_t)(jobID >> 8), (uint8_t)jobID, status};
+    return [NSData dataWithBytes:reply length:sizeof(reply)];
+}
+
+static BOOL PGTWriteAll(int fd, NSData *data) {
+    const uint8_t *bytes = data.bytes;
+    NSUInteger sent = 0;
+    while (sent < data.length) {
+        ssize_t count = send(fd, bytes + sent, data.length - sent, 0);
+        if (count <= 0) {
+            return NO;
+        }
+        sent += (NSUInteger)count;
+    }
+    return YES;
+}
+
+@interface PrinterGatewayTests : XCTestCase
+
+@end
+
+@implementation PrinterGatewayTests {
+    PrinterGateway *_gateway;
+    int _printerListener;
+    UInt16 _printerPort;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    _printerListener = PGTListen(&_printerPort);
+    _gateway = [[PrinterGateway alloc] initWithPort:0];
+    _gateway.idleTimeout = 60;
+}
+
+- (void)tearDown
+{
+    [_gateway stop];
+    close(_printerListener);
+    [super tearDown];
+}
+
+- (void)startGateway
+{
+    NSError *error = nil;
+    XCTAssertTrue([_gateway start:&error], @"%@", error);
+    XCTAssertNotEqual(_gateway.port, 0);
+}
+
+- (void)testFramesAreForwardedInOrder
+{
+    [self startGateway];
+    int client = PGTConnect(_gateway.port);
+    XCTAssertGreaterThanOrEqual(client, 0);
+    NSData *first = [@"first job\n" dataUsingEncoding:NSASCIIStringEncoding];
+    NSData *second = [@"second job\n" dataUsingEncoding:NSASCIIStringEncoding];
+    // Both frames in one write
+    NSMutableData *frames = [PGTFrame(1, _printerPort, @"127.0.0.1", first) mutableCopy];
+    [frames appendData:PGTFrame(2, _printerPort, @"127.0.0.1", second)];
+    XCTAssertTrue(PGTWriteAll(client, frames));
+
+    int printer = PGTAccept(_printerListener);
+    XCTAssertGreaterThanOrEqual(printer, 0);
+    NSMutableData *expected = [first mutableCopy];
+    [expected appendData:second];
+    XCTAssertEqualObjects(PGTRead(printer, expected.length, 5), expected);
+
+    NSMutableData *replies = [PGTReply(1, PrinterGatewayJobPrinted) mutableCopy];
+    [replies appendData:PGTReply(2, PrinterGatewayJobPrinted)];
+    XCTAssertEqualObjects(PGTRead(client, replies.length, 5), replies);
+    XCTAssertEqual(_gateway.statistics.jobsAccepted, 2u);
+    XCTAssertEqual(_gateway.statistics.jobsPrinted, 2u);
+    close(printer);
+    close(client);
+}
+
+- (void)testFrameSplitAcrossWritesIsReassembled
+{
+    [self startGateway];
+    int client = PGTConnect(_gateway.port);
+    NSData *payload = [@"split\n" dataUsingEncoding:NSASCIIStringEncoding];
+    NSData *frame = PGTFrame(7, _printerPort, @"127.0.0.1", payload);
+    for (NSUInteger i = 0; i < frame.length; i++) {
+        XCTAssertTrue(PGTWriteAll(client, [frame subdataWithRange:NSMakeRange(i, 1)]));
+    }
+    int printer = PGTAccept(_printerListener);
+    XCTAssertEqualObjects(PGTRead(printer, payload.length, 5), payload);
+    XCTAssertEqualObjects(PGTRead(client, 7, 5), PGTReply(7, PrinterGatewayJobPrinted));
+    close(printer);
+    close(client);
+}
+
+- (void)testOversizedFrameIsRejectedAndClosed
+{
+    _gateway.maxJobLength = 16;
+    [self startGateway];
+    int client = PGTConnect(_gateway.port);
+    NSData *payload = [NSMutableData dataWithLength:17];
+    XCTAssertTrue(PGTWriteAll(client, PGTFrame(3, _printerPort, @"127.0.0.1", payload)));
+    XCTAssertEqualObjects(PGTRead(client, 7, 5), PGTReply(3, PrinterGatewayJobRejected));
+    // Nothing follows the reply, the connection is closed
+    XCTAssertEqual(PGTRead(client, 1, 2).length, 0u);
+    XCTAssertEqual(_gateway.statistics.jobsAccepted, 0u);
+    XCTAssertEqual(_gateway.statistics.jobsFailed, 1u);
+    close(client);
+}
+
+- (void)testEmptyHostIsRejected
+{
+    [self startGateway];
+    int client = PGTConnect(_gateway.port);
+    XCTAssertTrue(PGTWriteAll(client, PGTFrame(4, _printerPort, @"", [NSData dataWithBytes:"x" length:1])));
+    XCTAssertEqualObjects(PGTRead(client, 7, 5), PGTReply(4, PrinterGatewayJobRejected));
+    close(client);
+}
+
+- (void)testBadMagicClosesTheConnection
+{
+    [self startGateway];
+    int client = PGTConnect(_gateway.port);
+    XCTAssertTrue(PGTWriteAll(client, [@"GET / HTTP/1.0\r\n\r\n" dataUsingEncoding:NSASCIIStringEncoding]));
+    XCTAssertEqual(PGTRead(client, 1, 5).length, 0u);
+    XCTAssertEqual(_gateway.statistics.jobsAccepted, 0u);
+    close(client);
+}
+
+- (void)testUnreachablePrinterFailsTheJob
+{
+    [self startGateway];
+    // A port nobody listens on: bind one, then close it
+    UInt16 deadPort = 0;
+    close(PGTListen(&deadPort));
+    int client = PGTConnect(_gateway.port);
+    XCTAssertTrue(PGTWriteAll(client, PGTFrame(5, deadPort, @"127.0.0.1", [NSData dataWithBytes:"x" length:1])));
+    XCTAssertEqualObjects(PGTRead(client, 7, 10), PGTReply(5, PrinterGatewayJobFailed));
+    close(client);
+}
+
+- (void)testSlowPrinterPausesTheClient
+{
+    const NSUInteger jobLength = 64 * 1024;
+    const uint32_t jobCount = 256;
+    _gateway.maxJobLength = jobLength;
+    _gateway.maxPendingBytesPerPrinter = jobLength;
+    [self startGateway];
+    int client = PGTConnect(_gateway.port);
+    fcntl(client, F_SETFL, fcntl(client, F_GETFL, 0) | O_NONBLOCK);
+
+    NSMutableData *payload = [NSMutableData dataWithLength:jobLength];
+    memset(payload.mutableBytes, 'A', jobLength);
+    NSMutableData *stream = [NSMutableData data];
+    for (uint32_t i = 1; i <= jobCount; i++) {
+        [stream appendData:PGTFrame(i, _printerPort, @"127.0.0.1", payload)];
+    }
+
+    // The gateway only dials the printer once the first job is queued, so accept while the client sends.
+    // The printer accepts the connection but reads nothing, so the gateway must stop reading the client.
+    int listener = _printerListener;
+    __block int printer = -1;
+    dispatch_semaphore_t connected = dispatch_semaphore_create(0);
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        printer = PGTAccept(listener);
+        dispatch_semaphore_signal(connected);
+    });
+    const uint8_t *bytes = stream.bytes;
+    NSUInteger sent = 0;
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5];
+    while (sent < stream.length && [deadline timeIntervalSinceNow] > 0) {
+        ssize_t count = send(client, bytes + sent, stream.length - sent, 0);
+        if (count > 0) {
+            sent += (NSUInteger)count;
+        } else {
+            usleep(10000);
+        }
+    }
+    XCTAssertEqual(dispatch_semaphore_wait(connected, dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC)), 0L);
+    XCTAssertGreaterThanOrEqual(printer, 0);
+    XCTAssertLessThan(sent, stream.length, @"the client was never paused");
+    NSUInteger accepted = _gateway.statistics.jobsAccepted;
+    XCTAssertLessThan(accepted, jobCount);
+    [NSThread sleepForTimeInterval:0.5];
+    XCTAssertEqual(_gateway.statistics.jobsAccepted, accepted, @"jobs were accepted while paused");
+
+    // Drain the printer; the client resumes and every job arrives
+    __block NSUInteger printed = 0;
+    dispatch_semaphore_t drained = dispatch_semaphore_create(0);
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        printed = PGTRead(printer, jobLength * jobCount, 30).length;
+        dispatch_semaphore_signal(drained);
+    });
+    NSMutableData *replies = [NSMutableData data];
+    deadline = [NSDate dateWithTimeIntervalSinceNow:30];
+    uint8_t buffer[4096];
+    while ((sent < stream.length || replies.length < 7 * jobCount) && [deadline timeIntervalSinceNow] > 0) {
+        ssize_t count = sent < stream.length ? send(client, bytes + sent, stream.length - sent, 0) : 0;
+        if (count > 0) {
+            sent += (NSUInteger)count;
+        }
+        ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+        if (received > 0) {
+            [replies appendBytes:buffer length:(NSUInteger)received];
+        } else if (count <= 0) {
+            usleep(1000);
+        }
+    }
+    dispatch_semaphore_wait(drained, dispatch_time(DISPATCH_TIME_NOW, 30 * NSEC_PER_SEC));
+
+    XCTAssertEqual(sent, stream.length);
+    XCTAssertEqual(printed, jobLength * jobCount);
+    XCTAssertEqual(replies.length, 7 * jobCount);
+    for (uint32_t i = 0; i < jobCount && 7 * (i + 1) <= replies.length; i++) {
+        XCTAssertEqualObjects([replies subdataWithRange:NSMakeRange(7 * i, 7)], PGTReply(i + 1, PrinterGatewayJobPrinted));
+    }
+    close(printer);
+    close(client);
+}
+
+@end
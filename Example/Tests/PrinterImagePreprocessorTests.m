@@ -0,0 +1,118 @@
+//
+//  PrinterImagePreprocessorTests.m
+//  libPrinterSDKTests
+//
+
+@import XCTest;
+#import "PrinterImagePreprocessor.h"
+
+/// Row padding of the fixtures, so strides differ from width * 4
+static const size_t PIPTPadding = 12;
+
+@interface PrinterImagePreprocessorTests : XCTestCase
+
+@end
+
+@implementation PrinterImagePreprocessorTests
+
+/// Premultiplied RGBA fixture: color gradients, a fixed pseudo-random alpha pattern and fully
+/// transparent and fully opaque bands, identical on every run
+- (NSData *)pixelsWithWidth:(int)width height:(int)height
+{
+    size_t stride = (size_t)width * 4 + PIPTPadding;
+    NSMutableData *data = [NSMutableData dataWithLength:stride * height];
+    uint8_t *bytes = data.mutableBytes;
+    uint32_t seed = 12345;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            seed = seed * 1103515245u + 12345u;
+            uint8_t alpha = (uint8_t)(seed >> 16);
+            if (y % 16 < 2) {
+                alpha = 0;
+            } else if (y % 16 < 4) {
+                alpha = 255;
+            }
+            uint8_t *pixel = bytes + (size_t)y * stride + 4 * (size_t)x;
+            pixel[0] = (uint8_t)((x * 255 / MAX(width - 1, 1)) * alpha / 255);
+            pixel[1] = (uint8_t)((y * 255 / MAX(height - 1, 1)) * alpha / 255);
+            pixel[2] = (uint8_t)(((x + y) & 0xFF) * alpha / 255);
+            pixel[3] = alpha;
+        }
+    }
+    return data;
+}
+
+/// Runs the fixture through both paths and compares the gray image and the bitmap byte for byte
+- (void)assertPathsMatchWithWidth:(int)width height:(int)height configure:(void (^)(PrinterImagePreprocessor *preprocessor))configure
+{
+    NSData *pixels = [self pixelsWithWidth:width height:height];
+    size_t stride = (size_t)width * 4 + PIPTPadding;
+    NSMutableArray<NSData *> *grays = [NSMutableArray array];
+    NSMutableArray<PrinterBitmap *> *bitmaps = [NSMutableArray array];
+    for (NSNumber *accelerate in @[@YES, @NO]) {
+        PrinterImagePreprocessor *preprocessor = [[PrinterImagePreprocessor alloc] init];
+        configure(preprocessor);
+        preprocessor.usesAccelerate = accelerate.boolValue;
+        int outputWidth = 0;
+        int outputHeight = 0;
+        [grays addObject:[preprocessor grayPixelsWithRGBAPixels:pixels.bytes width:width height:height stride:stride outputWidth:&outputWidth outputHeight:&outputHeight]];
+        XCTAssertEqual((NSUInteger)outputWidth * (NSUInteger)outputHeight, grays.lastObject.length);
+        [bitmaps addObject:[preprocessor bitmapWithRGBAPixels:pixels.bytes width:width height:height stride:stride]];
+    }
+    XCTAssertEqualObjects(grays[0], grays[1]);
+    XCTAssertEqual(bitmaps[0].width, bitmaps[1].width);
+    XCTAssertEqual(bitmaps[0].height, bitmaps[1].height);
+    XCTAssertEqualObjects(bitmaps[0].data, bitmaps[1].data);
+}
+
+- (void)testKnownGrayLevels
+{
+    // Opaque white, transparent, opaque black, half transparent black, opaque pure green
+    const uint8_t pixels[20] = {255, 255, 255, 255, 0, 0, 0, 0, 0, 0, 0, 255, 0, 0, 0, 128, 0, 255, 0, 255};
+    const uint8_t expected[5] = {255, 255, 0, 127, 149};
+    for (NSNumber *accelerate in @[@YES, @NO]) {
+        PrinterImagePreprocessor *preprocessor = [[PrinterImagePreprocessor alloc] init];
+        preprocessor.usesAccelerate = accelerate.boolValue;
+        NSData *gray = [preprocessor grayPixelsWithRGBAPixels:pixels width:5 height:1 stride:sizeof(pixels) outputWidth:NULL outputHeight:NULL];
+        XCTAssertEqualObjects(gray, [NSData dataWithBytes:expected length:sizeof(expected)], @"usesAccelerate %@", accelerate);
+    }
+}
+
+- (void)testAlphaMatches
+{
+    [self assertPathsMatchWithWidth:203 height:97 configure:^(PrinterImagePreprocessor *preprocessor) {
+    }];
+}
+
+- (void)testGammaMatches
+{
+    [self assertPathsMatchWithWidth:203 height:97 configure:^(PrinterImagePreprocessor *preprocessor) {
+        preprocessor.gamma = 2.2;
+    }];
+}
+
+- (void)testContrastMatches
+{
+    [self assertPathsMatchWithWidth:203 height:97 configure:^(PrinterImagePreprocessor *preprocessor) {
+        preprocessor.contrast = 1.6;
+        preprocessor.threshold = 100;
+    }];
+}
+
+- (void)testDownscaleMatches
+{
+    [self assertPathsMatchWithWidth:640 height:211 configure:^(PrinterImagePreprocessor *preprocessor) {
+        preprocessor.targetWidth = 384;
+        preprocessor.gamma = 0.8;
+    }];
+}
+
+- (void)testUpscaleMatches
+{
+    [self assertPathsMatchWithWidth:101 height:37 configure:^(PrinterImagePreprocessor *preprocessor) {
+        preprocessor.targetWidth = 576;
+        preprocessor.contrast = 0.7;
+    }];
+}
+
+@end
@@ -0,0 +1,225 @@
+//
+//  PrinterResumableTransferTests.m
+//  libPrinterSDKTests
+//
+
+@import XCTest;
+#import "PrinterResumableTransfer.h"
+
+typedef void (^PRTSendCompletion)(BOOL success, NSUInteger totalBytesSent, NSUInteger currentPackageIndex, NSError *error);
+
+/// Manager standing in for a BLE printer: it records every send call and leaves its progress to the test
+@interface PRTFakeManager : POSBLEManager
+@property (nonatomic, assign) BOOL connected;
+@property (nonatomic, readonly) NSMutableArray<NSData *> *sentData;
+@property (nonatomic, readonly) NSMutableArray<PRTSendCompletion> *sendCompletions;
+@end
+
+@implementation PRTFakeManager {
+    __weak id<POSBLEManagerDelegate> _fakeDelegate;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _connected = YES;
+        _sentData = [NSMutableArray array];
+        _sendCompletions = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (id<POSBLEManagerDelegate>)delegate
+{
+    return _fakeDelegate;
+}
+
+- (void)setDelegate:(id<POSBLEManagerDelegate>)delegate
+{
+    _fakeDelegate = delegate;
+}
+
+- (void)removeDelegate:(id<POSBLEManagerDelegate>)delegate
+{
+    if (_fakeDelegate == delegate) {
+        _fakeDelegate = nil;
+    }
+}
+
+- (BOOL)printerIsConnect
+{
+    return self.connected;
+}
+
+- (void)sendData:(NSData *)data withPackageSize:(NSUInteger)packageSize completion:(void (^)(BOOL, NSUInteger, NSUInteger, NSError *))completion
+{
+    [self.sentData addObject:[data copy]];
+    [self.sendCompletions addObject:[completion copy]];
+}
+
+@end
+
+@interface PrinterResumableTransferTests : XCTestCase
+
+@end
+
+@implementation PrinterResumableTransferTests {
+    PRTFakeManager *_manager;
+    NSData *_prefix;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    _manager = [[PRTFakeManager alloc] init];
+    _prefix = [NSData dataWithBytes:"\x1B\x40" length:2];
+}
+
+/// Three 10-byte commands: AAAAAAAAAA, BBBBBBBBBB, CCCCCCCCCC
+- (PrinterJobBuffer *)job
+{
+    PrinterJobBuffer *job = [[PrinterJobBuffer alloc] init];
+    for (NSString *command in @[@"AAAAAAAAAA", @"BBBBBBBBBB", @"CCCCCCCCCC"]) {
+        [job appendCommand:[command dataUsingEncoding:NSASCIIStringEncoding]];
+    }
+    return job;
+}
+
+- (PrinterResumableTransfer *)transferWithJob:(PrinterJobBuffer *)job
+{
+    PrinterResumableTransfer *transfer = [[PrinterResumableTransfer alloc] initWithJob:job posManager:_manager];
+    transfer.resumePrefix = _prefix;
+    return transfer;
+}
+
+- (NSData *)prefixedJob:(PrinterJobBuffer *)job fromOffset:(NSUInteger)offset
+{
+    NSMutableData *data = [_prefix mutableCopy];
+    [data appendData:[job.data subdataWithRange:NSMakeRange(offset, job.data.length - offset)]];
+    return data;
+}
+
+- (void)testDisconnectMidCommandResumesAtTheCommandStart
+{
+    PrinterJobBuffer *job = [self job];
+    PrinterResumableTransfer *transfer = [self transferWithJob:job];
+    NSMutableArray<NSNumber *> *progress = [NSMutableArray array];
+    transfer.progressBlock = ^(NSUInteger acknowledgedBytes) {
+        [progress addObject:@(acknowledgedBytes)];
+    };
+    __block NSUInteger completions = 0;
+    __block BOOL succeeded = NO;
+    transfer.completionBlock = ^(BOOL success, NSError *error) {
+        completions++;
+        succeeded = success;
+    };
+    [transfer start];
+    XCTAssertEqualObjects(_manager.sentData, @[job.data]);
+    XCTAssertEqual(_manager.delegate, transfer);
+
+    // Five bytes into the second command, then the link drops
+    _manager.sendCompletions[0](YES, 15, 0, nil);
+    XCTAssertEqual(transfer.acknowledgedBytes, 15u);
+    _manager.connected = NO;
+    [transfer POSbleDisconnectPeripheral:nil error:[NSError errorWithDomain:@"PrinterResumableTransferTests" code:1 userInfo:nil]];
+    XCTAssertEqual(transfer.state, PrinterTransferSuspended);
+    XCTAssertEqual(transfer.acknowledgedBytes, 10u);
+    XCTAssertEqual(_manager.sentData.count, 1u);
+
+    // The abandoned send reporting late changes nothing
+    _manager.sendCompletions[0](YES, 30, 1, nil);
+    XCTAssertEqual(transfer.acknowledgedBytes, 10u);
+    XCTAssertEqual(transfer.state, PrinterTransferSuspended);
+
+    _manager.connected = YES;
+    [transfer POSbleConnectPeripheral:nil];
+    XCTAssertEqual(transfer.state, PrinterTransferSending);
+    XCTAssertEqual(transfer.resumeCount, 1u);
+    XCTAssertEqualObjects(_manager.sentData[1], [self prefixedJob:job fromOffset:10]);
+
+    // Progress of the resumed send counts from the command start, not including the prefix
+    _manager.sendCompletions[1](YES, _prefix.length + 5, 0, nil);
+    XCTAssertEqual(transfer.acknowledgedBytes, 15u);
+    _manager.sendCompletions[1](YES, _prefix.length + 20, 1, nil);
+    XCTAssertEqual(transfer.state, PrinterTransferCompleted);
+    XCTAssertEqual(completions, 1u);
+    XCTAssertTrue(succeeded);
+    XCTAssertEqualObjects(progress, (@[@15, @30]));
+    XCTAssertNil(_manager.delegate);
+}
+
+- (void)testSendErrorWhileConnectedResumesAtOnce
+{
+    PrinterJobBuffer *job = [self job];
+    PrinterResumableTransfer *transfer = [self transferWithJob:job];
+    [transfer start];
+    _manager.sendCompletions[0](NO, 25, 0, [NSError errorWithDomain:@"PrinterResumableTransferTests" code:2 userInfo:nil]);
+    XCTAssertEqual(transfer.resumeCount, 1u);
+    XCTAssertEqualObjects(_manager.sentData[1], [self prefixedJob:job fromOffset:20]);
+}
+
+- (void)testTooManyResumesFailTheTransfer
+{
+    PrinterResumableTransfer *transfer = [self transferWithJob:[self job]];
+    transfer.maxResumeAttempts = 1;
+    __block BOOL failed = NO;
+    transfer.completionBlock = ^(BOOL success, NSError *error) {
+        failed = !success;
+    };
+    [transfer start];
+    NSError *error = [NSError errorWithDomain:@"PrinterResumableTransferTests" code:3 userInfo:nil];
+    _manager.sendCompletions[0](NO, 5, 0, error);
+    XCTAssertEqual(_manager.sentData.count, 2u);
+    _manager.sendCompletions[1](NO, 0, 0, error);
+    XCTAssertEqual(transfer.state, PrinterTransferFailed);
+    XCTAssertTrue(failed);
+    XCTAssertEqual(_manager.sentData.count, 2u);
+}
+
+- (void)testRestartResumesFromTheSpooledCheckpoint
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    PrinterJobBuffer *original = [self job];
+    uint64_t jobID = 0;
+    @autoreleasepool {
+        NSError *error = nil;
+        PrinterSpool *spool = [[PrinterSpool alloc] initWithPath:path recoveryPolicy:PrinterSpoolRecoveryResume error:&error];
+        XCTAssertNotNil(spool, @"%@", error);
+        spool.checkpointGranularity = 1;
+        jobID = [spool enqueueJob:original.data commandBoundaries:original.commandBoundaries committed:nil];
+        XCTAssertNotEqual(jobID, 0u);
+        // The printer acknowledged 25 bytes, then the app was killed
+        [spool recordBytesSent:25 forJob:jobID];
+        [spool synchronize];
+    }
+
+    NSError *error = nil;
+    PrinterSpool *spool = [[PrinterSpool alloc] initWithPath:path recoveryPolicy:PrinterSpoolRecoveryResume error:&error];
+    XCTAssertNotNil(spool, @"%@", error);
+    PrinterSpoolJob *recovered = spool.pendingJobs.firstObject;
+    XCTAssertEqual(recovered.jobID, jobID);
+    XCTAssertEqual(recovered.bytesSent, 20u);
+
+    PrinterJobBuffer *job = [[PrinterJobBuffer alloc] initWithSpoolJob:recovered];
+    XCTAssertEqualObjects(job.commandBoundaries, original.commandBoundaries);
+    PrinterResumableTransfer *transfer = [self transferWithJob:job];
+    transfer.progressBlock = ^(NSUInteger acknowledgedBytes) {
+        [spool recordBytesSent:acknowledgedBytes forJob:jobID];
+    };
+    transfer.completionBlock = ^(BOOL success, NSError *error) {
+        if (success) {
+            [spool completeJob:jobID];
+        }
+    };
+    [transfer startFromOffset:recovered.bytesSent];
+    XCTAssertEqualObjects(_manager.sentData, @[[self prefixedJob:job fromOffset:20]]);
+
+    _manager.sendCompletions[0](YES, _prefix.length + 10, 0, nil);
+    XCTAssertEqual(transfer.state, PrinterTransferCompleted);
+    [spool synchronize];
+    XCTAssertEqual(spool.pendingJobs.count, 0u);
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+}
+
+@end
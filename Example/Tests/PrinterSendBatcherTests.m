@@ -0,0 +1,128 @@
+//
+//  PrinterSendBatcherTests.m
+//  libPrinterSDKTests
+//
+
+@import XCTest;
+#import "PrinterSendBatcher.h"
+
+static NSData *PSBTText(NSString *text) {
+    return [text dataUsingEncoding:NSASCIIStringEncoding];
+}
+
+@interface PrinterSendBatcherTests : XCTestCase
+
+@end
+
+@implementation PrinterSendBatcherTests {
+    /// Batches handed to the writer, in order
+    NSMutableArray<NSData *> *_batches;
+    /// The writer's done blocks, called by the tests
+    NSMutableArray *_dones;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    _batches = [NSMutableArray array];
+    _dones = [NSMutableArray array];
+}
+
+/// A batcher whose writer records each batch and leaves completing it to the test
+- (PrinterSendBatcher *)batcher
+{
+    NSMutableArray<NSData *> *batches = _batches;
+    NSMutableArray *dones = _dones;
+    return [[PrinterSendBatcher alloc] initWithWriter:^(NSData *data, void (^done)(BOOL, NSError *)) {
+        [batches addObject:[NSData dataWithData:data]];
+        [dones addObject:[done copy]];
+    }];
+}
+
+- (void)completeBatch:(NSUInteger)index success:(BOOL)success error:(NSError *)error
+{
+    ((void (^)(BOOL, NSError *))_dones[index])(success, error);
+}
+
+/// Lets queued main-queue blocks run
+- (void)spinFor:(NSTimeInterval)interval
+{
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:interval]];
+}
+
+- (void)testFullBatchIsWrittenAtOnce
+{
+    PrinterSendBatcher *batcher = [self batcher];
+    batcher.maxBytes = 8;
+    batcher.maxDelay = 10;
+    [batcher writeData:PSBTText(@"abcd") completion:nil];
+    XCTAssertEqual(_batches.count, 0u);
+    [batcher writeData:PSBTText(@"efgh") completion:nil];
+    XCTAssertEqualObjects(_batches, @[PSBTText(@"abcdefgh")]);
+    XCTAssertEqual(batcher.fragmentCount, 2u);
+    XCTAssertEqual(batcher.batchCount, 1u);
+}
+
+- (void)testPartialBatchIsWrittenAfterTheDelay
+{
+    PrinterSendBatcher *batcher = [self batcher];
+    batcher.maxDelay = 0.01;
+    [batcher writeData:PSBTText(@"one ") completion:nil];
+    [batcher writeData:PSBTText(@"two ") completion:nil];
+    [batcher writeData:PSBTText(@"three") completion:nil];
+    XCTAssertEqual(_batches.count, 0u);
+    [self spinFor:0.2];
+    XCTAssertEqualObjects(_batches, @[PSBTText(@"one two three")]);
+}
+
+- (void)testEveryFragmentGetsTheBatchResult
+{
+    PrinterSendBatcher *batcher = [self batcher];
+    NSError *failure = [NSError errorWithDomain:@"PrinterSendBatcherTests" code:1 userInfo:nil];
+    NSMutableArray<NSError *> *errors = [NSMutableArray array];
+    __block NSUInteger failed = 0;
+    for (int i = 0; i < 3; i++) {
+        [batcher writeData:PSBTText(@"x") completion:^(BOOL success, NSError *error) {
+            failed += success ? 0 : 1;
+            [errors addObject:error];
+        }];
+    }
+    [batcher flush];
+    XCTAssertEqual(_batches.count, 1u);
+    [self completeBatch:0 success:NO error:failure];
+    [self spinFor:0.05];
+    XCTAssertEqual(failed, 3u);
+    XCTAssertEqualObjects(errors, (@[failure, failure, failure]));
+}
+
+- (void)testNextBatchWaitsForTheOneInFlight
+{
+    PrinterSendBatcher *batcher = [self batcher];
+    batcher.maxDelay = 0.01;
+    NSMutableArray<NSString *> *completed = [NSMutableArray array];
+    for (NSString *text in @[@"a", @"b", @"c", @"d"]) {
+        [batcher writeData:PSBTText(text) completion:^(BOOL success, NSError *error) {
+            [completed addObject:text];
+        }];
+        if ([text isEqualToString:@"a"]) {
+            [batcher flush];
+        }
+    }
+    // b, c and d are coalesced while a is written, even past the delay and an explicit flush
+    [self spinFor:0.1];
+    [batcher flush];
+    XCTAssertEqualObjects(_batches, @[PSBTText(@"a")]);
+
+    [self completeBatch:0 success:YES error:nil];
+    [self spinFor:0.05];
+    XCTAssertEqualObjects(completed, @[@"a"]);
+    XCTAssertEqualObjects(_batches, (@[PSBTText(@"a"), PSBTText(@"bcd")]));
+
+    [self completeBatch:1 success:YES error:nil];
+    [self spinFor:0.05];
+    XCTAssertEqualObjects(completed, (@[@"a", @"b", @"c", @"d"]));
+    XCTAssertEqual(batcher.fragmentCount, 4u);
+    XCTAssertEqual(batcher.batchCount, 2u);
+}
+
+@end
@@ -0,0 +1,47 @@
+//
+//  PrinterTextEncoderTests.m
+//  libPrinterSDKTests
+//
+
+@import XCTest;
+#import "PrinterTextEncoder.h"
+
+@interface PrinterTextEncoderTests : XCTestCase
+
+@end
+
+@implementation PrinterTextEncoderTests
+
+- (void)testASCIIInUTF16LittleEndianUsesTwoBytesPerCharacter
+{
+    PrinterTextEncoder *encoder = [PrinterTextEncoder encoderWithStringEncoding:NSUTF16LittleEndianStringEncoding];
+    PrinterTextEncodingResult *result = [encoder encodeString:@"ABC"];
+    const uint8_t expected[] = {'A', 0, 'B', 0, 'C', 0};
+    XCTAssertEqualObjects(result.data, [NSData dataWithBytes:expected length:sizeof(expected)]);
+    XCTAssertFalse(result.hasUnmappableCharacters);
+}
+
+- (void)testASCIIInUTF32BigEndianUsesFourBytesPerCharacter
+{
+    PrinterTextEncoder *encoder = [PrinterTextEncoder encoderWithStringEncoding:NSUTF32BigEndianStringEncoding];
+    NSData *data = [encoder encodeLines:@[@"A", @"B"] terminator:nil unmappableLines:NULL];
+    const uint8_t expected[] = {0, 0, 0, 'A', 0, 0, 0, 'B'};
+    XCTAssertEqualObjects(data, [NSData dataWithBytes:expected length:sizeof(expected)]);
+}
+
+- (void)testASCIIInCodePageIsCopied
+{
+    PrinterTextEncoder *encoder = [PrinterTextEncoder encoderWithCodePage:0];
+    XCTAssertEqualObjects([encoder encodeString:@"ABC"].data, [@"ABC" dataUsingEncoding:NSASCIIStringEncoding]);
+}
+
+- (void)testUnmappableCharacterIsReported
+{
+    PrinterTextEncoder *encoder = [PrinterTextEncoder encoderWithCodePage:0];
+    PrinterTextEncodingResult *result = [encoder encodeString:@"A€B"];
+    XCTAssertTrue(result.hasUnmappableCharacters);
+    XCTAssertEqualObjects(result.unmappableRanges, @[[NSValue valueWithRange:NSMakeRange(1, 1)]]);
+    XCTAssertEqualObjects(result.data, [@"A?B" dataUsingEncoding:NSASCIIStringEncoding]);
+}
+
+@end
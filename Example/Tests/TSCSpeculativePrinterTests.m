@@ -0,0 +1,245 @@
+//
+//  TSCSpeculativePrinterTests.m
+//  libPrinterSDKTests
+//
+
+@import XCTest;
+#import "TSCSpeculativePrinter.h"
+
+/// Transport standing in for a label printer: writes are recorded and succeed at once, the test
+/// plays the printer's echoes through receiveBlock
+@interface TSPTFakeTransport : NSObject <PrinterTransport>
+@property (nonatomic, assign) PrinterTransportState state;
+@property (nonatomic, assign) BOOL failsWrites;
+@property (nonatomic, readonly) NSMutableArray<NSData *> *writes;
+@end
+
+@implementation TSPTFakeTransport
+
+@synthesize metrics = _metrics;
+@synthesize maximumWriteLength = _maximumWriteLength;
+@synthesize pendingBytes = _pendingBytes;
+@synthesize highWaterMark = _highWaterMark;
+@synthesize writableBlock = _writableBlock;
+@synthesize receiveBlock = _receiveBlock;
+@synthesize stateBlock = _stateBlock;
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _state = PrinterTransportConnected;
+        _metrics = [[PrinterTransportMetrics alloc] init];
+        _maximumWriteLength = NSUIntegerMax;
+        _highWaterMark = 64 * 1024;
+        _writes = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)connect
+{
+    [self changeState:PrinterTransportConnected];
+}
+
+- (void)disconnect
+{
+    [self changeState:PrinterTransportDisconnected];
+}
+
+- (void)changeState:(PrinterTransportState)state
+{
+    self.state = state;
+    if (self.stateBlock) {
+        self.stateBlock(state, nil);
+    }
+}
+
+- (void)writeData:(NSData *)data completion:(void (^)(BOOL, NSError *))completion
+{
+    [self.writes addObject:[data copy]];
+    if (completion) {
+        completion(!self.failsWrites, nil);
+    }
+}
+
+- (void)readDataWithTimeout:(NSTimeInterval)timeout completion:(void (^)(NSData *, NSError *))completion
+{
+}
+
+- (void)echo:(NSString *)text
+{
+    self.receiveBlock([text dataUsingEncoding:NSASCIIStringEncoding]);
+}
+
+@end
+
+@interface TSCSpeculativePrinterTests : XCTestCase
+
+@end
+
+@implementation TSCSpeculativePrinterTests {
+    TSPTFakeTransport *_transport;
+    TSCSpeculativePrinter *_printer;
+    /// Status the scripted query answers with
+    LabelPrinterStatus _status;
+    NSUInteger _queries;
+    NSMutableArray<NSNumber *> *_reportedStatuses;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    _transport = [[TSPTFakeTransport alloc] init];
+    _status = LabelPrinterReady;
+    _reportedStatuses = [NSMutableArray array];
+    __weak TSCSpeculativePrinterTests *weakSelf = self;
+    _printer = [[TSCSpeculativePrinter alloc] initWithTransport:_transport statusQuery:^(void (^reply)(LabelPrinterStatus)) {
+        TSCSpeculativePrinterTests *strongSelf = weakSelf;
+        if (strongSelf) {
+            strongSelf->_queries++;
+            reply(strongSelf->_status);
+        }
+    }];
+    _printer.pollInterval = 0.01;
+    NSMutableArray<NSNumber *> *reported = _reportedStatuses;
+    _printer.statusBlock = ^(LabelPrinterStatus status) {
+        [reported addObject:@(status)];
+    };
+}
+
+- (void)tearDown
+{
+    [_printer cancelAll];
+    // Test cases outlive their run; let the printer and its polls go
+    _printer = nil;
+    _transport = nil;
+    [super tearDown];
+}
+
+- (NSData *)label:(NSUInteger)number
+{
+    return [[NSString stringWithFormat:@"CLS\r\nTEXT 10,10,\"3\",0,1,1,\"%lu\"\r\nPRINT 1\r\n", (unsigned long)number] dataUsingEncoding:NSASCIIStringEncoding];
+}
+
+- (NSData *)label:(NSUInteger)number withMarker:(NSUInteger)marker
+{
+    NSMutableData *data = [[self label:number] mutableCopy];
+    [data appendData:[[NSString stringWithFormat:@"\r\nOUT \"PSJ%lu;\"\r\n", (unsigned long)marker] dataUsingEncoding:NSASCIIStringEncoding]];
+    return data;
+}
+
+/// Queues labels 1...count and records the order their completions arrive in
+- (void)printLabels:(NSUInteger)count into:(NSMutableArray<NSString *> *)completed
+{
+    for (NSUInteger i = 1; i <= count; i++) {
+        [_printer printJob:[self label:i] completion:^(BOOL printed) {
+            [completed addObject:[NSString stringWithFormat:@"%lu %@", (unsigned long)i, printed ? @"printed" : @"dropped"]];
+        }];
+    }
+}
+
+/// Lets the scripted status polls run
+- (void)spinFor:(NSTimeInterval)interval
+{
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:interval]];
+}
+
+- (void)testEchoesCompleteJobsInOrder
+{
+    NSMutableArray<NSString *> *completed = [NSMutableArray array];
+    [self printLabels:3 into:completed];
+    XCTAssertEqualObjects(_transport.writes, (@[[self label:1 withMarker:1], [self label:2 withMarker:2], [self label:3 withMarker:3]]));
+
+    // An echo confirms every job up to it
+    [_transport echo:@"PSJ2;"];
+    XCTAssertEqualObjects(completed, (@[@"1 printed", @"2 printed"]));
+    // A marker split across two reads is put back together
+    [_transport echo:@"\r\nPS"];
+    [_transport echo:@"J3;\r\n"];
+    XCTAssertEqualObjects(completed, (@[@"1 printed", @"2 printed", @"3 printed"]));
+}
+
+- (void)testJobsBeyondMaxJobsInFlightWaitForEchoes
+{
+    _printer.maxJobsInFlight = 2;
+    NSMutableArray<NSString *> *completed = [NSMutableArray array];
+    [self printLabels:3 into:completed];
+    XCTAssertEqual(_transport.writes.count, 2u);
+    [_transport echo:@"PSJ1;"];
+    XCTAssertEqual(_transport.writes.count, 3u);
+    XCTAssertEqualObjects(_transport.writes[2], [self label:3 withMarker:3]);
+}
+
+- (void)testErrorPausesAndSyncMarkerResendsJobsThatNeverPrinted
+{
+    NSMutableArray<NSString *> *completed = [NSMutableArray array];
+    [self printLabels:3 into:completed];
+    [_transport echo:@"PSJ1;"];
+
+    // Paper runs out while labels 2 and 3 are in flight
+    _status = LabelPrinterPaperEnd;
+    [self spinFor:0.1];
+    XCTAssertGreaterThan(_queries, 0u);
+    XCTAssertTrue(_printer.paused);
+    XCTAssertEqualObjects(_reportedStatuses, @[@(LabelPrinterPaperEnd)]);
+    [_printer printJob:[self label:4] completion:^(BOOL printed) {
+        [completed addObject:[NSString stringWithFormat:@"4 %@", printed ? @"printed" : @"dropped"]];
+    }];
+    XCTAssertEqual(_transport.writes.count, 3u);
+
+    // Paper loaded: a sync marker goes out once, however often the printer reports ready
+    _status = LabelPrinterReady;
+    [self spinFor:0.1];
+    XCTAssertTrue(_printer.paused);
+    XCTAssertEqual(_transport.writes.count, 4u);
+    XCTAssertEqualObjects(_transport.writes[3], [@"\r\nOUT \"PSS4;\"\r\n" dataUsingEncoding:NSASCIIStringEncoding]);
+
+    // Label 2 was still buffered and echoes before the sync marker; label 3 never printed
+    [_transport echo:@"PSJ2;PSS4;"];
+    XCTAssertFalse(_printer.paused);
+    XCTAssertEqualObjects(_reportedStatuses, (@[@(LabelPrinterPaperEnd), @(LabelPrinterReady)]));
+    XCTAssertEqualObjects([_transport.writes subarrayWithRange:NSMakeRange(4, _transport.writes.count - 4)],
+                          (@[[self label:3 withMarker:5], [self label:4 withMarker:6]]));
+
+    [_transport echo:@"PSJ6;"];
+    // Every label printed exactly once, in order
+    XCTAssertEqualObjects(completed, (@[@"1 printed", @"2 printed", @"3 printed", @"4 printed"]));
+}
+
+- (void)testStaleSyncMarkerIsIgnored
+{
+    NSMutableArray<NSString *> *completed = [NSMutableArray array];
+    [self printLabels:1 into:completed];
+    [_printer reportStatus:LabelPrinterCoverOpened];
+    [_printer reportStatus:LabelPrinterReady];
+    // Opened again before the marker came back: the marker no longer proves anything
+    [_printer reportStatus:LabelPrinterCoverOpened];
+    [_transport echo:@"PSS2;"];
+    XCTAssertTrue(_printer.paused);
+    XCTAssertEqual(_transport.writes.count, 2u);
+}
+
+- (void)testFailedWritePauses
+{
+    _transport.failsWrites = YES;
+    NSMutableArray<NSString *> *completed = [NSMutableArray array];
+    [self printLabels:1 into:completed];
+    XCTAssertTrue(_printer.paused);
+    XCTAssertEqual(completed.count, 0u);
+}
+
+- (void)testJobsWaitForTheTransportToConnect
+{
+    _transport.state = PrinterTransportConnecting;
+    NSMutableArray<NSString *> *completed = [NSMutableArray array];
+    [self printLabels:2 into:completed];
+    XCTAssertEqual(_transport.writes.count, 0u);
+    XCTAssertFalse(_printer.paused);
+
+    [_transport connect];
+    [self spinFor:0.05];
+    XCTAssertEqualObjects(_transport.writes, (@[[self label:1 withMarker:1], [self label:2 withMarker:2]]));
+}
+
+@end
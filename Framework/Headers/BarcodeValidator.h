@@ -0,0 +1,107 @@
+//
+//  BarcodeValidator.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "PTable.h"
+#import "POSCommand.h"
+#import "PrinterSDKCodeDefines.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Represents barcode validation results
+typedef NS_ENUM(NSInteger, BarcodeValidationError) {
+    BarcodeValid = 0,            ///< Content is valid (normalizedContent may differ from the input)
+    BarcodeEmptyContent,         ///< Content is empty
+    BarcodeInvalidCharacter,     ///< Content contains a character the symbology cannot encode
+    BarcodeInvalidLength,        ///< Content length is not allowed by the symbology
+    BarcodeInvalidCheckDigit,    ///< Supplied check digit does not match the computed one
+    BarcodeUnsupportedType       ///< The barcode type is unknown
+};
+
+@interface BarcodeValidationResult : NSObject
+
+/// Validation result
+@property (nonatomic, readonly) BarcodeValidationError error;
+
+/// Index of the offending character, or -1
+@property (nonatomic, readonly) NSInteger errorIndex;
+
+/// Content to send to the printer: check digit appended where the symbology carries one in the data,
+/// start/stop characters added where they are mandatory. Equal to the input when validation fails.
+@property (nonatomic, readonly, copy) NSString *normalizedContent;
+
+/// Computed check character, or 0 when the symbology has none
+@property (nonatomic, readonly) unichar checkCharacter;
+
+/// Symbol width in modules without quiet zones, or 0 when not computed for the symbology
+@property (nonatomic, readonly) NSInteger moduleCount;
+
+/// YES when error is BarcodeValid
+@property (nonatomic, readonly) BOOL isValid;
+
+@end
+
+/// Validates and normalizes barcode content before it is sent to the printer.
+/// Check digits are computed locally and Code 128 is encoded with the code set switching
+/// that produces the fewest codewords, i.e. the narrowest symbol.
+@interface BarcodeValidator : NSObject
+
+/// Validates content for a PTable barcode type
+/// @param content Barcode content
+/// @param type Type of the barcode
+/// @return Validation result
++ (BarcodeValidationResult *)validateContent:(NSString *)content type:(BCSBarcodeType)type;
+
+/// Validates content for a TSPL barcode type
+/// @param content Barcode content
+/// @param codeType One of the kBarcodeType constants
+/// @return Validation result
++ (BarcodeValidationResult *)validateContent:(NSString *)content codeType:(NSString *)codeType;
+
+/// Validates content for an ESC/POS barcode type
+/// @param content Barcode content
+/// @param m Barcode type, 65~73 (see POSBarcodeType)
+/// @return Validation result
++ (BarcodeValidationResult *)validateContent:(NSString *)content posBarcodeType:(int)m;
+
+/// Validates a batch of contents concurrently
+/// @param contents Barcode contents
+/// @param type Type of the barcodes
+/// @return Validation results, in the order of contents
++ (NSArray<BarcodeValidationResult *> *)validateContents:(NSArray<NSString *> *)contents type:(BCSBarcodeType)type;
+
+/// Validates a batch of contents concurrently
+/// @param contents Barcode contents
+/// @param codeType One of the kBarcodeType constants
+/// @return Validation results, in the order of contents
++ (NSArray<BarcodeValidationResult *> *)validateContents:(NSArray<NSString *> *)contents codeType:(NSString *)codeType;
+
+/// Finds invalid contents without building result objects, for bulk pre-flight checks
+/// @param contents Barcode contents
+/// @param type Type of the barcodes
+/// @return Indexes of the contents that fail validation
++ (NSIndexSet *)invalidIndexesInContents:(NSArray<NSString *> *)contents type:(BCSBarcodeType)type;
+
+/// Computes the GS1 modulo 10 check digit (EAN/UPC/ITF-14/EAN-14)
+/// @param digits Digits without check digit
+/// @return Check digit 0-9, or -1 if digits contains a non-digit
++ (int)gs1CheckDigitForDigits:(NSString *)digits;
+
+/// Encodes Code 128 content for ESC/POS (GS k m=73), using the optimal code set switching.
+/// Code set C pairs are sent as binary values, '{' in code set B is escaped.
+/// @param content ASCII content (0-127)
+/// @return Data for the barcode content, or nil if the content cannot be encoded
++ (nullable NSData *)posCode128DataWithContent:(NSString *)content;
+
+/// Builds a validated ESC/POS print barcode command (GS k m n d1...dn).
+/// @param m Barcode type, 65~73 (see POSBarcodeType)
+/// @param content Barcode content
+/// @param error Receives the validation result, may be NULL
+/// @return Data for printing barcode, or nil if the content is invalid
++ (nullable NSData *)printBarcodeWithM:(int)m content:(NSString *)content error:(nullable BarcodeValidationError *)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
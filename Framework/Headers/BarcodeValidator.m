@@ -0,0 +1,883 @@
+//
+//  BarcodeValidator.m
+//  Printer
+//
+
+#import "BarcodeValidator.h"
+#import <stdbool.h>
+
+#pragma mark - Symbology rules
+
+typedef enum {
+    BCKindUPCA,
+    BCKindUPCE,
+    BCKindEAN13,
+    BCKindEAN8,
+    BCKindITF14,
+    BCKindEAN14,
+    BCKindCode39,       // standard character set, upper-cased
+    BCKindCode39Full,   // full ASCII
+    BCKindCode39C,      // standard character set, printer appends the modulo 43 check
+    BCKindITF,          // even number of digits
+    BCKindITFC,         // printer appends the check digit, data needs an odd number of digits
+    BCKindCodabar,
+    BCKindCode93,
+    BCKindCode128,
+    BCKindASCII,        // any 7-bit content (manual Code 128, EAN128, Telepen, Code 49)
+    BCKindMSI,
+    BCKindMSIC,         // printer appends the modulo 10 check
+    BCKindPostnet,
+    BCKindPlanet,
+    BCKindDigits,
+    BCKindCode11,
+    BCKindPlessey,
+    BCKindIdentcode,
+    BCKindLeitcode,
+    BCKindUnsupported
+} BCKind;
+
+typedef struct {
+    BCKind kind;
+    int addon;          // 0, 2 or 5 add-on digits for EAN/UPC
+} BCSpec;
+
+typedef struct {
+    int error;          // BarcodeValidationError
+    long errorIndex;
+    size_t outLength;   // normalized content length, the output buffer holds n + 4 bytes
+    int check;          // check character or 0
+    long modules;
+} BCOutcome;
+
+enum { C128SetA = 0, C128SetB = 1, C128SetC = 2 };
+enum { C128OpStart, C128OpChar, C128OpShift, C128OpPair, C128OpLatch, C128OpBase };
+
+typedef struct {
+    int cost;
+    uint8_t op;
+    uint8_t prev;
+} C128Cell;
+
+typedef struct {
+    uint8_t op;
+    uint8_t set;
+    uint8_t c0;
+    uint8_t c1;
+} C128Step;
+
+static const char *const BCCode39Chars = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. $/+%";
+
+static inline bool BCIsDigit(uint8_t c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline bool C128InSet(uint8_t c, int set) {
+    return set == C128SetA ? c < 96 : (c >= 32 && c < 128);
+}
+
+static inline uint8_t BCUpper(uint8_t c) {
+    return (c >= 'a' && c <= 'z') ? (uint8_t)(c - 32) : c;
+}
+
+static bool BCIsCodabarGuard(uint8_t c) {
+    c = BCUpper(c);
+    return c != 0 && strchr("ABCDTN*E", c) != NULL;
+}
+
+static int BCCode39Value(uint8_t c) {
+    for (int i = 0; BCCode39Chars[i]; i++) {
+        if ((uint8_t)BCCode39Chars[i] == c) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static long BCFirstNonDigit(const uint8_t *s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (!BCIsDigit(s[i])) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+/// GS1 modulo 10: weight 3 on the digit next to the check digit, alternating with 1
+static int BCGS1Check(const uint8_t *d, size_t n) {
+    int sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        int digit = d[n - 1 - i] - '0';
+        sum += (i & 1) ? digit : digit * 3;
+    }
+    return (10 - sum % 10) % 10;
+}
+
+/// Deutsche Post Identcode/Leitcode: weights 4 and 9 from the left
+static int BCDeutschePostCheck(const uint8_t *d, size_t n) {
+    int sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += (d[i] - '0') * ((i & 1) ? 9 : 4);
+    }
+    return (10 - sum % 10) % 10;
+}
+
+/// Luhn modulo 10 used by MSI
+static int BCLuhnCheck(const uint8_t *d, size_t n) {
+    int sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        int digit = d[n - 1 - i] - '0';
+        if ((i & 1) == 0) {
+            digit *= 2;
+            if (digit > 9) {
+                digit -= 9;
+            }
+        }
+        sum += digit;
+    }
+    return (10 - sum % 10) % 10;
+}
+
+/// Expands UPC-E (number system + 6 digits) to the 11 UPC-A digits the check digit is computed over
+static void BCExpandUPCE(uint8_t ns, const uint8_t *d, uint8_t *upca) {
+    uint8_t last = d[5];
+    upca[0] = ns;
+    switch (last) {
+        case '0': case '1': case '2':
+            memcpy(upca + 1, (uint8_t[]){d[0], d[1], last, '0', '0', '0', '0', d[2], d[3], d[4]}, 10);
+            break;
+        case '3':
+            memcpy(upca + 1, (uint8_t[]){d[0], d[1], d[2], '0', '0', '0', '0', '0', d[3], d[4]}, 10);
+            break;
+        case '4':
+            memcpy(upca + 1, (uint8_t[]){d[0], d[1], d[2], d[3], '0', '0', '0', '0', '0', d[4]}, 10);
+            break;
+        default:
+            memcpy(upca + 1, (uint8_t[]){d[0], d[1], d[2], d[3], d[4], '0', '0', '0', '0', last}, 10);
+            break;
+    }
+}
+
+/// Plans Code 128 with the minimum number of codewords (start code included, check and stop excluded).
+/// Returns the codeword count and writes the steps in print order, or -1 if a character is outside 0-127.
+/// steps must hold 2 * n + 1 entries.
+static int C128Plan(const uint8_t *s, size_t n, C128Step *steps, size_t *stepCount) {
+    const int infinity = 1 << 29;
+    size_t cells = (n + 1) * 3;
+    C128Cell *base = malloc(cells * sizeof(C128Cell));
+    C128Cell *best = malloc(cells * sizeof(C128Cell));
+    if (base == NULL || best == NULL) {
+        free(base);
+        free(best);
+        return -1;
+    }
+    for (size_t i = 0; i < cells; i++) {
+        base[i].cost = infinity;
+    }
+    for (int set = 0; set < 3; set++) {
+        base[set] = (C128Cell){1, C128OpStart, (uint8_t)set};
+    }
+
+    for (size_t i = 0; i <= n; i++) {
+        C128Cell *b = base + i * 3;
+        C128Cell *l = best + i * 3;
+        for (int t = 0; t < 3; t++) {
+            l[t] = (C128Cell){b[t].cost, C128OpBase, (uint8_t)t};
+        }
+        for (int t = 0; t < 3; t++) {
+            for (int from = 0; from < 3; from++) {
+                if (from != t && b[from].cost + 1 < l[t].cost) {
+                    l[t] = (C128Cell){b[from].cost + 1, C128OpLatch, (uint8_t)from};
+                }
+            }
+        }
+        if (i == n) {
+            break;
+        }
+        uint8_t c = s[i];
+        if (c > 127) {
+            free(base);
+            free(best);
+            return -1;
+        }
+        C128Cell *next = base + (i + 1) * 3;
+        for (int set = C128SetA; set <= C128SetB; set++) {
+            if (l[set].cost >= infinity) {
+                continue;
+            }
+            if (C128InSet(c, set)) {
+                if (l[set].cost + 1 < next[set].cost) {
+                    next[set] = (C128Cell){l[set].cost + 1, C128OpChar, (uint8_t)set};
+                }
+            } else if (c != '{' && C128InSet(c, 1 - set)) {
+                if (l[set].cost + 2 < next[set].cost) {
+                    next[set] = (C128Cell){l[set].cost + 2, C128OpShift, (uint8_t)set};
+                }
+            }
+        }
+        if (l[C128SetC].cost < infinity && i + 1 < n && BCIsDigit(c) && BCIsDigit(s[i + 1])) {
+            C128Cell *pair = base + (i + 2) * 3;
+            if (l[C128SetC].cost + 1 < pair[C128SetC].cost) {
+                pair[C128SetC] = (C128Cell){l[C128SetC].cost + 1, C128OpPair, C128SetC};
+            }
+        }
+    }
+
+    int set = 0;
+    for (int t = 1; t < 3; t++) {
+        if (best[n * 3 + t].cost < best[n * 3 + set].cost) {
+            set = t;
+        }
+    }
+    int cost = best[n * 3 + set].cost;
+    if (cost >= infinity) {
+        free(base);
+        free(best);
+        return -1;
+    }
+
+    // Walk back from the end, then reverse into print order
+    size_t count = 0;
+    size_t i = n;
+    for (;;) {
+        C128Cell latch = best[i * 3 + set];
+        if (latch.op == C128OpLatch) {
+            steps[count++] = (C128Step){C128OpLatch, (uint8_t)set, 0, 0};
+            set = latch.prev;
+        }
+        C128Cell cell = base[i * 3 + set];
+        if (cell.op == C128OpStart) {
+            steps[count++] = (C128Step){C128OpStart, (uint8_t)set, 0, 0};
+            break;
+        }
+        if (cell.op == C128OpPair) {
+            steps[count++] = (C128Step){C128OpPair, C128SetC, s[i - 2], s[i - 1]};
+            i -= 2;
+        } else {
+            steps[count++] = (C128Step){cell.op, (uint8_t)set, s[i - 1], 0};
+            i -= 1;
+        }
+        set = cell.prev;
+    }
+    for (size_t a = 0, z = count - 1; a < z; a++, z--) {
+        C128Step tmp = steps[a];
+        steps[a] = steps[z];
+        steps[z] = tmp;
+    }
+    *stepCount = count;
+    free(base);
+    free(best);
+    return cost;
+}
+
+/// Fixed-length GS1-style symbologies: accepts the data with or without its check digit
+static void BCValidateFixed(const uint8_t *s, size_t n, size_t length, int addon, int (*check)(const uint8_t *, size_t), uint8_t *out, BCOutcome *o) {
+    long bad = BCFirstNonDigit(s, n);
+    if (bad >= 0) {
+        o->error = BarcodeInvalidCharacter;
+        o->errorIndex = bad;
+        return;
+    }
+    if (n < (size_t)addon + length - 1 || n > (size_t)addon + length) {
+        o->error = BarcodeInvalidLength;
+        return;
+    }
+    size_t dataLength = n - (size_t)addon;
+    int digit = check(s, length - 1);
+    if (dataLength == length && s[length - 1] - '0' != digit) {
+        o->error = BarcodeInvalidCheckDigit;
+        o->errorIndex = (long)length - 1;
+        return;
+    }
+    memcpy(out, s, length - 1);
+    out[length - 1] = (uint8_t)('0' + digit);
+    memcpy(out + length, s + dataLength, (size_t)addon);
+    o->outLength = length + (size_t)addon;
+    o->check = '0' + digit;
+}
+
+static long BCAddonModules(int addon) {
+    return addon == 2 ? 20 : (addon == 5 ? 47 : 0);
+}
+
+static void BCValidate(BCSpec spec, const uint8_t *s, size_t n, uint8_t *out, BCOutcome *o) {
+    memset(o, 0, sizeof(*o));
+    o->errorIndex = -1;
+    if (n == 0) {
+        o->error = BarcodeEmptyContent;
+        return;
+    }
+    memcpy(out, s, n);
+    o->outLength = n;
+
+    switch (spec.kind) {
+        case BCKindUPCA:
+            BCValidateFixed(s, n, 12, spec.addon, BCGS1Check, out, o);
+            o->modules = 95 + BCAddonModules(spec.addon);
+            break;
+        case BCKindEAN13:
+            BCValidateFixed(s, n, 13, spec.addon, BCGS1Check, out, o);
+            o->modules = 95 + BCAddonModules(spec.addon);
+            break;
+        case BCKindEAN8:
+            BCValidateFixed(s, n, 8, spec.addon, BCGS1Check, out, o);
+            o->modules = 67 + BCAddonModules(spec.addon);
+            break;
+        case BCKindITF14:
+        case BCKindEAN14:
+            BCValidateFixed(s, n, 14, 0, BCGS1Check, out, o);
+            break;
+        case BCKindIdentcode:
+            BCValidateFixed(s, n, 12, 0, BCDeutschePostCheck, out, o);
+            break;
+        case BCKindLeitcode:
+            BCValidateFixed(s, n, 14, 0, BCDeutschePostCheck, out, o);
+            break;
+        case BCKindUPCE: {
+            long bad = BCFirstNonDigit(s, n);
+            if (bad >= 0) {
+                o->error = BarcodeInvalidCharacter;
+                o->errorIndex = bad;
+                return;
+            }
+            if (n < (size_t)spec.addon + 6 || n - (size_t)spec.addon > 8) {
+                o->error = BarcodeInvalidLength;
+                return;
+            }
+            size_t dataLength = n - (size_t)spec.addon;
+            uint8_t ns = dataLength == 6 ? '0' : s[0];
+            const uint8_t *data = dataLength == 6 ? s : s + 1;
+            if (ns != '0' && ns != '1') {
+                o->error = BarcodeInvalidCharacter;
+                o->errorIndex = 0;
+                return;
+            }
+            uint8_t upca[11];
+            BCExpandUPCE(ns, data, upca);
+            int digit = BCGS1Check(upca, 11);
+            if (dataLength == 8 && s[7] - '0' != digit) {
+                o->error = BarcodeInvalidCheckDigit;
+                o->errorIndex = 7;
+                return;
+            }
+            out[0] = ns;
+            memcpy(out + 1, data, 6);
+            out[7] = (uint8_t)('0' + digit);
+            memcpy(out + 8, s + dataLength, (size_t)spec.addon);
+            o->outLength = 8 + (size_t)spec.addon;
+            o->check = '0' + digit;
+            o->modules = 51 + BCAddonModules(spec.addon);
+            break;
+        }
+        case BCKindCode39:
+        case BCKindCode39C: {
+            size_t start = 0;
+            size_t end = n;
+            if (n >= 2 && s[0] == '*' && s[n - 1] == '*') {
+                start = 1;
+                end = n - 1;
+            }
+            int sum = 0;
+            for (size_t i = start; i < end; i++) {
+                uint8_t c = BCUpper(s[i]);
+                int value = BCCode39Value(c);
+                if (value < 0) {
+                    o->error = BarcodeInvalidCharacter;
+                    o->errorIndex = (long)i;
+                    return;
+                }
+                sum += value;
+                out[i - start] = c;
+            }
+            o->outLength = end - start;
+            if (o->outLength == 0) {
+                o->error = BarcodeEmptyContent;
+                return;
+            }
+            if (spec.kind == BCKindCode39C) {
+                o->check = (uint8_t)BCCode39Chars[sum % 43];
+            }
+            o->modules = (long)(o->outLength + 2 + (spec.kind == BCKindCode39C)) * 13 - 1;
+            break;
+        }
+        case BCKindITF:
+        case BCKindITFC: {
+            long bad = BCFirstNonDigit(s, n);
+            if (bad >= 0) {
+                o->error = BarcodeInvalidCharacter;
+                o->errorIndex = bad;
+                return;
+            }
+            // Interleaved 2 of 5 encodes digit pairs, pad with a leading zero when the count does not fit
+            bool needsOdd = spec.kind == BCKindITFC;
+            bool pad = ((n & 1) == 1) != needsOdd;
+            size_t offset = pad ? 1 : 0;
+            out[0] = '0';
+            memcpy(out + offset, s, n);
+            o->outLength = n + offset;
+            if (needsOdd) {
+                o->check = '0' + BCGS1Check(out, o->outLength);
+            }
+            o->modules = (long)(o->outLength + needsOdd) * 9 + 9;
+            break;
+        }
+        case BCKindCodabar: {
+            static const char *body = "0123456789-$:/.+";
+            bool first = BCIsCodabarGuard(s[0]);
+            bool last = BCIsCodabarGuard(s[n - 1]);
+            if (first != last || (first && n < 2)) {
+                o->error = BarcodeInvalidCharacter;
+                o->errorIndex = first ? (long)n - 1 : 0;
+                return;
+            }
+            size_t start = first ? 1 : 0;
+            size_t end = first ? n - 1 : n;
+            for (size_t i = start; i < end; i++) {
+                if (s[i] == 0 || strchr(body, s[i]) == NULL) {
+                    o->error = BarcodeInvalidCharacter;
+                    o->errorIndex = (long)i;
+                    return;
+                }
+            }
+            if (!first) {
+                out[0] = 'A';
+                memcpy(out + 1, s, n);
+                out[n + 1] = 'A';
+                o->outLength = n + 2;
+            } else {
+                out[0] = BCUpper(s[0]);
+                out[n - 1] = BCUpper(s[n - 1]);
+            }
+            break;
+        }
+        case BCKindCode93:
+        case BCKindCode39Full:
+        case BCKindASCII:
+            for (size_t i = 0; i < n; i++) {
+                if (s[i] > 127) {
+                    o->error = BarcodeInvalidCharacter;
+                    o->errorIndex = (long)i;
+                    return;
+                }
+            }
+            break;
+        case BCKindCode128: {
+            // Already in ESC/POS code set notation, nothing to plan
+            if (n >= 2 && s[0] == '{' && s[1] >= 'A' && s[1] <= 'C') {
+                break;
+            }
+            for (size_t i = 0; i < n; i++) {
+                if (s[i] > 127) {
+                    o->error = BarcodeInvalidCharacter;
+                    o->errorIndex = (long)i;
+                    return;
+                }
+            }
+            C128Step *steps = malloc((2 * n + 1) * sizeof(C128Step));
+            size_t count = 0;
+            int codewords = steps ? C128Plan(s, n, steps, &count) : -1;
+            free(steps);
+            if (codewords < 0) {
+                o->error = BarcodeInvalidCharacter;
+                return;
+            }
+            o->modules = 11L * (codewords + 1) + 13;
+            break;
+        }
+        case BCKindMSI:
+        case BCKindMSIC:
+        case BCKindDigits: {
+            long bad = BCFirstNonDigit(s, n);
+            if (bad >= 0) {
+                o->error = BarcodeInvalidCharacter;
+                o->errorIndex = bad;
+                return;
+            }
+            if (spec.kind == BCKindMSIC) {
+                o->check = '0' + BCLuhnCheck(s, n);
+            }
+            break;
+        }
+        case BCKindPostnet:
+        case BCKindPlanet: {
+            long bad = BCFirstNonDigit(s, n);
+            if (bad >= 0) {
+                o->error = BarcodeInvalidCharacter;
+                o->errorIndex = bad;
+                return;
+            }
+            bool allowed = spec.kind == BCKindPostnet ? (n == 5 || n == 9 || n == 11) : (n == 11 || n == 13);
+            if (!allowed) {
+                o->error = BarcodeInvalidLength;
+            }
+            break;
+        }
+        case BCKindCode11:
+            for (size_t i = 0; i < n; i++) {
+                if (!BCIsDigit(s[i]) && s[i] != '-') {
+                    o->error = BarcodeInvalidCharacter;
+                    o->errorIndex = (long)i;
+                    return;
+                }
+            }
+            break;
+        case BCKindPlessey:
+            for (size_t i = 0; i < n; i++) {
+                uint8_t c = (s[i] >= 'a' && s[i] <= 'f') ? (uint8_t)(s[i] - 32) : s[i];
+                if (!BCIsDigit(c) && !(c >= 'A' && c <= 'F')) {
+                    o->error = BarcodeInvalidCharacter;
+                    o->errorIndex = (long)i;
+                    return;
+                }
+                out[i] = c;
+            }
+            break;
+        case BCKindUnsupported:
+            o->error = BarcodeUnsupportedType;
+            break;
+    }
+}
+
+#pragma mark - Type mapping
+
+static BCSpec BCSpecForBCSType(BCSBarcodeType type) {
+    switch (type) {
+        case BCS_UPCA:    return (BCSpec){BCKindUPCA, 0};
+        case BCS_UPCE:    return (BCSpec){BCKindUPCE, 0};
+        case BCS_EAN13:   return (BCSpec){BCKindEAN13, 0};
+        case BCS_EAN8:    return (BCSpec){BCKindEAN8, 0};
+        case BCS_Code39:  return (BCSpec){BCKindCode39, 0};
+        case BCS_ITF:     return (BCSpec){BCKindITF, 0};
+        case BCS_Codabar: return (BCSpec){BCKindCodabar, 0};
+        case BCS_Code93:  return (BCSpec){BCKindCode93, 0};
+        case BCS_Code128: return (BCSpec){BCKindCode128, 0};
+    }
+    return (BCSpec){BCKindUnsupported, 0};
+}
+
+static BCSpec BCSpecForPOSType(int m) {
+    switch (m) {
+        case POSBarcodeTypeUPCA:        return BCSpecForBCSType(BCS_UPCA);
+        case POSBarcodeTypeUPCE:        return BCSpecForBCSType(BCS_UPCE);
+        case POSBarcodeTypeJAN13_EAN13: return BCSpecForBCSType(BCS_EAN13);
+        case POSBarcodeTypeJAN8_EAN8:   return BCSpecForBCSType(BCS_EAN8);
+        case POSBarcodeTypeCode39:      return BCSpecForBCSType(BCS_Code39);
+        case POSBarcodeTypeITF:         return BCSpecForBCSType(BCS_ITF);
+        case POSBarcodeTypeCodabar:     return BCSpecForBCSType(BCS_Codabar);
+        case POSBarcodeTypeCode93:      return BCSpecForBCSType(BCS_Code93);
+        case POSBarcodeTypeCode128:     return BCSpecForBCSType(BCS_Code128);
+    }
+    return (BCSpec){BCKindUnsupported, 0};
+}
+
+static BCSpec BCSpecForCodeType(NSString *codeType) {
+    static NSDictionary<NSString *, NSValue *> *specs = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableDictionary *map = [NSMutableDictionary dictionary];
+        void (^add)(NSString *, BCKind, int) = ^(NSString *name, BCKind kind, int addon) {
+            BCSpec spec = {kind, addon};
+            map[name] = [NSValue valueWithBytes:&spec objCType:@encode(BCSpec)];
+        };
+        add(kBarcodeTypeCode128, BCKindASCII, 0);
+        add(kBarcodeTypeCode128Manual, BCKindASCII, 0);
+        add(kBarcodeTypeEAN128, BCKindASCII, 0);
+        add(kBarcodeTypeInterleaved25, BCKindITF, 0);
+        add(kBarcodeTypeInterleaved25C, BCKindITFC, 0);
+        add(kBarcodeTypeCode39, BCKindCode39Full, 0);
+        add(kBarcodeTypeCode39C, BCKindCode39C, 0);
+        add(kBarcodeTypeCode93, BCKindCode93, 0);
+        add(kBarcodeTypeEAN13, BCKindEAN13, 0);
+        add(kBarcodeTypeEAN13_2, BCKindEAN13, 2);
+        add(kBarcodeTypeEAN13_5, BCKindEAN13, 5);
+        add(kBarcodeTypeEAN8, BCKindEAN8, 0);
+        add(kBarcodeTypeEAN8_2, BCKindEAN8, 2);
+        add(kBarcodeTypeEAN8_5, BCKindEAN8, 5);
+        add(kBarcodeTypeCodabar, BCKindCodabar, 0);
+        add(kBarcodeTypePostnet, BCKindPostnet, 0);
+        add(kBarcodeTypeUPCA, BCKindUPCA, 0);
+        add(kBarcodeTypeUPCA_2, BCKindUPCA, 2);
+        add(kBarcodeTypeUPCA_5, BCKindUPCA, 5);
+        add(kBarcodeTypeUPCE, BCKindUPCE, 0);
+        add(kBarcodeTypeUPCE_2, BCKindUPCE, 2);
+        add(kBarcodeTypeUPCE_5, BCKindUPCE, 5);
+        add(kBarcodeTypeCpost, BCKindDigits, 0);
+        add(kBarcodeTypeMSI, BCKindMSI, 0);
+        add(kBarcodeTypeMSIC, BCKindMSIC, 0);
+        add(kBarcodeTypePlessey, BCKindPlessey, 0);
+        add(kBarcodeTypeITF14, BCKindITF14, 0);
+        add(kBarcodeTypeEAN14, BCKindEAN14, 0);
+        add(kBarcodeTypeCode11, BCKindCode11, 0);
+        add(kBarcodeTypeTelepen, BCKindASCII, 0);
+        add(kBarcodeTypeTelepenN, BCKindDigits, 0);
+        add(kBarcodeTypePlanet, BCKindPlanet, 0);
+        add(kBarcodeTypeCode49, BCKindASCII, 0);
+        add(kBarcodeTypeDPIIdentcode, BCKindIdentcode, 0);
+        add(kBarcodeTypeDPILeitcode, BCKindLeitcode, 0);
+        specs = [map copy];
+    });
+    BCSpec spec = {BCKindUnsupported, 0};
+    NSValue *value = codeType ? specs[codeType] : nil;
+    if (value) {
+        [value getValue:&spec];
+    }
+    return spec;
+}
+
+#pragma mark - Result
+
+@interface BarcodeValidationResult ()
+
+- (instancetype)initWithError:(BarcodeValidationError)error
+                   errorIndex:(NSInteger)errorIndex
+            normalizedContent:(NSString *)normalizedContent
+               checkCharacter:(unichar)checkCharacter
+                  moduleCount:(NSInteger)moduleCount;
+
+@end
+
+@implementation BarcodeValidationResult
+
+- (instancetype)initWithError:(BarcodeValidationError)error errorIndex:(NSInteger)errorIndex normalizedContent:(NSString *)normalizedContent checkCharacter:(unichar)checkCharacter moduleCount:(NSInteger)moduleCount {
+    self = [super init];
+    if (self) {
+        _error = error;
+        _errorIndex = errorIndex;
+        _normalizedContent = [normalizedContent copy];
+        _checkCharacter = checkCharacter;
+        _moduleCount = moduleCount;
+    }
+    return self;
+}
+
+- (BOOL)isValid {
+    return _error == BarcodeValid;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: error=%ld index=%ld content=%@>", NSStringFromClass([self class]), (long)_error, (long)_errorIndex, _normalizedContent];
+}
+
+@end
+
+#pragma mark - Validator
+
+/// Runs the validator on the content's characters. Characters outside Latin-1 are reported as invalid
+/// for every symbology, so the byte buffer only needs one slot per UTF-16 unit.
+static BCOutcome BCValidateString(BCSpec spec, NSString *content, NSString **normalized) {
+    BCOutcome outcome;
+    NSUInteger length = content.length;
+    uint8_t stackBuffer[2 * 128 + 4];
+    uint8_t *buffer = length <= 128 ? stackBuffer : malloc(2 * length + 4);
+    if (buffer == NULL) {
+        // Too long to buffer, no symbology encodes content of this size
+        outcome = (BCOutcome){BarcodeInvalidLength, 0, 0, 0, 0};
+        if (normalized != NULL) {
+            *normalized = content;
+        }
+        return outcome;
+    }
+    uint8_t *bytes = buffer;
+    uint8_t *out = buffer + length;
+    long badIndex = -1;
+
+    const char *ascii = CFStringGetCStringPtr((__bridge CFStringRef)content, kCFStringEncodingASCII);
+    if (ascii != NULL) {
+        memcpy(bytes, ascii, length);
+    } else {
+        CFStringInlineBuffer inlineBuffer;
+        CFStringInitInlineBuffer((__bridge CFStringRef)content, &inlineBuffer, CFRangeMake(0, (CFIndex)length));
+        for (NSUInteger i = 0; i < length; i++) {
+            UniChar c = CFStringGetCharacterFromInlineBuffer(&inlineBuffer, (CFIndex)i);
+            if (c > 0xFF && badIndex < 0) {
+                badIndex = (long)i;
+            }
+            bytes[i] = (uint8_t)c;
+        }
+    }
+
+    BCValidate(spec, bytes, length, out, &outcome);
+    if (badIndex >= 0 && outcome.error == BarcodeValid) {
+        outcome.error = BarcodeInvalidCharacter;
+        outcome.errorIndex = badIndex;
+    }
+    if (normalized != NULL) {
+        if (outcome.error == BarcodeValid) {
+            *normalized = [[NSString alloc] initWithBytes:out length:outcome.outLength encoding:NSISOLatin1StringEncoding];
+        } else {
+            *normalized = content;
+        }
+    }
+    if (buffer != stackBuffer) {
+        free(buffer);
+    }
+    return outcome;
+}
+
+static BarcodeValidationResult *BCResult(BCSpec spec, NSString *content) {
+    NSString *normalized = nil;
+    BCOutcome outcome = BCValidateString(spec, content ?: @"", &normalized);
+    return [[BarcodeValidationResult alloc] initWithError:outcome.error
+                                               errorIndex:outcome.errorIndex
+                                        normalizedContent:normalized ?: @""
+                                           checkCharacter:(unichar)outcome.check
+                                              moduleCount:outcome.modules];
+}
+
+static NSArray<BarcodeValidationResult *> *BCBatch(BCSpec spec, NSArray<NSString *> *contents) {
+    NSUInteger count = contents.count;
+    if (count == 0) {
+        return @[];
+    }
+    __strong BarcodeValidationResult **results = (__strong BarcodeValidationResult **)calloc(count, sizeof(BarcodeValidationResult *));
+    if (results == NULL) {
+        return @[];
+    }
+    const NSUInteger chunk = 1024;
+    NSUInteger chunks = (count + chunk - 1) / chunk;
+    dispatch_apply(chunks, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t index) {
+        NSUInteger end = MIN((index + 1) * chunk, count);
+        for (NSUInteger i = index * chunk; i < end; i++) {
+            results[i] = BCResult(spec, contents[i]);
+        }
+    });
+    NSArray *array = [NSArray arrayWithObjects:results count:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        results[i] = nil;
+    }
+    free(results);
+    return array;
+}
+
+@implementation BarcodeValidator
+
++ (BarcodeValidationResult *)validateContent:(NSString *)content type:(BCSBarcodeType)type {
+    return BCResult(BCSpecForBCSType(type), content);
+}
+
++ (BarcodeValidationResult *)validateContent:(NSString *)content codeType:(NSString *)codeType {
+    return BCResult(BCSpecForCodeType(codeType), content);
+}
+
++ (BarcodeValidationResult *)validateContent:(NSString *)content posBarcodeType:(int)m {
+    return BCResult(BCSpecForPOSType(m), content);
+}
+
++ (NSArray<BarcodeValidationResult *> *)validateContents:(NSArray<NSString *> *)contents type:(BCSBarcodeType)type {
+    return BCBatch(BCSpecForBCSType(type), contents);
+}
+
++ (NSArray<BarcodeValidationResult *> *)validateContents:(NSArray<NSString *> *)contents codeType:(NSString *)codeType {
+    return BCBatch(BCSpecForCodeType(codeType), contents);
+}
+
++ (NSIndexSet *)invalidIndexesInContents:(NSArray<NSString *> *)contents type:(BCSBarcodeType)type {
+    BCSpec spec = BCSpecForBCSType(type);
+    NSUInteger count = contents.count;
+    uint8_t *flags = calloc(MAX(count, (NSUInteger)1), 1);
+    if (flags == NULL) {
+        return [NSIndexSet indexSet];
+    }
+    const NSUInteger chunk = 1024;
+    NSUInteger chunks = (count + chunk - 1) / chunk;
+    dispatch_apply(chunks, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t index) {
+        NSUInteger end = MIN((index + 1) * chunk, count);
+        for (NSUInteger i = index * chunk; i < end; i++) {
+            flags[i] = BCValidateString(spec, contents[i], NULL).error != BarcodeValid;
+        }
+    });
+    NSMutableIndexSet *invalid = [NSMutableIndexSet indexSet];
+    for (NSUInteger i = 0; i < count; i++) {
+        if (flags[i]) {
+            [invalid addIndex:i];
+        }
+    }
+    free(flags);
+    return invalid;
+}
+
++ (int)gs1CheckDigitForDigits:(NSString *)digits {
+    NSData *data = [digits dataUsingEncoding:NSASCIIStringEncoding];
+    if (data == nil || BCFirstNonDigit(data.bytes, data.length) >= 0) {
+        return -1;
+    }
+    return BCGS1Check(data.bytes, data.length);
+}
+
++ (NSData *)posCode128DataWithContent:(NSString *)content {
+    NSData *ascii = [content dataUsingEncoding:NSASCIIStringEncoding];
+    if (ascii.length == 0) {
+        return nil;
+    }
+    const uint8_t *s = ascii.bytes;
+    size_t n = ascii.length;
+    C128Step *steps = malloc((2 * n + 1) * sizeof(C128Step));
+    if (steps == NULL) {
+        return nil;
+    }
+    size_t count = 0;
+    if (C128Plan(s, n, steps, &count) < 0) {
+        free(steps);
+        return nil;
+    }
+    static const uint8_t setNames[3] = {'A', 'B', 'C'};
+    NSMutableData *data = [NSMutableData dataWithCapacity:n + 2 * count];
+    for (size_t i = 0; i < count; i++) {
+        C128Step step = steps[i];
+        switch (step.op) {
+            case C128OpStart:
+            case C128OpLatch: {
+                uint8_t code[2] = {'{', setNames[step.set]};
+                [data appendBytes:code length:2];
+                break;
+            }
+            case C128OpShift: {
+                uint8_t code[3] = {'{', 'S', step.c0};
+                [data appendBytes:code length:3];
+                break;
+            }
+            case C128OpPair: {
+                uint8_t value = (uint8_t)((step.c0 - '0') * 10 + (step.c1 - '0'));
+                [data appendBytes:&value length:1];
+                break;
+            }
+            default:
+                if (step.c0 == '{') {
+                    [data appendBytes:"{" length:1];
+                }
+                [data appendBytes:&step.c0 length:1];
+                break;
+        }
+    }
+    free(steps);
+    return data;
+}
+
++ (NSData *)printBarcodeWithM:(int)m content:(NSString *)content error:(BarcodeValidationError *)error {
+    NSString *normalized = nil;
+    BCOutcome outcome = BCValidateString(BCSpecForPOSType(m), content ?: @"", &normalized);
+    if (error != NULL) {
+        *error = outcome.error;
+    }
+    if (outcome.error != BarcodeValid) {
+        return nil;
+    }
+    NSData *payload = nil;
+    if (m == POSBarcodeTypeCode128 && !([normalized hasPrefix:@"{A"] || [normalized hasPrefix:@"{B"] || [normalized hasPrefix:@"{C"])) {
+        payload = [self posCode128DataWithContent:normalized];
+    } else {
+        payload = [normalized dataUsingEncoding:NSISOLatin1StringEncoding];
+    }
+    if (payload.length == 0 || payload.length > 255) {
+        if (error != NULL) {
+            *error = BarcodeInvalidLength;
+        }
+        return nil;
+    }
+    NSMutableData *command = [NSMutableData dataWithCapacity:payload.length + 4];
+    uint8_t header[4] = {0x1D, 0x6B, (uint8_t)m, (uint8_t)payload.length};
+    [command appendBytes:header length:sizeof(header)];
+    [command appendData:payload];
+    return command;
+}
+
+@end
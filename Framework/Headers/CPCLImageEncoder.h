@@ -0,0 +1,71 @@
+//
+//  CPCLImageEncoder.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import <UIKit/UIKit.h>
+#import "PrinterBitmap.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// CPCL graphic command format
+typedef NS_ENUM(NSInteger, CPCLGraphicFormat) {
+    CPCL_GRAPHIC_AUTO = 0, ///< CG, or EG when requiresASCII is set
+    CPCL_GRAPHIC_CG,       ///< Binary graphic data (COMPRESSED-GRAPHICS)
+    CPCL_GRAPHIC_EG        ///< Hexadecimal graphic data (EXPANDED-GRAPHICS), twice the size of CG
+};
+
+/// Called for every encoded graphic command, in print order.
+/// @param command The CG or EG command
+/// @param stop Set to YES to stop encoding the remaining bands
+typedef void (^CPCLImageEncoderCommandBlock)(NSData *command, BOOL *stop);
+
+/// Encodes images into CPCL graphic commands.
+/// Blank margins are trimmed by moving the origin, and tall images are split into bands
+/// that can be sent while the rest of the image is still being encoded.
+@interface CPCLImageEncoder : NSObject
+
+/// Graphic command format (default: CPCL_GRAPHIC_AUTO)
+@property (nonatomic, assign) CPCLGraphicFormat format;
+
+/// Set when the link is not 8-bit clean, CPCL_GRAPHIC_AUTO then selects EG (default: NO)
+@property (nonatomic, assign) BOOL requiresASCII;
+
+/// Skips blank leading and trailing rows and columns (default: YES)
+@property (nonatomic, assign) BOOL trimsBlankMargins;
+
+/// Maximum height of one graphic command in dots, 0 keeps the image in one command (default: 256)
+@property (nonatomic, assign) int bandHeight;
+
+/// Draws an image with the default encoder settings
+/// @param x The x-coordinate
+/// @param y The y-coordinate
+/// @param image The UIImage to draw
+/// @return NSData object representing the command
++ (NSData *)drawImageWithx:(int)x y:(int)y image:(UIImage *)image;
+
+/// Draws an image
+/// @param x The x-coordinate
+/// @param y The y-coordinate
+/// @param image The UIImage to draw
+/// @return NSData object representing the command
+- (NSData *)drawImageWithx:(int)x y:(int)y image:(UIImage *)image;
+
+/// Draws a bitmap
+/// @param x The x-coordinate
+/// @param y The y-coordinate
+/// @param bitmap The bitmap to draw
+/// @return NSData object representing the command
+- (NSData *)drawBitmapWithx:(int)x y:(int)y bitmap:(PrinterBitmap *)bitmap;
+
+/// Encodes a bitmap band by band, handing each graphic command over as soon as it is built
+/// @param x The x-coordinate
+/// @param y The y-coordinate
+/// @param bitmap The bitmap to draw
+/// @param commandBlock Block called with each command
+- (void)encodeBitmapWithx:(int)x y:(int)y bitmap:(PrinterBitmap *)bitmap commandBlock:(CPCLImageEncoderCommandBlock)commandBlock;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,131 @@
+//
+//  CPCLImageEncoder.m
+//  Printer
+//
+
+#import "CPCLImageEncoder.h"
+
+@implementation CPCLImageEncoder
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _format = CPCL_GRAPHIC_AUTO;
+        _requiresASCII = NO;
+        _trimsBlankMargins = YES;
+        _bandHeight = 256;
+    }
+    return self;
+}
+
++ (NSData *)drawImageWithx:(int)x y:(int)y image:(UIImage *)image {
+    return [[[self alloc] init] drawImageWithx:x y:y image:image];
+}
+
+- (NSData *)drawImageWithx:(int)x y:(int)y image:(UIImage *)image {
+    PrinterBitmap *bitmap = [PrinterBitmap bitmapWithImage:image];
+    if (bitmap == nil) {
+        return [NSData data];
+    }
+    return [self drawBitmapWithx:x y:y bitmap:bitmap];
+}
+
+- (NSData *)drawBitmapWithx:(int)x y:(int)y bitmap:(PrinterBitmap *)bitmap {
+    NSMutableData *commands = [NSMutableData data];
+    [self encodeBitmapWithx:x y:y bitmap:bitmap commandBlock:^(NSData *command, BOOL *stop) {
+        [commands appendData:command];
+    }];
+    return commands;
+}
+
+- (void)encodeBitmapWithx:(int)x y:(int)y bitmap:(PrinterBitmap *)bitmap commandBlock:(CPCLImageEncoderCommandBlock)commandBlock {
+    int left = 0;
+    int right = bitmap.width;
+    int top = 0;
+    int bottom = bitmap.height;
+    if (bitmap.width == 0 || bitmap.height == 0) {
+        return;
+    }
+
+    if (self.trimsBlankMargins) {
+        int bytesPerRow = bitmap.bytesPerRow;
+        uint8_t *columns = calloc((size_t)bytesPerRow, 1);
+        if (columns == NULL) {
+            return;
+        }
+        top = -1;
+        for (int row = 0; row < bitmap.height; row++) {
+            const uint8_t *bytes = [bitmap bytesForRow:row];
+            uint8_t any = 0;
+            for (int i = 0; i < bytesPerRow; i++) {
+                columns[i] |= bytes[i];
+                any |= bytes[i];
+            }
+            if (any) {
+                if (top < 0) {
+                    top = row;
+                }
+                bottom = row + 1;
+            }
+        }
+        if (top < 0) {
+            free(columns);
+            return;
+        }
+        left = bitmap.width;
+        right = 0;
+        for (int col = 0; col < bitmap.width; col++) {
+            if (columns[col >> 3] & (0x80 >> (col & 7))) {
+                left = MIN(left, col);
+                right = col + 1;
+            }
+        }
+        free(columns);
+    }
+
+    BOOL hex = self.format == CPCL_GRAPHIC_EG || (self.format == CPCL_GRAPHIC_AUTO && self.requiresASCII);
+    int band = self.bandHeight > 0 ? self.bandHeight : bottom - top;
+    BOOL stop = NO;
+    for (int row = top; row < bottom && !stop; row += band) {
+        int first = row;
+        int last = MIN(row + band, bottom);
+        if (self.trimsBlankMargins) {
+            while (first < last && [bitmap isRowBlank:first]) {
+                first++;
+            }
+            while (last > first && [bitmap isRowBlank:last - 1]) {
+                last--;
+            }
+            if (first == last) {
+                continue;
+            }
+        }
+        PrinterBitmap *slice = [bitmap bitmapWithX:left y:first width:right - left height:last - first];
+        commandBlock([self graphicCommandWithx:x + left y:y + first bitmap:slice hex:hex], &stop);
+    }
+}
+
+- (NSData *)graphicCommandWithx:(int)x y:(int)y bitmap:(PrinterBitmap *)bitmap hex:(BOOL)hex {
+    static const char digits[] = "0123456789ABCDEF";
+    NSString *header = [NSString stringWithFormat:@"%@ %d %d %d %d ", hex ? @"EG" : @"CG", bitmap.bytesPerRow, bitmap.height, x, y];
+    NSData *headerData = [header dataUsingEncoding:NSASCIIStringEncoding];
+    NSUInteger length = bitmap.data.length;
+    NSMutableData *command = [NSMutableData dataWithCapacity:headerData.length + (hex ? length * 2 : length) + 2];
+    [command appendData:headerData];
+    if (hex) {
+        NSUInteger offset = command.length;
+        [command setLength:offset + length * 2];
+        const uint8_t *src = bitmap.data.bytes;
+        char *dst = (char *)command.mutableBytes + offset;
+        for (NSUInteger i = 0; i < length; i++) {
+            dst[2 * i] = digits[src[i] >> 4];
+            dst[2 * i + 1] = digits[src[i] & 0x0F];
+        }
+    } else {
+        [command appendData:bitmap.data];
+    }
+    [command appendBytes:"\r\n" length:2];
+    return command;
+}
+
+@end
@@ -0,0 +1,84 @@
+//
+//  POSMacroOptimizer.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "PrinterResumableTransfer.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Outcome of optimizing one job
+@interface POSMacroResult : NSObject
+
+/// The job to send; the original job when no macro pays off or the model lacks macros
+@property (nonatomic, strong, readonly) PrinterJobBuffer *job;
+
+/// Commands recorded as the macro, nil when no macro is used
+@property (nonatomic, strong, readonly, nullable) NSData *macro;
+
+/// Whether the job defines the macro, NO when it reuses the macro the printer holds
+@property (nonatomic, readonly) BOOL definesMacro;
+
+/// Number of places the macro is executed
+@property (nonatomic, readonly) NSUInteger executions;
+
+/// Bytes saved against the original job, including the cost of the definition
+@property (nonatomic, readonly) NSInteger bytesSaved;
+
+@end
+
+/// Records a command sequence that repeats within a job, such as a formatted separator line or
+/// a footer printed on every receipt, as the printer's macro (GS :) and replaces each occurrence
+/// with an execute-macro command (GS ^).
+///
+/// ESC/POS printers hold one macro, kept until power off. By default every job defines the macro it
+/// executes, because a printer that was switched off, reset or rebooted after a paper out has lost
+/// it and would skip the executions silently. With reusesHeldMacros the optimizer remembers which
+/// macro each printer holds, so later jobs execute it without defining it again. Sequences are made of
+/// whole commands of the job buffer, so a macro never starts or ends inside a command.
+/// Macros are only used on models registered as supporting them; any other printer gets the
+/// job unchanged.
+@interface POSMacroOptimizer : NSObject
+
+/// Largest macro in bytes (default: 2048, the usual macro buffer)
+@property (nonatomic, assign) NSUInteger maximumMacroLength;
+
+/// Most commands in a macro (default: 32)
+@property (nonatomic, assign) NSUInteger maximumMacroCommands;
+
+/// Whether a job executes the macro an earlier job defined on the same printer without defining it
+/// again (default: NO). Only safe when every power cycle and reset is reported through invalidatePrinter:.
+@property (nonatomic, assign) BOOL reusesHeldMacros;
+
+/// Whether models that were never registered use macros (default: NO)
+@property (nonatomic, assign) BOOL supportsUnknownModels;
+
+/// Bytes saved by all jobs optimized so far
+@property (nonatomic, readonly) NSUInteger totalBytesSaved;
+
+/// Returns the shared optimizer
++ (instancetype)sharedOptimizer;
+
+/// Registers whether a model supports GS : and GS ^
+/// @param supported Whether macros may be used
+/// @param model Model name, e.g. PrinterProfile printerName; matched case-insensitively as a prefix
+- (void)setMacrosSupported:(BOOL)supported forModel:(NSString *)model;
+
+/// Returns whether a model uses macros
+/// @param model Model name, nil for unknown
+- (BOOL)macrosSupportedForModel:(nullable NSString *)model;
+
+/// Optimizes a job for a printer
+/// @param job The job, built command by command
+/// @param model Model of the printer, nil for unknown
+/// @param printerID Identifier of the printer, e.g. its MAC address
+- (POSMacroResult *)optimizeJob:(PrinterJobBuffer *)job model:(nullable NSString *)model printerID:(NSString *)printerID;
+
+/// Forgets the macro a printer holds, e.g. after a power cycle or a failed write
+/// @param printerID Identifier of the printer
+- (void)invalidatePrinter:(NSString *)printerID;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,269 @@
+//
+//  POSMacroOptimizer.m
+//  Printer
+//
+
+#import "POSMacroOptimizer.h"
+#import "POSCommand.h"
+
+@interface POSMacroResult ()
+- (instancetype)initWithJob:(PrinterJobBuffer *)job macro:(NSData *)macro definesMacro:(BOOL)definesMacro executions:(NSUInteger)executions bytesSaved:(NSInteger)bytesSaved;
+@end
+
+@implementation POSMacroResult
+
+- (instancetype)initWithJob:(PrinterJobBuffer *)job macro:(NSData *)macro definesMacro:(BOOL)definesMacro executions:(NSUInteger)executions bytesSaved:(NSInteger)bytesSaved {
+    self = [super init];
+    if (self) {
+        _job = job;
+        _macro = macro;
+        _definesMacro = definesMacro;
+        _executions = executions;
+        _bytesSaved = bytesSaved;
+    }
+    return self;
+}
+
+@end
+
+@implementation POSMacroOptimizer {
+    /// Lowercased model prefix -> @YES / @NO
+    NSMutableDictionary<NSString *, NSNumber *> *_models;
+    /// Printer -> macro it holds
+    NSMutableDictionary<NSString *, NSData *> *_macros;
+    NSData *_execute;
+    NSData *_define;
+}
+
++ (instancetype)sharedOptimizer {
+    static POSMacroOptimizer *optimizer = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        optimizer = [[POSMacroOptimizer alloc] init];
+    });
+    return optimizer;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _maximumMacroLength = 2048;
+        _maximumMacroCommands = 32;
+        _models = [NSMutableDictionary dictionary];
+        _macros = [NSMutableDictionary dictionary];
+        // Run once, no wait, no button
+        _execute = [POSCommand executeMacrodeCommandWithR:1 andT:0 andM:0];
+        _define = [POSCommand startOrStopMacrodeFinition];
+    }
+    return self;
+}
+
+#pragma mark - Models
+
+- (void)setMacrosSupported:(BOOL)supported forModel:(NSString *)model {
+    @synchronized (self) {
+        _models[[model lowercaseString]] = @(supported);
+    }
+}
+
+- (BOOL)macrosSupportedForModel:(NSString *)model {
+    if (model.length == 0) {
+        return self.supportsUnknownModels;
+    }
+    NSString *name = [model lowercaseString];
+    @synchronized (self) {
+        // The longest registered prefix decides, so "XP-58" can override "XP"
+        NSString *match = nil;
+        for (NSString *prefix in _models) {
+            if ([name hasPrefix:prefix] && prefix.length > match.length) {
+                match = prefix;
+            }
+        }
+        return match ? _models[match].boolValue : self.supportsUnknownModels;
+    }
+}
+
+#pragma mark - Optimizing
+
+/// Real-time commands and macro commands themselves cannot be recorded
+static BOOL POSMacroCanRecord(NSData *command) {
+    if (command.length == 0) {
+        return NO;
+    }
+    const uint8_t *bytes = command.bytes;
+    if (bytes[0] == 0x10) {
+        return NO;
+    }
+    return !(bytes[0] == 0x1D && command.length > 1 && (bytes[1] == ':' || bytes[1] == '^'));
+}
+
+- (NSArray<NSData *> *)commandsOfJob:(PrinterJobBuffer *)job {
+    NSMutableArray<NSData *> *commands = [NSMutableArray array];
+    NSData *data = job.data;
+    __block NSUInteger start = 0;
+    [job.commandBoundaries enumerateIndexesUsingBlock:^(NSUInteger boundary, BOOL *stop) {
+        if (boundary > start) {
+            [commands addObject:[data subdataWithRange:NSMakeRange(start, boundary - start)]];
+            start = boundary;
+        }
+    }];
+    if (data.length > start) {
+        [commands addObject:[data subdataWithRange:NSMakeRange(start, data.length - start)]];
+    }
+    return commands;
+}
+
+/// Places where the held macro occurs, as ranges of command indexes
+- (NSArray<NSValue *> *)occurrencesOfMacro:(NSData *)macro inCommands:(NSArray<NSData *> *)commands {
+    NSMutableArray<NSValue *> *ranges = [NSMutableArray array];
+    NSUInteger i = 0;
+    while (i < commands.count) {
+        NSMutableData *sequence = [NSMutableData data];
+        NSUInteger k = 0;
+        while (i + k < commands.count && sequence.length < macro.length && POSMacroCanRecord(commands[i + k])) {
+            [sequence appendData:commands[i + k]];
+            k++;
+        }
+        if ([sequence isEqualToData:macro]) {
+            [ranges addObject:[NSValue valueWithRange:NSMakeRange(i, k)]];
+            i += k;
+        } else {
+            i++;
+        }
+    }
+    return ranges;
+}
+
+/// Non-overlapping occurrences of a k-command sequence, given all its starts in ascending order
+static NSArray<NSValue *> *POSMacroDisjointRanges(NSArray<NSNumber *> *starts, NSUInteger k) {
+    NSMutableArray<NSValue *> *ranges = [NSMutableArray array];
+    NSUInteger end = 0;
+    for (NSNumber *start in starts) {
+        if (start.unsignedIntegerValue >= end) {
+            [ranges addObject:[NSValue valueWithRange:NSMakeRange(start.unsignedIntegerValue, k)]];
+            end = start.unsignedIntegerValue + k;
+        }
+    }
+    return ranges;
+}
+
+- (POSMacroResult *)optimizeJob:(PrinterJobBuffer *)job model:(NSString *)model printerID:(NSString *)printerID {
+    POSMacroResult *unchanged = [[POSMacroResult alloc] initWithJob:job macro:nil definesMacro:NO executions:0 bytesSaved:0];
+    if (![self macrosSupportedForModel:model]) {
+        return unchanged;
+    }
+    NSData *held = nil;
+    if (self.reusesHeldMacros) {
+        @synchronized (self) {
+            held = _macros[printerID];
+        }
+    }
+
+    NSArray<NSData *> *commands = [self commandsOfJob:job];
+    NSInteger executeLength = (NSInteger)_execute.length;
+    NSInteger defineLength = 2 * (NSInteger)_define.length;
+
+    NSData *bestMacro = nil;
+    NSArray<NSValue *> *bestRanges = nil;
+    NSInteger bestSaving = 0;
+    if (held) {
+        NSArray<NSValue *> *ranges = [self occurrencesOfMacro:held inCommands:commands];
+        NSInteger saving = (NSInteger)ranges.count * ((NSInteger)held.length - executeLength);
+        if (saving > bestSaving) {
+            bestMacro = held;
+            bestRanges = ranges;
+            bestSaving = saving;
+        }
+    }
+
+    // Sequences of k+1 commands can only repeat where their first k commands repeat, so each
+    // round extends the starts of the sequences that occurred more than once
+    NSMutableArray<NSNumber *> *starts = [NSMutableArray arrayWithCapacity:commands.count];
+    for (NSUInteger i = 0; i < commands.count; i++) {
+        [starts addObject:@(i)];
+    }
+    for (NSUInteger k = 1; k <= self.maximumMacroCommands && starts.count > 1; k++) {
+        NSMutableDictionary<NSData *, NSMutableArray<NSNumber *> *> *groups = [NSMutableDictionary dictionary];
+        for (NSNumber *start in starts) {
+            NSUInteger i = start.unsignedIntegerValue;
+            if (i + k > commands.count || !POSMacroCanRecord(commands[i + k - 1])) {
+                continue;
+            }
+            NSMutableData *sequence = [NSMutableData data];
+            for (NSUInteger j = i; j < i + k; j++) {
+                [sequence appendData:commands[j]];
+            }
+            if (sequence.length > self.maximumMacroLength) {
+                continue;
+            }
+            NSMutableArray<NSNumber *> *group = groups[sequence];
+            if (group == nil) {
+                group = [NSMutableArray array];
+                groups[sequence] = group;
+            }
+            [group addObject:start];
+        }
+        NSMutableArray<NSNumber *> *repeated = [NSMutableArray array];
+        for (NSData *sequence in groups) {
+            NSArray<NSNumber *> *group = groups[sequence];
+            if (group.count < 2) {
+                continue;
+            }
+            [repeated addObjectsFromArray:group];
+            if ((NSInteger)sequence.length <= executeLength) {
+                continue;
+            }
+            NSArray<NSValue *> *ranges = POSMacroDisjointRanges(group, k);
+            NSInteger saving = (NSInteger)ranges.count * ((NSInteger)sequence.length - executeLength);
+            if (!(held && [sequence isEqualToData:held])) {
+                saving -= (NSInteger)sequence.length + defineLength;
+            }
+            if (saving > bestSaving) {
+                bestMacro = sequence;
+                bestRanges = ranges;
+                bestSaving = saving;
+            }
+        }
+        [repeated sortUsingSelector:@selector(compare:)];
+        starts = repeated;
+    }
+    if (bestMacro == nil) {
+        return unchanged;
+    }
+
+    PrinterJobBuffer *optimized = [[PrinterJobBuffer alloc] init];
+    BOOL defines = !(held && [bestMacro isEqualToData:held]);
+    if (defines) {
+        NSMutableData *definition = [_define mutableCopy];
+        [definition appendData:bestMacro];
+        [definition appendData:_define];
+        [optimized appendCommand:definition];
+    }
+    NSUInteger next = 0;
+    for (NSValue *value in bestRanges) {
+        NSRange range = value.rangeValue;
+        for (; next < range.location; next++) {
+            [optimized appendCommand:commands[next]];
+        }
+        [optimized appendCommand:_execute];
+        next = NSMaxRange(range);
+    }
+    for (; next < commands.count; next++) {
+        [optimized appendCommand:commands[next]];
+    }
+
+    NSInteger saved = (NSInteger)job.data.length - (NSInteger)optimized.data.length;
+    @synchronized (self) {
+        _macros[printerID] = bestMacro;
+        _totalBytesSaved += (NSUInteger)MAX(saved, 0);
+    }
+    return [[POSMacroResult alloc] initWithJob:optimized macro:bestMacro definesMacro:defines executions:bestRanges.count bytesSaved:saved];
+}
+
+- (void)invalidatePrinter:(NSString *)printerID {
+    @synchronized (self) {
+        [_macros removeObjectForKey:printerID];
+    }
+}
+
+@end
@@ -0,0 +1,57 @@
+//
+//  POSMixedTextRenderer.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreGraphics/CoreGraphics.h>
+#import "PrinterTextEncoder.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Prints text that the printer fonts only partly cover (Arabic, Thai, emoji, ...).
+/// Each line is split into runs the code page can encode, which are sent as text, and runs it cannot,
+/// which are rasterized on the host and sent as inline 24-dot bit images (ESC * 33).
+/// Rasterized runs are cached, so repeated words only cost one rendering.
+@interface POSMixedTextRenderer : NSObject
+
+/// Encoder for the code page selected on the printer (default: PC437)
+@property (nonatomic, strong) PrinterTextEncoder *textEncoder;
+
+/// Characters that are always rasterized even if the code page maps them,
+/// e.g. Arabic letters on printers without contextual shaping. Default: nil
+@property (nonatomic, copy, nullable) NSCharacterSet *rasterizedCharacters;
+
+/// Font size of rasterized runs in dots (default: 22, fits the 24-dot line of Font A)
+@property (nonatomic, assign) CGFloat fontSize;
+
+/// Gray level (0-255) below which a rasterized dot is printed (default: 128)
+@property (nonatomic, assign) int threshold;
+
+/// Maximum number of cached runs (default: 256)
+@property (nonatomic, assign) NSUInteger cacheCapacity;
+
+/// Creates a renderer for a code page
+/// @param encoder Encoder matching the printer's code page
+- (instancetype)initWithTextEncoder:(PrinterTextEncoder *)encoder;
+
+/// Returns a shared renderer using PC437
++ (instancetype)sharedRenderer;
+
+/// ESC/POS data printing one line followed by a line feed.
+/// Lines the code page fully covers are sent as plain text.
+/// @param line The text of the line, without a line break
+/// @return Data command
+- (NSData *)lineCommandWithText:(NSString *)line;
+
+/// ESC/POS data printing text, line breaks start new lines
+/// @param text The text to print
+/// @return Data command
+- (NSData *)printText:(NSString *)text;
+
+/// Removes all cached runs
+- (void)removeAllCachedRuns;
+
+@end
+
+NS_ASSUME_NONNULL_END
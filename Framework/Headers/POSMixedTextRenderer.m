@@ -0,0 +1,205 @@
+//
+//  POSMixedTextRenderer.m
+//  Printer
+//
+
+#import "POSMixedTextRenderer.h"
+#import "POSCommand.h"
+#import "PrinterBitmap.h"
+#import <CoreText/CoreText.h>
+
+/// ESC * 33 prints 24 dots per column, 3 bytes per column
+static const int POSMixedBandHeight = 24;
+static const int POSMixedMaxColumns = 1023;
+
+@implementation POSMixedTextRenderer {
+    NSCache<NSString *, NSData *> *_runs;
+}
+
++ (instancetype)sharedRenderer {
+    static POSMixedTextRenderer *renderer = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        renderer = [[POSMixedTextRenderer alloc] init];
+    });
+    return renderer;
+}
+
+- (instancetype)init {
+    return [self initWithTextEncoder:[PrinterTextEncoder encoderWithCodePage:0]];
+}
+
+- (instancetype)initWithTextEncoder:(PrinterTextEncoder *)encoder {
+    self = [super init];
+    if (self) {
+        _textEncoder = encoder;
+        _fontSize = 22;
+        _threshold = 128;
+        _runs = [[NSCache alloc] init];
+        self.cacheCapacity = 256;
+    }
+    return self;
+}
+
+- (void)setCacheCapacity:(NSUInteger)cacheCapacity {
+    _cacheCapacity = cacheCapacity;
+    _runs.countLimit = cacheCapacity;
+}
+
+- (void)removeAllCachedRuns {
+    [_runs removeAllObjects];
+}
+
+#pragma mark - Segmentation
+
+/// Ranges of the line that have to be rasterized: unmappable or forced characters,
+/// widened to whole grapheme clusters and joined across whitespace so words keep their shaping.
+- (NSArray<NSValue *> *)rasterRangesForLine:(NSString *)line {
+    NSMutableArray<NSValue *> *candidates = [NSMutableArray arrayWithArray:[self.textEncoder encodeString:line].unmappableRanges];
+    if (self.rasterizedCharacters) {
+        NSRange search = NSMakeRange(0, line.length);
+        while (search.length > 0) {
+            NSRange found = [line rangeOfCharacterFromSet:self.rasterizedCharacters options:0 range:search];
+            if (found.location == NSNotFound) {
+                break;
+            }
+            [candidates addObject:[NSValue valueWithRange:found]];
+            search = NSMakeRange(NSMaxRange(found), line.length - NSMaxRange(found));
+        }
+        [candidates sortUsingComparator:^NSComparisonResult(NSValue *a, NSValue *b) {
+            NSUInteger la = a.rangeValue.location, lb = b.rangeValue.location;
+            return la < lb ? NSOrderedAscending : (la > lb ? NSOrderedDescending : NSOrderedSame);
+        }];
+    }
+
+    NSCharacterSet *whitespace = [NSCharacterSet whitespaceCharacterSet];
+    NSMutableArray<NSValue *> *ranges = [NSMutableArray array];
+    for (NSValue *value in candidates) {
+        NSRange range = [line rangeOfComposedCharacterSequencesForRange:value.rangeValue];
+        NSValue *last = ranges.lastObject;
+        if (last) {
+            NSRange previous = last.rangeValue;
+            if (range.location <= NSMaxRange(previous)) {
+                ranges[ranges.count - 1] = [NSValue valueWithRange:NSUnionRange(previous, range)];
+                continue;
+            }
+            NSString *gap = [line substringWithRange:NSMakeRange(NSMaxRange(previous), range.location - NSMaxRange(previous))];
+            if ([gap stringByTrimmingCharactersInSet:whitespace].length == 0) {
+                ranges[ranges.count - 1] = [NSValue valueWithRange:NSUnionRange(previous, range)];
+                continue;
+            }
+        }
+        [ranges addObject:[NSValue valueWithRange:range]];
+    }
+    return ranges;
+}
+
+#pragma mark - Rasterization
+
+/// Renders a run into ESC * 33 column data (3 bytes per column, top dot in the MSB)
+- (NSData *)columnsForRun:(NSString *)run {
+    NSString *key = [NSString stringWithFormat:@"%.2f|%d|%@", self.fontSize, self.threshold, run];
+    NSData *cached = [_runs objectForKey:key];
+    if (cached) {
+        return cached;
+    }
+
+    CTFontRef font = CTFontCreateUIFontForLanguage(kCTFontUIFontSystem, self.fontSize, NULL);
+    if (font == NULL) {
+        return nil;
+    }
+    NSAttributedString *attributed = [[NSAttributedString alloc] initWithString:run attributes:@{(__bridge id)kCTFontAttributeName: (__bridge id)font}];
+    CFRelease(font);
+    CTLineRef ctLine = CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)attributed);
+    CGFloat ascent = 0, descent = 0, leading = 0;
+    double lineWidth = CTLineGetTypographicBounds(ctLine, &ascent, &descent, &leading);
+    int width = MAX(1, (int)ceil(lineWidth));
+
+    uint8_t *gray = malloc((size_t)width * POSMixedBandHeight);
+    if (gray == NULL) {
+        CFRelease(ctLine);
+        return nil;
+    }
+    memset(gray, 0xFF, (size_t)width * POSMixedBandHeight);
+    CGColorSpaceRef space = CGColorSpaceCreateDeviceGray();
+    CGContextRef context = CGBitmapContextCreate(gray, width, POSMixedBandHeight, 8, width, space, (CGBitmapInfo)kCGImageAlphaNone);
+    CGColorSpaceRelease(space);
+    if (context == NULL) {
+        CFRelease(ctLine);
+        free(gray);
+        return nil;
+    }
+    // Center the glyph box vertically in the band, CoreGraphics has its origin at the bottom
+    CGFloat baseline = (POSMixedBandHeight - (ascent + descent)) / 2.0 + descent;
+    CGContextSetTextPosition(context, 0, MAX(baseline, 0));
+    CTLineDraw(ctLine, context);
+    CGContextRelease(context);
+    CFRelease(ctLine);
+
+    PrinterBitmap *bitmap = [PrinterBitmap bitmapWithGrayPixels:gray width:width height:POSMixedBandHeight stride:(size_t)width threshold:self.threshold];
+    free(gray);
+
+    NSMutableData *columns = [NSMutableData dataWithLength:(NSUInteger)width * 3];
+    uint8_t *out = columns.mutableBytes;
+    for (int band = 0; band < 3; band++) {
+        for (int bit = 0; bit < 8; bit++) {
+            const uint8_t *row = [bitmap bytesForRow:band * 8 + bit];
+            uint8_t mask = (uint8_t)(0x80 >> bit);
+            for (int x = 0; x < width; x++) {
+                if (row[x >> 3] & (0x80 >> (x & 7))) {
+                    out[x * 3 + band] |= mask;
+                }
+            }
+        }
+    }
+    [_runs setObject:columns forKey:key];
+    return columns;
+}
+
+- (void)appendRun:(NSString *)run toData:(NSMutableData *)data {
+    NSData *columns = [self columnsForRun:run];
+    if (columns == nil) {
+        [data appendData:[self.textEncoder encodeString:run].data];
+        return;
+    }
+    int width = (int)(columns.length / 3);
+    for (int x = 0; x < width; x += POSMixedMaxColumns) {
+        int count = MIN(POSMixedMaxColumns, width - x);
+        NSData *chunk = [columns subdataWithRange:NSMakeRange((NSUInteger)x * 3, (NSUInteger)count * 3)];
+        [data appendData:[POSCommand selectBmpModelWithM:33 andnL:count & 0xFF andnH:count >> 8 andNSData:chunk]];
+    }
+}
+
+#pragma mark - Commands
+
+- (NSData *)lineCommandWithText:(NSString *)line {
+    NSMutableData *data = [NSMutableData data];
+    NSUInteger position = 0;
+    for (NSValue *value in [self rasterRangesForLine:line]) {
+        NSRange range = value.rangeValue;
+        if (range.location > position) {
+            [data appendData:[self.textEncoder encodeString:[line substringWithRange:NSMakeRange(position, range.location - position)]].data];
+        }
+        [self appendRun:[line substringWithRange:range] toData:data];
+        position = NSMaxRange(range);
+    }
+    if (position < line.length) {
+        [data appendData:[self.textEncoder encodeString:[line substringFromIndex:position]].data];
+    }
+    [data appendData:[POSCommand printAndFeedLine]];
+    return data;
+}
+
+- (NSData *)printText:(NSString *)text {
+    NSMutableData *data = [NSMutableData data];
+    NSString *normalized = [text stringByReplacingOccurrencesOfString:@"\r\n" withString:@"\n"];
+    NSArray<NSString *> *lines = [normalized componentsSeparatedByString:@"\n"];
+    // A trailing line break ends the last line, it does not start an empty one
+    NSUInteger count = [normalized hasSuffix:@"\n"] ? lines.count - 1 : lines.count;
+    for (NSUInteger i = 0; i < count; i++) {
+        [data appendData:[self lineCommandWithText:lines[i]]];
+    }
+    return data;
+}
+
+@end
@@ -0,0 +1,105 @@
+//
+//  POSPageComposer.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "PrinterBitmap.h"
+#import "PrinterTextEncoder.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Print direction of a page mode region (ESC T)
+typedef NS_ENUM(NSInteger, POSPageDirection) {
+    POSPageDirectionLeftToRight = 0, ///< Starting at the upper left
+    POSPageDirectionBottomToTop,     ///< Starting at the lower left, rotated 90 degrees counterclockwise
+    POSPageDirectionRightToLeft,     ///< Starting at the lower right, rotated 180 degrees
+    POSPageDirectionTopToBottom      ///< Starting at the upper right, rotated 90 degrees clockwise
+};
+
+/// A rectangular area of the page with its own print direction.
+/// Coordinates of the content are in dots, relative to the region's starting corner and measured
+/// along its print direction; y is the baseline for text, as in ESC/POS page mode.
+@interface POSPageRegion : NSObject
+
+/// Left edge on the page in dots
+@property (nonatomic, readonly) int x;
+
+/// Top edge on the page in dots
+@property (nonatomic, readonly) int y;
+
+/// Width in dots
+@property (nonatomic, readonly) int width;
+
+/// Height in dots
+@property (nonatomic, readonly) int height;
+
+/// Print direction
+@property (nonatomic, readonly) POSPageDirection direction;
+
+/// Adds text
+/// @param text The text, without line breaks
+/// @param x The x-coordinate
+/// @param y The y-coordinate of the baseline
+- (void)addText:(NSString *)text x:(int)x y:(int)y;
+
+/// Adds text with a format prefix, e.g. [POSCommand selectPrintMode:] or [POSCommand setTextSize:height:].
+/// The format applies to this text only: afterwards print mode, character size, bold, double strike,
+/// underline, font, reverse, upside down, right spacing and alignment are set back to their defaults.
+/// @param text The text, without line breaks
+/// @param format Commands selecting the text format
+/// @param x The x-coordinate
+/// @param y The y-coordinate of the baseline
+- (void)addText:(NSString *)text format:(nullable NSData *)format x:(int)x y:(int)y;
+
+/// Adds a 1D barcode (see POSCommand printBarcodeWithM:andContent:useEnCodeing:)
+/// @param m Barcode type
+/// @param content Barcode content
+/// @param x The x-coordinate
+/// @param y The y-coordinate of the bottom of the bars
+- (void)addBarcodeWithM:(int)m content:(NSString *)content x:(int)x y:(int)y;
+
+/// Adds a small raster image
+/// @param bitmap The image
+/// @param x The x-coordinate
+/// @param y The y-coordinate of the bottom of the image
+- (void)addBitmap:(PrinterBitmap *)bitmap x:(int)x y:(int)y;
+
+/// Adds arbitrary printable commands at a position
+/// @param command The command data
+/// @param x The x-coordinate
+/// @param y The y-coordinate
+- (void)addCommand:(NSData *)command x:(int)x y:(int)y;
+
+@end
+
+/// Lays out text, barcodes and small images into ESC/POS page mode regions, so rotated and
+/// side-by-side content prints as characters instead of one large raster image.
+/// The generated stream skips direction, area and position commands that would not change the printer state.
+@interface POSPageComposer : NSObject
+
+/// Encoder used for region text (default: GB18030)
+@property (nonatomic, strong) PrinterTextEncoder *textEncoder;
+
+/// Regions in the order they were added
+@property (nonatomic, readonly) NSArray<POSPageRegion *> *regions;
+
+/// Adds a region
+/// @param x Left edge on the page in dots
+/// @param y Top edge on the page in dots
+/// @param width Width in dots
+/// @param height Height in dots
+/// @param direction Print direction inside the region
+/// @return The region, content is added to it directly
+- (POSPageRegion *)addRegionWithX:(int)x y:(int)y width:(int)width height:(int)height direction:(POSPageDirection)direction;
+
+/// Removes all regions
+- (void)removeAllRegions;
+
+/// Page mode command stream: selects page mode, draws every region, prints the page and returns to standard mode
+/// @return Data command
+- (NSData *)pageData;
+
+@end
+
+NS_ASSUME_NONNULL_END
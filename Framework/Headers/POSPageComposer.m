@@ -0,0 +1,201 @@
+//
+//  POSPageComposer.m
+//  Printer
+//
+
+#import "POSPageComposer.h"
+#import "POSCommand.h"
+
+/// One positioned piece of content
+@interface POSPageItem : NSObject
+@property (nonatomic, strong) NSData *command;
+@property (nonatomic, assign) int x;
+@property (nonatomic, assign) int y;
+/// Text keeps the vertical position, images and barcodes may move it
+@property (nonatomic, assign) BOOL keepsVerticalPosition;
+@property (nonatomic, assign) NSUInteger order;
+@end
+
+@implementation POSPageItem
+@end
+
+@interface POSPageRegion ()
+@property (nonatomic, weak) POSPageComposer *composer;
+@property (nonatomic, strong) NSMutableArray<POSPageItem *> *items;
+@end
+
+/// Sets every character attribute a format can change back to its default
+static NSData *POSPageFormatReset(void) {
+    static NSData *reset = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableData *data = [NSMutableData data];
+        [data appendData:[POSCommand selectPrintMode:0]];
+        [data appendData:[POSCommand selectCharacterSize:0]];
+        [data appendData:[POSCommand selectOrCancleBoldModel:0]];
+        [data appendData:[POSCommand selectOrCancleDoublePrintMode:0]];
+        [data appendData:[POSCommand selectOrCancleUnderLineModel:0]];
+        [data appendData:[POSCommand selectOrCancelChineseCharUnderLineModel:0]];
+        [data appendData:[POSCommand selectOrCancelChineseCharDoubleWH:0]];
+        [data appendData:[POSCommand selectFont:0]];
+        [data appendData:[POSCommand selectOrCancleInvertPrintModel:0]];
+        [data appendData:[POSCommand selectOrCancleConvertPrintModel:0]];
+        [data appendData:[POSCommand setCharRightSpace:0]];
+        [data appendData:[POSCommand selectAlignment:0]];
+        reset = data;
+    });
+    return reset;
+}
+
+@implementation POSPageRegion
+
+- (instancetype)initWithX:(int)x y:(int)y width:(int)width height:(int)height direction:(POSPageDirection)direction {
+    self = [super init];
+    if (self) {
+        _x = MAX(x, 0);
+        _y = MAX(y, 0);
+        _width = MAX(width, 1);
+        _height = MAX(height, 1);
+        _direction = direction;
+        _items = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)addItem:(NSData *)command x:(int)x y:(int)y keepsVerticalPosition:(BOOL)keeps {
+    if (command.length == 0) {
+        return;
+    }
+    POSPageItem *item = [[POSPageItem alloc] init];
+    item.command = command;
+    item.x = MAX(x, 0);
+    item.y = MAX(y, 0);
+    item.keepsVerticalPosition = keeps;
+    item.order = self.items.count;
+    [self.items addObject:item];
+}
+
+- (void)addText:(NSString *)text x:(int)x y:(int)y {
+    [self addText:text format:nil x:x y:y];
+}
+
+- (void)addText:(NSString *)text format:(NSData *)format x:(int)x y:(int)y {
+    NSData *encoded = [self.composer.textEncoder encodeString:text].data;
+    if (format.length == 0) {
+        [self addItem:encoded x:x y:y keepsVerticalPosition:YES];
+        return;
+    }
+    NSMutableData *command = [NSMutableData dataWithData:format];
+    [command appendData:encoded];
+    [command appendData:POSPageFormatReset()];
+    [self addItem:command x:x y:y keepsVerticalPosition:YES];
+}
+
+- (void)addBarcodeWithM:(int)m content:(NSString *)content x:(int)x y:(int)y {
+    [self addItem:[POSCommand printBarcodeWithM:m andContent:content useEnCodeing:NSASCIIStringEncoding] x:x y:y keepsVerticalPosition:NO];
+}
+
+- (void)addBitmap:(PrinterBitmap *)bitmap x:(int)x y:(int)y {
+    [self addItem:[bitmap rasterCommandWithMode:RasterNolmorWH] x:x y:y keepsVerticalPosition:NO];
+}
+
+- (void)addCommand:(NSData *)command x:(int)x y:(int)y {
+    [self addItem:command x:x y:y keepsVerticalPosition:NO];
+}
+
+@end
+
+@implementation POSPageComposer {
+    NSMutableArray<POSPageRegion *> *_regions;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _textEncoder = [PrinterTextEncoder encoderWithStringEncoding:CFStringConvertEncodingToNSStringEncoding(kCFStringEncodingGB_18030_2000)];
+        _regions = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (NSArray<POSPageRegion *> *)regions {
+    return [_regions copy];
+}
+
+- (POSPageRegion *)addRegionWithX:(int)x y:(int)y width:(int)width height:(int)height direction:(POSPageDirection)direction {
+    POSPageRegion *region = [[POSPageRegion alloc] initWithX:x y:y width:width height:height direction:direction];
+    region.composer = self;
+    [_regions addObject:region];
+    return region;
+}
+
+- (void)removeAllRegions {
+    [_regions removeAllObjects];
+}
+
+- (NSData *)pageData {
+    NSMutableData *data = [NSMutableData data];
+    [data appendData:[POSCommand selectPagemode]];
+
+    // ESC T persists from earlier pages, so the first region always sends its direction;
+    // direction and area are only resent when they differ from the previous region
+    POSPageDirection direction = POSPageDirectionLeftToRight;
+    BOOL hasDirection = NO;
+    BOOL hasArea = NO;
+    int areaX = 0, areaY = 0, areaWidth = 0, areaHeight = 0;
+
+    for (POSPageRegion *region in _regions) {
+        if (region.items.count == 0) {
+            continue;
+        }
+        if (!hasDirection || region.direction != direction) {
+            [data appendData:[POSCommand selectPrintDirectionUnderPageMode:(int)region.direction]];
+            direction = region.direction;
+            hasDirection = YES;
+        }
+        if (!hasArea || areaX != region.x || areaY != region.y || areaWidth != region.width || areaHeight != region.height) {
+            [data appendData:[POSCommand setPrintAreaUnderPageModelWithxL:region.x & 0xFF
+                                                                    andxH:(region.x >> 8) & 0xFF
+                                                                    andyL:region.y & 0xFF
+                                                                    andyH:(region.y >> 8) & 0xFF
+                                                                   anddxL:region.width & 0xFF
+                                                                   anddxH:(region.width >> 8) & 0xFF
+                                                                   anddyL:region.height & 0xFF
+                                                                   anddyH:(region.height >> 8) & 0xFF]];
+            hasArea = YES;
+            areaX = region.x;
+            areaY = region.y;
+            areaWidth = region.width;
+            areaHeight = region.height;
+        }
+
+        // Top to bottom, left to right, so consecutive items on one baseline share the vertical position
+        NSArray<POSPageItem *> *items = [region.items sortedArrayUsingComparator:^NSComparisonResult(POSPageItem *a, POSPageItem *b) {
+            if (a.y != b.y) {
+                return a.y < b.y ? NSOrderedAscending : NSOrderedDescending;
+            }
+            if (a.x != b.x) {
+                return a.x < b.x ? NSOrderedAscending : NSOrderedDescending;
+            }
+            return a.order < b.order ? NSOrderedAscending : NSOrderedDescending;
+        }];
+        BOOL knowsY = NO;
+        int currentY = 0;
+        for (POSPageItem *item in items) {
+            if (!knowsY || currentY != item.y) {
+                [data appendData:[POSCommand setAbsolutePositionUnderPageModelWithnL:item.y & 0xFF andnH:(item.y >> 8) & 0xFF]];
+                currentY = item.y;
+                knowsY = YES;
+            }
+            [data appendData:[POSCommand setAbsolutePrintPositionWithNL:item.x & 0xFF andNH:(item.x >> 8) & 0xFF]];
+            [data appendData:item.command];
+            knowsY = item.keepsVerticalPosition;
+        }
+    }
+
+    [data appendData:[POSCommand printUnderPageModel]];
+    [data appendData:[POSCommand selectStabdardMode]];
+    return data;
+}
+
+@end
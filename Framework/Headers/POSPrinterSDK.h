@@ -10,5 +10,26 @@
 #import "POSBLEManager.h"
 #import "POSWIFIManager.h"
 #import "POSCommand.h"
+#import "BarcodeValidator.h"
+#import "PrinterSymbolRenderer.h"
+#import "PrinterImagePreprocessor.h"
+#import "PrinterTextEncoder.h"
+#import "PrinterSpool.h"
+#import "PrinterResumableTransfer.h"
+#import "PrinterPacketizer.h"
+#import "PrinterBLESessionManager.h"
+#import "PrinterTransport.h"
+#import "PrinterSocketTransport.h"
+#import "PrinterTransportAdapters.h"
+#import "PrinterGateway.h"
+#import "PrinterSendBatcher.h"
+#import "POSMixedTextRenderer.h"
+#import "PTableLayout.h"
+#import "POSPageComposer.h"
+#import "POSStreamOptimizer.h"
+#import "POSMacroOptimizer.h"
+#import "PrinterDiscoveryService.h"
+#import "PrinterAddressResolver.h"
+#import "PrinterProvisioner.h"
 
 #endif
@@ -0,0 +1,46 @@
+//
+//  POSStreamOptimizer.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "PrinterResumableTransfer.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Removes redundant mode-setting commands from an ESC/POS stream while printing the same output.
+///
+/// The optimizer follows the printer state set by ESC E (bold), ESC a (alignment), GS ! (character
+/// size), ESC M (font), ESC 2/ESC 3 (line spacing) and ESC - (underline), also through ESC ! and
+/// ESC @. A setting is sent just before something that prints or feeds, and only if it changes
+/// the state, so settings that repeat the current value or are overwritten before use disappear
+/// and text runs with the same attributes end up adjacent. Consecutive ESC d and ESC J feeds are
+/// merged, repeated ESC @ is sent once, and settings still pending at the end are kept since they
+/// carry over to the next job.
+///
+/// Other commands pass through unchanged. When a command is not recognized, the state is treated
+/// as unknown; in raw data the rest of the stream is copied as it is, in a job the optimizer
+/// continues at the next command boundary.
+@interface POSStreamOptimizer : NSObject
+
+/// Whether the printer is assumed to be in its ESC @ state when the stream starts (default: NO).
+/// Only enable it when every job starts on a freshly initialized printer.
+@property (nonatomic, assign) BOOL assumesInitializedPrinter;
+
+/// Bytes removed by the last optimization
+@property (nonatomic, readonly) NSUInteger lastBytesSaved;
+
+/// Offset of the first unrecognized command of the last optimization, NSNotFound if there was none
+@property (nonatomic, readonly) NSUInteger lastUnrecognizedOffset;
+
+/// Optimizes raw ESC/POS data
+/// @param data The stream
+- (NSData *)optimizeData:(NSData *)data;
+
+/// Optimizes a job built command by command
+/// @param job The job
+- (PrinterJobBuffer *)optimizeJob:(PrinterJobBuffer *)job;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,411 @@
+//
+//  POSStreamOptimizer.m
+//  Printer
+//
+
+#import "POSStreamOptimizer.h"
+
+/// Printer settings the optimizer follows
+typedef NS_ENUM(NSInteger, POSStreamSetting) {
+    POSStreamSettingBold = 0,
+    POSStreamSettingAlignment,
+    POSStreamSettingSize,
+    POSStreamSettingFont,
+    POSStreamSettingLineSpacing,
+    POSStreamSettingUnderline,
+    POSStreamSettingCount
+};
+
+/// Value of a setting the printer may hold anything for
+static const NSInteger POSStreamUnknown = NSIntegerMin;
+
+/// Line spacing selected by ESC 2
+static const NSInteger POSStreamDefaultSpacing = -1;
+
+/// What a parsed command does to the state
+typedef NS_ENUM(NSInteger, POSStreamCommandKind) {
+    POSStreamCommandOther = 0,  ///< Prints, feeds or changes state the optimizer does not follow
+    POSStreamCommandText,       ///< Characters and single-byte controls such as LF
+    POSStreamCommandSetting,    ///< Changes one followed setting
+    POSStreamCommandReset,      ///< ESC @
+    POSStreamCommandPrintMode,  ///< ESC !
+    POSStreamCommandFeedLines,  ///< ESC d n
+    POSStreamCommandFeedDots,   ///< ESC J n
+    POSStreamCommandPageMode    ///< ESC L / ESC S, settings apply per mode
+};
+
+static BOOL POSStreamIsPrefix(uint8_t byte) {
+    return byte == 0x10 || byte == 0x1B || byte == 0x1C || byte == 0x1D;
+}
+
+static NSUInteger POSStreamTerminated(const uint8_t *bytes, NSUInteger available, NSUInteger start, NSUInteger limit) {
+    for (NSUInteger i = start; i < available && i < start + limit; i++) {
+        if (bytes[i] == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/// Length of the command at bytes, 0 when it is unknown or incomplete
+static NSUInteger POSStreamCommandLength(const uint8_t *bytes, NSUInteger available) {
+    if (!POSStreamIsPrefix(bytes[0])) {
+        NSUInteger i = 1;
+        while (i < available && !POSStreamIsPrefix(bytes[i])) {
+            i++;
+        }
+        return i;
+    }
+    if (available < 2) {
+        return 0;
+    }
+    NSUInteger length = 0;
+    uint8_t x = bytes[1];
+    switch (bytes[0]) {
+        case 0x10: // DLE
+            length = (x == 0x04 || x == 0x05) ? 3 : (x == 0x14 ? 5 : 0);
+            break;
+        case 0x1B: // ESC
+            switch (x) {
+                case '@': case '2': case '<': case 'L': case 'S': case 'i': case 'm': case 0x0C:
+                    length = 2;
+                    break;
+                case 'E': case 'a': case 'M': case '3': case '-': case '!': case 'd': case 'J': case 'G':
+                case 'V': case '{': case ' ': case 't': case 'R': case 'T': case '%': case '?': case 'U':
+                case 'r': case 'e':
+                    length = 3;
+                    break;
+                case 'c': case '$': case '\\':
+                    length = 4;
+                    break;
+                case 'p':
+                    length = 5;
+                    break;
+                case 'W':
+                    length = 10;
+                    break;
+                case '*':
+                    if (available >= 5) {
+                        NSUInteger columns = bytes[3] | (bytes[4] << 8);
+                        length = 5 + columns * ((bytes[2] == 32 || bytes[2] == 33) ? 3 : 1);
+                    }
+                    break;
+                case 'D':
+                    length = POSStreamTerminated(bytes, available, 2, 33);
+                    break;
+            }
+            break;
+        case 0x1C: // FS
+            switch (x) {
+                case '&': case '.':
+                    length = 2;
+                    break;
+                case '!': case '-': case 'W': case 'C':
+                    length = 3;
+                    break;
+                case 'S': case 'p':
+                    length = 4;
+                    break;
+            }
+            break;
+        case 0x1D: // GS
+            switch (x) {
+                case ':':
+                    length = 2;
+                    break;
+                case '!': case 'B': case 'H': case 'h': case 'w': case 'f': case 'a': case 'r': case 'I':
+                case 'b': case '/':
+                    length = 3;
+                    break;
+                case 'L': case 'W': case '$': case '\\': case 'P':
+                    length = 4;
+                    break;
+                case '^':
+                    length = 5;
+                    break;
+                case 'V':
+                    if (available >= 3) {
+                        uint8_t m = bytes[2];
+                        if (m == 0 || m == 1 || m == 48 || m == 49) {
+                            length = 3;
+                        } else if (m == 65 || m == 66 || m == 97 || m == 98 || m == 103 || m == 104) {
+                            length = 4;
+                        }
+                    }
+                    break;
+                case 'k':
+                    if (available >= 4) {
+                        uint8_t m = bytes[2];
+                        if (m <= 6) {
+                            length = POSStreamTerminated(bytes, available, 3, 256);
+                        } else if (m >= 65 && m <= 79) {
+                            length = 4 + bytes[3];
+                        }
+                    }
+                    break;
+                case 'v':
+                    if (available >= 8 && bytes[2] == '0') {
+                        NSUInteger width = bytes[4] | (bytes[5] << 8);
+                        NSUInteger height = bytes[6] | (bytes[7] << 8);
+                        length = 8 + width * height;
+                    }
+                    break;
+                case '(':
+                    if (available >= 5) {
+                        length = 5 + (bytes[3] | (bytes[4] << 8));
+                    }
+                    break;
+                case '8':
+                    if (available >= 7 && bytes[2] == 'L') {
+                        length = 7 + ((NSUInteger)bytes[3] | ((NSUInteger)bytes[4] << 8) | ((NSUInteger)bytes[5] << 16) | ((NSUInteger)bytes[6] << 24));
+                    }
+                    break;
+                case '*':
+                    if (available >= 4) {
+                        length = 4 + bytes[2] * bytes[3] * 8;
+                    }
+                    break;
+            }
+            break;
+    }
+    return length <= available ? length : 0;
+}
+
+/// Maps the 0/48, 1/49, 2/50 parameter forms to 0, 1, 2
+static NSInteger POSStreamDigit(uint8_t n) {
+    return (n >= 48 && n <= 50) ? n - 48 : n;
+}
+
+/// Classifies a recognized command; for settings, also returns which one and its value
+static POSStreamCommandKind POSStreamClassify(const uint8_t *bytes, NSUInteger length, POSStreamSetting *setting, NSInteger *value) {
+    if (!POSStreamIsPrefix(bytes[0])) {
+        return POSStreamCommandText;
+    }
+    uint8_t x = bytes[1];
+    if (bytes[0] == 0x1B) {
+        switch (x) {
+            case '@': return POSStreamCommandReset;
+            case '!': return POSStreamCommandPrintMode;
+            case 'd': return POSStreamCommandFeedLines;
+            case 'J': return POSStreamCommandFeedDots;
+            case 'L': case 'S': return POSStreamCommandPageMode;
+            case 'E': *setting = POSStreamSettingBold; *value = bytes[2] & 1; return POSStreamCommandSetting;
+            case 'a': *setting = POSStreamSettingAlignment; *value = POSStreamDigit(bytes[2]); return POSStreamCommandSetting;
+            case 'M': *setting = POSStreamSettingFont; *value = POSStreamDigit(bytes[2]); return POSStreamCommandSetting;
+            case '-': *setting = POSStreamSettingUnderline; *value = POSStreamDigit(bytes[2]); return POSStreamCommandSetting;
+            case '2': *setting = POSStreamSettingLineSpacing; *value = POSStreamDefaultSpacing; return POSStreamCommandSetting;
+            case '3': *setting = POSStreamSettingLineSpacing; *value = bytes[2]; return POSStreamCommandSetting;
+        }
+    } else if (bytes[0] == 0x1D && x == '!') {
+        *setting = POSStreamSettingSize;
+        *value = bytes[2];
+        return POSStreamCommandSetting;
+    }
+    return POSStreamCommandOther;
+}
+
+@implementation POSStreamOptimizer {
+    NSMutableData *_output;
+    NSMutableIndexSet *_boundaries;
+    /// What the printer holds after the output so far
+    NSInteger _state[POSStreamSettingCount];
+    /// Latest setting commands not sent yet, nil where none is pending
+    NSData *_pending[POSStreamSettingCount];
+    NSInteger _pendingValue[POSStreamSettingCount];
+    BOOL _atLineStart;
+    /// End of the last ESC @ / ESC d / ESC J in the output, to recognize them as the last command
+    NSUInteger _resetEnd;
+    NSUInteger _feedEnd;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _lastUnrecognizedOffset = NSNotFound;
+    }
+    return self;
+}
+
+#pragma mark - State
+
+- (void)setAllSettings:(NSInteger)value {
+    for (NSInteger i = 0; i < POSStreamSettingCount; i++) {
+        _state[i] = value;
+    }
+}
+
+- (void)setDefaultSettings {
+    [self setAllSettings:0];
+    _state[POSStreamSettingLineSpacing] = POSStreamDefaultSpacing;
+}
+
+- (void)clearPending {
+    for (NSInteger i = 0; i < POSStreamSettingCount; i++) {
+        _pending[i] = nil;
+    }
+}
+
+- (void)emitBytes:(const uint8_t *)bytes length:(NSUInteger)length {
+    if (length == 0) {
+        return;
+    }
+    [_boundaries addIndex:_output.length];
+    [_output appendBytes:bytes length:length];
+}
+
+/// Sends the pending settings that change the state; called before anything that prints or feeds
+- (void)flushPending {
+    for (NSInteger i = 0; i < POSStreamSettingCount; i++) {
+        NSData *command = _pending[i];
+        if (command == nil) {
+            continue;
+        }
+        _pending[i] = nil;
+        if (_pendingValue[i] == _state[i]) {
+            continue;
+        }
+        [self emitBytes:command.bytes length:command.length];
+        // ESC a is ignored unless it starts a line
+        _state[i] = (i == POSStreamSettingAlignment && !_atLineStart) ? POSStreamUnknown : _pendingValue[i];
+    }
+}
+
+#pragma mark - Optimizing
+
+- (void)beginOptimizing:(NSUInteger)capacity {
+    _output = [NSMutableData dataWithCapacity:capacity];
+    _boundaries = [NSMutableIndexSet indexSet];
+    [self clearPending];
+    if (self.assumesInitializedPrinter) {
+        [self setDefaultSettings];
+    } else {
+        [self setAllSettings:POSStreamUnknown];
+    }
+    _atLineStart = self.assumesInitializedPrinter;
+    _resetEnd = NSNotFound;
+    _feedEnd = NSNotFound;
+    _lastUnrecognizedOffset = NSNotFound;
+}
+
+/// Handles one recognized command
+- (void)processBytes:(const uint8_t *)bytes length:(NSUInteger)length {
+    POSStreamSetting setting = POSStreamSettingBold;
+    NSInteger value = 0;
+    POSStreamCommandKind kind = POSStreamClassify(bytes, length, &setting, &value);
+    switch (kind) {
+        case POSStreamCommandSetting:
+            _pending[setting] = [NSData dataWithBytes:bytes length:length];
+            _pendingValue[setting] = value;
+            return;
+        case POSStreamCommandReset:
+            // Settings made just before ESC @ never take effect
+            [self clearPending];
+            if (_resetEnd != _output.length) {
+                [self emitBytes:bytes length:length];
+                _resetEnd = _output.length;
+            }
+            [self setDefaultSettings];
+            _atLineStart = YES;
+            return;
+        case POSStreamCommandFeedLines:
+        case POSStreamCommandFeedDots: {
+            [self flushPending];
+            uint8_t *output = _output.mutableBytes;
+            // The first feed emptied the print buffer, so the second only adds to the distance
+            if (_feedEnd == _output.length && output[_feedEnd - 2] == bytes[1] && output[_feedEnd - 1] + bytes[2] <= 255) {
+                output[_feedEnd - 1] += bytes[2];
+            } else {
+                [self emitBytes:bytes length:length];
+                _feedEnd = _output.length;
+            }
+            _atLineStart = YES;
+            return;
+        }
+        case POSStreamCommandPrintMode: {
+            [self flushPending];
+            [self emitBytes:bytes length:length];
+            uint8_t n = bytes[2];
+            _state[POSStreamSettingFont] = n & 0x01;
+            _state[POSStreamSettingBold] = (n >> 3) & 0x01;
+            _state[POSStreamSettingSize] = ((n & 0x20) ? 0x10 : 0) | ((n & 0x10) ? 0x01 : 0);
+            // ESC ! turns underline on without choosing its thickness
+            _state[POSStreamSettingUnderline] = (n & 0x80) ? POSStreamUnknown : 0;
+            return;
+        }
+        case POSStreamCommandPageMode:
+            [self flushPending];
+            [self emitBytes:bytes length:length];
+            [self setAllSettings:POSStreamUnknown];
+            _atLineStart = YES;
+            return;
+        case POSStreamCommandText:
+            [self flushPending];
+            [self emitBytes:bytes length:length];
+            _atLineStart = bytes[length - 1] == 0x0A || bytes[length - 1] == 0x0C;
+            return;
+        case POSStreamCommandOther:
+            [self flushPending];
+            [self emitBytes:bytes length:length];
+            // A cut (GS V) leaves the paper at the start of a line
+            _atLineStart = bytes[0] == 0x1D && bytes[1] == 'V';
+            return;
+    }
+}
+
+/// Optimizes the bytes, resuming after an unrecognized command at the next boundary if there is one
+- (void)processData:(NSData *)data boundaries:(NSIndexSet *)boundaries {
+    const uint8_t *bytes = data.bytes;
+    NSUInteger offset = 0;
+    while (offset < data.length) {
+        NSUInteger length = POSStreamCommandLength(bytes + offset, data.length - offset);
+        if (length > 0) {
+            [self processBytes:bytes + offset length:length];
+            offset += length;
+            continue;
+        }
+        if (_lastUnrecognizedOffset == NSNotFound) {
+            _lastUnrecognizedOffset = offset;
+        }
+        NSUInteger next = [boundaries indexGreaterThanIndex:offset];
+        NSUInteger end = next == NSNotFound ? data.length : MIN(next, data.length);
+        [self flushPending];
+        [self emitBytes:bytes + offset length:end - offset];
+        [self setAllSettings:POSStreamUnknown];
+        _atLineStart = NO;
+        offset = end;
+    }
+    // Whatever is still pending carries over to the next job
+    [self flushPending];
+    _lastBytesSaved = data.length - _output.length;
+}
+
+- (NSData *)optimizeData:(NSData *)data {
+    [self beginOptimizing:data.length];
+    [self processData:data boundaries:nil];
+    NSData *output = [_output copy];
+    _output = nil;
+    _boundaries = nil;
+    return output;
+}
+
+- (PrinterJobBuffer *)optimizeJob:(PrinterJobBuffer *)job {
+    [self beginOptimizing:job.data.length];
+    [self processData:job.data boundaries:job.commandBoundaries];
+    PrinterJobBuffer *optimized = [[PrinterJobBuffer alloc] init];
+    NSData *output = _output;
+    __block NSUInteger start = 0;
+    [_boundaries enumerateIndexesUsingBlock:^(NSUInteger boundary, BOOL *stop) {
+        if (boundary > start) {
+            [optimized appendCommand:[output subdataWithRange:NSMakeRange(start, boundary - start)]];
+            start = boundary;
+        }
+    }];
+    if (output.length > start) {
+        [optimized appendCommand:[output subdataWithRange:NSMakeRange(start, output.length - start)]];
+    }
+    _output = nil;
+    _boundaries = nil;
+    return optimized;
+}
+
+@end
@@ -0,0 +1,60 @@
+//
+//  PTableLayout.h
+//  PrinterSDK
+//
+
+#import <Foundation/Foundation.h>
+#import "PTable.h"
+#import "PrinterTextEncoder.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Lays out text tables for receipts in one pass.
+/// Widths are counted in half-width cells: East Asian wide and fullwidth characters take two cells,
+/// combining marks none. Wrapped and padded cells are cached, so repeated cell texts are laid out once.
+@interface PTableLayout : NSObject
+
+/// Width of every column in half-width cells
+@property (nonatomic, copy, readonly) NSArray<NSNumber *> *columnWidths;
+
+/// Alignment of the columns
+@property (nonatomic, assign, readonly) TableAlignType align;
+
+/// Encoder for the printer's character set (default: GB18030)
+@property (nonatomic, strong) PrinterTextEncoder *textEncoder;
+
+/// Bytes ending every printed line (default: LF)
+@property (nonatomic, copy) NSData *lineTerminator;
+
+/// Treat East Asian ambiguous characters (e.g. Greek, Cyrillic, box drawing) as wide (default: NO)
+@property (nonatomic, assign) BOOL ambiguousIsWide;
+
+/// Maximum number of cached cell layouts (default: 1024)
+@property (nonatomic, assign) NSUInteger cacheCapacity;
+
+/// Creates a table layout
+/// @param widths Width of every column in half-width cells, e.g. @[@16, @8, @8] for a 32-cell line
+/// @param align Alignment of the columns
+- (instancetype)initWithColumnWidths:(NSArray<NSNumber *> *)widths align:(TableAlignType)align;
+
+/// Lays out a whole table into one buffer. Cells longer than their column wrap onto extra lines.
+/// @param rows The rows, each with one string per column; missing cells are left blank
+/// @return Data representing the table
+- (NSData *)tableDataWithRows:(NSArray<NSArray<NSString *> *> *)rows;
+
+/// Appends one row to a buffer
+/// @param row One string per column
+/// @param data The buffer to append to
+- (void)appendRow:(NSArray<NSString *> *)row toData:(NSMutableData *)data;
+
+/// Removes all cached cell layouts
+- (void)removeAllCachedCells;
+
+/// Number of half-width cells a string occupies
+/// @param string The text to measure
+/// @param ambiguousIsWide Whether East Asian ambiguous characters count as wide
++ (NSUInteger)displayWidthOfString:(NSString *)string ambiguousIsWide:(BOOL)ambiguousIsWide;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,305 @@
+//
+//  PTableLayout.m
+//  PrinterSDK
+//
+
+#import "PTableLayout.h"
+
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} PTableRange;
+
+/// Wide (W) and fullwidth (F) ranges of Unicode EastAsianWidth.txt
+static const PTableRange PTableWideRanges[] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0},
+    {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F},
+    {0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5},
+    {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728},
+    {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+    {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55},
+    {0x2E80, 0x303E}, {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+    {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F},
+    {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4}, {0x17000, 0x18CFF}, {0x1B000, 0x1B2FF},
+    {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F202},
+    {0x1F210, 0x1F23B}, {0x1F240, 0x1F248}, {0x1F250, 0x1F251}, {0x1F260, 0x1F265}, {0x1F300, 0x1F320},
+    {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C}, {0x1F37E, 0x1F393}, {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3},
+    {0x1F3E0, 0x1F3F0}, {0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F43E}, {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC},
+    {0x1F4FF, 0x1F53D}, {0x1F54B, 0x1F54E}, {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A}, {0x1F595, 0x1F596},
+    {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F}, {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2},
+    {0x1F6D5, 0x1F6D7}, {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC}, {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F93A},
+    {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
+
+/// Common ambiguous (A) ranges: Latin-1 symbols, Greek, Cyrillic, punctuation, box drawing, private use
+static const PTableRange PTableAmbiguousRanges[] = {
+    {0x00A1, 0x00A1}, {0x00A4, 0x00A4}, {0x00A7, 0x00A8}, {0x00AA, 0x00AA}, {0x00AD, 0x00AE},
+    {0x00B0, 0x00B4}, {0x00B6, 0x00BA}, {0x00BC, 0x00BF}, {0x00C6, 0x00C6}, {0x00D0, 0x00D0},
+    {0x00D7, 0x00D8}, {0x00DE, 0x00E1}, {0x00E6, 0x00E6}, {0x00E8, 0x00EA}, {0x00EC, 0x00ED},
+    {0x00F0, 0x00F0}, {0x00F2, 0x00F3}, {0x00F7, 0x00FA}, {0x00FC, 0x00FC}, {0x00FE, 0x00FE},
+    {0x0391, 0x03A9}, {0x03B1, 0x03C9}, {0x0401, 0x0401}, {0x0410, 0x044F}, {0x0451, 0x0451},
+    {0x2010, 0x2010}, {0x2013, 0x2016}, {0x2018, 0x2019}, {0x201C, 0x201D}, {0x2020, 0x2022},
+    {0x2024, 0x2027}, {0x2030, 0x2030}, {0x2032, 0x2033}, {0x2035, 0x2035}, {0x203B, 0x203B},
+    {0x203E, 0x203E}, {0x2103, 0x2103}, {0x2116, 0x2116}, {0x2121, 0x2122}, {0x2160, 0x216B},
+    {0x2170, 0x2179}, {0x2190, 0x2199}, {0x2460, 0x24E9}, {0x2500, 0x254B}, {0x2550, 0x2573},
+    {0x2580, 0x258F}, {0x2592, 0x2595}, {0x25A0, 0x25A1}, {0x25B2, 0x25B3}, {0x25C6, 0x25C8},
+    {0x25CB, 0x25CB}, {0x25CE, 0x25D1}, {0x2605, 0x2606}, {0x2640, 0x2640}, {0x2642, 0x2642},
+    {0xE000, 0xF8FF}, {0xFFFD, 0xFFFD},
+};
+
+/// Zero-width ranges: combining marks, joiners and variation selectors
+static const PTableRange PTableZeroRanges[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A}, {0x064B, 0x065F},
+    {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF},
+    {0x200B, 0x200F}, {0x2028, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0x302A, 0x302D},
+    {0x3099, 0x309A}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0xE0100, 0xE01EF},
+};
+
+/// Width classes stored in the BMP table
+enum {
+    PTableWidthZero = 0,
+    PTableWidthNarrow = 1,
+    PTableWidthWide = 2,
+    PTableWidthAmbiguous = 3,
+};
+
+static BOOL PTableRangesContain(const PTableRange *ranges, size_t count, uint32_t c) {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (c < ranges[mid].first) {
+            high = mid;
+        } else if (c > ranges[mid].last) {
+            low = mid + 1;
+        } else {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+#define PTABLE_COUNT(ranges) (sizeof(ranges) / sizeof(ranges[0]))
+
+static uint8_t PTableWidthClass(uint32_t c) {
+    if (c < 0x20 || (c >= 0x7F && c < 0xA0)) {
+        return PTableWidthZero;
+    }
+    if (PTableRangesContain(PTableZeroRanges, PTABLE_COUNT(PTableZeroRanges), c)) {
+        return PTableWidthZero;
+    }
+    if (PTableRangesContain(PTableWideRanges, PTABLE_COUNT(PTableWideRanges), c)) {
+        return PTableWidthWide;
+    }
+    if (PTableRangesContain(PTableAmbiguousRanges, PTABLE_COUNT(PTableAmbiguousRanges), c)) {
+        return PTableWidthAmbiguous;
+    }
+    return PTableWidthNarrow;
+}
+
+/// Width classes of the whole BMP, built once so the common case is a single load
+static const uint8_t *PTableBMPWidths(void) {
+    static uint8_t *widths = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        widths = malloc(0x10000);
+        for (uint32_t c = 0; c < 0x10000; c++) {
+            widths[c] = PTableWidthClass(c);
+        }
+    });
+    return widths;
+}
+
+static inline int PTableCharacterWidth(const uint8_t *bmp, uint32_t c, BOOL ambiguousIsWide) {
+    if (c >= 0x20 && c < 0x7F) {
+        return 1;
+    }
+    uint8_t cls = c < 0x10000 ? bmp[c] : PTableWidthClass(c);
+    if (cls == PTableWidthAmbiguous) {
+        return ambiguousIsWide ? 2 : 1;
+    }
+    return cls;
+}
+
+/// Reads the code point at index and advances index past it
+static inline uint32_t PTableNextCodePoint(const UniChar *units, NSUInteger length, NSUInteger *index) {
+    UniChar c = units[*index];
+    *index += 1;
+    if (CFStringIsSurrogateHighCharacter(c) && *index < length && CFStringIsSurrogateLowCharacter(units[*index])) {
+        UniChar low = units[*index];
+        *index += 1;
+        return CFStringGetLongCharacterForSurrogatePair(c, low);
+    }
+    return c;
+}
+
+/// Gives access to the UTF-16 units of a string without copying when possible
+typedef struct {
+    const UniChar *units;
+    UniChar *buffer;
+    NSUInteger length;
+} PTableUnits;
+
+static PTableUnits PTableUnitsOfString(NSString *string) {
+    PTableUnits result = {NULL, NULL, string.length};
+    result.units = CFStringGetCharactersPtr((__bridge CFStringRef)string);
+    if (result.units == NULL && result.length > 0) {
+        result.buffer = malloc(result.length * sizeof(UniChar));
+        [string getCharacters:result.buffer range:NSMakeRange(0, result.length)];
+        result.units = result.buffer;
+    }
+    return result;
+}
+
+@implementation PTableLayout {
+    NSCache<NSString *, NSArray<NSData *> *> *_cells;
+    NSData *_spaces;
+}
+
+- (instancetype)initWithColumnWidths:(NSArray<NSNumber *> *)widths align:(TableAlignType)align {
+    self = [super init];
+    if (self) {
+        _columnWidths = [widths copy];
+        _align = align;
+        _textEncoder = [PrinterTextEncoder encoderWithStringEncoding:CFStringConvertEncodingToNSStringEncoding(kCFStringEncodingGB_18030_2000)];
+        _lineTerminator = [NSData dataWithBytes:"\n" length:1];
+        _cells = [[NSCache alloc] init];
+        self.cacheCapacity = 1024;
+
+        NSUInteger widest = 0;
+        for (NSNumber *width in widths) {
+            widest = MAX(widest, width.unsignedIntegerValue);
+        }
+        NSMutableData *spaces = [NSMutableData dataWithLength:widest];
+        memset(spaces.mutableBytes, ' ', widest);
+        _spaces = spaces;
+    }
+    return self;
+}
+
+- (void)setCacheCapacity:(NSUInteger)cacheCapacity {
+    _cacheCapacity = cacheCapacity;
+    _cells.countLimit = cacheCapacity;
+}
+
+- (void)setTextEncoder:(PrinterTextEncoder *)textEncoder {
+    _textEncoder = textEncoder;
+    [_cells removeAllObjects];
+}
+
+- (void)setAmbiguousIsWide:(BOOL)ambiguousIsWide {
+    _ambiguousIsWide = ambiguousIsWide;
+    [_cells removeAllObjects];
+}
+
+- (void)removeAllCachedCells {
+    [_cells removeAllObjects];
+}
+
++ (NSUInteger)displayWidthOfString:(NSString *)string ambiguousIsWide:(BOOL)ambiguousIsWide {
+    const uint8_t *bmp = PTableBMPWidths();
+    PTableUnits units = PTableUnitsOfString(string);
+    NSUInteger width = 0;
+    NSUInteger index = 0;
+    while (index < units.length) {
+        width += (NSUInteger)PTableCharacterWidth(bmp, PTableNextCodePoint(units.units, units.length, &index), ambiguousIsWide);
+    }
+    free(units.buffer);
+    return width;
+}
+
+- (BOOL)isRightAlignedColumn:(NSUInteger)column {
+    switch (self.align) {
+        case ALL_LEFT_ALIGN:   return NO;
+        case ALL_RIGHT_ALIGN:  return YES;
+        case FIRST_LEFT_ALIGN: return column > 0;
+    }
+    return NO;
+}
+
+/// Wraps a cell to its column and pads every line to the full width
+- (NSArray<NSData *> *)linesForCell:(NSString *)text width:(NSUInteger)width rightAligned:(BOOL)right {
+    NSString *key = [NSString stringWithFormat:@"%lu|%d|%@", (unsigned long)width, right, text];
+    NSArray<NSData *> *cached = [_cells objectForKey:key];
+    if (cached) {
+        return cached;
+    }
+
+    const uint8_t *bmp = PTableBMPWidths();
+    PTableUnits units = PTableUnitsOfString(text);
+    NSMutableArray<NSData *> *lines = [NSMutableArray array];
+    NSUInteger start = 0, index = 0, used = 0;
+    BOOL ambiguousIsWide = self.ambiguousIsWide;
+
+    void (^emit)(NSUInteger, NSUInteger, NSUInteger) = ^(NSUInteger from, NSUInteger to, NSUInteger lineWidth) {
+        NSString *segment = [text substringWithRange:NSMakeRange(from, to - from)];
+        NSData *encoded = [self.textEncoder encodeString:segment].data;
+        NSUInteger padding = lineWidth < width ? width - lineWidth : 0;
+        NSMutableData *line = [NSMutableData dataWithCapacity:encoded.length + padding];
+        if (right) {
+            [line appendBytes:self->_spaces.bytes length:padding];
+        }
+        [line appendData:encoded];
+        if (!right) {
+            [line appendBytes:self->_spaces.bytes length:padding];
+        }
+        [lines addObject:line];
+    };
+
+    while (index < units.length) {
+        NSUInteger next = index;
+        int cw = PTableCharacterWidth(bmp, PTableNextCodePoint(units.units, units.length, &next), ambiguousIsWide);
+        // A character wider than the column still takes a line of its own
+        if (used + (NSUInteger)cw > width && used > 0) {
+            emit(start, index, used);
+            start = index;
+            used = 0;
+        }
+        used += (NSUInteger)cw;
+        index = next;
+    }
+    if (used > 0 || lines.count == 0) {
+        emit(start, index, used);
+    }
+    free(units.buffer);
+
+    [_cells setObject:lines forKey:key];
+    return lines;
+}
+
+- (void)appendRow:(NSArray<NSString *> *)row toData:(NSMutableData *)data {
+    NSUInteger columns = self.columnWidths.count;
+    NSMutableArray<NSArray<NSData *> *> *cells = [NSMutableArray arrayWithCapacity:columns];
+    NSUInteger height = 1;
+    for (NSUInteger i = 0; i < columns; i++) {
+        NSString *text = i < row.count ? row[i] : @"";
+        NSArray<NSData *> *lines = [self linesForCell:text width:self.columnWidths[i].unsignedIntegerValue rightAligned:[self isRightAlignedColumn:i]];
+        [cells addObject:lines];
+        height = MAX(height, lines.count);
+    }
+    for (NSUInteger line = 0; line < height; line++) {
+        for (NSUInteger i = 0; i < columns; i++) {
+            NSArray<NSData *> *lines = cells[i];
+            if (line < lines.count) {
+                [data appendData:lines[line]];
+            } else {
+                [data appendBytes:_spaces.bytes length:self.columnWidths[i].unsignedIntegerValue];
+            }
+        }
+        [data appendData:self.lineTerminator];
+    }
+}
+
+- (NSData *)tableDataWithRows:(NSArray<NSArray<NSString *> *> *)rows {
+    NSUInteger lineWidth = 0;
+    for (NSNumber *width in self.columnWidths) {
+        lineWidth += width.unsignedIntegerValue;
+    }
+    NSMutableData *data = [NSMutableData dataWithCapacity:rows.count * (lineWidth + self.lineTerminator.length)];
+    for (NSArray<NSString *> *row in rows) {
+        [self appendRow:row toData:data];
+    }
+    return data;
+}
+
+@end
@@ -0,0 +1,113 @@
+//
+//  PrinterAddressResolver.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "PrinterDiscoveryService.h"
+#import "WIFIConnecter.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Where a candidate address came from
+typedef NS_ENUM(NSInteger, PrinterResolveSource) {
+    PrinterResolveSourceCache = 0, ///< MAC/IP cache
+    PrinterResolveSourceDiscovery  ///< UDP discovery after the cache missed
+};
+
+/// Timing of one address attempt, for telemetry
+@interface PrinterResolveAttempt : NSObject
+
+/// The printer's MAC address
+@property (nonatomic, copy, readonly) NSString *mac;
+
+/// The address tried
+@property (nonatomic, copy, readonly) NSString *ip;
+
+/// Where the address came from
+@property (nonatomic, readonly) PrinterResolveSource source;
+
+/// Time from starting the attempt until it finished, in seconds
+@property (nonatomic, readonly) NSTimeInterval duration;
+
+/// YES if the TCP connection came up
+@property (nonatomic, readonly) BOOL success;
+
+/// YES if a discovery answer confirmed that the printer with this MAC has this address
+@property (nonatomic, readonly) BOOL identityConfirmed;
+
+/// errno of a failed attempt, ETIMEDOUT on timeout, ECANCELED if another address won first
+@property (nonatomic, readonly) int errorCode;
+
+@end
+
+/// Resolves a printer's MAC address to a reachable IP without a discovery sweep in the common case.
+/// Cached addresses within their TTL are probed with TCP connects, started staggered and running in
+/// parallel (happy eyeballs); the first address that accepts wins. Only when every cached address fails
+/// does the resolver fall back to UDP discovery.
+///
+/// A TCP accept only proves that some device listens at the address. After a DHCP lease moved, the
+/// cached IP can belong to another printer, and jobs would print there. With verifiesIdentity set, a
+/// discovery sweep runs alongside the connects, and a cached address only wins once the sweep reports
+/// the MAC at that address. If the printer does not answer discovery before discoveryTimeout, the first
+/// accepted cached address is returned with identityConfirmed NO, which leaves that risk open.
+@interface PrinterAddressResolver : NSObject
+
+/// How long a cached address stays a candidate (default: 24 hours)
+@property (nonatomic, assign) NSTimeInterval cacheTTL;
+
+/// Delay between starting two cached address attempts (default: 0.25 s)
+@property (nonatomic, assign) NSTimeInterval attemptDelay;
+
+/// Timeout of a single TCP connect attempt (default: 1.5 s)
+@property (nonatomic, assign) NSTimeInterval connectTimeout;
+
+/// Deadline of the discovery fallback (default: 3 s)
+@property (nonatomic, assign) NSTimeInterval discoveryTimeout;
+
+/// Whether cached addresses need a discovery answer for the MAC before they win (default: YES).
+/// NO trusts any TCP accept, which is faster but can connect to another printer that took over the IP.
+@property (nonatomic, assign) BOOL verifiesIdentity;
+
+/// Called on the main queue for every finished attempt
+@property (nonatomic, copy, nullable) void (^telemetryBlock)(PrinterResolveAttempt *attempt);
+
+/// Returns the shared resolver, using the shared discovery service
++ (instancetype)sharedResolver;
+
+/// Creates a resolver
+/// @param discovery The discovery service used for its cache and as the fallback
+- (instancetype)initWithDiscoveryService:(PrinterDiscoveryService *)discovery;
+
+/// Resolves a MAC address
+/// @param mac The MAC address, any case, with or without separators
+/// @param port The TCP port to probe, e.g. 9100
+/// @param completion Called on the main queue with the address, or nil if the printer was not found
+- (void)resolveMAC:(NSString *)mac port:(UInt16)port completion:(void (^)(NSString * _Nullable ip, NSArray<PrinterResolveAttempt *> *attempts))completion;
+
+/// Remembers an address that worked, e.g. after a manual connect
+/// @param ip The address
+/// @param mac The MAC address
+- (void)recordAddress:(NSString *)ip forMAC:(NSString *)mac;
+
+/// Forgets all addresses of a printer
+/// @param mac The MAC address
+- (void)invalidateMAC:(NSString *)mac;
+
+/// Resolves the MAC address and connects POSWIFIManager to it
+/// @param mac The MAC address
+/// @param port The port
+/// @param manager The manager to connect
+/// @param completion Called on the main queue with the address used, nil if resolution failed
+- (void)connectWithMac:(NSString *)mac port:(UInt16)port manager:(POSWIFIManager *)manager completion:(nullable void (^)(NSString * _Nullable ip))completion;
+
+/// Resolves the MAC address and connects a WIFIConnecter to it
+/// @param mac The MAC address
+/// @param port The port
+/// @param connecter The connecter to connect
+/// @param completion Called on the main queue with the address used, nil if resolution failed
+- (void)connectWithMac:(NSString *)mac port:(UInt16)port connecter:(WIFIConnecter *)connecter completion:(nullable void (^)(NSString * _Nullable ip))completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
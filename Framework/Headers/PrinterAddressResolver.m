@@ -0,0 +1,386 @@
+//
+//  PrinterAddressResolver.m
+//  Printer
+//
+
+#import "PrinterAddressResolver.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <netdb.h>
+#import <fcntl.h>
+#import <poll.h>
+#import <unistd.h>
+
+/// Addresses kept per printer; older ones are dropped
+static const NSUInteger PrinterResolverHistoryLength = 3;
+
+/// Polling slice of a connect attempt, so cancelled attempts stop early
+static const int PrinterResolverPollSlice = 50;
+
+@interface PrinterResolveAttempt ()
+@property (nonatomic, copy, readwrite) NSString *mac;
+@property (nonatomic, copy, readwrite) NSString *ip;
+@property (nonatomic, readwrite) PrinterResolveSource source;
+@property (nonatomic, readwrite) NSTimeInterval duration;
+@property (nonatomic, readwrite) BOOL success;
+@property (nonatomic, readwrite) BOOL identityConfirmed;
+@property (nonatomic, readwrite) int errorCode;
+@end
+
+@implementation PrinterResolveAttempt
+@end
+
+/// A remembered address
+@interface PrinterResolverEntry : NSObject
+@property (nonatomic, copy) NSString *ip;
+@property (nonatomic, strong) NSDate *date;
+@end
+
+@implementation PrinterResolverEntry
+@end
+
+/// Non-blocking TCP connect with a timeout. Returns 0 on success, otherwise an errno value.
+static int PrinterResolverConnect(NSString *ip, UInt16 port, NSTimeInterval timeout, volatile BOOL *cancelled) {
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    struct addrinfo *info = NULL;
+    NSString *service = [NSString stringWithFormat:@"%u", port];
+    if (getaddrinfo(ip.UTF8String, service.UTF8String, &hints, &info) != 0 || info == NULL) {
+        return EINVAL;
+    }
+    int fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (fd < 0) {
+        int error = errno;
+        freeaddrinfo(info);
+        return error;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    int result = 0;
+    if (connect(fd, info->ai_addr, info->ai_addrlen) != 0) {
+        result = errno;
+        if (result == EINPROGRESS) {
+            result = ETIMEDOUT;
+            int remaining = (int)(timeout * 1000);
+            while (remaining > 0) {
+                if (*cancelled) {
+                    result = ECANCELED;
+                    break;
+                }
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                int slice = MIN(remaining, PrinterResolverPollSlice);
+                int ready = poll(&pfd, 1, slice);
+                if (ready > 0) {
+                    int error = 0;
+                    socklen_t length = sizeof(error);
+                    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                    result = error;
+                    break;
+                }
+                if (ready < 0 && errno != EINTR) {
+                    result = errno;
+                    break;
+                }
+                remaining -= slice;
+            }
+        }
+    }
+    close(fd);
+    freeaddrinfo(info);
+    return result;
+}
+
+/// State shared by the parallel attempts of one resolution
+@interface PrinterResolution : NSObject
+@property (nonatomic, copy) NSString *mac;
+@property (nonatomic, strong) NSMutableArray<PrinterResolveAttempt *> *attempts;
+@property (nonatomic, assign) NSUInteger pending;
+@property (nonatomic, assign) BOOL finished;
+/// Cached addresses are provisional until the sweep confirms the MAC
+@property (nonatomic, assign) BOOL verifying;
+/// Cached addresses that accepted a connection but are not confirmed yet, in order
+@property (nonatomic, strong) NSMutableArray<NSString *> *acceptedIPs;
+/// Address the sweep reported for the MAC
+@property (nonatomic, copy) NSString *discoveredIP;
+@property (nonatomic, assign) BOOL sweepFinished;
+@property (nonatomic, copy) void (^completion)(NSString *ip, NSArray<PrinterResolveAttempt *> *attempts);
+@end
+
+@implementation PrinterResolution {
+@public
+    volatile BOOL _cancelled;
+}
+@end
+
+@implementation PrinterAddressResolver {
+    PrinterDiscoveryService *_discovery;
+    NSMutableDictionary<NSString *, NSMutableArray<PrinterResolverEntry *> *> *_entries;
+}
+
++ (instancetype)sharedResolver {
+    static PrinterAddressResolver *resolver = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        resolver = [[PrinterAddressResolver alloc] initWithDiscoveryService:[PrinterDiscoveryService sharedService]];
+    });
+    return resolver;
+}
+
+- (instancetype)initWithDiscoveryService:(PrinterDiscoveryService *)discovery {
+    self = [super init];
+    if (self) {
+        _discovery = discovery;
+        _cacheTTL = 24 * 3600;
+        _attemptDelay = 0.25;
+        _connectTimeout = 1.5;
+        _discoveryTimeout = 3;
+        _verifiesIdentity = YES;
+        _entries = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+#pragma mark - Cache
+
+- (void)recordAddress:(NSString *)ip forMAC:(NSString *)mac {
+    NSString *key = [PrinterDiscoveryService normalizedMAC:mac];
+    @synchronized (self) {
+        NSMutableArray<PrinterResolverEntry *> *entries = _entries[key] ?: [NSMutableArray array];
+        for (PrinterResolverEntry *entry in [entries copy]) {
+            if ([entry.ip isEqualToString:ip]) {
+                [entries removeObject:entry];
+            }
+        }
+        PrinterResolverEntry *entry = [[PrinterResolverEntry alloc] init];
+        entry.ip = ip;
+        entry.date = [NSDate date];
+        [entries insertObject:entry atIndex:0];
+        while (entries.count > PrinterResolverHistoryLength) {
+            [entries removeLastObject];
+        }
+        _entries[key] = entries;
+    }
+}
+
+- (void)invalidateMAC:(NSString *)mac {
+    @synchronized (self) {
+        [_entries removeObjectForKey:[PrinterDiscoveryService normalizedMAC:mac]];
+    }
+}
+
+/// Forgets one address of a printer, e.g. after discovery showed it belongs to another device
+- (void)forgetAddress:(NSString *)ip forMAC:(NSString *)key {
+    @synchronized (self) {
+        NSMutableArray<PrinterResolverEntry *> *entries = _entries[key];
+        for (PrinterResolverEntry *entry in [entries copy]) {
+            if ([entry.ip isEqualToString:ip]) {
+                [entries removeObject:entry];
+            }
+        }
+    }
+}
+
+/// Cached addresses within their TTL, most recent first
+- (NSArray<NSString *> *)candidatesForMAC:(NSString *)key {
+    NSDate *oldest = [NSDate dateWithTimeIntervalSinceNow:-self.cacheTTL];
+    NSMutableArray<NSString *> *candidates = [NSMutableArray array];
+    @synchronized (self) {
+        for (PrinterResolverEntry *entry in _entries[key]) {
+            if ([entry.date compare:oldest] == NSOrderedDescending) {
+                [candidates addObject:entry.ip];
+            }
+        }
+    }
+    PrinterDiscoveryRecord *record = [_discovery cachedRecordForMAC:key];
+    if (record && [record.lastSeen compare:oldest] == NSOrderedDescending && ![candidates containsObject:record.ip]) {
+        [candidates addObject:record.ip];
+    }
+    return candidates;
+}
+
+#pragma mark - Resolution
+
+- (void)resolveMAC:(NSString *)mac port:(UInt16)port completion:(void (^)(NSString *, NSArray<PrinterResolveAttempt *> *))completion {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self resolveMAC:mac port:port completion:completion];
+        });
+        return;
+    }
+    NSString *key = [PrinterDiscoveryService normalizedMAC:mac];
+    PrinterResolution *resolution = [[PrinterResolution alloc] init];
+    resolution.mac = key;
+    resolution.attempts = [NSMutableArray array];
+    resolution.completion = completion;
+
+    NSArray<NSString *> *candidates = [self candidatesForMAC:key];
+    if (candidates.count == 0) {
+        [self discoverResolution:resolution port:port];
+        return;
+    }
+    resolution.pending = candidates.count;
+    if (self.verifiesIdentity) {
+        resolution.verifying = YES;
+        resolution.acceptedIPs = [NSMutableArray array];
+        [self discoverResolution:resolution port:port];
+    }
+    [candidates enumerateObjectsUsingBlock:^(NSString *ip, NSUInteger index, BOOL *stop) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(index * self.attemptDelay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            [self startAttemptWithIP:ip source:PrinterResolveSourceCache port:port resolution:resolution];
+        });
+    }];
+}
+
+- (void)startAttemptWithIP:(NSString *)ip source:(PrinterResolveSource)source port:(UInt16)port resolution:(PrinterResolution *)resolution {
+    if (resolution.finished) {
+        [self finishAttemptWithIP:ip source:source duration:0 result:ECANCELED port:port resolution:resolution];
+        return;
+    }
+    NSTimeInterval timeout = self.connectTimeout;
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        int result = PrinterResolverConnect(ip, port, timeout, &resolution->_cancelled);
+        NSTimeInterval duration = CFAbsoluteTimeGetCurrent() - start;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self finishAttemptWithIP:ip source:source duration:duration result:result port:port resolution:resolution];
+        });
+    });
+}
+
+- (void)finishAttemptWithIP:(NSString *)ip source:(PrinterResolveSource)source duration:(NSTimeInterval)duration result:(int)result port:(UInt16)port resolution:(PrinterResolution *)resolution {
+    PrinterResolveAttempt *attempt = [[PrinterResolveAttempt alloc] init];
+    attempt.mac = resolution.mac;
+    attempt.ip = ip;
+    attempt.source = source;
+    attempt.duration = duration;
+    attempt.success = result == 0;
+    attempt.errorCode = result;
+    [resolution.attempts addObject:attempt];
+    if (self.telemetryBlock) {
+        self.telemetryBlock(attempt);
+    }
+
+    if (attempt.success && !resolution.finished) {
+        if (source == PrinterResolveSourceCache && resolution.verifying) {
+            if ([ip isEqualToString:resolution.discoveredIP]) {
+                [self confirmResolution:resolution ip:ip];
+            } else if (resolution.discoveredIP == nil) {
+                [resolution.acceptedIPs addObject:ip];
+            } else {
+                // The printer answered from elsewhere, this address is another device
+                [self forgetAddress:ip forMAC:resolution.mac];
+            }
+        } else {
+            attempt.identityConfirmed = source == PrinterResolveSourceDiscovery;
+            [self recordAddress:ip forMAC:resolution.mac];
+            [self finishResolution:resolution ip:ip];
+        }
+    }
+    if (source == PrinterResolveSourceCache && --resolution.pending == 0 && !resolution.finished) {
+        if (!resolution.verifying) {
+            [self discoverResolution:resolution port:port];
+        } else if (resolution.sweepFinished) {
+            [self finishUnconfirmedResolution:resolution];
+        }
+    } else if (source == PrinterResolveSourceDiscovery && !resolution.finished) {
+        [self finishResolution:resolution ip:nil];
+    }
+}
+
+- (void)discoverResolution:(PrinterResolution *)resolution port:(UInt16)port {
+    __block BOOL found = NO;
+    [_discovery discoverWithTimeout:self.discoveryTimeout result:^(PrinterDiscoveryRecord *record, BOOL isNew) {
+        if (found || resolution.finished) {
+            return;
+        }
+        if (![record.mac isEqualToString:resolution.mac]) {
+            // Another printer answering from an address that accepted: not ours
+            if ([resolution.acceptedIPs containsObject:record.ip]) {
+                [resolution.acceptedIPs removeObject:record.ip];
+                [self forgetAddress:record.ip forMAC:resolution.mac];
+            }
+            return;
+        }
+        found = YES;
+        resolution.discoveredIP = record.ip;
+        if ([resolution.acceptedIPs containsObject:record.ip]) {
+            [self confirmResolution:resolution ip:record.ip];
+            return;
+        }
+        for (NSString *stale in resolution.acceptedIPs) {
+            [self forgetAddress:stale forMAC:resolution.mac];
+        }
+        [resolution.acceptedIPs removeAllObjects];
+        [self startAttemptWithIP:record.ip source:PrinterResolveSourceDiscovery port:port resolution:resolution];
+    } completion:^(NSArray<PrinterDiscoveryRecord *> *records) {
+        resolution.sweepFinished = YES;
+        if (found || resolution.finished) {
+            return;
+        }
+        if (!resolution.verifying || resolution.pending == 0) {
+            [self finishUnconfirmedResolution:resolution];
+        }
+    }];
+}
+
+/// A cached address accepted and discovery reported the MAC there
+- (void)confirmResolution:(PrinterResolution *)resolution ip:(NSString *)ip {
+    for (PrinterResolveAttempt *attempt in resolution.attempts) {
+        if (attempt.success && [attempt.ip isEqualToString:ip]) {
+            attempt.identityConfirmed = YES;
+        }
+    }
+    [self recordAddress:ip forMAC:resolution.mac];
+    [self finishResolution:resolution ip:ip];
+}
+
+/// The printer did not answer discovery; an accepted cached address is the best guess left
+- (void)finishUnconfirmedResolution:(PrinterResolution *)resolution {
+    NSString *ip = resolution.acceptedIPs.firstObject;
+    if (ip) {
+        [self recordAddress:ip forMAC:resolution.mac];
+    }
+    [self finishResolution:resolution ip:ip];
+}
+
+- (void)finishResolution:(PrinterResolution *)resolution ip:(NSString *)ip {
+    resolution.finished = YES;
+    resolution->_cancelled = YES;
+    if (resolution.completion) {
+        resolution.completion(ip, [resolution.attempts copy]);
+        resolution.completion = nil;
+    }
+}
+
+#pragma mark - Connecting
+
+- (void)connectWithMac:(NSString *)mac port:(UInt16)port manager:(POSWIFIManager *)manager completion:(void (^)(NSString *))completion {
+    [self resolveMAC:mac port:port completion:^(NSString *ip, NSArray<PrinterResolveAttempt *> *attempts) {
+        if (ip) {
+            [manager connectWithHost:ip port:port];
+        }
+        if (completion) {
+            completion(ip);
+        }
+    }];
+}
+
+- (void)connectWithMac:(NSString *)mac port:(UInt16)port connecter:(WIFIConnecter *)connecter completion:(void (^)(NSString *))completion {
+    [self resolveMAC:mac port:port completion:^(NSString *ip, NSArray<PrinterResolveAttempt *> *attempts) {
+        if (ip) {
+            [connecter connectWithHost:ip port:port];
+        }
+        if (completion) {
+            completion(ip);
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,115 @@
+//
+//  PrinterBLESessionManager.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreBluetooth/CoreBluetooth.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class PrinterBLESessionManager;
+
+/// State of a BLE session
+typedef NS_ENUM(NSInteger, PrinterBLESessionState) {
+    PrinterBLESessionConnecting = 0, ///< Connecting and discovering characteristics
+    PrinterBLESessionReady,          ///< Writable
+    PrinterBLESessionDisconnected    ///< Closed or lost, pending writes failed
+};
+
+/// One connected printer with its own write queue.
+/// Writes are split into packets of the peripheral's maximum write length and sent when the shared
+/// scheduler gives the session its turn.
+@interface PrinterBLESession : NSObject
+
+/// The printer
+@property (nonatomic, strong, readonly) CBPeripheral *peripheral;
+
+/// Current state
+@property (nonatomic, readonly) PrinterBLESessionState state;
+
+/// Bytes written to the peripheral so far
+@property (nonatomic, readonly) NSUInteger bytesSent;
+
+/// Bytes queued and not yet written
+@property (nonatomic, readonly) NSUInteger pendingBytes;
+
+/// Characteristic used for writing, set once the session is ready
+@property (nonatomic, strong, readonly, nullable) CBCharacteristic *writeCharacteristic;
+
+/// Called on the main queue with data notified by the printer
+@property (nonatomic, copy, nullable) void (^receiveBlock)(NSData *data);
+
+/// Called on the main queue when the state changes
+@property (nonatomic, copy, nullable) void (^stateBlock)(PrinterBLESessionState state, NSError * _Nullable error);
+
+/// Queues data for the printer
+/// @param data The data
+/// @param completion Called on the main queue once all bytes were written, or with the error that stopped them
+- (void)writeData:(NSData *)data completion:(nullable void (^)(BOOL success, NSError * _Nullable error))completion;
+
+/// Disconnects the printer and fails the pending writes
+- (void)close;
+
+@end
+
+/// Scan results and central state
+@protocol PrinterBLESessionManagerDelegate <NSObject>
+@optional
+
+/// A peripheral was discovered
+/// @param manager The manager
+/// @param peripheral The peripheral
+/// @param RSSI Signal strength
+- (void)sessionManager:(PrinterBLESessionManager *)manager didDiscoverPeripheral:(CBPeripheral *)peripheral RSSI:(NSNumber *)RSSI;
+
+/// The Bluetooth state changed
+/// @param manager The manager
+/// @param state The new state
+- (void)sessionManager:(PrinterBLESessionManager *)manager didUpdateState:(NSInteger)state;
+
+@end
+
+/// Drives several BLE printers at once, e.g. a receipt printer and a label printer.
+/// Unlike POSBLEManager/TSCBLEManager, which hold a single peripheral, every connected printer gets
+/// its own PrinterBLESession. All sessions share one central and one serial I/O queue, on which a
+/// round-robin scheduler gives each session up to packetsPerTurn packets per turn, so every link
+/// stays busy and no session can starve the others.
+@interface PrinterBLESessionManager : NSObject
+
+/// Receives scan results and state changes on the main queue
+@property (nonatomic, weak, nullable) id<PrinterBLESessionManagerDelegate> delegate;
+
+/// Services to scan for, nil for all peripherals
+@property (nonatomic, copy, nullable) NSArray<CBUUID *> *serviceUUIDs;
+
+/// Write characteristic to use, nil picks the first writable characteristic.
+/// A session whose peripheral has no matching characteristic disconnects with a CBATTErrorAttributeNotFound error.
+@property (nonatomic, strong, nullable) CBUUID *characteristicUUID;
+
+/// Packets a session may send before the next session gets its turn (default: 4)
+@property (nonatomic, assign) NSUInteger packetsPerTurn;
+
+/// Open sessions
+@property (nonatomic, readonly) NSArray<PrinterBLESession *> *sessions;
+
+/// Returns the shared manager
++ (instancetype)sharedManager;
+
+/// Starts scanning
+- (void)startScan;
+
+/// Stops scanning
+- (void)stopScan;
+
+/// Connects a peripheral and returns its session; returns the existing session if one is open
+/// @param peripheral A peripheral reported by this manager
+- (PrinterBLESession *)openSessionWithPeripheral:(CBPeripheral *)peripheral;
+
+/// Returns the open session of a peripheral
+/// @param identifier The peripheral identifier
+- (nullable PrinterBLESession *)sessionForIdentifier:(NSUUID *)identifier;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,433 @@
+//
+//  PrinterBLESessionManager.m
+//  Printer
+//
+
+#import "PrinterBLESessionManager.h"
+
+/// A queued write
+@interface PrinterBLEWrite : NSObject
+@property (nonatomic, strong) NSData *data;
+@property (nonatomic, assign) NSUInteger offset;
+@property (nonatomic, copy) void (^completion)(BOOL success, NSError *error);
+@end
+
+@implementation PrinterBLEWrite
+@end
+
+@interface PrinterBLESessionManager () <CBCentralManagerDelegate>
+@property (nonatomic, strong, readonly) dispatch_queue_t ioQueue;
+- (void)schedule;
+- (void)closeSession:(PrinterBLESession *)session;
+- (void)failSession:(PrinterBLESession *)session error:(NSError *)error;
+@end
+
+@interface PrinterBLESession () <CBPeripheralDelegate>
+- (instancetype)initWithPeripheral:(CBPeripheral *)peripheral manager:(PrinterBLESessionManager *)manager;
+- (BOOL)canSendPacket;
+- (void)sendPacket;
+- (void)didConnect;
+- (void)didDisconnectWithError:(NSError *)error;
+@end
+
+@implementation PrinterBLESession {
+    __weak PrinterBLESessionManager *_manager;
+    NSMutableArray<PrinterBLEWrite *> *_writes;
+    CBCharacteristicWriteType _writeType;
+    /// Completions waiting for the response of the last packet of their write
+    NSMutableArray<PrinterBLEWrite *> *_awaitingResponse;
+    /// Services whose characteristics were not discovered yet
+    NSUInteger _pendingServices;
+}
+
+- (instancetype)initWithPeripheral:(CBPeripheral *)peripheral manager:(PrinterBLESessionManager *)manager {
+    self = [super init];
+    if (self) {
+        _peripheral = peripheral;
+        _manager = manager;
+        _state = PrinterBLESessionConnecting;
+        _writes = [NSMutableArray array];
+        _awaitingResponse = [NSMutableArray array];
+        peripheral.delegate = self;
+    }
+    return self;
+}
+
+#pragma mark - Public
+
+- (void)writeData:(NSData *)data completion:(void (^)(BOOL, NSError *))completion {
+    PrinterBLEWrite *write = [[PrinterBLEWrite alloc] init];
+    write.data = [data copy];
+    write.completion = completion;
+    PrinterBLESessionManager *manager = _manager;
+    if (manager == nil) {
+        [self completeWrite:write success:NO error:nil];
+        return;
+    }
+    dispatch_async(manager.ioQueue, ^{
+        if (self.state == PrinterBLESessionDisconnected) {
+            [self completeWrite:write success:NO error:nil];
+            return;
+        }
+        if (write.data.length == 0) {
+            [self completeWrite:write success:YES error:nil];
+            return;
+        }
+        [self->_writes addObject:write];
+        self->_pendingBytes += write.data.length;
+        [manager schedule];
+    });
+}
+
+- (void)close {
+    [_manager closeSession:self];
+}
+
+#pragma mark - Scheduling (I/O queue)
+
+- (NSUInteger)maximumPacketLength {
+    NSUInteger length = [self.peripheral maximumWriteValueLengthForType:_writeType];
+    return MAX(length, 20);
+}
+
+- (BOOL)canSendPacket {
+    if (self.state != PrinterBLESessionReady || _writes.count == 0) {
+        return NO;
+    }
+    if (_writeType == CBCharacteristicWriteWithoutResponse) {
+        return self.peripheral.canSendWriteWithoutResponse;
+    }
+    return _awaitingResponse.count == 0;
+}
+
+- (void)sendPacket {
+    PrinterBLEWrite *write = _writes.firstObject;
+    NSUInteger length = MIN([self maximumPacketLength], write.data.length - write.offset);
+    NSData *packet = [write.data subdataWithRange:NSMakeRange(write.offset, length)];
+    [self.peripheral writeValue:packet forCharacteristic:self.writeCharacteristic type:_writeType];
+    write.offset += length;
+    _bytesSent += length;
+    _pendingBytes -= length;
+
+    BOOL finished = write.offset >= write.data.length;
+    if (finished) {
+        [_writes removeObjectAtIndex:0];
+    }
+    if (_writeType == CBCharacteristicWriteWithResponse) {
+        // One packet in flight, its response completes the write if it was the last packet
+        PrinterBLEWrite *marker = finished ? write : [[PrinterBLEWrite alloc] init];
+        [_awaitingResponse addObject:marker];
+    } else if (finished) {
+        [self completeWrite:write success:YES error:nil];
+    }
+}
+
+- (void)completeWrite:(PrinterBLEWrite *)write success:(BOOL)success error:(NSError *)error {
+    if (write.completion == nil) {
+        return;
+    }
+    void (^completion)(BOOL, NSError *) = write.completion;
+    write.completion = nil;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        completion(success, error);
+    });
+}
+
+- (void)failPendingWritesWithError:(NSError *)error {
+    for (PrinterBLEWrite *write in _awaitingResponse) {
+        [self completeWrite:write success:NO error:error];
+    }
+    for (PrinterBLEWrite *write in _writes) {
+        [self completeWrite:write success:NO error:error];
+    }
+    [_awaitingResponse removeAllObjects];
+    [_writes removeAllObjects];
+    _pendingBytes = 0;
+}
+
+- (void)updateState:(PrinterBLESessionState)state error:(NSError *)error {
+    if (_state == state) {
+        return;
+    }
+    _state = state;
+    void (^block)(PrinterBLESessionState, NSError *) = self.stateBlock;
+    if (block) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            block(state, error);
+        });
+    }
+}
+
+- (void)didConnect {
+    [self.peripheral discoverServices:nil];
+}
+
+- (void)didDisconnectWithError:(NSError *)error {
+    [self failPendingWritesWithError:error];
+    [self updateState:PrinterBLESessionDisconnected error:error];
+}
+
+#pragma mark - CBPeripheralDelegate
+
+- (void)peripheral:(CBPeripheral *)peripheral didDiscoverServices:(NSError *)error {
+    if (error) {
+        [_manager closeSession:self];
+        return;
+    }
+    _pendingServices = peripheral.services.count;
+    if (_pendingServices == 0) {
+        [self failMissingCharacteristic];
+        return;
+    }
+    for (CBService *service in peripheral.services) {
+        [peripheral discoverCharacteristics:nil forService:service];
+    }
+}
+
+/// Without a write characteristic the session could never send, so queued writes would wait forever
+- (void)failMissingCharacteristic {
+    [_manager failSession:self error:[NSError errorWithDomain:CBATTErrorDomain code:CBATTErrorAttributeNotFound userInfo:nil]];
+}
+
+- (void)peripheral:(CBPeripheral *)peripheral didDiscoverCharacteristicsForService:(CBService *)service error:(NSError *)error {
+    if (self.state != PrinterBLESessionConnecting) {
+        return;
+    }
+    if (_pendingServices > 0) {
+        _pendingServices--;
+    }
+    if (error) {
+        if (_pendingServices == 0 && self.writeCharacteristic == nil) {
+            [self failMissingCharacteristic];
+        }
+        return;
+    }
+    CBUUID *wanted = _manager.characteristicUUID;
+    for (CBCharacteristic *characteristic in service.characteristics) {
+        CBCharacteristicProperties properties = characteristic.properties;
+        if (properties & (CBCharacteristicPropertyNotify | CBCharacteristicPropertyIndicate)) {
+            [peripheral setNotifyValue:YES forCharacteristic:characteristic];
+        }
+        BOOL writable = properties & (CBCharacteristicPropertyWrite | CBCharacteristicPropertyWriteWithoutResponse);
+        if (self.writeCharacteristic == nil && writable && (wanted == nil || [characteristic.UUID isEqual:wanted])) {
+            _writeCharacteristic = characteristic;
+            _writeType = (properties & CBCharacteristicPropertyWriteWithoutResponse) ? CBCharacteristicWriteWithoutResponse : CBCharacteristicWriteWithResponse;
+        }
+    }
+    if (self.writeCharacteristic) {
+        [self updateState:PrinterBLESessionReady error:nil];
+        [_manager schedule];
+    } else if (_pendingServices == 0) {
+        [self failMissingCharacteristic];
+    }
+}
+
+- (void)peripheral:(CBPeripheral *)peripheral didWriteValueForCharacteristic:(CBCharacteristic *)characteristic error:(NSError *)error {
+    if (_awaitingResponse.count == 0) {
+        return;
+    }
+    PrinterBLEWrite *write = _awaitingResponse.firstObject;
+    [_awaitingResponse removeObjectAtIndex:0];
+    if (error) {
+        [self completeWrite:write success:NO error:error];
+        if (_writes.count > 0 && _writes.firstObject.offset > 0) {
+            // The rest of a write whose packet failed is useless to the printer
+            PrinterBLEWrite *broken = _writes.firstObject;
+            _pendingBytes -= broken.data.length - broken.offset;
+            [_writes removeObjectAtIndex:0];
+            [self completeWrite:broken success:NO error:error];
+        }
+    } else {
+        [self completeWrite:write success:YES error:nil];
+    }
+    [_manager schedule];
+}
+
+- (void)peripheralIsReadyToSendWriteWithoutResponse:(CBPeripheral *)peripheral {
+    [_manager schedule];
+}
+
+- (void)peripheral:(CBPeripheral *)peripheral didUpdateValueForCharacteristic:(CBCharacteristic *)characteristic error:(NSError *)error {
+    NSData *value = characteristic.value;
+    void (^block)(NSData *) = self.receiveBlock;
+    if (error || value.length == 0 || block == nil) {
+        return;
+    }
+    dispatch_async(dispatch_get_main_queue(), ^{
+        block(value);
+    });
+}
+
+@end
+
+@implementation PrinterBLESessionManager {
+    CBCentralManager *_central;
+    NSMutableDictionary<NSUUID *, PrinterBLESession *> *_sessions;
+    NSMutableArray<NSUUID *> *_ring;
+    NSUInteger _cursor;
+    BOOL _scanRequested;
+}
+
++ (instancetype)sharedManager {
+    static PrinterBLESessionManager *manager = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        manager = [[PrinterBLESessionManager alloc] init];
+    });
+    return manager;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _ioQueue = dispatch_queue_create("com.printer.ble.sessions", DISPATCH_QUEUE_SERIAL);
+        _packetsPerTurn = 4;
+        _sessions = [NSMutableDictionary dictionary];
+        _ring = [NSMutableArray array];
+        _central = [[CBCentralManager alloc] initWithDelegate:self queue:_ioQueue];
+    }
+    return self;
+}
+
+- (NSArray<PrinterBLESession *> *)sessions {
+    __block NSArray<PrinterBLESession *> *sessions = nil;
+    dispatch_sync(_ioQueue, ^{
+        sessions = self->_sessions.allValues;
+    });
+    return sessions;
+}
+
+- (PrinterBLESession *)sessionForIdentifier:(NSUUID *)identifier {
+    __block PrinterBLESession *session = nil;
+    dispatch_sync(_ioQueue, ^{
+        session = self->_sessions[identifier];
+    });
+    return session;
+}
+
+#pragma mark - Scanning
+
+- (void)startScan {
+    dispatch_async(_ioQueue, ^{
+        self->_scanRequested = YES;
+        if (self->_central.state == CBManagerStatePoweredOn) {
+            [self->_central scanForPeripheralsWithServices:self.serviceUUIDs options:nil];
+        }
+    });
+}
+
+- (void)stopScan {
+    dispatch_async(_ioQueue, ^{
+        self->_scanRequested = NO;
+        [self->_central stopScan];
+    });
+}
+
+#pragma mark - Sessions
+
+- (PrinterBLESession *)openSessionWithPeripheral:(CBPeripheral *)peripheral {
+    __block PrinterBLESession *session = nil;
+    dispatch_sync(_ioQueue, ^{
+        session = self->_sessions[peripheral.identifier];
+        if (session && session.state != PrinterBLESessionDisconnected) {
+            return;
+        }
+        session = [[PrinterBLESession alloc] initWithPeripheral:peripheral manager:self];
+        self->_sessions[peripheral.identifier] = session;
+        [self->_ring removeObject:peripheral.identifier];
+        [self->_ring addObject:peripheral.identifier];
+        [self->_central connectPeripheral:peripheral options:nil];
+    });
+    return session;
+}
+
+- (void)closeSession:(PrinterBLESession *)session {
+    dispatch_async(_ioQueue, ^{
+        [self removeSession:session error:nil];
+        [self->_central cancelPeripheralConnection:session.peripheral];
+    });
+}
+
+/// Called on the I/O queue
+- (void)failSession:(PrinterBLESession *)session error:(NSError *)error {
+    [self removeSession:session error:error];
+    [_central cancelPeripheralConnection:session.peripheral];
+}
+
+- (void)removeSession:(PrinterBLESession *)session error:(NSError *)error {
+    NSUUID *identifier = session.peripheral.identifier;
+    if (self->_sessions[identifier] == session) {
+        [self->_sessions removeObjectForKey:identifier];
+        [self->_ring removeObject:identifier];
+    }
+    [session didDisconnectWithError:error];
+}
+
+/// Round robin over the sessions, each sends up to packetsPerTurn packets per turn, until no session can send
+- (void)schedule {
+    NSUInteger quantum = MAX(self.packetsPerTurn, 1);
+    BOOL progress = YES;
+    while (progress && _ring.count > 0) {
+        progress = NO;
+        NSUInteger count = _ring.count;
+        for (NSUInteger i = 0; i < count; i++) {
+            PrinterBLESession *session = _sessions[_ring[(_cursor + i) % count]];
+            NSUInteger sent = 0;
+            while (sent < quantum && [session canSendPacket]) {
+                [session sendPacket];
+                sent++;
+            }
+            progress = progress || sent > 0;
+        }
+        _cursor = (_cursor + 1) % count;
+    }
+}
+
+#pragma mark - CBCentralManagerDelegate
+
+- (void)centralManagerDidUpdateState:(CBCentralManager *)central {
+    if (central.state == CBManagerStatePoweredOn && _scanRequested) {
+        [central scanForPeripheralsWithServices:self.serviceUUIDs options:nil];
+    }
+    if (central.state != CBManagerStatePoweredOn) {
+        for (PrinterBLESession *session in _sessions.allValues) {
+            [self removeSession:session error:nil];
+        }
+    }
+    NSInteger state = central.state;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        id<PrinterBLESessionManagerDelegate> delegate = self.delegate;
+        if ([delegate respondsToSelector:@selector(sessionManager:didUpdateState:)]) {
+            [delegate sessionManager:self didUpdateState:state];
+        }
+    });
+}
+
+- (void)centralManager:(CBCentralManager *)central didDiscoverPeripheral:(CBPeripheral *)peripheral advertisementData:(NSDictionary<NSString *, id> *)advertisementData RSSI:(NSNumber *)RSSI {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        id<PrinterBLESessionManagerDelegate> delegate = self.delegate;
+        if ([delegate respondsToSelector:@selector(sessionManager:didDiscoverPeripheral:RSSI:)]) {
+            [delegate sessionManager:self didDiscoverPeripheral:peripheral RSSI:RSSI];
+        }
+    });
+}
+
+- (void)centralManager:(CBCentralManager *)central didConnectPeripheral:(CBPeripheral *)peripheral {
+    [_sessions[peripheral.identifier] didConnect];
+}
+
+- (void)centralManager:(CBCentralManager *)central didFailToConnectPeripheral:(CBPeripheral *)peripheral error:(NSError *)error {
+    PrinterBLESession *session = _sessions[peripheral.identifier];
+    if (session) {
+        [self removeSession:session error:error];
+    }
+}
+
+- (void)centralManager:(CBCentralManager *)central didDisconnectPeripheral:(CBPeripheral *)peripheral error:(NSError *)error {
+    PrinterBLESession *session = _sessions[peripheral.identifier];
+    if (session) {
+        [self removeSession:session error:error];
+    }
+}
+
+@end
@@ -0,0 +1,80 @@
+//
+//  PrinterBitmap.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import <UIKit/UIKit.h>
+#import "POSImageTranster.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Packed 1-bpp bitmap shared by the image encoders.
+/// Rows are stored top to bottom, MSB first, and a set bit means a black dot.
+@interface PrinterBitmap : NSObject
+
+/// Width in dots
+@property (nonatomic, readonly) int width;
+
+/// Height in dots
+@property (nonatomic, readonly) int height;
+
+/// Number of bytes per packed row, (width + 7) / 8
+@property (nonatomic, readonly) int bytesPerRow;
+
+/// Packed bitmap data, bytesPerRow * height bytes
+@property (nonatomic, readonly) NSData *data;
+
+/// Creates a bitmap from packed row data.
+/// @param width Width in dots
+/// @param height Height in dots
+/// @param data Packed rows, at least ((width + 7) / 8) * height bytes
+- (instancetype)initWithWidth:(int)width height:(int)height data:(NSData *)data;
+
+/// Converts an image using the default threshold (128).
+/// @param image The image to convert
+/// @return The bitmap, or nil if the image has no bitmap representation
++ (nullable instancetype)bitmapWithImage:(UIImage *)image;
+
+/// Converts an image, dots darker than the threshold become black.
+/// Transparent areas are treated as white.
+/// @param image The image to convert
+/// @param threshold Gray level (0-255) below which a dot is printed
+/// @return The bitmap, or nil if the image has no bitmap representation
++ (nullable instancetype)bitmapWithImage:(UIImage *)image threshold:(int)threshold;
+
+/// Thresholds an 8-bit gray buffer.
+/// @param gray Gray pixels, 0 is black and 255 is white
+/// @param width Width in pixels
+/// @param height Height in pixels
+/// @param stride Bytes between the starts of two gray rows
+/// @param threshold Gray level (0-255) below which a dot is printed
++ (instancetype)bitmapWithGrayPixels:(const uint8_t *)gray
+                               width:(int)width
+                              height:(int)height
+                              stride:(size_t)stride
+                           threshold:(int)threshold;
+
+/// Pointer to the first byte of a packed row.
+/// @param row Row index, 0 is the top row
+- (const uint8_t *)bytesForRow:(int)row;
+
+/// Checks whether a row contains no black dot.
+/// @param row Row index, 0 is the top row
+- (BOOL)isRowBlank:(int)row;
+
+/// Returns a sub-rectangle of the bitmap, clipped to the bitmap bounds.
+/// @param x Left edge in dots
+/// @param y Top edge in dots
+/// @param width Width in dots
+/// @param height Height in dots
+- (PrinterBitmap *)bitmapWithX:(int)x y:(int)y width:(int)width height:(int)height;
+
+/// ESC/POS raster bit image command (GS v 0) for the whole bitmap.
+/// @param mode The raster print type
+/// @return Data command
+- (NSData *)rasterCommandWithMode:(PrintRasterType)mode;
+
+@end
+
+NS_ASSUME_NONNULL_END
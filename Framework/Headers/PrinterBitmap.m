@@ -0,0 +1,131 @@
+//
+//  PrinterBitmap.m
+//  Printer
+//
+
+#import "PrinterBitmap.h"
+
+@implementation PrinterBitmap
+
+- (instancetype)initWithWidth:(int)width height:(int)height data:(NSData *)data {
+    self = [super init];
+    if (self) {
+        _width = MAX(width, 0);
+        _height = MAX(height, 0);
+        _bytesPerRow = (_width + 7) / 8;
+        NSUInteger length = (NSUInteger)_bytesPerRow * (NSUInteger)_height;
+        if (data.length >= length) {
+            _data = [data subdataWithRange:NSMakeRange(0, length)];
+        } else {
+            NSMutableData *padded = [NSMutableData dataWithLength:length];
+            memcpy(padded.mutableBytes, data.bytes, data.length);
+            _data = padded;
+        }
+    }
+    return self;
+}
+
++ (instancetype)bitmapWithImage:(UIImage *)image {
+    return [self bitmapWithImage:image threshold:128];
+}
+
++ (instancetype)bitmapWithImage:(UIImage *)image threshold:(int)threshold {
+    CGImageRef cgImage = image.CGImage;
+    if (cgImage == NULL) {
+        return nil;
+    }
+    size_t width = CGImageGetWidth(cgImage);
+    size_t height = CGImageGetHeight(cgImage);
+    if (width == 0 || height == 0) {
+        return nil;
+    }
+
+    NSMutableData *pixels = [NSMutableData dataWithLength:width * height];
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceGray();
+    CGContextRef context = CGBitmapContextCreate(pixels.mutableBytes, width, height, 8, width, colorSpace, (CGBitmapInfo)kCGImageAlphaNone);
+    CGColorSpaceRelease(colorSpace);
+    if (context == NULL) {
+        return nil;
+    }
+    CGRect rect = CGRectMake(0, 0, width, height);
+    CGContextSetGrayFillColor(context, 1.0, 1.0);
+    CGContextFillRect(context, rect);
+    CGContextDrawImage(context, rect, cgImage);
+    CGContextRelease(context);
+
+    return [self bitmapWithGrayPixels:pixels.bytes width:(int)width height:(int)height stride:width threshold:threshold];
+}
+
++ (instancetype)bitmapWithGrayPixels:(const uint8_t *)gray width:(int)width height:(int)height stride:(size_t)stride threshold:(int)threshold {
+    int bytesPerRow = (width + 7) / 8;
+    NSMutableData *packed = [NSMutableData dataWithLength:(NSUInteger)bytesPerRow * (NSUInteger)height];
+    uint8_t *out = packed.mutableBytes;
+    for (int y = 0; y < height; y++) {
+        const uint8_t *src = gray + (size_t)y * stride;
+        uint8_t *dst = out + (size_t)y * bytesPerRow;
+        for (int x = 0; x < width; x++) {
+            if (src[x] < threshold) {
+                dst[x >> 3] |= (uint8_t)(0x80 >> (x & 7));
+            }
+        }
+    }
+    return [[self alloc] initWithWidth:width height:height data:packed];
+}
+
+- (const uint8_t *)bytesForRow:(int)row {
+    return (const uint8_t *)_data.bytes + (size_t)row * _bytesPerRow;
+}
+
+- (BOOL)isRowBlank:(int)row {
+    const uint8_t *bytes = [self bytesForRow:row];
+    for (int i = 0; i < _bytesPerRow; i++) {
+        if (bytes[i]) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+- (PrinterBitmap *)bitmapWithX:(int)x y:(int)y width:(int)width height:(int)height {
+    int left = MAX(x, 0);
+    int top = MAX(y, 0);
+    int right = MIN(x + width, _width);
+    int bottom = MIN(y + height, _height);
+    int w = MAX(right - left, 0);
+    int h = MAX(bottom - top, 0);
+    int outBytesPerRow = (w + 7) / 8;
+    NSMutableData *packed = [NSMutableData dataWithLength:(NSUInteger)outBytesPerRow * (NSUInteger)h];
+    uint8_t *out = packed.mutableBytes;
+    for (int row = 0; row < h; row++) {
+        const uint8_t *src = [self bytesForRow:top + row];
+        uint8_t *dst = out + (size_t)row * outBytesPerRow;
+        if ((left & 7) == 0) {
+            memcpy(dst, src + (left >> 3), outBytesPerRow);
+            if (w & 7) {
+                dst[outBytesPerRow - 1] &= (uint8_t)(0xFF << (8 - (w & 7)));
+            }
+            continue;
+        }
+        for (int col = 0; col < w; col++) {
+            int sx = left + col;
+            if (src[sx >> 3] & (0x80 >> (sx & 7))) {
+                dst[col >> 3] |= (uint8_t)(0x80 >> (col & 7));
+            }
+        }
+    }
+    return [[PrinterBitmap alloc] initWithWidth:w height:h data:packed];
+}
+
+- (NSData *)rasterCommandWithMode:(PrintRasterType)mode {
+    NSMutableData *command = [NSMutableData dataWithCapacity:8 + _data.length];
+    uint8_t header[8] = {
+        0x1D, 0x76, 0x30, (uint8_t)mode,
+        (uint8_t)(_bytesPerRow & 0xFF), (uint8_t)((_bytesPerRow >> 8) & 0xFF),
+        (uint8_t)(_height & 0xFF), (uint8_t)((_height >> 8) & 0xFF)
+    };
+    [command appendBytes:header length:sizeof(header)];
+    [command appendData:_data];
+    return command;
+}
+
+@end
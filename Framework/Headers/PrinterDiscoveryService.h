@@ -0,0 +1,100 @@
+//
+//  PrinterDiscoveryService.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "POSWIFIManager.h"
+#import "PrinterProfile.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// A printer seen on the network
+@interface PrinterDiscoveryRecord : NSObject
+
+/// MAC address, upper case, colon separated
+@property (nonatomic, copy, readonly) NSString *mac;
+
+/// Last known IP address
+@property (nonatomic, copy, readonly) NSString *ip;
+
+/// Printer name
+@property (nonatomic, copy, readonly) NSString *name;
+
+/// When the printer last answered a discovery
+@property (nonatomic, strong, readonly) NSDate *lastSeen;
+
+/// Profile reported by the printer, nil for records loaded from the cache
+@property (nonatomic, strong, readonly, nullable) PrinterProfile *profile;
+
+@end
+
+/// Called once per printer and sweep, and again if the printer answers from another IP; isNew is NO for such updates
+typedef void (^PrinterDiscoveryResultBlock)(PrinterDiscoveryRecord *record, BOOL isNew);
+
+/// Discovery on top of POSWIFIManager sendFindCmd: with a deadline, deduplication by MAC and a persisted MAC/IP table.
+/// The find command is repeated during a sweep so lost UDP answers are retried, and every printer is reported once.
+/// On startup, connectCachedPrinterWithMAC: connects to the last known IP right away while a sweep refreshes the table.
+@interface PrinterDiscoveryService : NSObject
+
+/// Interval between repeated find commands during a sweep (default: 0.5 s)
+@property (nonatomic, assign) NSTimeInterval repeatInterval;
+
+/// File the MAC/IP table is stored in (default: PrinterDiscovery.plist in the caches directory)
+@property (nonatomic, copy) NSString *cachePath;
+
+/// Cached entries older than this are dropped when loading (default: 30 days)
+@property (nonatomic, assign) NSTimeInterval cacheLifetime;
+
+/// YES while a sweep is running
+@property (nonatomic, readonly) BOOL isDiscovering;
+
+/// Printers in the persisted table, most recently seen first
+@property (nonatomic, readonly) NSArray<PrinterDiscoveryRecord *> *cachedRecords;
+
+/// Returns the shared service, using the shared POSWIFIManager
++ (instancetype)sharedService;
+
+/// Creates a service
+/// @param manager The manager whose UDP socket is used
+- (instancetype)initWithManager:(POSWIFIManager *)manager;
+
+/// Runs a sweep. A sweep that is already running is extended to the new deadline and gets the new blocks.
+/// @param timeout Deadline of the sweep in seconds
+/// @param result Called on the main queue for every printer found
+/// @param completion Called on the main queue at the deadline with all printers found in this sweep
+- (void)discoverWithTimeout:(NSTimeInterval)timeout
+                     result:(nullable PrinterDiscoveryResultBlock)result
+                 completion:(nullable void (^)(NSArray<PrinterDiscoveryRecord *> *records))completion;
+
+/// Ends the running sweep now, the completion block is still called
+- (void)stopDiscovery;
+
+/// Returns the cached entry of a printer
+/// @param mac The MAC address, any case, with or without separators
+- (nullable PrinterDiscoveryRecord *)cachedRecordForMAC:(NSString *)mac;
+
+/// Forgets the cached entry of a printer, e.g. after its address was changed
+/// @param mac The MAC address, any case, with or without separators
+- (void)removeCachedRecordForMAC:(NSString *)mac;
+
+/// Connects to the cached IP of a printer and refreshes the table in the background.
+/// If the sweep finds the printer at another IP, it reconnects there only once the first attempt failed
+/// (POSwifiDisconnectWithError:) or had not connected when the sweep ended, so an attempt in flight is never cut short.
+/// The manager's delegate keeps getting its callbacks during the connect and is restored once it ends.
+/// @param mac The MAC address
+/// @param port The port, e.g. 9100
+/// @param timeout Deadline of the background sweep in seconds
+/// @return NO if the printer is not in the cache; a sweep is started anyway
+- (BOOL)connectCachedPrinterWithMAC:(NSString *)mac port:(UInt16)port refreshTimeout:(NSTimeInterval)timeout;
+
+/// Clears the persisted table
+- (void)removeAllCachedRecords;
+
+/// Formats a MAC address the way records store it: upper case, colon separated
+/// @param mac The MAC address, any case, with or without separators
++ (NSString *)normalizedMAC:(NSString *)mac;
+
+@end
+
+NS_ASSUME_NONNULL_END
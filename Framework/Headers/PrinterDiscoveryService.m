@@ -0,0 +1,410 @@
+//
+//  PrinterDiscoveryService.m
+//  Printer
+//
+
+#import "PrinterDiscoveryService.h"
+
+static NSString *PrinterDiscoveryNormalizedMAC(NSString *mac) {
+    NSMutableString *hex = [NSMutableString string];
+    NSCharacterSet *digits = [NSCharacterSet characterSetWithCharactersInString:@"0123456789ABCDEFabcdef"];
+    for (NSUInteger i = 0; i < mac.length; i++) {
+        unichar c = [mac characterAtIndex:i];
+        if ([digits characterIsMember:c]) {
+            [hex appendFormat:@"%C", c];
+        }
+    }
+    NSString *upper = hex.uppercaseString;
+    NSMutableArray<NSString *> *pairs = [NSMutableArray array];
+    for (NSUInteger i = 0; i + 1 < upper.length; i += 2) {
+        [pairs addObject:[upper substringWithRange:NSMakeRange(i, 2)]];
+    }
+    return [pairs componentsJoinedByString:@":"];
+}
+
+@interface PrinterDiscoveryRecord ()
+- (instancetype)initWithMAC:(NSString *)mac ip:(NSString *)ip name:(NSString *)name lastSeen:(NSDate *)lastSeen profile:(PrinterProfile *)profile;
+@end
+
+@implementation PrinterDiscoveryRecord
+
+- (instancetype)initWithMAC:(NSString *)mac ip:(NSString *)ip name:(NSString *)name lastSeen:(NSDate *)lastSeen profile:(PrinterProfile *)profile {
+    self = [super init];
+    if (self) {
+        _mac = [mac copy];
+        _ip = [ip copy];
+        _name = [name copy] ?: @"";
+        _lastSeen = lastSeen;
+        _profile = profile;
+    }
+    return self;
+}
+
+- (NSDictionary *)dictionaryRepresentation {
+    return @{@"mac": self.mac, @"ip": self.ip, @"name": self.name, @"lastSeen": self.lastSeen};
+}
+
++ (instancetype)recordWithDictionary:(NSDictionary *)dictionary {
+    NSString *mac = dictionary[@"mac"];
+    NSString *ip = dictionary[@"ip"];
+    NSDate *lastSeen = dictionary[@"lastSeen"];
+    if (![mac isKindOfClass:[NSString class]] || ![ip isKindOfClass:[NSString class]] || ![lastSeen isKindOfClass:[NSDate class]]) {
+        return nil;
+    }
+    NSString *name = [dictionary[@"name"] isKindOfClass:[NSString class]] ? dictionary[@"name"] : @"";
+    return [[self alloc] initWithMAC:mac ip:ip name:name lastSeen:lastSeen profile:nil];
+}
+
+@end
+
+@interface PrinterDiscoveryService () <POSWIFIManagerDelegate>
+@end
+
+@implementation PrinterDiscoveryService {
+    POSWIFIManager *_manager;
+    NSMutableDictionary<NSString *, PrinterDiscoveryRecord *> *_cache;
+    NSMutableDictionary<NSString *, PrinterDiscoveryRecord *> *_sweep;
+    NSMutableArray<PrinterDiscoveryResultBlock> *_resultBlocks;
+    NSMutableArray<void (^)(NSArray<PrinterDiscoveryRecord *> *)> *_completionBlocks;
+    NSTimer *_repeatTimer;
+    NSTimer *_deadlineTimer;
+    NSDate *_deadline;
+    BOOL _cacheLoaded;
+    /// Printer of the running optimistic connect, nil when none runs
+    NSString *_connectMAC;
+    UInt16 _connectPort;
+    /// IP of the connection attempt in flight, nil once it failed
+    NSString *_connectingIP;
+    /// IP the sweep reported while an attempt was in flight, tried once that attempt fails
+    NSString *_redirectIP;
+    /// Disconnect callbacks caused by abandoning an attempt ourselves
+    NSUInteger _abandonedAttempts;
+    /// Delegate of the manager before the optimistic connect, called back meanwhile and restored at its end
+    __weak id<POSWIFIManagerDelegate> _previousDelegate;
+}
+
++ (instancetype)sharedService {
+    static PrinterDiscoveryService *service = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        service = [[PrinterDiscoveryService alloc] initWithManager:[POSWIFIManager sharedInstance]];
+    });
+    return service;
+}
+
+- (instancetype)initWithManager:(POSWIFIManager *)manager {
+    self = [super init];
+    if (self) {
+        _manager = manager;
+        _repeatInterval = 0.5;
+        _cacheLifetime = 30 * 24 * 3600;
+        NSString *caches = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject ?: NSTemporaryDirectory();
+        _cachePath = [caches stringByAppendingPathComponent:@"PrinterDiscovery.plist"];
+        _cache = [NSMutableDictionary dictionary];
+        _resultBlocks = [NSMutableArray array];
+        _completionBlocks = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)setCachePath:(NSString *)cachePath {
+    _cachePath = [cachePath copy];
+    _cacheLoaded = NO;
+}
+
+#pragma mark - Cache
+
+- (void)loadCacheIfNeeded {
+    if (_cacheLoaded) {
+        return;
+    }
+    _cacheLoaded = YES;
+    [_cache removeAllObjects];
+    NSArray *entries = [NSArray arrayWithContentsOfFile:self.cachePath];
+    NSDate *oldest = [NSDate dateWithTimeIntervalSinceNow:-self.cacheLifetime];
+    for (NSDictionary *entry in entries) {
+        if (![entry isKindOfClass:[NSDictionary class]]) {
+            continue;
+        }
+        PrinterDiscoveryRecord *record = [PrinterDiscoveryRecord recordWithDictionary:entry];
+        if (record && [record.lastSeen compare:oldest] == NSOrderedDescending) {
+            _cache[PrinterDiscoveryNormalizedMAC(record.mac)] = record;
+        }
+    }
+}
+
+- (void)saveCache {
+    NSMutableArray *entries = [NSMutableArray arrayWithCapacity:_cache.count];
+    for (PrinterDiscoveryRecord *record in _cache.allValues) {
+        [entries addObject:[record dictionaryRepresentation]];
+    }
+    [entries writeToFile:self.cachePath atomically:YES];
+}
+
+- (NSArray<PrinterDiscoveryRecord *> *)cachedRecords {
+    [self loadCacheIfNeeded];
+    return [_cache.allValues sortedArrayUsingComparator:^NSComparisonResult(PrinterDiscoveryRecord *a, PrinterDiscoveryRecord *b) {
+        return [b.lastSeen compare:a.lastSeen];
+    }];
+}
+
+- (PrinterDiscoveryRecord *)cachedRecordForMAC:(NSString *)mac {
+    [self loadCacheIfNeeded];
+    return _cache[PrinterDiscoveryNormalizedMAC(mac)];
+}
+
+- (void)removeCachedRecordForMAC:(NSString *)mac {
+    [self loadCacheIfNeeded];
+    NSString *key = PrinterDiscoveryNormalizedMAC(mac);
+    if (_cache[key]) {
+        [_cache removeObjectForKey:key];
+        [self saveCache];
+    }
+}
+
+- (void)removeAllCachedRecords {
+    [_cache removeAllObjects];
+    _cacheLoaded = YES;
+    [[NSFileManager defaultManager] removeItemAtPath:self.cachePath error:nil];
+}
+
++ (NSString *)normalizedMAC:(NSString *)mac {
+    return PrinterDiscoveryNormalizedMAC(mac);
+}
+
+#pragma mark - Sweep
+
+- (void)discoverWithTimeout:(NSTimeInterval)timeout result:(PrinterDiscoveryResultBlock)result completion:(void (^)(NSArray<PrinterDiscoveryRecord *> *))completion {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self discoverWithTimeout:timeout result:result completion:completion];
+        });
+        return;
+    }
+    [self loadCacheIfNeeded];
+    if (result) {
+        [_resultBlocks addObject:result];
+    }
+    if (completion) {
+        [_completionBlocks addObject:completion];
+    }
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:MAX(timeout, 0)];
+    if (_isDiscovering) {
+        // Replay what this sweep already found to the new result block
+        if (result) {
+            for (PrinterDiscoveryRecord *record in _sweep.allValues) {
+                result(record, YES);
+            }
+        }
+        if ([deadline compare:_deadline] != NSOrderedDescending) {
+            return;
+        }
+    } else {
+        if (![_manager createUdpSocket]) {
+            [self finishSweep];
+            return;
+        }
+        _isDiscovering = YES;
+        _sweep = [NSMutableDictionary dictionary];
+        [self sendFindCommand];
+        _repeatTimer = [NSTimer scheduledTimerWithTimeInterval:MAX(self.repeatInterval, 0.05) target:self selector:@selector(sendFindCommand) userInfo:nil repeats:YES];
+    }
+    _deadline = deadline;
+    [_deadlineTimer invalidate];
+    _deadlineTimer = [NSTimer scheduledTimerWithTimeInterval:MAX(timeout, 0) target:self selector:@selector(stopDiscovery) userInfo:nil repeats:NO];
+}
+
+- (void)sendFindCommand {
+    __weak typeof(self) weakSelf = self;
+    [_manager sendFindCmd:^(PrinterProfile *foundPrinter) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [weakSelf handleFoundPrinter:foundPrinter];
+        });
+    }];
+}
+
+- (void)handleFoundPrinter:(PrinterProfile *)profile {
+    if (!_isDiscovering || profile == nil) {
+        return;
+    }
+    Byte *bytes = [profile getMACArray];
+    if (bytes == NULL) {
+        return;
+    }
+    NSString *mac = [NSString stringWithFormat:@"%02X:%02X:%02X:%02X:%02X:%02X", bytes[0], bytes[1], bytes[2], bytes[3], bytes[4], bytes[5]];
+    NSString *ip = [profile getIPString];
+    if (ip.length == 0) {
+        return;
+    }
+
+    PrinterDiscoveryRecord *previous = _sweep[mac];
+    if (previous && [previous.ip isEqualToString:ip]) {
+        return;
+    }
+    PrinterDiscoveryRecord *record = [[PrinterDiscoveryRecord alloc] initWithMAC:mac ip:ip name:profile.printerName lastSeen:[NSDate date] profile:profile];
+    _sweep[mac] = record;
+    _cache[mac] = record;
+    for (PrinterDiscoveryResultBlock block in [_resultBlocks copy]) {
+        block(record, previous == nil);
+    }
+}
+
+- (void)stopDiscovery {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self stopDiscovery];
+        });
+        return;
+    }
+    if (!_isDiscovering) {
+        return;
+    }
+    [_manager closeUdpSocket];
+    _isDiscovering = NO;
+    [self saveCache];
+    [self finishSweep];
+}
+
+- (void)finishSweep {
+    [_repeatTimer invalidate];
+    [_deadlineTimer invalidate];
+    _repeatTimer = nil;
+    _deadlineTimer = nil;
+    NSArray<PrinterDiscoveryRecord *> *records = _sweep.allValues ?: @[];
+    NSArray *completions = [_completionBlocks copy];
+    [_resultBlocks removeAllObjects];
+    [_completionBlocks removeAllObjects];
+    _sweep = nil;
+    for (void (^completion)(NSArray<PrinterDiscoveryRecord *> *) in completions) {
+        completion(records);
+    }
+}
+
+#pragma mark - Optimistic connect
+
+- (BOOL)connectCachedPrinterWithMAC:(NSString *)mac port:(UInt16)port refreshTimeout:(NSTimeInterval)timeout {
+    NSString *key = PrinterDiscoveryNormalizedMAC(mac);
+    PrinterDiscoveryRecord *cached = [self cachedRecordForMAC:key];
+    _connectMAC = key;
+    _connectPort = port;
+    _connectingIP = nil;
+    _redirectIP = nil;
+    if (_manager.delegate != self) {
+        _previousDelegate = _manager.delegate;
+        _manager.delegate = self;
+    }
+    if (cached) {
+        [self connectToIP:cached.ip];
+    }
+    __weak typeof(self) weakSelf = self;
+    [self discoverWithTimeout:timeout result:^(PrinterDiscoveryRecord *record, BOOL isNew) {
+        [weakSelf optimisticConnectFoundRecord:record];
+    } completion:^(NSArray<PrinterDiscoveryRecord *> *records) {
+        [weakSelf optimisticConnectSweepFinished];
+    }];
+    return cached != nil;
+}
+
+- (void)connectToIP:(NSString *)ip {
+    _connectingIP = ip;
+    _redirectIP = nil;
+    [_manager connectWithHost:ip port:_connectPort];
+}
+
+- (void)endOptimisticConnect {
+    _connectMAC = nil;
+    _connectingIP = nil;
+    _redirectIP = nil;
+    _abandonedAttempts = 0;
+    id<POSWIFIManagerDelegate> previous = _previousDelegate;
+    _previousDelegate = nil;
+    [_manager removeDelegate:self];
+    if (previous && _manager.delegate != previous) {
+        _manager.delegate = previous;
+    }
+}
+
+/// A sweep answer only redirects once the current attempt failed; while it is in flight the IP is kept for later
+- (void)optimisticConnectFoundRecord:(PrinterDiscoveryRecord *)record {
+    if (_connectMAC == nil || ![record.mac isEqualToString:_connectMAC] || [record.ip isEqualToString:_connectingIP] || [_manager printerIsConnect]) {
+        return;
+    }
+    if (_connectingIP) {
+        _redirectIP = record.ip;
+        return;
+    }
+    [self connectToIP:record.ip];
+}
+
+/// The refresh timeout also bounds the first attempt: if it has not connected by then, it counts as failed
+- (void)optimisticConnectSweepFinished {
+    if (_connectMAC == nil || [_manager printerIsConnect]) {
+        return;
+    }
+    if (_redirectIP) {
+        if (_connectingIP) {
+            _abandonedAttempts++;
+            [_manager disconnect];
+        }
+        [self connectToIP:_redirectIP];
+    } else if (_connectingIP == nil) {
+        [self endOptimisticConnect];
+    }
+}
+
+- (void)optimisticConnectFailed {
+    if (_abandonedAttempts > 0) {
+        _abandonedAttempts--;
+        return;
+    }
+    if (_connectMAC == nil) {
+        return;
+    }
+    _connectingIP = nil;
+    if (_redirectIP) {
+        [self connectToIP:_redirectIP];
+    } else if (!_isDiscovering) {
+        [self endOptimisticConnect];
+    }
+}
+
+#pragma mark - POSWIFIManagerDelegate
+
+- (void)POSwifiConnectedToHost:(NSString *)host port:(UInt16)port {
+    id<POSWIFIManagerDelegate> previous = _previousDelegate;
+    if ([previous respondsToSelector:@selector(POSwifiConnectedToHost:port:)]) {
+        [previous POSwifiConnectedToHost:host port:port];
+    }
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (self->_connectMAC) {
+            [self endOptimisticConnect];
+        }
+    });
+}
+
+- (void)POSwifiDisconnectWithError:(NSError *)error {
+    id<POSWIFIManagerDelegate> previous = _previousDelegate;
+    if ([previous respondsToSelector:@selector(POSwifiDisconnectWithError:)]) {
+        [previous POSwifiDisconnectWithError:error];
+    }
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [self optimisticConnectFailed];
+    });
+}
+
+- (void)POSwifiWriteValueWithTag:(long)tag {
+    id<POSWIFIManagerDelegate> previous = _previousDelegate;
+    if ([previous respondsToSelector:@selector(POSwifiWriteValueWithTag:)]) {
+        [previous POSwifiWriteValueWithTag:tag];
+    }
+}
+
+- (void)POSwifiReceiveValueForData:(NSData *)data {
+    id<POSWIFIManagerDelegate> previous = _previousDelegate;
+    if ([previous respondsToSelector:@selector(POSwifiReceiveValueForData:)]) {
+        [previous POSwifiReceiveValueForData:data];
+    }
+}
+
+@end
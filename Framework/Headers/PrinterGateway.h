@@ -0,0 +1,96 @@
+//
+//  PrinterGateway.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Outcome of a gateway job
+typedef NS_ENUM(uint8_t, PrinterGatewayJobStatus) {
+    PrinterGatewayJobPrinted = 0,  ///< Written to the printer
+    PrinterGatewayJobFailed = 1,   ///< The printer could not be reached or the write failed
+    PrinterGatewayJobRejected = 2  ///< Malformed frame or over the size limit
+};
+
+/// Counters of a gateway
+@interface PrinterGatewayStatistics : NSObject
+
+/// Jobs accepted from clients and submitJob:
+@property (nonatomic, readonly) NSUInteger jobsAccepted;
+
+/// Jobs written to their printer
+@property (nonatomic, readonly) NSUInteger jobsPrinted;
+
+/// Jobs that failed or were rejected
+@property (nonatomic, readonly) NSUInteger jobsFailed;
+
+/// Client connections currently open
+@property (nonatomic, readonly) NSUInteger clientCount;
+
+/// Printers with queued jobs or an open connection
+@property (nonatomic, readonly) NSUInteger printerCount;
+
+@end
+
+/// Print gateway: accepts raw print jobs over a local TCP socket and fans them out to networked
+/// printers on their raw port (9100, or 4000 on label printers), one ordered queue per printer.
+///
+/// Everything runs on one serial queue driven by dispatch sources (kqueue on Apple platforms,
+/// epoll on Linux), and only Foundation and POSIX are used, so the gateway can run in a server
+/// process. Memory is bounded: a client's input buffer never exceeds one frame of at most
+/// maxJobLength bytes, and reading from a client pauses while the printer it feeds has more than
+/// maxPendingBytesPerPrinter queued.
+///
+/// Request frame (integers big-endian):
+///   "PJ" | job id (4) | printer port (2) | host length (1) | host | payload length (4) | payload
+/// Reply frame, sent when the job finished:
+///   "PR" | job id (4) | PrinterGatewayJobStatus (1)
+@interface PrinterGateway : NSObject
+
+/// Local port clients connect to
+@property (nonatomic, readonly) UInt16 port;
+
+/// Address to listen on (default: 127.0.0.1)
+@property (nonatomic, copy) NSString *bindAddress;
+
+/// Largest payload accepted in one frame (default: 4 MB)
+@property (nonatomic, assign) NSUInteger maxJobLength;
+
+/// Queued bytes per printer above which clients feeding it are paused (default: 1 MB)
+@property (nonatomic, assign) NSUInteger maxPendingBytesPerPrinter;
+
+/// Seconds after which an idle printer connection is closed (default: 30)
+@property (nonatomic, assign) NSTimeInterval idleTimeout;
+
+/// Seconds to wait for a printer connection (default: 5)
+@property (nonatomic, assign) NSTimeInterval connectTimeout;
+
+/// Counters, read on any queue
+@property (nonatomic, strong, readonly) PrinterGatewayStatistics *statistics;
+
+/// Creates a gateway; call start to listen
+/// @param port Local port, 0 picks a free port (see port after start)
+- (instancetype)initWithPort:(UInt16)port;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/// Starts listening
+/// @param error Set when the socket cannot be bound
+/// @return YES when listening
+- (BOOL)start:(NSError **)error;
+
+/// Stops listening, closes the clients and printer connections and fails the queued jobs
+- (void)stop;
+
+/// Queues a job without going through the socket
+/// @param data The print data
+/// @param host Printer address
+/// @param port Printer port
+/// @param completion Called on the gateway queue when the job finished
+- (void)submitJob:(NSData *)data host:(NSString *)host port:(UInt16)port completion:(nullable void (^)(PrinterGatewayJobStatus status))completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
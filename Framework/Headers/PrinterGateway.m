@@ -0,0 +1,503 @@
+//
+//  PrinterGateway.m
+//  Printer
+//
+
+#import "PrinterGateway.h"
+#import "PrinterSocketTransport.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <fcntl.h>
+#import <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/// Fixed part of a request frame: magic, job id, port, host length, payload length
+static const NSUInteger PrinterGatewayRequestHeaderLength = 2 + 4 + 2 + 1 + 4;
+
+/// Bytes read from a client at a time
+static const size_t PrinterGatewayReadLength = 64 * 1024;
+
+static uint32_t PrinterGatewayReadUInt32(const uint8_t *bytes) {
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+/// Sets up the read and write sources of a socket; the socket is closed once both are cancelled
+static void PrinterGatewayMakeSources(int fd, dispatch_queue_t queue, dispatch_source_t *readSource, dispatch_source_t *writeSource) {
+    *readSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)fd, 0, queue);
+    *writeSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, (uintptr_t)fd, 0, queue);
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_group_enter(group);
+    dispatch_group_enter(group);
+    dispatch_source_set_cancel_handler(*readSource, ^{
+        dispatch_group_leave(group);
+    });
+    dispatch_source_set_cancel_handler(*writeSource, ^{
+        dispatch_group_leave(group);
+    });
+    dispatch_group_notify(group, queue, ^{
+        close(fd);
+    });
+}
+
+@interface PrinterGatewayStatistics ()
+@property (nonatomic, readwrite) NSUInteger jobsAccepted;
+@property (nonatomic, readwrite) NSUInteger jobsPrinted;
+@property (nonatomic, readwrite) NSUInteger jobsFailed;
+@property (nonatomic, readwrite) NSUInteger clientCount;
+@property (nonatomic, readwrite) NSUInteger printerCount;
+@end
+
+@implementation PrinterGatewayStatistics
+@end
+
+/// A queued job
+@interface PrinterGatewayJob : NSObject
+@property (nonatomic, strong) NSData *data;
+@property (nonatomic, copy) void (^completion)(PrinterGatewayJobStatus status);
+@end
+
+@implementation PrinterGatewayJob
+@end
+
+@class PrinterGatewayClient;
+
+/// One printer: its connection, jobs waiting for it and the clients paused on it
+@interface PrinterGatewayPrinter : NSObject
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, strong) PrinterSocketTransport *transport;
+@property (nonatomic, assign) BOOL connected;
+@property (nonatomic, strong) NSMutableArray<PrinterGatewayJob *> *waitingJobs;
+@property (nonatomic, assign) NSUInteger queuedBytes;
+@property (nonatomic, assign) NSUInteger idleGeneration;
+@property (nonatomic, strong) NSMutableArray<PrinterGatewayClient *> *pausedClients;
+@end
+
+@implementation PrinterGatewayPrinter
+@end
+
+/// One client connection
+@interface PrinterGatewayClient : NSObject
+@property (nonatomic, assign) int fd;
+@property (nonatomic, strong) dispatch_source_t readSource;
+@property (nonatomic, strong) dispatch_source_t writeSource;
+@property (nonatomic, assign) BOOL readSuspended;
+@property (nonatomic, assign) BOOL writeSuspended;
+@property (nonatomic, assign) BOOL closed;
+/// Close once the pending replies are sent
+@property (nonatomic, assign) BOOL closeAfterFlush;
+@property (nonatomic, strong) NSMutableData *input;
+@property (nonatomic, strong) NSMutableData *output;
+/// Printer this client waits for, nil unless paused
+@property (nonatomic, weak) PrinterGatewayPrinter *pausedOn;
+@end
+
+@implementation PrinterGatewayClient
+@end
+
+@implementation PrinterGateway {
+    dispatch_queue_t _queue;
+    int _listenFD;
+    dispatch_source_t _listenSource;
+    NSMutableSet<PrinterGatewayClient *> *_clients;
+    NSMutableDictionary<NSString *, PrinterGatewayPrinter *> *_printers;
+}
+
+- (instancetype)initWithPort:(UInt16)port {
+    self = [super init];
+    if (self) {
+        _port = port;
+        _bindAddress = @"127.0.0.1";
+        _maxJobLength = 4 * 1024 * 1024;
+        _maxPendingBytesPerPrinter = 1024 * 1024;
+        _idleTimeout = 30;
+        _connectTimeout = 5;
+        _statistics = [[PrinterGatewayStatistics alloc] init];
+        _queue = dispatch_queue_create("com.printer.gateway", DISPATCH_QUEUE_SERIAL);
+        _listenFD = -1;
+        _clients = [NSMutableSet set];
+        _printers = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_listenSource) {
+        dispatch_source_cancel(_listenSource);
+    }
+}
+
+#pragma mark - Listening
+
+- (BOOL)start:(NSError **)error {
+    __block int result = 0;
+    dispatch_sync(_queue, ^{
+        result = [self startListening];
+    });
+    if (result != 0 && error) {
+        *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:result userInfo:nil];
+    }
+    return result == 0;
+}
+
+- (int)startListening {
+    if (_listenFD >= 0) {
+        return 0;
+    }
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(_port);
+    if (inet_pton(AF_INET, self.bindAddress.UTF8String, &address.sin_addr) != 1) {
+        return EINVAL;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return errno;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        int error = errno;
+        close(fd);
+        return error;
+    }
+    socklen_t length = sizeof(address);
+    getsockname(fd, (struct sockaddr *)&address, &length);
+    _port = ntohs(address.sin_port);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    _listenFD = fd;
+    _listenSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)fd, 0, _queue);
+    __weak PrinterGateway *weakSelf = self;
+    dispatch_source_set_event_handler(_listenSource, ^{
+        [weakSelf acceptClients];
+    });
+    dispatch_source_set_cancel_handler(_listenSource, ^{
+        close(fd);
+    });
+    dispatch_resume(_listenSource);
+    return 0;
+}
+
+- (void)stop {
+    dispatch_async(_queue, ^{
+        if (self->_listenSource) {
+            dispatch_source_cancel(self->_listenSource);
+            self->_listenSource = nil;
+            self->_listenFD = -1;
+        }
+        for (PrinterGatewayClient *client in [self->_clients allObjects]) {
+            [self closeClient:client];
+        }
+        for (PrinterGatewayPrinter *printer in [self->_printers allValues]) {
+            [self closePrinter:printer];
+        }
+    });
+}
+
+- (void)acceptClients {
+    while (YES) {
+        int fd = accept(_listenFD, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+#ifdef SO_NOSIGPIPE
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+        PrinterGatewayClient *client = [[PrinterGatewayClient alloc] init];
+        client.fd = fd;
+        client.input = [NSMutableData data];
+        client.output = [NSMutableData data];
+        dispatch_source_t readSource, writeSource;
+        PrinterGatewayMakeSources(fd, _queue, &readSource, &writeSource);
+        client.readSource = readSource;
+        client.writeSource = writeSource;
+        client.writeSuspended = YES;
+        __weak PrinterGateway *weakSelf = self;
+        __weak PrinterGatewayClient *weakClient = client;
+        dispatch_source_set_event_handler(readSource, ^{
+            [weakSelf readClient:weakClient];
+        });
+        dispatch_source_set_event_handler(writeSource, ^{
+            PrinterGatewayClient *strongClient = weakClient;
+            if (strongClient && !strongClient.writeSuspended) {
+                dispatch_suspend(strongClient.writeSource);
+                strongClient.writeSuspended = YES;
+                [weakSelf flushClient:strongClient];
+            }
+        });
+        [_clients addObject:client];
+        _statistics.clientCount = _clients.count;
+        dispatch_resume(readSource);
+    }
+}
+
+#pragma mark - Clients
+
+- (void)readClient:(PrinterGatewayClient *)client {
+    if (client == nil || client.closed) {
+        return;
+    }
+    // Never hold more than one maximal frame per client
+    NSUInteger capacity = PrinterGatewayRequestHeaderLength + 255 + self.maxJobLength;
+    NSUInteger room = capacity > client.input.length ? capacity - client.input.length : 0;
+    if (room == 0) {
+        [self suspendReading:client];
+        return;
+    }
+    uint8_t buffer[PrinterGatewayReadLength];
+    ssize_t length = recv(client.fd, buffer, MIN(room, sizeof(buffer)), 0);
+    if (length > 0) {
+        [client.input appendBytes:buffer length:(NSUInteger)length];
+        [self parseClient:client];
+    } else if (length == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        [self closeClient:client];
+    }
+}
+
+/// Submits every complete frame in the client's buffer, stopping when the client gets paused
+- (void)parseClient:(PrinterGatewayClient *)client {
+    while (!client.closed && client.pausedOn == nil) {
+        const uint8_t *bytes = client.input.bytes;
+        NSUInteger available = client.input.length;
+        if (available < 9) {
+            return;
+        }
+        if (bytes[0] != 'P' || bytes[1] != 'J') {
+            [self closeClient:client];
+            return;
+        }
+        uint32_t jobID = PrinterGatewayReadUInt32(bytes + 2);
+        UInt16 port = (UInt16)((bytes[6] << 8) | bytes[7]);
+        NSUInteger hostLength = bytes[8];
+        if (available < 9 + hostLength + 4) {
+            return;
+        }
+        NSUInteger payloadLength = PrinterGatewayReadUInt32(bytes + 9 + hostLength);
+        NSString *host = [[NSString alloc] initWithBytes:bytes + 9 length:hostLength encoding:NSUTF8StringEncoding];
+        if (payloadLength > self.maxJobLength || host.length == 0) {
+            // The stream cannot be resynchronized after a bad frame
+            _statistics.jobsFailed++;
+            [self replyToClient:client jobID:jobID status:PrinterGatewayJobRejected];
+            client.closeAfterFlush = YES;
+            [self suspendReading:client];
+            [self flushClient:client];
+            return;
+        }
+        NSUInteger frameLength = PrinterGatewayRequestHeaderLength + hostLength + payloadLength;
+        if (available < frameLength) {
+            return;
+        }
+        NSData *payload = [client.input subdataWithRange:NSMakeRange(frameLength - payloadLength, payloadLength)];
+        [client.input replaceBytesInRange:NSMakeRange(0, frameLength) withBytes:NULL length:0];
+
+        __weak PrinterGatewayClient *weakClient = client;
+        PrinterGatewayPrinter *printer = [self enqueueJob:payload host:host port:port completion:^(PrinterGatewayJobStatus status) {
+            [self replyToClient:weakClient jobID:jobID status:status];
+        }];
+        if (printer.queuedBytes > self.maxPendingBytesPerPrinter) {
+            client.pausedOn = printer;
+            [printer.pausedClients addObject:client];
+            [self suspendReading:client];
+        }
+    }
+}
+
+- (void)suspendReading:(PrinterGatewayClient *)client {
+    if (!client.readSuspended && !client.closed) {
+        client.readSuspended = YES;
+        dispatch_suspend(client.readSource);
+    }
+}
+
+- (void)resumeClient:(PrinterGatewayClient *)client {
+    client.pausedOn = nil;
+    if (client.closed || client.closeAfterFlush) {
+        return;
+    }
+    [self parseClient:client];
+    if (client.pausedOn == nil && client.readSuspended) {
+        client.readSuspended = NO;
+        dispatch_resume(client.readSource);
+    }
+}
+
+- (void)replyToClient:(PrinterGatewayClient *)client jobID:(uint32_t)jobID status:(PrinterGatewayJobStatus)status {
+    if (client == nil || client.closed) {
+        return;
+    }
+    uint8_t reply[7] = {'P', 'R', (uint8_t)(jobID >> 24), (uint8_t)(jobID >> 16), (uint8_t)(jobID >> 8), (uint8_t)jobID, status};
+    [client.output appendBytes:reply length:sizeof(reply)];
+    [self flushClient:client];
+}
+
+- (void)flushClient:(PrinterGatewayClient *)client {
+    while (client.output.length > 0 && !client.closed) {
+        ssize_t sent = send(client.fd, client.output.bytes, client.output.length, MSG_NOSIGNAL);
+        if (sent > 0) {
+            [client.output replaceBytesInRange:NSMakeRange(0, (NSUInteger)sent) withBytes:NULL length:0];
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (client.writeSuspended) {
+                client.writeSuspended = NO;
+                dispatch_resume(client.writeSource);
+            }
+            return;
+        } else {
+            [self closeClient:client];
+            return;
+        }
+    }
+    if (client.closeAfterFlush) {
+        [self closeClient:client];
+    }
+}
+
+- (void)closeClient:(PrinterGatewayClient *)client {
+    if (client.closed) {
+        return;
+    }
+    client.closed = YES;
+    [client.pausedOn.pausedClients removeObject:client];
+    client.pausedOn = nil;
+    dispatch_source_cancel(client.readSource);
+    dispatch_source_cancel(client.writeSource);
+    if (client.readSuspended) {
+        dispatch_resume(client.readSource);
+    }
+    if (client.writeSuspended) {
+        dispatch_resume(client.writeSource);
+    }
+    client.input = nil;
+    client.output = nil;
+    [_clients removeObject:client];
+    _statistics.clientCount = _clients.count;
+}
+
+#pragma mark - Printers
+
+- (void)submitJob:(NSData *)data host:(NSString *)host port:(UInt16)port completion:(void (^)(PrinterGatewayJobStatus))completion {
+    NSData *copy = [data copy];
+    dispatch_async(_queue, ^{
+        [self enqueueJob:copy host:host port:port completion:completion];
+    });
+}
+
+- (PrinterGatewayPrinter *)enqueueJob:(NSData *)data host:(NSString *)host port:(UInt16)port completion:(void (^)(PrinterGatewayJobStatus))completion {
+    port = port ?: 9100;
+    NSString *key = [NSString stringWithFormat:@"%@:%u", host, port];
+    PrinterGatewayPrinter *printer = _printers[key];
+    if (printer == nil) {
+        printer = [self printerWithHost:host port:port key:key];
+        _printers[key] = printer;
+        _statistics.printerCount = _printers.count;
+    }
+    _statistics.jobsAccepted++;
+    PrinterGatewayJob *job = [[PrinterGatewayJob alloc] init];
+    job.data = data;
+    job.completion = completion;
+    printer.queuedBytes += data.length;
+    printer.idleGeneration++;
+    if (printer.connected) {
+        [self writeJob:job toPrinter:printer];
+    } else {
+        [printer.waitingJobs addObject:job];
+        [printer.transport connect];
+    }
+    return printer;
+}
+
+- (PrinterGatewayPrinter *)printerWithHost:(NSString *)host port:(UInt16)port key:(NSString *)key {
+    PrinterGatewayPrinter *printer = [[PrinterGatewayPrinter alloc] init];
+    printer.key = key;
+    printer.waitingJobs = [NSMutableArray array];
+    printer.pausedClients = [NSMutableArray array];
+    printer.transport = [[PrinterSocketTransport alloc] initWithHost:host port:port queue:_queue];
+    printer.transport.connectTimeout = self.connectTimeout;
+    printer.transport.callbackQueue = _queue;
+    __weak PrinterGatewayPrinter *weakPrinter = printer;
+    printer.transport.stateBlock = ^(PrinterTransportState state, NSError *error) {
+        [self printer:weakPrinter didChangeState:state];
+    };
+    return printer;
+}
+
+- (void)printer:(PrinterGatewayPrinter *)printer didChangeState:(PrinterTransportState)state {
+    if (printer == nil) {
+        return;
+    }
+    if (state == PrinterTransportConnected) {
+        printer.connected = YES;
+        NSArray<PrinterGatewayJob *> *jobs = [printer.waitingJobs copy];
+        [printer.waitingJobs removeAllObjects];
+        for (PrinterGatewayJob *job in jobs) {
+            [self writeJob:job toPrinter:printer];
+        }
+    } else if (state == PrinterTransportDisconnected) {
+        // Jobs already handed to the transport fail through their write completions
+        printer.connected = NO;
+        NSArray<PrinterGatewayJob *> *jobs = [printer.waitingJobs copy];
+        [printer.waitingJobs removeAllObjects];
+        for (PrinterGatewayJob *job in jobs) {
+            [self finishJob:job printer:printer status:PrinterGatewayJobFailed];
+        }
+    }
+}
+
+- (void)writeJob:(PrinterGatewayJob *)job toPrinter:(PrinterGatewayPrinter *)printer {
+    [printer.transport writeData:job.data completion:^(BOOL success, NSError *error) {
+        [self finishJob:job printer:printer status:success ? PrinterGatewayJobPrinted : PrinterGatewayJobFailed];
+    }];
+}
+
+- (void)finishJob:(PrinterGatewayJob *)job printer:(PrinterGatewayPrinter *)printer status:(PrinterGatewayJobStatus)status {
+    printer.queuedBytes -= MIN(printer.queuedBytes, job.data.length);
+    if (status == PrinterGatewayJobPrinted) {
+        _statistics.jobsPrinted++;
+    } else {
+        _statistics.jobsFailed++;
+    }
+    if (job.completion) {
+        job.completion(status);
+    }
+    if (printer.queuedBytes <= self.maxPendingBytesPerPrinter && printer.pausedClients.count > 0) {
+        NSArray<PrinterGatewayClient *> *clients = [printer.pausedClients copy];
+        [printer.pausedClients removeAllObjects];
+        for (PrinterGatewayClient *client in clients) {
+            [self resumeClient:client];
+        }
+    }
+    if (printer.queuedBytes == 0) {
+        [self scheduleIdleCloseOfPrinter:printer];
+    }
+}
+
+/// Closes a printer connection nothing was queued on for idleTimeout, keeping descriptors bounded
+- (void)scheduleIdleCloseOfPrinter:(PrinterGatewayPrinter *)printer {
+    NSUInteger generation = ++printer.idleGeneration;
+    __weak PrinterGatewayPrinter *weakPrinter = printer;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.idleTimeout * NSEC_PER_SEC)), _queue, ^{
+        PrinterGatewayPrinter *idle = weakPrinter;
+        if (idle && idle.idleGeneration == generation && idle.queuedBytes == 0) {
+            [self closePrinter:idle];
+        }
+    });
+}
+
+- (void)closePrinter:(PrinterGatewayPrinter *)printer {
+    [printer.transport disconnect];
+    [self printer:printer didChangeState:PrinterTransportDisconnected];
+    if (_printers[printer.key] == printer) {
+        [_printers removeObjectForKey:printer.key];
+        _statistics.printerCount = _printers.count;
+    }
+}
+
+@end
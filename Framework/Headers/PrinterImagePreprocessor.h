@@ -0,0 +1,63 @@
+//
+//  PrinterImagePreprocessor.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "PrinterBitmap.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Prepares images for printing: color to gray, gamma, contrast, resize and threshold.
+///
+/// Every stage uses integer arithmetic with fixed rounding, so the result is the same on every
+/// platform. On Apple platforms the gray conversion and the gamma/contrast table run through
+/// vImage; elsewhere, or with usesAccelerate NO, they run through scalar C loops (no SIMD) that give
+/// identical pixels. Resizing is scalar C in both paths and averages the covered source area, since
+/// vImage's own scaling filters are not reproducible.
+@interface PrinterImagePreprocessor : NSObject
+
+/// Gamma applied to the gray levels, above 1 darkens mid tones (default: 1)
+@property (nonatomic, assign) double gamma;
+
+/// Contrast around mid gray, 1 leaves it unchanged (default: 1)
+@property (nonatomic, assign) double contrast;
+
+/// Output width in dots, 0 keeps the image width; the height keeps the aspect ratio (default: 0)
+@property (nonatomic, assign) int targetWidth;
+
+/// Gray level (0-255) below which a dot is printed (default: 128)
+@property (nonatomic, assign) int threshold;
+
+/// Whether vImage is used where available (default: YES)
+@property (nonatomic, assign) BOOL usesAccelerate;
+
+/// Converts an image; transparent areas are treated as white
+/// @param image The image
+/// @return The bitmap, or nil if the image has no bitmap representation
+- (nullable PrinterBitmap *)bitmapWithImage:(UIImage *)image;
+
+/// Converts RGBA pixels with premultiplied alpha
+/// @param rgba Pixels, 4 bytes each in R, G, B, A order
+/// @param width Width in pixels
+/// @param height Height in pixels
+/// @param stride Bytes between the starts of two rows
+- (PrinterBitmap *)bitmapWithRGBAPixels:(const uint8_t *)rgba width:(int)width height:(int)height stride:(size_t)stride;
+
+/// The preprocessed 8-bit gray image before thresholding, 0 is black
+/// @param rgba Pixels, 4 bytes each in R, G, B, A order, premultiplied alpha
+/// @param width Width in pixels
+/// @param height Height in pixels
+/// @param stride Bytes between the starts of two rows
+/// @param outputWidth Set to the width of the result, which is also its stride
+/// @param outputHeight Set to the height of the result
+- (NSData *)grayPixelsWithRGBAPixels:(const uint8_t *)rgba
+                               width:(int)width
+                              height:(int)height
+                              stride:(size_t)stride
+                         outputWidth:(int *)outputWidth
+                        outputHeight:(int *)outputHeight;
+
+@end
+
+NS_ASSUME_NONNULL_END
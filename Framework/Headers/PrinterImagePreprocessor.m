@@ -0,0 +1,156 @@
+//
+//  PrinterImagePreprocessor.m
+//  Printer
+//
+
+#import "PrinterImagePreprocessor.h"
+#if defined(__APPLE__)
+#import <Accelerate/Accelerate.h>
+#endif
+
+/// BT.601 luma weights in 1/256, applied to R, G, B; A is weighted -256 to composite over white
+static const int16_t PrinterGrayWeights[4] = {77, 150, 29, -256};
+static const int32_t PrinterGrayDivisor = 256;
+/// Rounds the weighted sum and adds 255 for the white background
+static const int32_t PrinterGrayBias = 128 + 256 * 255;
+
+/// Gray level of a premultiplied RGBA pixel composited over white
+static inline uint8_t PrinterGrayLevel(const uint8_t *pixel) {
+    int32_t sum = PrinterGrayWeights[0] * pixel[0] + PrinterGrayWeights[1] * pixel[1] + PrinterGrayWeights[2] * pixel[2] + PrinterGrayWeights[3] * pixel[3];
+    int32_t level = (sum + PrinterGrayBias) / PrinterGrayDivisor;
+    return (uint8_t)MIN(MAX(level, 0), 255);
+}
+
+/// Averages the source area each output pixel covers. Source pixel i spans [i * dstCount, (i + 1) * dstCount)
+/// and output pixel x spans [x * srcCount, (x + 1) * srcCount), so all weights are integers summing to srcCount.
+static void PrinterResampleLine(const uint8_t *src, size_t srcStep, int srcCount, uint8_t *dst, size_t dstStep, int dstCount) {
+    for (int x = 0; x < dstCount; x++) {
+        uint64_t start = (uint64_t)x * (uint64_t)srcCount;
+        uint64_t end = start + (uint64_t)srcCount;
+        uint64_t sum = 0;
+        for (uint64_t i = start / (uint64_t)dstCount; i * (uint64_t)dstCount < end; i++) {
+            uint64_t low = MAX(start, i * (uint64_t)dstCount);
+            uint64_t high = MIN(end, (i + 1) * (uint64_t)dstCount);
+            sum += (high - low) * src[i * srcStep];
+        }
+        dst[x * dstStep] = (uint8_t)((sum + (uint64_t)srcCount / 2) / (uint64_t)srcCount);
+    }
+}
+
+@implementation PrinterImagePreprocessor
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _gamma = 1;
+        _contrast = 1;
+        _threshold = 128;
+        _usesAccelerate = YES;
+    }
+    return self;
+}
+
+/// Gamma and contrast as one lookup table
+- (void)fillTable:(uint8_t *)table {
+    double gamma = self.gamma > 0 ? self.gamma : 1;
+    for (int i = 0; i < 256; i++) {
+        double value = pow(i / 255.0, gamma) * 255.0;
+        value = (value - 128.0) * self.contrast + 128.0;
+        table[i] = (uint8_t)lround(MIN(MAX(value, 0.0), 255.0));
+    }
+}
+
+- (NSData *)grayPixelsWithRGBAPixels:(const uint8_t *)rgba width:(int)width height:(int)height stride:(size_t)stride outputWidth:(int *)outputWidth outputHeight:(int *)outputHeight {
+    width = MAX(width, 0);
+    height = MAX(height, 0);
+    NSMutableData *gray = [NSMutableData dataWithLength:(NSUInteger)width * (NSUInteger)height];
+    uint8_t table[256];
+    [self fillTable:table];
+    BOOL identity = YES;
+    for (int i = 0; i < 256 && identity; i++) {
+        identity = table[i] == i;
+    }
+
+    BOOL accelerated = NO;
+#if defined(__APPLE__)
+    if (self.usesAccelerate && width > 0 && height > 0) {
+        vImage_Buffer src = {(void *)rgba, (vImagePixelCount)height, (vImagePixelCount)width, stride};
+        vImage_Buffer dst = {gray.mutableBytes, (vImagePixelCount)height, (vImagePixelCount)width, (size_t)width};
+        vImage_Error error = vImageMatrixMultiply_ARGB8888ToPlanar8(&src, &dst, PrinterGrayWeights, PrinterGrayDivisor, NULL, PrinterGrayBias, kvImageNoFlags);
+        if (error == kvImageNoError && !identity) {
+            error = vImageTableLookUp_Planar8(&dst, &dst, table, kvImageNoFlags);
+        }
+        accelerated = error == kvImageNoError;
+    }
+#endif
+    if (!accelerated) {
+        uint8_t *out = gray.mutableBytes;
+        for (int y = 0; y < height; y++) {
+            const uint8_t *row = rgba + (size_t)y * stride;
+            uint8_t *dst = out + (size_t)y * width;
+            for (int x = 0; x < width; x++) {
+                dst[x] = table[PrinterGrayLevel(row + 4 * x)];
+            }
+        }
+    }
+
+    int targetWidth = self.targetWidth > 0 ? self.targetWidth : width;
+    int targetHeight = width > 0 ? (int)(((int64_t)height * targetWidth + width / 2) / width) : 0;
+    if (targetHeight == 0 && height > 0) {
+        targetHeight = 1;
+    }
+    if (outputWidth) {
+        *outputWidth = width > 0 ? targetWidth : 0;
+    }
+    if (outputHeight) {
+        *outputHeight = targetHeight;
+    }
+    if (width == 0 || (targetWidth == width && targetHeight == height)) {
+        return gray;
+    }
+
+    // Rows first, then columns, each rounded to 8 bits
+    NSMutableData *rows = [NSMutableData dataWithLength:(NSUInteger)targetWidth * (NSUInteger)height];
+    for (int y = 0; y < height; y++) {
+        PrinterResampleLine((const uint8_t *)gray.bytes + (size_t)y * width, 1, width, (uint8_t *)rows.mutableBytes + (size_t)y * targetWidth, 1, targetWidth);
+    }
+    NSMutableData *scaled = [NSMutableData dataWithLength:(NSUInteger)targetWidth * (NSUInteger)targetHeight];
+    for (int x = 0; x < targetWidth; x++) {
+        PrinterResampleLine((const uint8_t *)rows.bytes + x, (size_t)targetWidth, height, (uint8_t *)scaled.mutableBytes + x, (size_t)targetWidth, targetHeight);
+    }
+    return scaled;
+}
+
+- (PrinterBitmap *)bitmapWithRGBAPixels:(const uint8_t *)rgba width:(int)width height:(int)height stride:(size_t)stride {
+    int outputWidth = 0;
+    int outputHeight = 0;
+    NSData *gray = [self grayPixelsWithRGBAPixels:rgba width:width height:height stride:stride outputWidth:&outputWidth outputHeight:&outputHeight];
+    return [PrinterBitmap bitmapWithGrayPixels:gray.bytes width:outputWidth height:outputHeight stride:(size_t)outputWidth threshold:self.threshold];
+}
+
+- (PrinterBitmap *)bitmapWithImage:(UIImage *)image {
+    CGImageRef cgImage = image.CGImage;
+    if (cgImage == NULL) {
+        return nil;
+    }
+    size_t width = CGImageGetWidth(cgImage);
+    size_t height = CGImageGetHeight(cgImage);
+    if (width == 0 || height == 0) {
+        return nil;
+    }
+
+    // Drawn as is, without a background; the gray conversion composites over white
+    NSMutableData *pixels = [NSMutableData dataWithLength:width * height * 4];
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(pixels.mutableBytes, width, height, 8, width * 4, colorSpace, (CGBitmapInfo)kCGImageAlphaPremultipliedLast);
+    CGColorSpaceRelease(colorSpace);
+    if (context == NULL) {
+        return nil;
+    }
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), cgImage);
+    CGContextRelease(context);
+
+    return [self bitmapWithRGBAPixels:pixels.bytes width:(int)width height:(int)height stride:width * 4];
+}
+
+@end
@@ -0,0 +1,67 @@
+//
+//  PrinterPacketizer.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "PrinterResumableTransfer.h"
+
+@class WIFIConnecter;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Sends one packet; call done once the packet was written
+typedef void (^PrinterPacketWriter)(NSData *packet, void (^done)(BOOL success));
+
+/// Packs whole commands into MTU-sized packets instead of cutting the stream at fixed offsets.
+/// Commands are kept in order and added to the current packet while they fit. A raster image
+/// (GS v 0) that does not fit is re-encoded into several smaller GS v 0 commands split at row
+/// boundaries; any other command larger than a packet is split at byte offsets as a last resort.
+@interface PrinterPacketizer : NSObject
+
+/// Maximum packet size in bytes
+@property (nonatomic, assign) NSUInteger packetSize;
+
+/// Average fill of the packets of the last packetization, 0-1
+@property (nonatomic, readonly) double lastFillRatio;
+
+/// Creates a packetizer
+/// @param packetSize Maximum packet size, e.g. the BLE MTU minus 3
+- (instancetype)initWithPacketSize:(NSUInteger)packetSize;
+
+/// Packs a job built command by command
+/// @param job The job
+- (NSArray<NSData *> *)packetsForJob:(PrinterJobBuffer *)job;
+
+/// Packs a list of complete commands
+/// @param commands The commands in print order
+- (NSArray<NSData *> *)packetsForCommands:(NSArray<NSData *> *)commands;
+
+/// Sends packets one after another, each only after the previous one was written.
+/// The writer may call done synchronously; the packets are then sent in a loop, not recursively.
+/// @param packets The packets
+/// @param writer Writes a single packet
+/// @param completion Called after the last packet or the first failure
+- (void)sendPackets:(NSArray<NSData *> *)packets writer:(PrinterPacketWriter)writer completion:(nullable void (^)(BOOL success))completion;
+
+/// Packs and sends a job over POSBLEManager, each packet in a single package
+/// @param job The job
+/// @param manager The connected manager
+/// @param completion Called after the last packet or the first failure
+- (void)sendJob:(PrinterJobBuffer *)job posManager:(POSBLEManager *)manager completion:(nullable void (^)(BOOL success))completion;
+
+/// Packs and sends a job over TSCBLEManager, each packet in a single package
+/// @param job The job
+/// @param manager The connected manager
+/// @param completion Called after the last packet or the first failure
+- (void)sendJob:(PrinterJobBuffer *)job tscManager:(TSCBLEManager *)manager completion:(nullable void (^)(BOOL success))completion;
+
+/// Packs and sends a job over a WiFi connection
+/// @param job The job
+/// @param connecter The connected printer
+/// @param completion Called after the last packet or the first failure
+- (void)sendJob:(PrinterJobBuffer *)job wifiConnecter:(WIFIConnecter *)connecter completion:(nullable void (^)(BOOL success))completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
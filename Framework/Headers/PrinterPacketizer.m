@@ -0,0 +1,246 @@
+//
+//  PrinterPacketizer.m
+//  Printer
+//
+
+#import "PrinterPacketizer.h"
+#import "WIFIConnecter.h"
+
+/// GS v 0 m xL xH yL yH
+static const NSUInteger PrinterRasterHeaderLength = 8;
+
+/// One sendPackets:writer:completion: call. A packet the writer finishes synchronously is picked
+/// up by the loop in -pump, so thousands of packets do not nest thousands of stack frames.
+@interface PPacketSendRun : NSObject
+@property (nonatomic, copy) NSArray<NSData *> *packets;
+@property (nonatomic, copy) PrinterPacketWriter writer;
+@property (nonatomic, copy) void (^completion)(BOOL success);
+@end
+
+@implementation PPacketSendRun {
+    NSUInteger _index;
+    /// The packet at _index may be written
+    BOOL _ready;
+    /// -pump is on the stack
+    BOOL _pumping;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _ready = YES;
+    }
+    return self;
+}
+
+- (void)pump {
+    if (_pumping) {
+        return;
+    }
+    _pumping = YES;
+    while (_ready) {
+        _ready = NO;
+        if (_index >= self.packets.count) {
+            if (self.completion) {
+                self.completion(YES);
+            }
+            break;
+        }
+        NSUInteger index = _index;
+        __block BOOL finished = NO;
+        self.writer(self.packets[index], ^(BOOL success) {
+            if (finished) {
+                return;
+            }
+            finished = YES;
+            if (!success) {
+                if (self.completion) {
+                    self.completion(NO);
+                }
+                return;
+            }
+            self->_index = index + 1;
+            self->_ready = YES;
+            [self pump];
+        });
+    }
+    _pumping = NO;
+}
+
+@end
+
+@implementation PrinterPacketizer {
+    NSMutableArray<NSData *> *_packets;
+    NSMutableData *_current;
+    NSUInteger _payload;
+}
+
+- (instancetype)initWithPacketSize:(NSUInteger)packetSize {
+    self = [super init];
+    if (self) {
+        _packetSize = MAX(packetSize, 1);
+    }
+    return self;
+}
+
+- (instancetype)init {
+    return [self initWithPacketSize:20];
+}
+
+#pragma mark - Packing
+
+- (void)beginPacking {
+    _packets = [NSMutableArray array];
+    _current = [NSMutableData dataWithCapacity:self.packetSize];
+    _payload = 0;
+}
+
+- (NSArray<NSData *> *)endPacking {
+    [self flush];
+    NSArray<NSData *> *packets = _packets;
+    _lastFillRatio = packets.count > 0 ? (double)_payload / (double)(packets.count * self.packetSize) : 0;
+    _packets = nil;
+    _current = nil;
+    return packets;
+}
+
+- (void)flush {
+    if (_current.length == 0) {
+        return;
+    }
+    _payload += _current.length;
+    [_packets addObject:[_current copy]];
+    _current = [NSMutableData dataWithCapacity:self.packetSize];
+}
+
+- (void)addCommandBytes:(const uint8_t *)bytes length:(NSUInteger)length {
+    NSUInteger packetSize = self.packetSize;
+    if (length <= packetSize) {
+        if (_current.length + length > packetSize) {
+            [self flush];
+        }
+        [_current appendBytes:bytes length:length];
+        return;
+    }
+    if ([self addRasterBytes:bytes length:length]) {
+        return;
+    }
+    // No safe split point is known, fill the packets completely
+    NSUInteger offset = 0;
+    while (offset < length) {
+        if (_current.length == packetSize) {
+            [self flush];
+        }
+        NSUInteger count = MIN(packetSize - _current.length, length - offset);
+        [_current appendBytes:bytes + offset length:count];
+        offset += count;
+    }
+}
+
+/// Re-encodes an oversized GS v 0 image as several images of whole rows. Returns NO if the command is no raster image
+/// or a single row does not fit into a packet.
+- (BOOL)addRasterBytes:(const uint8_t *)bytes length:(NSUInteger)length {
+    if (length < PrinterRasterHeaderLength || bytes[0] != 0x1D || bytes[1] != 0x76 || bytes[2] != 0x30) {
+        return NO;
+    }
+    NSUInteger bytesPerRow = bytes[4] | (bytes[5] << 8);
+    NSUInteger rows = bytes[6] | (bytes[7] << 8);
+    if (bytesPerRow == 0 || length < PrinterRasterHeaderLength + bytesPerRow * rows ||
+        PrinterRasterHeaderLength + bytesPerRow > self.packetSize) {
+        return NO;
+    }
+
+    const uint8_t *data = bytes + PrinterRasterHeaderLength;
+    NSUInteger row = 0;
+    while (row < rows) {
+        NSUInteger space = self.packetSize - _current.length;
+        if (space < PrinterRasterHeaderLength + bytesPerRow) {
+            [self flush];
+            space = self.packetSize;
+        }
+        NSUInteger count = MIN(rows - row, (space - PrinterRasterHeaderLength) / bytesPerRow);
+        uint8_t header[PrinterRasterHeaderLength] = {
+            0x1D, 0x76, 0x30, bytes[3],
+            (uint8_t)(bytesPerRow & 0xFF), (uint8_t)(bytesPerRow >> 8),
+            (uint8_t)(count & 0xFF), (uint8_t)(count >> 8)
+        };
+        [_current appendBytes:header length:sizeof(header)];
+        [_current appendBytes:data + row * bytesPerRow length:count * bytesPerRow];
+        row += count;
+    }
+
+    // Bytes trailing the image belong to no known command
+    NSUInteger used = PrinterRasterHeaderLength + bytesPerRow * rows;
+    if (length > used) {
+        [self addCommandBytes:bytes + used length:length - used];
+    }
+    return YES;
+}
+
+- (NSArray<NSData *> *)packetsForCommands:(NSArray<NSData *> *)commands {
+    [self beginPacking];
+    for (NSData *command in commands) {
+        [self addCommandBytes:command.bytes length:command.length];
+    }
+    return [self endPacking];
+}
+
+- (NSArray<NSData *> *)packetsForJob:(PrinterJobBuffer *)job {
+    [self beginPacking];
+    const uint8_t *bytes = job.data.bytes;
+    __block NSUInteger start = 0;
+    [job.commandBoundaries enumerateIndexesUsingBlock:^(NSUInteger boundary, BOOL *stop) {
+        if (boundary > start) {
+            [self addCommandBytes:bytes + start length:boundary - start];
+            start = boundary;
+        }
+    }];
+    if (job.data.length > start) {
+        [self addCommandBytes:bytes + start length:job.data.length - start];
+    }
+    return [self endPacking];
+}
+
+#pragma mark - Sending
+
+- (void)sendPackets:(NSArray<NSData *> *)packets writer:(PrinterPacketWriter)writer completion:(void (^)(BOOL))completion {
+    PPacketSendRun *run = [[PPacketSendRun alloc] init];
+    run.packets = packets;
+    run.writer = writer;
+    run.completion = completion;
+    [run pump];
+}
+
+- (void)sendJob:(PrinterJobBuffer *)job posManager:(POSBLEManager *)manager completion:(void (^)(BOOL))completion {
+    [self sendPackets:[self packetsForJob:job] writer:^(NSData *packet, void (^done)(BOOL)) {
+        [manager sendData:packet withPackageSize:packet.length completion:^(BOOL success, NSUInteger totalBytesSent, NSUInteger currentPackageIndex, NSError *error) {
+            if (error || !success) {
+                done(NO);
+            } else if (totalBytesSent >= packet.length) {
+                done(YES);
+            }
+        }];
+    } completion:completion];
+}
+
+- (void)sendJob:(PrinterJobBuffer *)job tscManager:(TSCBLEManager *)manager completion:(void (^)(BOOL))completion {
+    [self sendPackets:[self packetsForJob:job] writer:^(NSData *packet, void (^done)(BOOL)) {
+        [manager sendData:packet withPackageSize:packet.length completion:^(BOOL success, NSUInteger totalBytesSent, NSUInteger currentPackageIndex, NSError *error) {
+            if (error || !success) {
+                done(NO);
+            } else if (totalBytesSent >= packet.length) {
+                done(YES);
+            }
+        }];
+    } completion:completion];
+}
+
+- (void)sendJob:(PrinterJobBuffer *)job wifiConnecter:(WIFIConnecter *)connecter completion:(void (^)(BOOL))completion {
+    [self sendPackets:[self packetsForJob:job] writer:^(NSData *packet, void (^done)(BOOL)) {
+        [connecter writeCommandWithData:packet writeCallBack:^(BOOL success, NSError *error) {
+            done(success && error == nil);
+        }];
+    } completion:completion];
+}
+
+@end
@@ -0,0 +1,114 @@
+//
+//  PrinterProvisioner.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "PrinterAddressResolver.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Network settings for one printer
+@interface PrinterProvisioningConfig : NSObject
+
+/// MAC address of the printer to configure
+@property (nonatomic, copy) NSString *mac;
+
+/// Static IP address, ignored with DHCP
+@property (nonatomic, copy, nullable) NSString *ip;
+
+/// Subnet mask
+@property (nonatomic, copy, nullable) NSString *mask;
+
+/// Gateway address
+@property (nonatomic, copy, nullable) NSString *gateway;
+
+/// Use DHCP instead of the static address
+@property (nonatomic, assign) BOOL dhcp;
+
+/// Wi-Fi SSID; when set the Wi-Fi configuration is written instead of the IP configuration
+@property (nonatomic, copy, nullable) NSString *ssid;
+
+/// Wi-Fi password
+@property (nonatomic, copy, nullable) NSString *password;
+
+/// Wi-Fi encryption type (see POSWIFIManager setWiFiConfigWithIP:mask:gateway:ssid:password:encrypt:)
+@property (nonatomic, assign) NSUInteger encrypt;
+
+/// Creates a static IP configuration
++ (instancetype)configWithMAC:(NSString *)mac ip:(NSString *)ip mask:(NSString *)mask gateway:(NSString *)gateway;
+
+/// Creates a DHCP configuration
++ (instancetype)dhcpConfigWithMAC:(NSString *)mac;
+
+@end
+
+/// Outcome for one printer
+typedef NS_ENUM(NSInteger, PrinterProvisioningStatus) {
+    PrinterProvisioningSucceeded = 0,      ///< Configured and reachable at the expected address
+    PrinterProvisioningNotFound,           ///< Not answering discovery, nothing was sent
+    PrinterProvisioningVerificationFailed, ///< Configured, but not reachable before the deadline
+    PrinterProvisioningConfigurationFailed ///< Found, but the UDP socket for sending the configuration could not be opened
+};
+
+/// Result for one printer
+@interface PrinterProvisioningResult : NSObject
+
+/// The configuration applied
+@property (nonatomic, strong, readonly) PrinterProvisioningConfig *config;
+
+/// Outcome
+@property (nonatomic, readonly) PrinterProvisioningStatus status;
+
+/// Address the printer answered at after configuration, nil unless it succeeded
+@property (nonatomic, copy, readonly, nullable) NSString *verifiedIP;
+
+/// Time from sending the configuration until the result, in seconds
+@property (nonatomic, readonly) NSTimeInterval duration;
+
+@end
+
+/// Provisions many printers in one run: one discovery sweep for the whole manifest, configurations
+/// written one after another through POSWIFIManager (it configures the printer in connectedPrinter, so
+/// writes cannot overlap; its previous connectedPrinter is restored after the last write), and verification that every printer comes back at its new address running
+/// concurrently with bounded parallelism once all writes are out. A DHCP printer only counts as verified
+/// at an address other than the one it had before, or at the same address after it was seen restarting.
+@interface PrinterProvisioner : NSObject
+
+/// Deadline of the discovery sweep (default: 3 s)
+@property (nonatomic, assign) NSTimeInterval discoveryTimeout;
+
+/// Pause between two configuration writes (default: 0.2 s)
+@property (nonatomic, assign) NSTimeInterval configInterval;
+
+/// Time a printer gets to restart and answer at its new address (default: 30 s)
+@property (nonatomic, assign) NSTimeInterval verifyTimeout;
+
+/// Delay between verification attempts of one printer (default: 1 s)
+@property (nonatomic, assign) NSTimeInterval verifyRetryInterval;
+
+/// Printers verified at the same time (default: 8)
+@property (nonatomic, assign) NSUInteger maxConcurrentVerifications;
+
+/// TCP port used to verify a printer (default: 9100)
+@property (nonatomic, assign) UInt16 port;
+
+/// Creates a provisioner
+/// @param manager The manager used for discovery and configuration
+/// @param resolver The resolver used for verification
+- (instancetype)initWithManager:(POSWIFIManager *)manager resolver:(PrinterAddressResolver *)resolver;
+
+/// Creates a provisioner using the shared manager and resolver
+- (instancetype)init;
+
+/// Provisions all printers of a manifest
+/// @param manifest One configuration per printer
+/// @param progress Called on the main queue with each printer's result as soon as it is known
+/// @param completion Called on the main queue with the results in manifest order, one per printer
+- (void)provisionManifest:(NSArray<PrinterProvisioningConfig *> *)manifest
+                 progress:(nullable void (^)(PrinterProvisioningResult *result))progress
+               completion:(void (^)(NSArray<PrinterProvisioningResult *> *results))completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,268 @@
+//
+//  PrinterProvisioner.m
+//  Printer
+//
+
+#import "PrinterProvisioner.h"
+
+@implementation PrinterProvisioningConfig
+
++ (instancetype)configWithMAC:(NSString *)mac ip:(NSString *)ip mask:(NSString *)mask gateway:(NSString *)gateway {
+    PrinterProvisioningConfig *config = [[self alloc] init];
+    config.mac = mac;
+    config.ip = ip;
+    config.mask = mask;
+    config.gateway = gateway;
+    return config;
+}
+
++ (instancetype)dhcpConfigWithMAC:(NSString *)mac {
+    PrinterProvisioningConfig *config = [[self alloc] init];
+    config.mac = mac;
+    config.dhcp = YES;
+    return config;
+}
+
+@end
+
+@interface PrinterProvisioningResult ()
+- (instancetype)initWithConfig:(PrinterProvisioningConfig *)config status:(PrinterProvisioningStatus)status verifiedIP:(NSString *)ip duration:(NSTimeInterval)duration;
+@end
+
+@implementation PrinterProvisioningResult
+
+- (instancetype)initWithConfig:(PrinterProvisioningConfig *)config status:(PrinterProvisioningStatus)status verifiedIP:(NSString *)ip duration:(NSTimeInterval)duration {
+    self = [super init];
+    if (self) {
+        _config = config;
+        _status = status;
+        _verifiedIP = [ip copy];
+        _duration = duration;
+    }
+    return self;
+}
+
+@end
+
+/// State of one provisioning run
+@interface PrinterProvisioningRun : NSObject
+@property (nonatomic, copy) NSArray<PrinterProvisioningConfig *> *manifest;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, PrinterProvisioningResult *> *results;
+@property (nonatomic, strong) NSMutableArray<PrinterProvisioningConfig *> *verifyQueue;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSDate *> *configuredAt;
+/// Address each printer answered discovery from before it was configured
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSString *> *previousIPs;
+/// Printers that stopped answering after configuration, i.e. restarted
+@property (nonatomic, strong) NSMutableSet<NSString *> *droppedOff;
+@property (nonatomic, assign) NSUInteger activeVerifications;
+/// The manager's connected printer before configuration retargeted it, restored afterwards
+@property (nonatomic, strong) PrinterProfile *savedPrinter;
+/// Distinct printers in the manifest
+@property (nonatomic, assign) NSUInteger expectedCount;
+@property (nonatomic, copy) void (^progress)(PrinterProvisioningResult *result);
+@property (nonatomic, copy) void (^completion)(NSArray<PrinterProvisioningResult *> *results);
+@end
+
+@implementation PrinterProvisioningRun
+@end
+
+@implementation PrinterProvisioner {
+    POSWIFIManager *_manager;
+    PrinterAddressResolver *_resolver;
+    PrinterDiscoveryService *_discovery;
+}
+
+- (instancetype)init {
+    return [self initWithManager:[POSWIFIManager sharedInstance] resolver:[PrinterAddressResolver sharedResolver]];
+}
+
+- (instancetype)initWithManager:(POSWIFIManager *)manager resolver:(PrinterAddressResolver *)resolver {
+    self = [super init];
+    if (self) {
+        _manager = manager;
+        _resolver = resolver;
+        _discovery = manager == [POSWIFIManager sharedInstance] ? [PrinterDiscoveryService sharedService] : [[PrinterDiscoveryService alloc] initWithManager:manager];
+        _discoveryTimeout = 3;
+        _configInterval = 0.2;
+        _verifyTimeout = 30;
+        _verifyRetryInterval = 1;
+        _maxConcurrentVerifications = 8;
+        _port = 9100;
+    }
+    return self;
+}
+
+- (void)provisionManifest:(NSArray<PrinterProvisioningConfig *> *)manifest
+                 progress:(void (^)(PrinterProvisioningResult *))progress
+               completion:(void (^)(NSArray<PrinterProvisioningResult *> *))completion {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self provisionManifest:manifest progress:progress completion:completion];
+        });
+        return;
+    }
+    PrinterProvisioningRun *run = [[PrinterProvisioningRun alloc] init];
+    run.manifest = manifest;
+    run.results = [NSMutableDictionary dictionary];
+    run.verifyQueue = [NSMutableArray array];
+    run.configuredAt = [NSMutableDictionary dictionary];
+    run.previousIPs = [NSMutableDictionary dictionary];
+    run.droppedOff = [NSMutableSet set];
+    run.progress = progress;
+    run.completion = completion;
+
+    NSMutableDictionary<NSString *, PrinterProvisioningConfig *> *wanted = [NSMutableDictionary dictionary];
+    for (PrinterProvisioningConfig *config in manifest) {
+        wanted[[PrinterDiscoveryService normalizedMAC:config.mac]] = config;
+    }
+    if (wanted.count == 0) {
+        completion(@[]);
+        return;
+    }
+    run.expectedCount = wanted.count;
+
+    // One sweep for the whole manifest, ended early once every printer answered
+    NSMutableDictionary<NSString *, PrinterProfile *> *found = [NSMutableDictionary dictionary];
+    __weak PrinterDiscoveryService *discovery = _discovery;
+    [_discovery discoverWithTimeout:self.discoveryTimeout result:^(PrinterDiscoveryRecord *record, BOOL isNew) {
+        if (wanted[record.mac] && record.profile) {
+            found[record.mac] = record.profile;
+            run.previousIPs[record.mac] = record.ip;
+            if (found.count == wanted.count) {
+                [discovery stopDiscovery];
+            }
+        }
+    } completion:^(NSArray<PrinterDiscoveryRecord *> *records) {
+        NSMutableArray<PrinterProvisioningConfig *> *configure = [NSMutableArray array];
+        for (PrinterProvisioningConfig *config in manifest) {
+            NSString *mac = [PrinterDiscoveryService normalizedMAC:config.mac];
+            if (found[mac]) {
+                [configure addObject:config];
+            } else {
+                [self finishConfig:config status:PrinterProvisioningNotFound ip:nil run:run];
+            }
+        }
+        // The sweep closed the UDP socket the configuration is written to
+        if (configure.count > 0 && ![self->_manager createUdpSocket]) {
+            for (PrinterProvisioningConfig *config in configure) {
+                [self finishConfig:config status:PrinterProvisioningConfigurationFailed ip:nil run:run];
+            }
+            [self checkCompletion:run];
+            return;
+        }
+        run.savedPrinter = self->_manager.connectedPrinter;
+        [self configureNext:configure profiles:found run:run];
+    }];
+}
+
+#pragma mark - Configuration
+
+/// Writes the configurations one at a time, the manager holds a single target printer.
+/// Verification waits until all are written: its discovery sweeps open and close the same UDP socket.
+- (void)configureNext:(NSMutableArray<PrinterProvisioningConfig *> *)pending profiles:(NSDictionary<NSString *, PrinterProfile *> *)profiles run:(PrinterProvisioningRun *)run {
+    if (pending.count == 0) {
+        // The manager is shared, other users expect it to point at their printer again
+        _manager.connectedPrinter = run.savedPrinter;
+        run.savedPrinter = nil;
+        [_manager closeUdpSocket];
+        [self startVerifications:run];
+        [self checkCompletion:run];
+        return;
+    }
+    PrinterProvisioningConfig *config = pending.firstObject;
+    [pending removeObjectAtIndex:0];
+    NSString *mac = [PrinterDiscoveryService normalizedMAC:config.mac];
+
+    _manager.connectedPrinter = profiles[mac];
+    NSString *ip = config.dhcp ? @"0.0.0.0" : (config.ip ?: @"");
+    NSString *mask = config.mask ?: @"255.255.255.0";
+    NSString *gateway = config.gateway ?: @"0.0.0.0";
+    if (config.ssid.length > 0) {
+        [_manager setWiFiConfigWithIP:ip mask:mask gateway:gateway ssid:config.ssid password:config.password ?: @"" encrypt:config.encrypt];
+    } else {
+        [_manager setIPConfigWithIP:ip Mask:mask Gateway:gateway DHCP:config.dhcp];
+    }
+    run.configuredAt[mac] = [NSDate date];
+
+    // The printer now restarts with its new address; neither cache may still point at the old one
+    [_resolver invalidateMAC:mac];
+    [_discovery removeCachedRecordForMAC:mac];
+    if (!config.dhcp && config.ip.length > 0) {
+        [_resolver recordAddress:config.ip forMAC:mac];
+    }
+    [run.verifyQueue addObject:config];
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.configInterval * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [self configureNext:pending profiles:profiles run:run];
+    });
+}
+
+#pragma mark - Verification
+
+- (void)startVerifications:(PrinterProvisioningRun *)run {
+    NSUInteger limit = MAX(self.maxConcurrentVerifications, 1);
+    while (run.activeVerifications < limit && run.verifyQueue.count > 0) {
+        PrinterProvisioningConfig *config = run.verifyQueue.firstObject;
+        [run.verifyQueue removeObjectAtIndex:0];
+        run.activeVerifications++;
+        [self verifyConfig:config run:run];
+    }
+}
+
+- (void)verifyConfig:(PrinterProvisioningConfig *)config run:(PrinterProvisioningRun *)run {
+    NSString *mac = [PrinterDiscoveryService normalizedMAC:config.mac];
+    [_resolver resolveMAC:mac port:self.port completion:^(NSString *ip, NSArray<PrinterResolveAttempt *> *attempts) {
+        if (ip == nil) {
+            [run.droppedOff addObject:mac];
+        }
+        // A DHCP printer still answering at its old address may not have applied the change yet;
+        // that address only counts once the printer was seen gone, since the lease can stay the same
+        BOOL expected = ip != nil && (config.dhcp ? (![ip isEqualToString:run.previousIPs[mac]] || [run.droppedOff containsObject:mac]) : [ip isEqualToString:config.ip]);
+        NSTimeInterval elapsed = -[run.configuredAt[mac] timeIntervalSinceNow];
+        if (expected || elapsed >= self.verifyTimeout) {
+            run.activeVerifications--;
+            [self finishConfig:config status:expected ? PrinterProvisioningSucceeded : PrinterProvisioningVerificationFailed ip:expected ? ip : nil run:run];
+            [self startVerifications:run];
+            [self checkCompletion:run];
+            return;
+        }
+        // Still restarting, keep the slot and try again
+        if (!config.dhcp && config.ip.length > 0) {
+            [self->_resolver recordAddress:config.ip forMAC:mac];
+        }
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.verifyRetryInterval * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            [self verifyConfig:config run:run];
+        });
+    }];
+}
+
+#pragma mark - Results
+
+- (void)finishConfig:(PrinterProvisioningConfig *)config status:(PrinterProvisioningStatus)status ip:(NSString *)ip run:(PrinterProvisioningRun *)run {
+    NSString *mac = [PrinterDiscoveryService normalizedMAC:config.mac];
+    NSDate *configuredAt = run.configuredAt[mac];
+    NSTimeInterval duration = configuredAt ? -[configuredAt timeIntervalSinceNow] : 0;
+    PrinterProvisioningResult *result = [[PrinterProvisioningResult alloc] initWithConfig:config status:status verifiedIP:ip duration:duration];
+    run.results[mac] = result;
+    if (run.progress) {
+        run.progress(result);
+    }
+}
+
+- (void)checkCompletion:(PrinterProvisioningRun *)run {
+    if (run.completion == nil || run.results.count < run.expectedCount) {
+        return;
+    }
+    NSMutableArray<PrinterProvisioningResult *> *results = [NSMutableArray arrayWithCapacity:run.manifest.count];
+    for (PrinterProvisioningConfig *config in run.manifest) {
+        PrinterProvisioningResult *result = run.results[[PrinterDiscoveryService normalizedMAC:config.mac]];
+        if (result && ![results containsObject:result]) {
+            [results addObject:result];
+        }
+    }
+    void (^completion)(NSArray<PrinterProvisioningResult *> *) = run.completion;
+    run.completion = nil;
+    completion(results);
+}
+
+@end
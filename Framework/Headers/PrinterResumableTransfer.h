@@ -0,0 +1,116 @@
+//
+//  PrinterResumableTransfer.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "POSBLEManager.h"
+#import "TSCBLEManager.h"
+#import "PrinterSpool.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Job data together with the offsets where its commands start.
+/// Build it command by command, e.g. [buffer appendCommand:[POSCommand printText:...]].
+/// Spool it with enqueueJob:commandBoundaries:committed: so the boundaries survive an app restart.
+@interface PrinterJobBuffer : NSObject
+
+/// Creates an empty buffer
+- (instancetype)init;
+
+/// Creates a buffer from data whose command starts are already known
+/// @param data All command bytes
+/// @param boundaries Command start offsets, nil if unknown, which makes every offset a boundary
+- (instancetype)initWithData:(NSData *)data commandBoundaries:(nullable NSIndexSet *)boundaries;
+
+/// Creates a buffer from a recovered spool job, with the boundaries stored in the journal
+/// @param job The spooled job; resume it with startFromOffset:job.bytesSent
+- (instancetype)initWithSpoolJob:(PrinterSpoolJob *)job;
+
+/// All command bytes
+@property (nonatomic, readonly) NSData *data;
+
+/// Offsets at which a command starts; 0 and the end of the data are always boundaries
+@property (nonatomic, readonly) NSIndexSet *commandBoundaries;
+
+/// Appends one complete command
+/// @param command The command bytes
+- (void)appendCommand:(NSData *)command;
+
+/// Appends several complete commands
+/// @param commands The commands
+- (void)appendCommands:(NSArray<NSData *> *)commands;
+
+/// Returns the last command boundary at or before an offset
+/// @param offset A byte offset into the data
+- (NSUInteger)commandBoundaryAtOrBeforeOffset:(NSUInteger)offset;
+
+@end
+
+/// State of a resumable transfer
+typedef NS_ENUM(NSInteger, PrinterTransferState) {
+    PrinterTransferIdle = 0,   ///< Not started
+    PrinterTransferSending,    ///< Data is being sent
+    PrinterTransferSuspended,  ///< The link dropped, waiting for the printer to reconnect
+    PrinterTransferCompleted,  ///< All data was sent
+    PrinterTransferFailed      ///< Cancelled or out of resume attempts
+};
+
+/// Sends a job over a BLE manager and resumes after disconnects.
+/// Progress reported by sendData:withPackageSize:completion: is tracked per job; after the link drops
+/// the transfer waits for POSbleConnectPeripheral:/TSCbleConnectPeripheral: and continues from the last
+/// command boundary the printer acknowledged, never from the middle of a command.
+@interface PrinterResumableTransfer : NSObject <POSBLEManagerDelegate, TSCBLEManagerDelegate>
+
+/// The job being sent
+@property (nonatomic, readonly) PrinterJobBuffer *job;
+
+/// Current state
+@property (nonatomic, readonly) PrinterTransferState state;
+
+/// Bytes of the job the printer acknowledged
+@property (nonatomic, readonly) NSUInteger acknowledgedBytes;
+
+/// Number of times the transfer was resumed
+@property (nonatomic, readonly) NSUInteger resumeCount;
+
+/// Package size passed to sendData:withPackageSize:completion: (default: 20)
+@property (nonatomic, assign) NSUInteger packageSize;
+
+/// Resumes allowed before the transfer fails (default: 3)
+@property (nonatomic, assign) NSUInteger maxResumeAttempts;
+
+/// Bytes sent before the remaining data when resuming, e.g. a command that gets the printer out of a
+/// half-received command. Default: nil
+@property (nonatomic, copy, nullable) NSData *resumePrefix;
+
+/// Called on every acknowledged progress with the job offset, e.g. to checkpoint a PrinterSpool
+@property (nonatomic, copy, nullable) void (^progressBlock)(NSUInteger acknowledgedBytes);
+
+/// Called once when the transfer completes or fails
+@property (nonatomic, copy, nullable) void (^completionBlock)(BOOL success, NSError * _Nullable error);
+
+/// Creates a transfer over POSBLEManager
+/// @param job The job to send
+/// @param manager The connected manager
+- (instancetype)initWithJob:(PrinterJobBuffer *)job posManager:(POSBLEManager *)manager;
+
+/// Creates a transfer over TSCBLEManager
+/// @param job The job to send
+/// @param manager The connected manager
+- (instancetype)initWithJob:(PrinterJobBuffer *)job tscManager:(TSCBLEManager *)manager;
+
+/// Starts sending, or resumes from a known offset after an app restart.
+/// Calling it again after the transfer completed or failed sends the job again and reports a new completion.
+/// @param offset Job offset already acknowledged, rounded down to a command boundary
+- (void)startFromOffset:(NSUInteger)offset;
+
+/// Starts sending from the first byte
+- (void)start;
+
+/// Stops the transfer, the completion block reports failure
+- (void)cancel;
+
+@end
+
+NS_ASSUME_NONNULL_END
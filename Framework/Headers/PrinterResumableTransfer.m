@@ -0,0 +1,261 @@
+//
+//  PrinterResumableTransfer.m
+//  Printer
+//
+
+#import "PrinterResumableTransfer.h"
+
+@implementation PrinterJobBuffer {
+    NSMutableData *_buffer;
+    NSMutableIndexSet *_boundaries;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _buffer = [NSMutableData data];
+        _boundaries = [NSMutableIndexSet indexSetWithIndex:0];
+    }
+    return self;
+}
+
+- (instancetype)initWithData:(NSData *)data commandBoundaries:(NSIndexSet *)boundaries {
+    self = [self init];
+    if (self) {
+        [_buffer appendData:data];
+        if (boundaries) {
+            NSMutableIndexSet *known = _boundaries;
+            [boundaries enumerateIndexesInRange:NSMakeRange(0, data.length) options:0 usingBlock:^(NSUInteger index, BOOL *stop) {
+                [known addIndex:index];
+            }];
+        } else {
+            [_boundaries addIndexesInRange:NSMakeRange(0, data.length)];
+        }
+        [_boundaries addIndex:data.length];
+    }
+    return self;
+}
+
+- (instancetype)initWithSpoolJob:(PrinterSpoolJob *)job {
+    return [self initWithData:job.data commandBoundaries:job.commandBoundaries];
+}
+
+- (NSData *)data {
+    return _buffer;
+}
+
+- (NSIndexSet *)commandBoundaries {
+    return _boundaries;
+}
+
+- (void)appendCommand:(NSData *)command {
+    if (command.length == 0) {
+        return;
+    }
+    [_buffer appendData:command];
+    [_boundaries addIndex:_buffer.length];
+}
+
+- (void)appendCommands:(NSArray<NSData *> *)commands {
+    for (NSData *command in commands) {
+        [self appendCommand:command];
+    }
+}
+
+- (NSUInteger)commandBoundaryAtOrBeforeOffset:(NSUInteger)offset {
+    if ([_boundaries containsIndex:offset]) {
+        return offset;
+    }
+    NSUInteger boundary = [_boundaries indexLessThanIndex:offset];
+    return boundary == NSNotFound ? 0 : boundary;
+}
+
+@end
+
+typedef void (^PrinterTransferSendCompletion)(BOOL success, NSUInteger totalBytesSent, NSUInteger currentPackageIndex, NSError *error);
+
+@implementation PrinterResumableTransfer {
+    __weak POSBLEManager *_posManager;
+    __weak TSCBLEManager *_tscManager;
+    /// Offset of the first job byte in the current send call
+    NSUInteger _sendOffset;
+    /// Prefix bytes in front of the job bytes in the current send call
+    NSUInteger _prefixLength;
+    /// Ignores callbacks of send calls that were abandoned by a disconnect
+    NSUInteger _generation;
+}
+
+- (instancetype)initWithJob:(PrinterJobBuffer *)job {
+    self = [super init];
+    if (self) {
+        _job = job;
+        _packageSize = 20;
+        _maxResumeAttempts = 3;
+    }
+    return self;
+}
+
+- (instancetype)initWithJob:(PrinterJobBuffer *)job posManager:(POSBLEManager *)manager {
+    self = [self initWithJob:job];
+    if (self) {
+        _posManager = manager;
+    }
+    return self;
+}
+
+- (instancetype)initWithJob:(PrinterJobBuffer *)job tscManager:(TSCBLEManager *)manager {
+    self = [self initWithJob:job];
+    if (self) {
+        _tscManager = manager;
+    }
+    return self;
+}
+
+- (BOOL)isConnected {
+    if (_posManager) {
+        return [_posManager printerIsConnect];
+    }
+    return _tscManager.isConnecting;
+}
+
+- (void)sendData:(NSData *)data completion:(PrinterTransferSendCompletion)completion {
+    if (_posManager) {
+        [_posManager sendData:data withPackageSize:self.packageSize completion:completion];
+    } else {
+        [_tscManager sendData:data withPackageSize:self.packageSize completion:completion];
+    }
+}
+
+- (void)start {
+    [self startFromOffset:0];
+}
+
+- (void)startFromOffset:(NSUInteger)offset {
+    if (self.state == PrinterTransferSending) {
+        return;
+    }
+    // A finished transfer starts over, otherwise finishWithSuccess:error: would swallow its completion
+    if (self.state == PrinterTransferCompleted || self.state == PrinterTransferFailed) {
+        _state = PrinterTransferIdle;
+        _resumeCount = 0;
+    }
+    if (_posManager) {
+        _posManager.delegate = self;
+    } else {
+        _tscManager.delegate = self;
+    }
+    _acknowledgedBytes = [self.job commandBoundaryAtOrBeforeOffset:MIN(offset, self.job.data.length)];
+    [self sendFromAcknowledgedOffsetWithPrefix:offset > 0];
+}
+
+- (void)cancel {
+    [self finishWithSuccess:NO error:[NSError errorWithDomain:NSCocoaErrorDomain code:NSUserCancelledError userInfo:nil]];
+}
+
+- (void)sendFromAcknowledgedOffsetWithPrefix:(BOOL)withPrefix {
+    NSData *jobData = self.job.data;
+    if (self.acknowledgedBytes >= jobData.length) {
+        [self finishWithSuccess:YES error:nil];
+        return;
+    }
+    _state = PrinterTransferSending;
+    _sendOffset = self.acknowledgedBytes;
+    NSMutableData *data = [NSMutableData data];
+    if (withPrefix && self.resumePrefix) {
+        [data appendData:self.resumePrefix];
+    }
+    _prefixLength = data.length;
+    [data appendData:[jobData subdataWithRange:NSMakeRange(_sendOffset, jobData.length - _sendOffset)]];
+
+    NSUInteger generation = ++_generation;
+    __weak typeof(self) weakSelf = self;
+    [self sendData:data completion:^(BOOL success, NSUInteger totalBytesSent, NSUInteger currentPackageIndex, NSError *error) {
+        [weakSelf handleSendResult:success totalBytesSent:totalBytesSent error:error generation:generation];
+    }];
+}
+
+- (void)handleSendResult:(BOOL)success totalBytesSent:(NSUInteger)totalBytesSent error:(NSError *)error generation:(NSUInteger)generation {
+    if (generation != _generation || self.state != PrinterTransferSending) {
+        return;
+    }
+    if (totalBytesSent > _prefixLength) {
+        NSUInteger acknowledged = MIN(_sendOffset + totalBytesSent - _prefixLength, self.job.data.length);
+        if (acknowledged > _acknowledgedBytes) {
+            _acknowledgedBytes = acknowledged;
+            if (self.progressBlock) {
+                self.progressBlock(acknowledged);
+            }
+        }
+    }
+    if (error || !success) {
+        [self suspendWithError:error];
+        return;
+    }
+    if (_acknowledgedBytes >= self.job.data.length) {
+        [self finishWithSuccess:YES error:nil];
+    }
+}
+
+/// Falls back to the last acknowledged command boundary and waits for the link
+- (void)suspendWithError:(NSError *)error {
+    _generation++;
+    _acknowledgedBytes = [self.job commandBoundaryAtOrBeforeOffset:_acknowledgedBytes];
+    if (self.resumeCount >= self.maxResumeAttempts) {
+        [self finishWithSuccess:NO error:error];
+        return;
+    }
+    _state = PrinterTransferSuspended;
+    if ([self isConnected]) {
+        [self resume];
+    }
+}
+
+- (void)resume {
+    if (self.state != PrinterTransferSuspended) {
+        return;
+    }
+    _resumeCount++;
+    [self sendFromAcknowledgedOffsetWithPrefix:YES];
+}
+
+- (void)finishWithSuccess:(BOOL)success error:(NSError *)error {
+    if (self.state == PrinterTransferCompleted || self.state == PrinterTransferFailed) {
+        return;
+    }
+    _generation++;
+    _state = success ? PrinterTransferCompleted : PrinterTransferFailed;
+    if (_posManager) {
+        [_posManager removeDelegate:self];
+    } else {
+        [_tscManager removeDelegate:self];
+    }
+    if (self.completionBlock) {
+        self.completionBlock(success, error);
+    }
+}
+
+#pragma mark - POSBLEManagerDelegate
+
+- (void)POSbleDisconnectPeripheral:(CBPeripheral *)peripheral error:(NSError *)error {
+    if (self.state == PrinterTransferSending) {
+        [self suspendWithError:error];
+    }
+}
+
+- (void)POSbleConnectPeripheral:(CBPeripheral *)peripheral {
+    [self resume];
+}
+
+#pragma mark - TSCBLEManagerDelegate
+
+- (void)TSCbleDisconnectPeripheral:(CBPeripheral *)peripheral error:(NSError *)error {
+    if (self.state == PrinterTransferSending) {
+        [self suspendWithError:error];
+    }
+}
+
+- (void)TSCbleConnectPeripheral:(CBPeripheral *)peripheral {
+    [self resume];
+}
+
+@end
@@ -0,0 +1,64 @@
+//
+//  PrinterSendBatcher.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "PrinterTransport.h"
+#import "POSWIFIManager.h"
+#import "TSCWIFIManager.h"
+#import "WIFIConnecter.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Writes one batch; call done once it was written
+typedef void (^PrinterBatchWriter)(NSData *data, void (^done)(BOOL success, NSError * _Nullable error));
+
+/// Opt-in coalescing of small writes, e.g. one POSCommand fragment per receipt line.
+/// Fragments are collected for up to maxDelay or maxBytes and written as one batch; every fragment's
+/// completion is called when its batch completes. Only one batch is written at a time, because the
+/// managers keep a single write callback; fragments queued meanwhile are coalesced into the next
+/// batch, which is written when the previous one completes. Batches reference the fragment buffers
+/// instead of copying them, and PrinterSocketTransport sends such a batch with one vectored send.
+@interface PrinterSendBatcher : NSObject
+
+/// Longest time a fragment waits for more (default: 0.002 s)
+@property (nonatomic, assign) NSTimeInterval maxDelay;
+
+/// Batch size that is written at once (default: 4096)
+@property (nonatomic, assign) NSUInteger maxBytes;
+
+/// Fragments written so far
+@property (nonatomic, readonly) NSUInteger fragmentCount;
+
+/// Batches written so far
+@property (nonatomic, readonly) NSUInteger batchCount;
+
+/// Creates a batcher over a write block
+- (instancetype)initWithWriter:(PrinterBatchWriter)writer;
+
+/// Creates a batcher over a receipt printer WiFi manager
+- (instancetype)initWithPOSManager:(POSWIFIManager *)manager;
+
+/// Creates a batcher over a label printer WiFi manager
+- (instancetype)initWithTSCManager:(TSCWIFIManager *)manager;
+
+/// Creates a batcher over a WIFIConnecter
+- (instancetype)initWithConnecter:(WIFIConnecter *)connecter;
+
+/// Creates a batcher over a transport
+- (instancetype)initWithTransport:(id<PrinterTransport>)transport;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/// Queues a fragment
+/// @param data The fragment
+/// @param completion Called on the main queue when the batch holding the fragment was written
+- (void)writeData:(NSData *)data completion:(nullable void (^)(BOOL success, NSError * _Nullable error))completion;
+
+/// Writes the collected fragments now, or as soon as the batch in flight completes
+- (void)flush;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,145 @@
+//
+//  PrinterSendBatcher.m
+//  Printer
+//
+
+#import "PrinterSendBatcher.h"
+
+@implementation PrinterSendBatcher {
+    PrinterBatchWriter _writer;
+#if defined(__APPLE__)
+    dispatch_data_t _batch;
+#else
+    NSMutableData *_batch;
+#endif
+    NSMutableArray *_completions;
+    NSUInteger _batchLength;
+    NSUInteger _batchFragments;
+    /// Bumped by every flush so stale timers do nothing
+    NSUInteger _generation;
+    /// A batch is being written; the managers keep a single write callback, so the next batch waits for it
+    BOOL _writing;
+}
+
+- (instancetype)initWithWriter:(PrinterBatchWriter)writer {
+    self = [super init];
+    if (self) {
+        _writer = [writer copy];
+        _maxDelay = 0.002;
+        _maxBytes = 4096;
+        _completions = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (instancetype)initWithPOSManager:(POSWIFIManager *)manager {
+    return [self initWithWriter:^(NSData *data, void (^done)(BOOL, NSError *)) {
+        [manager writeCommandWithData:data writeCallBack:^(BOOL success, NSError *error) {
+            done(success, error);
+        }];
+    }];
+}
+
+- (instancetype)initWithTSCManager:(TSCWIFIManager *)manager {
+    return [self initWithWriter:^(NSData *data, void (^done)(BOOL, NSError *)) {
+        [manager writeCommandWithData:data writeCallBack:^(long tag) {
+            done(YES, nil);
+        }];
+    }];
+}
+
+- (instancetype)initWithConnecter:(WIFIConnecter *)connecter {
+    return [self initWithWriter:^(NSData *data, void (^done)(BOOL, NSError *)) {
+        [connecter writeCommandWithData:data writeCallBack:^(BOOL success, NSError *error) {
+            done(success, error);
+        }];
+    }];
+}
+
+- (instancetype)initWithTransport:(id<PrinterTransport>)transport {
+    return [self initWithWriter:^(NSData *data, void (^done)(BOOL, NSError *)) {
+        [transport writeData:data completion:done];
+    }];
+}
+
+#pragma mark - Batching
+
+- (void)writeData:(NSData *)data completion:(void (^)(BOOL, NSError *))completion {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self writeData:data completion:completion];
+        });
+        return;
+    }
+    if (data.length == 0) {
+        if (completion) {
+            completion(YES, nil);
+        }
+        return;
+    }
+    NSData *fragment = [data copy];
+#if defined(__APPLE__)
+    // Reference the fragment's bytes, the batch keeps the fragment alive
+    dispatch_data_t region = dispatch_data_create(fragment.bytes, fragment.length, NULL, ^{
+        (void)fragment;
+    });
+    _batch = _batch ? dispatch_data_create_concat(_batch, region) : region;
+#else
+    if (_batch == nil) {
+        _batch = [NSMutableData dataWithCapacity:self.maxBytes];
+    }
+    [_batch appendData:fragment];
+#endif
+    [_completions addObject:completion ?: [NSNull null]];
+    _batchLength += fragment.length;
+    _batchFragments++;
+
+    if (_batchLength >= self.maxBytes) {
+        [self flush];
+    } else if (_batchFragments == 1) {
+        NSUInteger generation = _generation;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.maxDelay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            if (generation == self->_generation) {
+                [self flush];
+            }
+        });
+    }
+}
+
+- (void)flush {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self flush];
+        });
+        return;
+    }
+    _generation++;
+    if (_batchFragments == 0 || _writing) {
+        // Fragments queued while a batch is in flight go out when it completes
+        return;
+    }
+    // dispatch_data_t is an NSData on Apple platforms; its regions stay separate
+    NSData *batch = (NSData *)_batch;
+    NSArray *completions = [_completions copy];
+    _batch = nil;
+    [_completions removeAllObjects];
+    _fragmentCount += _batchFragments;
+    _batchCount++;
+    _batchLength = 0;
+    _batchFragments = 0;
+    _writing = YES;
+
+    _writer(batch, ^(BOOL success, NSError *error) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            self->_writing = NO;
+            for (id completion in completions) {
+                if (completion != [NSNull null]) {
+                    ((void (^)(BOOL, NSError *))completion)(success, error);
+                }
+            }
+            [self flush];
+        });
+    });
+}
+
+@end
@@ -0,0 +1,41 @@
+//
+//  PrinterSocketTransport.h
+//  Printer
+//
+
+#import "PrinterTransport.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Raw TCP transport (port 9100 style) on plain POSIX sockets and dispatch sources.
+/// It depends on Foundation and libdispatch only, so the encoding, queuing and packetizing
+/// pipeline can run against store printers from a server as well as from the app.
+/// Connects are non-blocking and wait on a dispatch source, so no thread is held while a printer
+/// does not answer; only a host name lookup runs on a global queue.
+@interface PrinterSocketTransport : PrinterBaseTransport
+
+/// Printer host name or address
+@property (nonatomic, copy, readonly) NSString *host;
+
+/// Printer port
+@property (nonatomic, readonly) UInt16 port;
+
+/// Seconds to wait for the TCP connection (default: 5)
+@property (nonatomic, assign) NSTimeInterval connectTimeout;
+
+/// Creates a transport; call connect to open it
+/// @param host Printer host name or address
+/// @param port Printer port, usually 9100
+- (instancetype)initWithHost:(NSString *)host port:(UInt16)port;
+
+/// Creates a transport whose socket events are handled on queue, e.g. one queue for all printers of a server
+/// @param host Printer host name or address
+/// @param port Printer port, usually 9100
+/// @param queue Target queue of the transport's I/O, nil for its own
+- (instancetype)initWithHost:(NSString *)host port:(UInt16)port queue:(nullable dispatch_queue_t)queue;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,363 @@
+//
+//  PrinterSocketTransport.m
+//  Printer
+//
+
+#import "PrinterSocketTransport.h"
+#import <sys/socket.h>
+#import <sys/uio.h>
+#import <netinet/in.h>
+#import <netinet/tcp.h>
+#import <netdb.h>
+#import <fcntl.h>
+#import <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/// Bytes read from the socket at a time
+static const size_t PrinterSocketReadLength = 4096;
+
+/// Regions passed to one vectored send
+#define PrinterSocketMaxVectors 64
+
+/// Resolves host and port; numericOnly fails at once for names instead of asking DNS
+static struct addrinfo *PrinterSocketResolve(NSString *host, UInt16 port, BOOL numericOnly) {
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | (numericOnly ? AI_NUMERICHOST : 0);
+    struct addrinfo *info = NULL;
+    NSString *service = [NSString stringWithFormat:@"%u", port];
+    if (getaddrinfo(host.UTF8String, service.UTF8String, &hints, &info) != 0) {
+        return NULL;
+    }
+    return info;
+}
+
+/// Non-blocking TCP socket for an address, -1 with errno set on failure
+static int PrinterSocketCreate(const struct addrinfo *ai) {
+    int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) {
+        return -1;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+@implementation PrinterSocketTransport {
+    dispatch_queue_t _ioQueue;
+    int _fd;
+    dispatch_source_t _readSource;
+    dispatch_source_t _writeSource;
+    BOOL _writeSourceSuspended;
+    NSData *_output;
+    NSUInteger _outputOffset;
+    void (^_outputDone)(BOOL success, NSError *error);
+    /// Bumped by closeLink so a connect finishing afterwards is dropped
+    NSUInteger _connectGeneration;
+    /// Addresses of the connect in progress, the next one to try and the socket being connected
+    struct addrinfo *_connectInfo;
+    struct addrinfo *_connectAddress;
+    dispatch_source_t _connectSource;
+}
+
+- (instancetype)initWithHost:(NSString *)host port:(UInt16)port {
+    return [self initWithHost:host port:port queue:nil];
+}
+
+- (instancetype)initWithHost:(NSString *)host port:(UInt16)port queue:(dispatch_queue_t)queue {
+    self = [super init];
+    if (self) {
+        _host = [host copy];
+        _port = port;
+        _connectTimeout = 5;
+        _fd = -1;
+        _ioQueue = dispatch_queue_create("com.printer.transport.socket", DISPATCH_QUEUE_SERIAL);
+        if (queue) {
+            dispatch_set_target_queue(_ioQueue, queue);
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self cancelConnect];
+    [self teardown];
+}
+
+#pragma mark - Link
+
+- (void)openLink {
+    NSString *host = self.host;
+    UInt16 port = self.port;
+    dispatch_async(_ioQueue, ^{
+        struct addrinfo *info = PrinterSocketResolve(host, port, YES);
+        if (info) {
+            [self connectToAddresses:info];
+            return;
+        }
+        // Only a host name lookup may block, so it alone leaves the I/O queue
+        NSUInteger generation = self->_connectGeneration;
+        dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+            struct addrinfo *resolved = PrinterSocketResolve(host, port, NO);
+            dispatch_async(self->_ioQueue, ^{
+                if (generation != self->_connectGeneration) {
+                    if (resolved) {
+                        freeaddrinfo(resolved);
+                    }
+                    return;
+                }
+                if (resolved == NULL) {
+                    [self didDisconnectWithError:[NSError errorWithDomain:NSPOSIXErrorDomain code:EHOSTUNREACH userInfo:nil]];
+                    return;
+                }
+                [self connectToAddresses:resolved];
+            });
+        });
+    });
+}
+
+- (void)closeLink {
+    dispatch_async(_ioQueue, ^{
+        self->_connectGeneration++;
+        [self cancelConnect];
+        [self teardown];
+    });
+}
+
+- (void)writeLinkData:(NSData *)data done:(void (^)(BOOL, NSError *))done {
+    dispatch_async(_ioQueue, ^{
+        if (self->_fd < 0) {
+            done(NO, [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOTCONN userInfo:nil]);
+            return;
+        }
+        self->_output = data;
+        self->_outputOffset = 0;
+        self->_outputDone = done;
+        [self flushOutput];
+    });
+}
+
+#pragma mark - Private (I/O queue)
+
+/// Starts a non-blocking connect to each address in turn until one accepts; takes ownership of info
+- (void)connectToAddresses:(struct addrinfo *)info {
+    [self cancelConnect];
+    _connectInfo = info;
+    _connectAddress = info;
+    [self connectNextAddressAfterError:ETIMEDOUT];
+}
+
+- (void)connectNextAddressAfterError:(int)lastError {
+    struct addrinfo *ai = _connectAddress;
+    if (ai == NULL) {
+        [self cancelConnect];
+        [self didDisconnectWithError:[NSError errorWithDomain:NSPOSIXErrorDomain code:lastError userInfo:nil]];
+        return;
+    }
+    _connectAddress = ai->ai_next;
+    int fd = PrinterSocketCreate(ai);
+    if (fd < 0) {
+        [self connectNextAddressAfterError:errno];
+        return;
+    }
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+        [self cancelConnect];
+        [self startWithSocket:fd];
+        [self didConnect];
+        return;
+    }
+    if (errno != EINPROGRESS) {
+        int error = errno;
+        close(fd);
+        [self connectNextAddressAfterError:error];
+        return;
+    }
+
+    // The socket turns writable once the connect finished either way; SO_ERROR tells which
+    dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, (uintptr_t)fd, 0, _ioQueue);
+    _connectSource = source;
+    NSUInteger generation = _connectGeneration;
+    __block BOOL connected = NO;
+    __weak PrinterSocketTransport *weakSelf = self;
+    dispatch_source_set_event_handler(source, ^{
+        PrinterSocketTransport *strongSelf = weakSelf;
+        if (strongSelf == nil || strongSelf->_connectSource != source) {
+            return;
+        }
+        int result = 0;
+        socklen_t length = sizeof(result);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &result, &length) != 0) {
+            result = errno;
+        }
+        strongSelf->_connectSource = nil;
+        connected = result == 0;
+        dispatch_source_cancel(source);
+        if (!connected) {
+            [strongSelf connectNextAddressAfterError:result];
+        }
+    });
+    // The socket moves to the read and write sources only after this source let go of it
+    dispatch_source_set_cancel_handler(source, ^{
+        PrinterSocketTransport *strongSelf = weakSelf;
+        if (!connected || strongSelf == nil || generation != strongSelf->_connectGeneration) {
+            close(fd);
+            return;
+        }
+        [strongSelf cancelConnect];
+        [strongSelf startWithSocket:fd];
+        [strongSelf didConnect];
+    });
+    dispatch_resume(source);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.connectTimeout * NSEC_PER_SEC)), _ioQueue, ^{
+        PrinterSocketTransport *strongSelf = weakSelf;
+        if (strongSelf == nil || strongSelf->_connectSource != source) {
+            return;
+        }
+        strongSelf->_connectSource = nil;
+        dispatch_source_cancel(source);
+        [strongSelf connectNextAddressAfterError:ETIMEDOUT];
+    });
+}
+
+/// Drops the connect in progress; its socket is closed by its source's cancel handler
+- (void)cancelConnect {
+    if (_connectSource) {
+        dispatch_source_cancel(_connectSource);
+        _connectSource = nil;
+    }
+    if (_connectInfo) {
+        freeaddrinfo(_connectInfo);
+        _connectInfo = NULL;
+    }
+    _connectAddress = NULL;
+}
+
+- (void)startWithSocket:(int)fd {
+    _fd = fd;
+    _readSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)fd, 0, _ioQueue);
+    _writeSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, (uintptr_t)fd, 0, _ioQueue);
+    __weak PrinterSocketTransport *weakSelf = self;
+    dispatch_source_set_event_handler(_readSource, ^{
+        [weakSelf readAvailable];
+    });
+    dispatch_source_set_event_handler(_writeSource, ^{
+        PrinterSocketTransport *strongSelf = weakSelf;
+        if (strongSelf) {
+            dispatch_suspend(strongSelf->_writeSource);
+            strongSelf->_writeSourceSuspended = YES;
+            [strongSelf flushOutput];
+        }
+    });
+    // The socket is closed once both sources stopped using it
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_group_enter(group);
+    dispatch_group_enter(group);
+    dispatch_source_set_cancel_handler(_readSource, ^{
+        dispatch_group_leave(group);
+    });
+    dispatch_source_set_cancel_handler(_writeSource, ^{
+        dispatch_group_leave(group);
+    });
+    dispatch_group_notify(group, _ioQueue, ^{
+        close(fd);
+    });
+    _writeSourceSuspended = YES;
+    dispatch_resume(_readSource);
+}
+
+- (void)readAvailable {
+    uint8_t buffer[PrinterSocketReadLength];
+    ssize_t length = recv(_fd, buffer, sizeof(buffer), 0);
+    if (length > 0) {
+        [self didReceiveData:[NSData dataWithBytes:buffer length:(NSUInteger)length]];
+    } else if (length == 0) {
+        [self failWithErrorCode:ECONNRESET];
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        [self failWithErrorCode:errno];
+    }
+}
+
+/// Sends as much of the current write as the socket takes, waiting on the write source for the rest.
+/// Discontiguous data (e.g. from PrinterSendBatcher) goes out as one vectored send of its regions.
+- (void)flushOutput {
+    if (_output == nil || _fd < 0) {
+        return;
+    }
+    while (_outputOffset < _output.length) {
+        struct iovec vectors[PrinterSocketMaxVectors];
+        struct iovec *vector = vectors;
+        __block int count = 0;
+        NSUInteger offset = _outputOffset;
+        [_output enumerateByteRangesUsingBlock:^(const void *bytes, NSRange range, BOOL *stop) {
+            if (NSMaxRange(range) <= offset) {
+                return;
+            }
+            NSUInteger skip = offset > range.location ? offset - range.location : 0;
+            vector[count].iov_base = (uint8_t *)bytes + skip;
+            vector[count].iov_len = range.length - skip;
+            *stop = ++count == PrinterSocketMaxVectors;
+        }];
+        struct msghdr message = {0};
+        message.msg_iov = vectors;
+        message.msg_iovlen = count;
+        ssize_t sent = sendmsg(_fd, &message, MSG_NOSIGNAL);
+        if (sent > 0) {
+            _outputOffset += (NSUInteger)sent;
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (_writeSourceSuspended) {
+                _writeSourceSuspended = NO;
+                dispatch_resume(_writeSource);
+            }
+            return;
+        } else {
+            [self failWithErrorCode:sent < 0 ? errno : EPIPE];
+            return;
+        }
+    }
+    void (^done)(BOOL, NSError *) = _outputDone;
+    _output = nil;
+    _outputDone = nil;
+    done(YES, nil);
+}
+
+- (void)failWithErrorCode:(int)code {
+    NSError *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil];
+    void (^done)(BOOL, NSError *) = _outputDone;
+    _output = nil;
+    _outputDone = nil;
+    if (done) {
+        done(NO, error);
+    }
+    [self teardown];
+    [self didDisconnectWithError:error];
+}
+
+- (void)teardown {
+    if (_fd < 0) {
+        return;
+    }
+    _fd = -1;
+    dispatch_source_cancel(_readSource);
+    dispatch_source_cancel(_writeSource);
+    if (_writeSourceSuspended) {
+        _writeSourceSuspended = NO;
+        dispatch_resume(_writeSource);
+    }
+    _readSource = nil;
+    _writeSource = nil;
+    _output = nil;
+    _outputDone = nil;
+}
+
+@end
@@ -0,0 +1,109 @@
+//
+//  PrinterSpool.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Error domain of PrinterSpool
+extern NSString * const PrinterSpoolErrorDomain;
+
+/// What happens to unfinished jobs found when a spool is opened
+typedef NS_ENUM(NSInteger, PrinterSpoolRecoveryPolicy) {
+    PrinterSpoolRecoveryResume = 0, ///< Keep the jobs and continue after the last transmitted checkpoint
+    PrinterSpoolRecoveryRestart,    ///< Keep the jobs and send them again from the first byte
+    PrinterSpoolRecoveryDiscard     ///< Drop the jobs
+};
+
+/// Progress callback with the signature of POSBLEManager/TSCBLEManager writeCompletion and sendData:withPackageSize:completion:
+typedef void (^PrinterSpoolProgressBlock)(BOOL success, NSUInteger totalBytesSent, NSUInteger currentPackageIndex, NSError * _Nullable error);
+
+/// A job stored in the spool
+@interface PrinterSpoolJob : NSObject
+
+/// Identifier, increasing in enqueue order
+@property (nonatomic, readonly) uint64_t jobID;
+
+/// All command bytes of the job
+@property (nonatomic, readonly) NSData *data;
+
+/// Where sending resumes. With command boundaries this is the start of the command the acknowledged
+/// progress is in; without them it is the raw checkpoint, which can fall inside a command.
+/// After a restart it is the last checkpoint, so up to checkpointGranularity bytes of whole commands
+/// the printer already received are sent again.
+@property (nonatomic, readonly) NSUInteger bytesSent;
+
+/// Offsets at which the job's commands start, nil if the job was enqueued without them
+@property (nonatomic, readonly, nullable) NSIndexSet *commandBoundaries;
+
+/// The bytes still to be sent, from bytesSent
+@property (nonatomic, readonly) NSData *remainingData;
+
+@end
+
+/// Durable print spool backed by a memory-mapped, append-only journal.
+/// Every record carries a sequence number and a CRC-32, so a record torn by a crash is detected and dropped on open.
+/// Records written to the mapping survive the app being killed right away; group commit flushes them to storage
+/// every commitInterval, so enqueueing only costs a copy and a checksum.
+@interface PrinterSpool : NSObject
+
+/// Delay after the first uncommitted write before the journal is flushed (default: 0.005 s)
+@property (nonatomic, assign) NSTimeInterval commitInterval;
+
+/// Minimum progress in bytes between two checkpoint records (default: 1024); the final progress is always recorded.
+/// Checkpoints of jobs with command boundaries are rounded down to a command start.
+@property (nonatomic, assign) NSUInteger checkpointGranularity;
+
+/// Unfinished jobs in enqueue order
+@property (nonatomic, readonly) NSArray<PrinterSpoolJob *> *pendingJobs;
+
+/// Opens or creates a spool
+/// @param path Journal file path
+/// @param policy What to do with unfinished jobs found in the journal
+/// @param error Receives the error if the journal cannot be opened
+- (nullable instancetype)initWithPath:(NSString *)path recoveryPolicy:(PrinterSpoolRecoveryPolicy)policy error:(NSError **)error;
+
+/// Appends a job
+/// @param data Command bytes of the job
+/// @param committed Called on the main queue once the job is flushed to storage, may be nil
+/// @return The job identifier, 0 if the journal could not grow
+- (uint64_t)enqueueJob:(NSData *)data committed:(nullable void (^)(BOOL durable))committed;
+
+/// Appends a job together with the offsets its commands start at, so a resume never begins mid-command
+/// @param data Command bytes of the job
+/// @param boundaries Command start offsets, e.g. PrinterJobBuffer.commandBoundaries; 0 is always a boundary
+/// @param committed Called on the main queue once the job is flushed to storage, may be nil
+/// @return The job identifier, 0 if the journal could not grow
+- (uint64_t)enqueueJob:(NSData *)data commandBoundaries:(nullable NSIndexSet *)boundaries committed:(nullable void (^)(BOOL durable))committed;
+
+/// Records transmitted progress of a job. Progress never moves backwards.
+/// @param bytesSent Bytes of the job acknowledged so far
+/// @param jobID The job identifier
+- (void)recordBytesSent:(NSUInteger)bytesSent forJob:(uint64_t)jobID;
+
+/// Marks a job as printed and removes it from the pending jobs
+/// @param jobID The job identifier
+- (void)completeJob:(uint64_t)jobID;
+
+/// Removes a job without printing it
+/// @param jobID The job identifier
+- (void)discardJob:(uint64_t)jobID;
+
+/// Returns a progress block for sending a job, completing the job once every byte was sent.
+/// @param jobID The job identifier
+/// @param offset Offset of the first byte handed to the send call, i.e. the job's bytesSent when resuming
+- (PrinterSpoolProgressBlock)progressBlockForJob:(uint64_t)jobID offset:(NSUInteger)offset;
+
+/// Flushes all written records to storage before returning
+- (void)synchronize;
+
+/// Rewrites the journal so it only holds unfinished jobs. If the rewritten journal cannot be mapped,
+/// the jobs stay in the file but this instance rejects further work; open the spool again to recover them.
+/// @param error Receives the error if the journal cannot be rewritten
+- (BOOL)compact:(NSError **)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,619 @@
+//
+//  PrinterSpool.m
+//  Printer
+//
+
+#import "PrinterSpool.h"
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <zlib.h>
+
+NSString * const PrinterSpoolErrorDomain = @"PrinterSpoolErrorDomain";
+
+static const uint32_t PSpoolFileMagic = 0x4C505350;   // "PSPL"
+static const uint32_t PSpoolRecordMagic = 0x43455250; // "PREC"
+static const uint32_t PSpoolVersion = 1;
+static const size_t PSpoolHeaderSize = 64;
+static const size_t PSpoolGrowth = 1 << 20;
+
+typedef NS_ENUM(uint32_t, PSpoolRecordType) {
+    PSpoolRecordJob = 1,      ///< value: job length, payload: job bytes
+    PSpoolRecordProgress = 2, ///< value: bytes sent
+    PSpoolRecordDone = 3,     ///< job printed or discarded
+    PSpoolRecordBoundaries = 4 ///< payload: uint32 offsets of the job's command starts
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t baseSequence;
+} PSpoolHeader;
+
+/// Record header, followed by the payload padded to 8 bytes.
+/// The sequence number continues from the file header, so stale records behind the tail never match.
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    uint64_t sequence;
+    uint64_t jobID;
+    uint64_t value;
+    uint32_t length;
+    uint32_t crc;
+} PSpoolRecord;
+
+static size_t PSpoolRecordSize(size_t length) {
+    return sizeof(PSpoolRecord) + ((length + 7) & ~(size_t)7);
+}
+
+static uint32_t PSpoolChecksum(PSpoolRecord record, const uint8_t *payload) {
+    record.crc = 0;
+    uLong crc = crc32(0L, (const Bytef *)&record, sizeof(record));
+    if (record.length > 0) {
+        crc = crc32(crc, payload, record.length);
+    }
+    return (uint32_t)crc;
+}
+
+static NSError *PSpoolError(NSString *description) {
+    return [NSError errorWithDomain:PrinterSpoolErrorDomain code:errno userInfo:@{NSLocalizedDescriptionKey: description}];
+}
+
+@interface PSpoolEntry : NSObject
+@property (nonatomic, assign) uint64_t jobID;
+@property (nonatomic, assign) size_t payloadOffset;
+@property (nonatomic, assign) NSUInteger length;
+@property (nonatomic, assign) NSUInteger bytesSent;
+@property (nonatomic, assign) NSUInteger checkpoint;
+/// Command starts, nil when the job was enqueued without them
+@property (nonatomic, strong) NSIndexSet *boundaries;
+@end
+
+@implementation PSpoolEntry
+
+/// Progress rounded down to the start of the command it is in
+- (NSUInteger)resumeOffsetForBytes:(NSUInteger)bytes {
+    if (self.boundaries == nil || bytes >= self.length) {
+        return bytes;
+    }
+    NSUInteger boundary = [self.boundaries indexLessThanOrEqualToIndex:bytes];
+    return boundary == NSNotFound ? 0 : boundary;
+}
+
+@end
+
+@interface PrinterSpoolJob ()
+- (instancetype)initWithJobID:(uint64_t)jobID data:(NSData *)data bytesSent:(NSUInteger)bytesSent commandBoundaries:(NSIndexSet *)boundaries;
+@end
+
+@implementation PrinterSpoolJob
+
+- (instancetype)initWithJobID:(uint64_t)jobID data:(NSData *)data bytesSent:(NSUInteger)bytesSent commandBoundaries:(NSIndexSet *)boundaries {
+    self = [super init];
+    if (self) {
+        _jobID = jobID;
+        _data = data;
+        _bytesSent = MIN(bytesSent, data.length);
+        _commandBoundaries = boundaries;
+    }
+    return self;
+}
+
+- (NSData *)remainingData {
+    return [self.data subdataWithRange:NSMakeRange(self.bytesSent, self.data.length - self.bytesSent)];
+}
+
+@end
+
+@implementation PrinterSpool {
+    NSString *_path;
+    int _fd;
+    uint8_t *_map;
+    size_t _capacity;
+    size_t _tail;
+    uint64_t _nextSequence;
+    uint64_t _nextJobID;
+    NSMutableDictionary<NSNumber *, PSpoolEntry *> *_entries;
+    NSMutableArray<NSNumber *> *_order;
+
+    dispatch_queue_t _queue;
+    /// msync and munmap run here, so flushing never blocks enqueueing
+    dispatch_queue_t _syncQueue;
+    size_t _dirtyStart;
+    BOOL _commitScheduled;
+    BOOL _needsFileSync;
+    NSMutableArray<void (^)(BOOL)> *_commitBlocks;
+    /// Set when compaction lost the journal mapping; the spool then refuses all work
+    BOOL _unusable;
+}
+
+- (instancetype)initWithPath:(NSString *)path recoveryPolicy:(PrinterSpoolRecoveryPolicy)policy error:(NSError **)error {
+    self = [super init];
+    if (self) {
+        _path = [path copy];
+        _commitInterval = 0.005;
+        _checkpointGranularity = 1024;
+        _entries = [NSMutableDictionary dictionary];
+        _order = [NSMutableArray array];
+        _commitBlocks = [NSMutableArray array];
+        _queue = dispatch_queue_create("com.printer.spool", DISPATCH_QUEUE_SERIAL);
+        _syncQueue = dispatch_queue_create("com.printer.spool.sync", DISPATCH_QUEUE_SERIAL);
+        _nextJobID = 1;
+
+        _fd = open(path.fileSystemRepresentation, O_RDWR | O_CREAT, 0600);
+        if (_fd < 0) {
+            if (error) *error = PSpoolError(@"Cannot open spool file");
+            return nil;
+        }
+        struct stat st;
+        if (fstat(_fd, &st) != 0) {
+            if (error) *error = PSpoolError(@"Cannot read spool file");
+            close(_fd);
+            return nil;
+        }
+        BOOL fresh = (size_t)st.st_size < PSpoolHeaderSize;
+        size_t capacity = fresh ? PSpoolGrowth : (size_t)st.st_size;
+        if (![self mapCapacity:capacity error:error]) {
+            close(_fd);
+            return nil;
+        }
+
+        PSpoolHeader *header = (PSpoolHeader *)_map;
+        BOOL initialize = fresh || header->magic != PSpoolFileMagic || header->version != PSpoolVersion;
+        if (initialize) {
+            memset(_map, 0, PSpoolHeaderSize);
+            header->magic = PSpoolFileMagic;
+            header->version = PSpoolVersion;
+            header->baseSequence = 1;
+        }
+        [self recover];
+        if (initialize) {
+            _dirtyStart = 0;
+        }
+        [self applyRecoveryPolicy:policy];
+        if (_entries.count == 0 && _tail > PSpoolHeaderSize) {
+            [self reset];
+        }
+        [self synchronize];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    uint8_t *map = _map;
+    size_t capacity = _capacity;
+    int fd = _fd;
+    size_t end = _tail;
+    if (map == NULL) {
+        return;
+    }
+    dispatch_async(self->_syncQueue, ^{
+        msync(map, end, MS_SYNC);
+        munmap(map, capacity);
+        close(fd);
+    });
+}
+
+#pragma mark - Mapping
+
+- (BOOL)mapCapacity:(size_t)capacity error:(NSError **)error {
+    if (ftruncate(_fd, (off_t)capacity) != 0) {
+        if (error) *error = PSpoolError(@"Cannot grow spool file");
+        return NO;
+    }
+    void *map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (map == MAP_FAILED) {
+        if (error) *error = PSpoolError(@"Cannot map spool file");
+        return NO;
+    }
+    if (_map) {
+        // Pending flushes may still use the old mapping, unmap after them
+        uint8_t *old = _map;
+        size_t oldCapacity = _capacity;
+        dispatch_async(_syncQueue, ^{
+            munmap(old, oldCapacity);
+        });
+    }
+    _map = map;
+    _capacity = capacity;
+    _needsFileSync = YES;
+    return YES;
+}
+
+- (BOOL)ensureCapacity:(size_t)needed {
+    if (needed <= _capacity) {
+        return YES;
+    }
+    size_t capacity = MAX(_capacity * 2, (needed + PSpoolGrowth - 1) / PSpoolGrowth * PSpoolGrowth);
+    return [self mapCapacity:capacity error:NULL];
+}
+
+#pragma mark - Journal
+
+- (void)recover {
+    PSpoolHeader *header = (PSpoolHeader *)_map;
+    size_t offset = PSpoolHeaderSize;
+    uint64_t sequence = header->baseSequence;
+    while (offset + sizeof(PSpoolRecord) <= _capacity) {
+        PSpoolRecord record;
+        memcpy(&record, _map + offset, sizeof(record));
+        if (record.magic != PSpoolRecordMagic || record.sequence != sequence) {
+            break;
+        }
+        if (record.length > _capacity - offset - sizeof(record)) {
+            break;
+        }
+        const uint8_t *payload = _map + offset + sizeof(record);
+        if (PSpoolChecksum(record, payload) != record.crc) {
+            break;
+        }
+        [self applyRecord:record payloadOffset:offset + sizeof(record)];
+        offset += PSpoolRecordSize(record.length);
+        sequence++;
+    }
+    _tail = offset;
+    _dirtyStart = offset;
+    _nextSequence = sequence;
+}
+
+- (void)applyRecord:(PSpoolRecord)record payloadOffset:(size_t)payloadOffset {
+    NSNumber *key = @(record.jobID);
+    switch ((PSpoolRecordType)record.type) {
+        case PSpoolRecordJob: {
+            PSpoolEntry *entry = [[PSpoolEntry alloc] init];
+            entry.jobID = record.jobID;
+            entry.payloadOffset = payloadOffset;
+            entry.length = record.length;
+            _entries[key] = entry;
+            [_order addObject:key];
+            _nextJobID = MAX(_nextJobID, record.jobID + 1);
+            break;
+        }
+        case PSpoolRecordProgress: {
+            PSpoolEntry *entry = _entries[key];
+            entry.bytesSent = MIN((NSUInteger)record.value, entry.length);
+            entry.checkpoint = entry.bytesSent;
+            break;
+        }
+        case PSpoolRecordBoundaries: {
+            PSpoolEntry *entry = _entries[key];
+            NSMutableIndexSet *boundaries = [NSMutableIndexSet indexSetWithIndex:0];
+            const uint8_t *payload = _map + payloadOffset;
+            for (uint32_t i = 0; i + sizeof(uint32_t) <= record.length; i += sizeof(uint32_t)) {
+                uint32_t offset;
+                memcpy(&offset, payload + i, sizeof(offset));
+                if (offset < entry.length) {
+                    [boundaries addIndex:offset];
+                }
+            }
+            entry.boundaries = boundaries;
+            break;
+        }
+        case PSpoolRecordDone:
+            [_entries removeObjectForKey:key];
+            [_order removeObject:key];
+            break;
+    }
+}
+
+- (void)applyRecoveryPolicy:(PrinterSpoolRecoveryPolicy)policy {
+    if (policy == PrinterSpoolRecoveryResume) {
+        return;
+    }
+    for (NSNumber *key in [_order copy]) {
+        if (policy == PrinterSpoolRecoveryDiscard) {
+            [self appendType:PSpoolRecordDone jobID:key.unsignedLongLongValue value:0 bytes:NULL length:0];
+        } else if (_entries[key].bytesSent > 0) {
+            [self appendType:PSpoolRecordProgress jobID:key.unsignedLongLongValue value:0 bytes:NULL length:0];
+        }
+    }
+}
+
+/// Appends and applies a record. Returns the payload offset, 0 if the journal could not grow.
+- (size_t)appendType:(PSpoolRecordType)type jobID:(uint64_t)jobID value:(uint64_t)value bytes:(const void *)bytes length:(size_t)length {
+    if (length > UINT32_MAX || _map == NULL) {
+        return 0;
+    }
+    size_t size = PSpoolRecordSize(length);
+    if (![self ensureCapacity:_tail + size]) {
+        return 0;
+    }
+    PSpoolRecord record = {PSpoolRecordMagic, type, _nextSequence, jobID, value, (uint32_t)length, 0};
+    uint8_t *payload = _map + _tail + sizeof(record);
+    if (length > 0) {
+        memcpy(payload, bytes, length);
+    }
+    record.crc = PSpoolChecksum(record, payload);
+    memcpy(_map + _tail, &record, sizeof(record));
+
+    size_t payloadOffset = _tail + sizeof(record);
+    _tail += size;
+    _nextSequence++;
+    [self applyRecord:record payloadOffset:payloadOffset];
+    return payloadOffset;
+}
+
+/// Empties the journal; the new base sequence invalidates every old record
+- (void)reset {
+    PSpoolHeader *header = (PSpoolHeader *)_map;
+    header->baseSequence = _nextSequence;
+    _tail = PSpoolHeaderSize;
+    _dirtyStart = 0;
+}
+
+#pragma mark - Group commit
+
+- (void)scheduleCommit:(void (^)(BOOL))block {
+    if (block) {
+        [_commitBlocks addObject:block];
+    }
+    if (_commitScheduled) {
+        return;
+    }
+    _commitScheduled = YES;
+    __weak typeof(self) weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.commitInterval * NSEC_PER_SEC)), _queue, ^{
+        [weakSelf commit];
+    });
+}
+
+/// Runs on _queue. Hands the dirty range to the sync queue, callbacks fire once it is on storage.
+- (void)commit {
+    _commitScheduled = NO;
+    if (_map == NULL) {
+        NSArray<void (^)(BOOL)> *blocks = [_commitBlocks copy];
+        [_commitBlocks removeAllObjects];
+        if (blocks.count > 0) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                for (void (^block)(BOOL) in blocks) {
+                    block(NO);
+                }
+            });
+        }
+        return;
+    }
+    if (_dirtyStart >= _tail && _commitBlocks.count == 0 && !_needsFileSync) {
+        return;
+    }
+    size_t page = (size_t)getpagesize();
+    size_t start = MIN(_dirtyStart, _tail) & ~(page - 1);
+    size_t end = _tail;
+    uint8_t *map = _map;
+    int fd = _fd;
+    BOOL fileSync = _needsFileSync;
+    NSArray<void (^)(BOOL)> *blocks = [_commitBlocks copy];
+    [_commitBlocks removeAllObjects];
+    _dirtyStart = _tail;
+    _needsFileSync = NO;
+
+    dispatch_async(_syncQueue, ^{
+        BOOL durable = end <= start || msync(map + start, end - start, MS_SYNC) == 0;
+        if (fileSync) {
+            // The file size changed, flush the metadata too
+            durable = fsync(fd) == 0 && durable;
+        }
+        if (blocks.count > 0) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                for (void (^block)(BOOL) in blocks) {
+                    block(durable);
+                }
+            });
+        }
+    });
+}
+
+- (void)synchronize {
+    dispatch_sync(_queue, ^{
+        [self commit];
+    });
+    dispatch_sync(_syncQueue, ^{});
+}
+
+#pragma mark - Jobs
+
+- (uint64_t)enqueueJob:(NSData *)data committed:(void (^)(BOOL))committed {
+    return [self enqueueJob:data commandBoundaries:nil committed:committed];
+}
+
+/// Boundaries payload: the command starts inside the job, 0 is implied
+static NSData *PSpoolBoundaryPayload(NSIndexSet *boundaries, NSUInteger length) {
+    NSMutableData *payload = [NSMutableData data];
+    [boundaries enumerateIndexesInRange:NSMakeRange(1, length > 1 ? length - 1 : 0) options:0 usingBlock:^(NSUInteger index, BOOL *stop) {
+        uint32_t offset = (uint32_t)index;
+        [payload appendBytes:&offset length:sizeof(offset)];
+    }];
+    return payload;
+}
+
+- (uint64_t)enqueueJob:(NSData *)data commandBoundaries:(NSIndexSet *)boundaries committed:(void (^)(BOOL))committed {
+    __block uint64_t jobID = 0;
+    dispatch_sync(_queue, ^{
+        uint64_t candidate = self->_nextJobID;
+        NSData *payload = boundaries ? PSpoolBoundaryPayload(boundaries, data.length) : nil;
+        // Both records go out in the same commit; if the boundaries do not fit, the job is dropped again
+        if ([self appendType:PSpoolRecordJob jobID:candidate value:data.length bytes:data.bytes length:data.length] == 0 ||
+            (payload && [self appendType:PSpoolRecordBoundaries jobID:candidate value:0 bytes:payload.bytes length:payload.length] == 0)) {
+            if (self->_entries[@(candidate)]) {
+                [self appendType:PSpoolRecordDone jobID:candidate value:0 bytes:NULL length:0];
+            }
+            if (committed) {
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    committed(NO);
+                });
+            }
+            return;
+        }
+        jobID = candidate;
+        [self scheduleCommit:committed];
+    });
+    return jobID;
+}
+
+- (void)recordBytesSent:(NSUInteger)bytesSent forJob:(uint64_t)jobID {
+    dispatch_async(_queue, ^{
+        PSpoolEntry *entry = self->_entries[@(jobID)];
+        if (entry == nil) {
+            return;
+        }
+        NSUInteger bytes = MIN(bytesSent, entry.length);
+        if (bytes <= entry.bytesSent) {
+            return;
+        }
+        entry.bytesSent = bytes;
+        // Checkpoints land on command starts, so a resume never begins inside a command
+        NSUInteger checkpoint = [entry resumeOffsetForBytes:bytes];
+        if (checkpoint <= entry.checkpoint || (checkpoint < entry.length && checkpoint - entry.checkpoint < self.checkpointGranularity)) {
+            return;
+        }
+        [self appendType:PSpoolRecordProgress jobID:jobID value:checkpoint bytes:NULL length:0];
+        // applyRecord set bytesSent back to the checkpoint
+        entry.bytesSent = bytes;
+        [self scheduleCommit:nil];
+    });
+}
+
+- (void)finishJob:(uint64_t)jobID {
+    dispatch_async(_queue, ^{
+        if (self->_entries[@(jobID)] == nil) {
+            return;
+        }
+        [self appendType:PSpoolRecordDone jobID:jobID value:0 bytes:NULL length:0];
+        if (self->_entries.count == 0) {
+            [self reset];
+        }
+        [self scheduleCommit:nil];
+    });
+}
+
+- (void)completeJob:(uint64_t)jobID {
+    [self finishJob:jobID];
+}
+
+- (void)discardJob:(uint64_t)jobID {
+    [self finishJob:jobID];
+}
+
+- (PrinterSpoolProgressBlock)progressBlockForJob:(uint64_t)jobID offset:(NSUInteger)offset {
+    __weak typeof(self) weakSelf = self;
+    return ^(BOOL success, NSUInteger totalBytesSent, NSUInteger currentPackageIndex, NSError *error) {
+        PrinterSpool *spool = weakSelf;
+        if (spool == nil || totalBytesSent == 0) {
+            return;
+        }
+        [spool recordBytesSent:offset + totalBytesSent forJob:jobID];
+        dispatch_async(spool->_queue, ^{
+            PSpoolEntry *entry = spool->_entries[@(jobID)];
+            if (success && entry && entry.bytesSent >= entry.length) {
+                [spool finishJob:jobID];
+            }
+        });
+    };
+}
+
+- (NSArray<PrinterSpoolJob *> *)pendingJobs {
+    NSMutableArray<PrinterSpoolJob *> *jobs = [NSMutableArray array];
+    dispatch_sync(_queue, ^{
+        for (NSNumber *key in self->_order) {
+            PSpoolEntry *entry = self->_entries[key];
+            NSData *data = [NSData dataWithBytes:self->_map + entry.payloadOffset length:entry.length];
+            [jobs addObject:[[PrinterSpoolJob alloc] initWithJobID:entry.jobID data:data bytesSent:[entry resumeOffsetForBytes:entry.bytesSent] commandBoundaries:entry.boundaries]];
+        }
+    });
+    return jobs;
+}
+
+#pragma mark - Compaction
+
+- (BOOL)compact:(NSError **)error {
+    __block BOOL result = YES;
+    __block NSError *failure = nil;
+    dispatch_sync(_queue, ^{
+        if (self->_unusable) {
+            failure = PSpoolError(@"Spool file was lost by an earlier compaction");
+            result = NO;
+            return;
+        }
+        if (self->_entries.count == 0) {
+            [self reset];
+            [self commit];
+            return;
+        }
+
+        // Write the live jobs into a new journal, then swap it in atomically
+        uint64_t sequence = self->_nextSequence;
+        NSMutableData *journal = [NSMutableData dataWithLength:PSpoolHeaderSize];
+        PSpoolHeader *header = journal.mutableBytes;
+        header->magic = PSpoolFileMagic;
+        header->version = PSpoolVersion;
+        header->baseSequence = sequence;
+        for (NSNumber *key in self->_order) {
+            PSpoolEntry *entry = self->_entries[key];
+            const uint8_t *payload = self->_map + entry.payloadOffset;
+            PSpoolRecord job = {PSpoolRecordMagic, PSpoolRecordJob, sequence++, entry.jobID, entry.length, (uint32_t)entry.length, 0};
+            job.crc = PSpoolChecksum(job, payload);
+            [journal appendBytes:&job length:sizeof(job)];
+            [journal appendBytes:payload length:entry.length];
+            [journal increaseLengthBy:PSpoolRecordSize(entry.length) - sizeof(job) - entry.length];
+            if (entry.boundaries) {
+                NSData *boundaries = PSpoolBoundaryPayload(entry.boundaries, entry.length);
+                PSpoolRecord record = {PSpoolRecordMagic, PSpoolRecordBoundaries, sequence++, entry.jobID, 0, (uint32_t)boundaries.length, 0};
+                record.crc = PSpoolChecksum(record, boundaries.bytes);
+                [journal appendBytes:&record length:sizeof(record)];
+                [journal appendData:boundaries];
+                [journal increaseLengthBy:PSpoolRecordSize(boundaries.length) - sizeof(record) - boundaries.length];
+            }
+            NSUInteger checkpoint = [entry resumeOffsetForBytes:entry.bytesSent];
+            if (checkpoint > 0) {
+                PSpoolRecord progress = {PSpoolRecordMagic, PSpoolRecordProgress, sequence++, entry.jobID, checkpoint, 0, 0};
+                progress.crc = PSpoolChecksum(progress, NULL);
+                [journal appendBytes:&progress length:sizeof(progress)];
+            }
+        }
+
+        NSString *temporary = [self->_path stringByAppendingString:@".compact"];
+        int fd = open(temporary.fileSystemRepresentation, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0 || write(fd, journal.bytes, journal.length) != (ssize_t)journal.length || fsync(fd) != 0 ||
+            rename(temporary.fileSystemRepresentation, self->_path.fileSystemRepresentation) != 0) {
+            failure = PSpoolError(@"Cannot rewrite spool file");
+            if (fd >= 0) {
+                close(fd);
+            }
+            unlink(temporary.fileSystemRepresentation);
+            result = NO;
+            return;
+        }
+
+        // Let pending flushes of the old file finish before it is closed
+        [self commit];
+        uint8_t *oldMap = self->_map;
+        size_t oldCapacity = self->_capacity;
+        int oldFd = self->_fd;
+        dispatch_async(self->_syncQueue, ^{
+            munmap(oldMap, oldCapacity);
+            close(oldFd);
+        });
+        self->_fd = fd;
+        self->_map = NULL;
+        [self->_entries removeAllObjects];
+        [self->_order removeAllObjects];
+        size_t capacity = MAX(PSpoolGrowth, (journal.length + PSpoolGrowth - 1) / PSpoolGrowth * PSpoolGrowth);
+        if (![self mapCapacity:capacity error:&failure]) {
+            // The old journal is gone and the new one cannot be mapped; the jobs are safe in the
+            // new file, but this instance cannot write anymore until the spool is opened again
+            close(fd);
+            self->_fd = -1;
+            self->_unusable = YES;
+            result = NO;
+            return;
+        }
+        [self recover];
+        [self commit];
+    });
+    if (!result && error) {
+        *error = failure;
+    }
+    return result;
+}
+
+@end
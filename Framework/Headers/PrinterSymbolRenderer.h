@@ -0,0 +1,162 @@
+//
+//  PrinterSymbolRenderer.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "PrinterBitmap.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// 2D symbologies that can be drawn by the printer firmware or rendered on the host
+typedef NS_ENUM(NSInteger, PrinterSymbolType) {
+    PrinterSymbolQRCode = 0,   ///< QR Code
+    PrinterSymbolPDF417,       ///< PDF417
+    PrinterSymbolDataMatrix    ///< DataMatrix (firmware only, no host encoder available)
+};
+
+/// Where a symbol is rendered
+typedef NS_ENUM(NSInteger, PrinterSymbolRenderMode) {
+    PrinterSymbolRenderFirmware = 0, ///< Send the symbol command and let the printer encode it
+    PrinterSymbolRenderHost          ///< Encode on the host and send a raster image
+};
+
+/// Chooses host or firmware rendering per printer model from measured print times.
+/// A model uses the firmware until a firmware time was recorded, then gets host rendering once so
+/// both modes can be compared, and from then on the faster mode. Every explorationInterval-th
+/// decision picks the slower mode to keep its average current. Models whose firmware was marked
+/// unsupported always use the host. Report the time of every print with recordPrintDuration:.
+@interface PrinterSymbolRenderPolicy : NSObject
+
+/// Weight of a new measurement in the moving average, 0-1 (default: 0.3)
+@property (nonatomic, assign) double smoothingFactor;
+
+/// Every how many decisions the slower mode is used once, 0 never (default: 20)
+@property (nonatomic, assign) NSUInteger explorationInterval;
+
+/// Records how long a symbol took to print.
+/// @param duration Time from sending the command until the printer reported completion, in seconds
+/// @param model The printer model name
+/// @param type The symbology
+/// @param mode The render mode that was used
+- (void)recordPrintDuration:(NSTimeInterval)duration forModel:(NSString *)model symbol:(PrinterSymbolType)type mode:(PrinterSymbolRenderMode)mode;
+
+/// Marks the firmware of a model as unable to print a symbology, forcing host rendering
+/// @param model The printer model name
+/// @param type The symbology
+- (void)markFirmwareUnsupportedForModel:(NSString *)model symbol:(PrinterSymbolType)type;
+
+/// Returns the render mode to use
+/// @param model The printer model name
+/// @param type The symbology
+- (PrinterSymbolRenderMode)renderModeForModel:(NSString *)model symbol:(PrinterSymbolType)type;
+
+@end
+
+/// Host-side 2D symbol encoder producing packed 1-bpp module bitmaps.
+/// Encoded symbols are kept in an LRU cache keyed by content, error correction level and module size,
+/// so repeated codes are only encoded once.
+@interface PrinterSymbolRenderer : NSObject
+
+/// Maximum number of cached symbols (default: 64)
+@property (nonatomic, assign) NSUInteger cacheCapacity;
+
+/// Policy used by the command methods to pick host or firmware rendering
+@property (nonatomic, strong) PrinterSymbolRenderPolicy *policy;
+
+/// Returns the shared renderer
++ (instancetype)sharedRenderer;
+
+/// Encodes a symbol on the host.
+/// @param type The symbology
+/// @param content The symbol content
+/// @param eccLevel QR: 0-3 for L/M/Q/H (48-51 are accepted as well); PDF417: 0-8
+/// @param moduleSize Module size in dots (1-16)
+/// @param encoding Encoding used to turn the content into bytes
+/// @return The bitmap, or nil if the symbology has no host encoder or the content cannot be encoded
+- (nullable PrinterBitmap *)bitmapForSymbol:(PrinterSymbolType)type
+                                    content:(NSString *)content
+                                   eccLevel:(int)eccLevel
+                                 moduleSize:(int)moduleSize
+                                   encoding:(NSStringEncoding)encoding;
+
+/// Removes all cached symbols
+- (void)removeAllCachedSymbols;
+
+/// ESC/POS command printing a symbol, rendered where the policy says is faster for the model.
+/// @param type The symbology
+/// @param content The symbol content
+/// @param eccLevel QR: 0-3 for L/M/Q/H; PDF417: 0-8
+/// @param moduleSize Module size in dots
+/// @param encoding Content encoding
+/// @param model The printer model name
+/// @return Data command
+- (NSData *)posCommandForSymbol:(PrinterSymbolType)type
+                        content:(NSString *)content
+                       eccLevel:(int)eccLevel
+                     moduleSize:(int)moduleSize
+                       encoding:(NSStringEncoding)encoding
+                          model:(NSString *)model;
+
+/// ESC/POS command printing a symbol, rendered where the policy says is faster for the model.
+/// Pass the mode reported in usedMode to the policy's recordPrintDuration: with the print time.
+/// @param type The symbology
+/// @param content The symbol content
+/// @param eccLevel QR: 0-3 for L/M/Q/H; PDF417: 0-8
+/// @param moduleSize Module size in dots
+/// @param encoding Content encoding
+/// @param model The printer model name
+/// @param usedMode Set to the mode the command uses; host rendering falls back to the firmware when the content cannot be encoded
+/// @return Data command
+- (NSData *)posCommandForSymbol:(PrinterSymbolType)type
+                        content:(NSString *)content
+                       eccLevel:(int)eccLevel
+                     moduleSize:(int)moduleSize
+                       encoding:(NSStringEncoding)encoding
+                          model:(NSString *)model
+                       usedMode:(nullable PrinterSymbolRenderMode *)usedMode;
+
+/// TSPL command printing a symbol, rendered where the policy says is faster for the model.
+/// @param x The x-coordinate
+/// @param y The y-coordinate
+/// @param type The symbology
+/// @param content The symbol content
+/// @param eccLevel QR: 0-3 for L/M/Q/H; PDF417: 0-8
+/// @param moduleSize Module size in dots
+/// @param encoding Content encoding
+/// @param model The printer model name
+/// @return Data command
+- (NSData *)tscCommandWithX:(int)x
+                       andY:(int)y
+                     symbol:(PrinterSymbolType)type
+                    content:(NSString *)content
+                   eccLevel:(int)eccLevel
+                 moduleSize:(int)moduleSize
+                   encoding:(NSStringEncoding)encoding
+                      model:(NSString *)model;
+
+/// TSPL command printing a symbol, rendered where the policy says is faster for the model.
+/// Pass the mode reported in usedMode to the policy's recordPrintDuration: with the print time.
+/// @param x The x-coordinate
+/// @param y The y-coordinate
+/// @param type The symbology
+/// @param content The symbol content
+/// @param eccLevel QR: 0-3 for L/M/Q/H; PDF417: 0-8
+/// @param moduleSize Module size in dots
+/// @param encoding Content encoding
+/// @param model The printer model name
+/// @param usedMode Set to the mode the command uses; host rendering falls back to the firmware when the content cannot be encoded
+/// @return Data command
+- (NSData *)tscCommandWithX:(int)x
+                       andY:(int)y
+                     symbol:(PrinterSymbolType)type
+                    content:(NSString *)content
+                   eccLevel:(int)eccLevel
+                 moduleSize:(int)moduleSize
+                   encoding:(NSStringEncoding)encoding
+                      model:(NSString *)model
+                   usedMode:(nullable PrinterSymbolRenderMode *)usedMode;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,340 @@
+//
+//  PrinterSymbolRenderer.m
+//  Printer
+//
+
+#import "PrinterSymbolRenderer.h"
+#import "POSCommand.h"
+#import "TSCCommand.h"
+#import "PrinterSDKCodeDefines.h"
+#import <CoreImage/CoreImage.h>
+
+static NSString *PrinterSymbolPolicyKey(NSString *model, PrinterSymbolType type, PrinterSymbolRenderMode mode) {
+    return [NSString stringWithFormat:@"%@|%ld|%ld", model, (long)type, (long)mode];
+}
+
+/// Maps ESC/POS style levels (48-51) and plain indexes (0-3) to 0-3
+static int PrinterSymbolQRLevel(int eccLevel) {
+    if (eccLevel >= 48) {
+        eccLevel -= 48;
+    }
+    return MIN(MAX(eccLevel, 0), 3);
+}
+
+@implementation PrinterSymbolRenderPolicy {
+    NSMutableDictionary<NSString *, NSNumber *> *_durations;
+    NSMutableSet<NSString *> *_unsupported;
+    /// Models and symbologies host rendering was handed out for before it had a measurement
+    NSMutableSet<NSString *> *_hostTrials;
+    /// Decisions made per model and symbology once both modes were measured
+    NSMutableDictionary<NSString *, NSNumber *> *_decisions;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _smoothingFactor = 0.3;
+        _explorationInterval = 20;
+        _durations = [NSMutableDictionary dictionary];
+        _unsupported = [NSMutableSet set];
+        _hostTrials = [NSMutableSet set];
+        _decisions = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (void)recordPrintDuration:(NSTimeInterval)duration forModel:(NSString *)model symbol:(PrinterSymbolType)type mode:(PrinterSymbolRenderMode)mode {
+    if (duration < 0) {
+        return;
+    }
+    NSString *key = PrinterSymbolPolicyKey(model, type, mode);
+    @synchronized (self) {
+        NSNumber *average = _durations[key];
+        double alpha = MIN(MAX(self.smoothingFactor, 0.0), 1.0);
+        double value = average ? average.doubleValue * (1.0 - alpha) + duration * alpha : duration;
+        _durations[key] = @(value);
+    }
+}
+
+- (void)markFirmwareUnsupportedForModel:(NSString *)model symbol:(PrinterSymbolType)type {
+    @synchronized (self) {
+        [_unsupported addObject:PrinterSymbolPolicyKey(model, type, PrinterSymbolRenderFirmware)];
+    }
+}
+
+- (PrinterSymbolRenderMode)renderModeForModel:(NSString *)model symbol:(PrinterSymbolType)type {
+    if (type == PrinterSymbolDataMatrix) {
+        return PrinterSymbolRenderFirmware;
+    }
+    NSString *firmwareKey = PrinterSymbolPolicyKey(model, type, PrinterSymbolRenderFirmware);
+    NSString *hostKey = PrinterSymbolPolicyKey(model, type, PrinterSymbolRenderHost);
+    @synchronized (self) {
+        if ([_unsupported containsObject:firmwareKey]) {
+            return PrinterSymbolRenderHost;
+        }
+        NSNumber *firmware = _durations[firmwareKey];
+        NSNumber *host = _durations[hostKey];
+        if (firmware == nil) {
+            return PrinterSymbolRenderFirmware;
+        }
+        if (host == nil) {
+            // Try the host once so there is something to compare against
+            if ([_hostTrials containsObject:hostKey]) {
+                return PrinterSymbolRenderFirmware;
+            }
+            [_hostTrials addObject:hostKey];
+            return PrinterSymbolRenderHost;
+        }
+        PrinterSymbolRenderMode preferred = host.doubleValue < firmware.doubleValue ? PrinterSymbolRenderHost : PrinterSymbolRenderFirmware;
+        NSUInteger decisions = _decisions[hostKey].unsignedIntegerValue + 1;
+        _decisions[hostKey] = @(decisions);
+        // Now and then use the slower mode, so its average follows firmware or link changes
+        if (self.explorationInterval > 0 && decisions % self.explorationInterval == 0) {
+            return preferred == PrinterSymbolRenderHost ? PrinterSymbolRenderFirmware : PrinterSymbolRenderHost;
+        }
+        return preferred;
+    }
+}
+
+@end
+
+@implementation PrinterSymbolRenderer {
+    NSMutableDictionary<NSString *, PrinterBitmap *> *_cache;
+    NSMutableOrderedSet<NSString *> *_recency;
+    CIContext *_context;
+}
+
++ (instancetype)sharedRenderer {
+    static PrinterSymbolRenderer *renderer = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        renderer = [[PrinterSymbolRenderer alloc] init];
+    });
+    return renderer;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _cacheCapacity = 64;
+        _policy = [[PrinterSymbolRenderPolicy alloc] init];
+        _cache = [NSMutableDictionary dictionary];
+        _recency = [NSMutableOrderedSet orderedSet];
+    }
+    return self;
+}
+
+- (void)removeAllCachedSymbols {
+    @synchronized (self) {
+        [_cache removeAllObjects];
+        [_recency removeAllObjects];
+    }
+}
+
+- (PrinterBitmap *)bitmapForSymbol:(PrinterSymbolType)type content:(NSString *)content eccLevel:(int)eccLevel moduleSize:(int)moduleSize encoding:(NSStringEncoding)encoding {
+    if (type == PrinterSymbolDataMatrix || content.length == 0) {
+        return nil;
+    }
+    moduleSize = MIN(MAX(moduleSize, 1), 16);
+    eccLevel = type == PrinterSymbolQRCode ? PrinterSymbolQRLevel(eccLevel) : MIN(MAX(eccLevel, 0), 8);
+    NSString *key = [NSString stringWithFormat:@"%ld|%d|%d|%lu|%@", (long)type, eccLevel, moduleSize, (unsigned long)encoding, content];
+
+    @synchronized (self) {
+        PrinterBitmap *cached = _cache[key];
+        if (cached) {
+            [_recency removeObject:key];
+            [_recency addObject:key];
+            return cached;
+        }
+    }
+
+    PrinterBitmap *bitmap = [self encodeSymbol:type content:content eccLevel:eccLevel moduleSize:moduleSize encoding:encoding];
+    if (bitmap == nil) {
+        return nil;
+    }
+
+    @synchronized (self) {
+        _cache[key] = bitmap;
+        [_recency removeObject:key];
+        [_recency addObject:key];
+        while (_recency.count > MAX(self.cacheCapacity, (NSUInteger)1)) {
+            NSString *oldest = _recency.firstObject;
+            [_recency removeObjectAtIndex:0];
+            [_cache removeObjectForKey:oldest];
+        }
+    }
+    return bitmap;
+}
+
+- (PrinterBitmap *)encodeSymbol:(PrinterSymbolType)type content:(NSString *)content eccLevel:(int)eccLevel moduleSize:(int)moduleSize encoding:(NSStringEncoding)encoding {
+    NSData *message = [content dataUsingEncoding:encoding];
+    if (message.length == 0) {
+        return nil;
+    }
+
+    CIFilter *filter = nil;
+    if (type == PrinterSymbolQRCode) {
+        filter = [CIFilter filterWithName:@"CIQRCodeGenerator"];
+        [filter setValue:message forKey:@"inputMessage"];
+        [filter setValue:@[@"L", @"M", @"Q", @"H"][PrinterSymbolQRLevel(eccLevel)] forKey:@"inputCorrectionLevel"];
+    } else {
+        filter = [CIFilter filterWithName:@"CIPDF417BarcodeGenerator"];
+        [filter setValue:message forKey:@"inputMessage"];
+        [filter setValue:@(MIN(MAX(eccLevel, 0), 8)) forKey:@"inputCorrectionLevel"];
+    }
+    CIImage *output = filter.outputImage;
+    if (output == nil) {
+        return nil;
+    }
+
+    CGImageRef image = NULL;
+    @synchronized (self) {
+        if (_context == nil) {
+            _context = [CIContext contextWithOptions:nil];
+        }
+        image = [_context createCGImage:output fromRect:CGRectIntegral(output.extent)];
+    }
+    if (image == NULL) {
+        return nil;
+    }
+
+    // The generators emit one pixel per module; read the modules back as gray
+    size_t columns = CGImageGetWidth(image);
+    size_t rows = CGImageGetHeight(image);
+    NSMutableData *gray = [NSMutableData dataWithLength:columns * rows];
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceGray();
+    CGContextRef context = CGBitmapContextCreate(gray.mutableBytes, columns, rows, 8, columns, colorSpace, (CGBitmapInfo)kCGImageAlphaNone);
+    CGColorSpaceRelease(colorSpace);
+    if (context == NULL) {
+        CGImageRelease(image);
+        return nil;
+    }
+    CGContextSetInterpolationQuality(context, kCGInterpolationNone);
+    CGContextDrawImage(context, CGRectMake(0, 0, columns, rows), image);
+    CGContextRelease(context);
+    CGImageRelease(image);
+
+    // Replicate every module into a moduleSize x moduleSize block of dots
+    int width = (int)columns * moduleSize;
+    int height = (int)rows * moduleSize;
+    int bytesPerRow = (width + 7) / 8;
+    NSMutableData *packed = [NSMutableData dataWithLength:(NSUInteger)bytesPerRow * (NSUInteger)height];
+    const uint8_t *modules = gray.bytes;
+    uint8_t *out = packed.mutableBytes;
+    for (size_t row = 0; row < rows; row++) {
+        uint8_t *dst = out + row * moduleSize * bytesPerRow;
+        for (size_t col = 0; col < columns; col++) {
+            if (modules[row * columns + col] >= 128) {
+                continue;
+            }
+            for (int dx = 0; dx < moduleSize; dx++) {
+                int x = (int)col * moduleSize + dx;
+                dst[x >> 3] |= (uint8_t)(0x80 >> (x & 7));
+            }
+        }
+        for (int dy = 1; dy < moduleSize; dy++) {
+            memcpy(dst + dy * bytesPerRow, dst, bytesPerRow);
+        }
+    }
+    return [[PrinterBitmap alloc] initWithWidth:width height:height data:packed];
+}
+
+- (NSData *)posCommandForSymbol:(PrinterSymbolType)type content:(NSString *)content eccLevel:(int)eccLevel moduleSize:(int)moduleSize encoding:(NSStringEncoding)encoding model:(NSString *)model {
+    return [self posCommandForSymbol:type content:content eccLevel:eccLevel moduleSize:moduleSize encoding:encoding model:model usedMode:NULL];
+}
+
+- (NSData *)posCommandForSymbol:(PrinterSymbolType)type content:(NSString *)content eccLevel:(int)eccLevel moduleSize:(int)moduleSize encoding:(NSStringEncoding)encoding model:(NSString *)model usedMode:(PrinterSymbolRenderMode *)usedMode {
+    if ([self.policy renderModeForModel:model symbol:type] == PrinterSymbolRenderHost) {
+        PrinterBitmap *bitmap = [self bitmapForSymbol:type content:content eccLevel:eccLevel moduleSize:moduleSize encoding:encoding];
+        if (bitmap) {
+            if (usedMode) {
+                *usedMode = PrinterSymbolRenderHost;
+            }
+            return [bitmap rasterCommandWithMode:RasterNolmorWH];
+        }
+    }
+
+    if (usedMode) {
+        *usedMode = PrinterSymbolRenderFirmware;
+    }
+    switch (type) {
+        case PrinterSymbolQRCode:
+            return [POSCommand printQRCode:moduleSize level:48 + PrinterSymbolQRLevel(eccLevel) code:content useEnCodeing:encoding];
+        case PrinterSymbolPDF417: {
+            NSUInteger length = [content lengthOfBytesUsingEncoding:encoding] + 3;
+            NSMutableData *command = [NSMutableData data];
+            [command appendData:[POSCommand setpdf417WidthOfModule:moduleSize]];
+            // GS ( k <fn 69>: error correction level m = 48 selects levels 0-8 as n = 48-56
+            const uint8_t level[] = {0x1D, 0x28, 0x6B, 0x04, 0x00, 0x30, 0x45, 0x30, (uint8_t)(48 + MIN(MAX(eccLevel, 0), 8))};
+            [command appendBytes:level length:sizeof(level)];
+            [command appendData:[POSCommand storethepdf417WithpL:(int)(length & 0xFF) andpH:(int)((length >> 8) & 0xFF) andContent:content usEnCoding:encoding]];
+            [command appendData:[POSCommand printPdf417InStore]];
+            return command;
+        }
+        case PrinterSymbolDataMatrix:
+            break;
+    }
+    return [NSData data];
+}
+
+- (NSData *)tscCommandWithX:(int)x andY:(int)y symbol:(PrinterSymbolType)type content:(NSString *)content eccLevel:(int)eccLevel moduleSize:(int)moduleSize encoding:(NSStringEncoding)encoding model:(NSString *)model {
+    return [self tscCommandWithX:x andY:y symbol:type content:content eccLevel:eccLevel moduleSize:moduleSize encoding:encoding model:model usedMode:NULL];
+}
+
+- (NSData *)tscCommandWithX:(int)x andY:(int)y symbol:(PrinterSymbolType)type content:(NSString *)content eccLevel:(int)eccLevel moduleSize:(int)moduleSize encoding:(NSStringEncoding)encoding model:(NSString *)model usedMode:(PrinterSymbolRenderMode *)usedMode {
+    PrinterSymbolRenderMode mode = [self.policy renderModeForModel:model symbol:type];
+    PrinterBitmap *bitmap = nil;
+    if (mode == PrinterSymbolRenderHost || type == PrinterSymbolPDF417) {
+        bitmap = [self bitmapForSymbol:type content:content eccLevel:eccLevel moduleSize:moduleSize encoding:encoding];
+    }
+
+    if (usedMode) {
+        *usedMode = (mode == PrinterSymbolRenderHost && bitmap) ? PrinterSymbolRenderHost : PrinterSymbolRenderFirmware;
+    }
+    if (mode == PrinterSymbolRenderHost && bitmap) {
+        // Plain BITMAP command, TSPL prints 0 bits
+        NSMutableData *command = [NSMutableData data];
+        NSString *header = [NSString stringWithFormat:@"BITMAP %d,%d,%d,%d,0,", x, y, bitmap.bytesPerRow, bitmap.height];
+        [command appendData:[header dataUsingEncoding:NSASCIIStringEncoding]];
+        NSUInteger offset = command.length;
+        [command appendData:bitmap.data];
+        uint8_t *bytes = (uint8_t *)command.mutableBytes + offset;
+        for (NSUInteger i = 0; i < bitmap.data.length; i++) {
+            bytes[i] = (uint8_t)~bytes[i];
+        }
+        [command appendBytes:"\r\n" length:2];
+        return command;
+    }
+
+    switch (type) {
+        case PrinterSymbolQRCode: {
+            NSArray<NSString *> *levels = @[kECCLevelL, kECCLevelM, kEECLevelQ, kEECLevelH];
+            return [TSCCommand qrCodeWithX:x
+                                      andY:y
+                               andEccLevel:levels[PrinterSymbolQRLevel(eccLevel)]
+                              andCellWidth:MIN(MAX(moduleSize, 1), 10)
+                                   andMode:kQRCodeModeAuto
+                               andRotation:TSPLRotation0
+                                andContent:content
+                             usStrEnCoding:encoding];
+        }
+        case PrinterSymbolPDF417:
+            return [TSCCommand pdf417WithX:x
+                                      andY:y
+                                  andWidth:bitmap ? bitmap.width : moduleSize * 200
+                                 andHeight:bitmap ? bitmap.height : moduleSize * 60
+                                 andRotate:0
+                                andContent:content
+                             usStrEnCoding:encoding];
+        case PrinterSymbolDataMatrix:
+            return [TSCCommand dmateixWithX:x
+                                       andY:y
+                                   andWidth:moduleSize * 48
+                                  andHeight:moduleSize * 48
+                                 andContent:content
+                              usStrEnCoding:encoding];
+    }
+    return [NSData data];
+}
+
+@end
@@ -0,0 +1,83 @@
+//
+//  PrinterTextEncoder.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Result of encoding text for the printer
+@interface PrinterTextEncodingResult : NSObject
+
+/// Encoded bytes, unmappable characters replaced by the encoder's substitution byte
+@property (nonatomic, readonly) NSData *data;
+
+/// Ranges (UTF-16 units of the source string) of the characters the code page cannot represent
+@property (nonatomic, readonly) NSArray<NSValue *> *unmappableRanges;
+
+/// YES when at least one character could not be encoded
+@property (nonatomic, readonly) BOOL hasUnmappableCharacters;
+
+@end
+
+/// Transcodes text into the printer's code page using precomputed lookup tables.
+/// Tables are built once per encoding on first use and shared by all encoders;
+/// ASCII runs are copied through without a table lookup.
+@interface PrinterTextEncoder : NSObject
+
+/// The encoding text is converted to
+@property (nonatomic, readonly) NSStringEncoding stringEncoding;
+
+/// Byte written in place of an unmappable character (default: '?')
+@property (nonatomic, assign) uint8_t substitutionByte;
+
+/// Creates an encoder for a string encoding, e.g. GB18030, Big5, EUC-KR or a DOS/Windows code page
+/// @param encoding The string encoding
+/// @return The encoder, or nil if the encoding is not available
++ (nullable instancetype)encoderWithStringEncoding:(NSStringEncoding)encoding;
+
+/// Creates an encoder for an ESC/POS character code table (see POSCommand setCodePage:/selectCharacterCodePage:)
+///
+/// | Page | Code page   |
+/// |------|-------------|
+/// | 0    | PC437       |
+/// | 2    | PC850       |
+/// | 3    | PC860       |
+/// | 4    | PC863       |
+/// | 5    | PC865       |
+/// | 16   | WPC1252     |
+/// | 17   | PC866       |
+/// | 18   | PC852       |
+/// | 19   | PC858       |
+///
+/// @param page The code table number
+/// @return The encoder, or nil for an unknown table
++ (nullable instancetype)encoderWithCodePage:(int)page;
+
+/// Creates an encoder for a TSPL code page name (see TSCCommand codePage:), e.g. @"437", @"850", @"1252"
+/// @param name The code page name
+/// @return The encoder, or nil for an unknown code page
++ (nullable instancetype)encoderWithCodePageName:(NSString *)name;
+
+/// Encodes a string
+/// @param string The text to encode
+/// @return The encoded bytes and the unmappable ranges
+- (PrinterTextEncodingResult *)encodeString:(NSString *)string;
+
+/// Encodes a whole receipt in one pass
+/// @param lines The lines of text
+/// @param terminator Bytes appended after every line, may be nil
+/// @param unmappableLines Receives the indexes of lines containing unmappable characters, may be NULL
+/// @return The encoded bytes of all lines
+- (NSData *)encodeLines:(NSArray<NSString *> *)lines
+             terminator:(nullable NSData *)terminator
+        unmappableLines:(NSIndexSet * _Nullable * _Nullable)unmappableLines;
+
+/// Checks whether a string can be encoded without substitution
+/// @param string The text to check
+- (BOOL)canEncodeString:(NSString *)string;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,395 @@
+//
+//  PrinterTextEncoder.m
+//  Printer
+//
+
+#import "PrinterTextEncoder.h"
+#if defined(__aarch64__)
+#import <arm_neon.h>
+#endif
+
+/// Table entries: < 0x100 single byte, >= 0x100 lead/trail pair, 0xFFFF not in the table
+static const uint16_t PTEUnmapped = 0xFFFF;
+static const NSUInteger PTETableEntries = 0x10000;
+
+/// Pseudo code page id for PC858, which the system does not provide: PC850 with the euro sign at 0xD5
+static const CFStringEncoding PTEEncodingPC858 = 0xFFFF0858;
+
+@implementation PrinterTextEncodingResult
+
+- (instancetype)initWithData:(NSData *)data unmappableRanges:(NSArray<NSValue *> *)ranges {
+    self = [super init];
+    if (self) {
+        _data = data;
+        _unmappableRanges = [ranges copy];
+    }
+    return self;
+}
+
+- (BOOL)hasUnmappableCharacters {
+    return _unmappableRanges.count > 0;
+}
+
+@end
+
+static BOOL PTEDecodeOne(const uint8_t *bytes, CFIndex length, CFStringEncoding encoding, UniChar *character) {
+    CFStringRef string = CFStringCreateWithBytes(kCFAllocatorDefault, bytes, length, encoding, false);
+    if (string == NULL) {
+        return NO;
+    }
+    BOOL single = CFStringGetLength(string) == 1;
+    if (single) {
+        *character = CFStringGetCharacterAtIndex(string, 0);
+    }
+    CFRelease(string);
+    return single && *character != 0xFFFD;
+}
+
+/// Builds the UTF-16 -> code page table by decoding every single byte and, for multi-byte
+/// encodings, every lead/trail pair. The first byte sequence found for a character wins.
+static NSData *PTEBuildTable(CFStringEncoding encoding) {
+    CFStringEncoding system = encoding == PTEEncodingPC858 ? kCFStringEncodingDOSLatin1 : encoding;
+    NSMutableData *data = [NSMutableData dataWithLength:PTETableEntries * sizeof(uint16_t)];
+    uint16_t *table = data.mutableBytes;
+    memset(table, 0xFF, data.length);
+
+    for (int b = 0; b < 0x100; b++) {
+        uint8_t byte = (uint8_t)b;
+        UniChar c;
+        if (PTEDecodeOne(&byte, 1, system, &c) && table[c] == PTEUnmapped) {
+            table[c] = (uint16_t)b;
+        }
+    }
+    if (CFStringGetMaximumSizeForEncoding(1, system) > 1) {
+        for (int lead = 0x81; lead <= 0xFE; lead++) {
+            for (int trail = 0x40; trail <= 0xFE; trail++) {
+                if (trail == 0x7F) {
+                    continue;
+                }
+                uint8_t pair[2] = {(uint8_t)lead, (uint8_t)trail};
+                UniChar c;
+                if (PTEDecodeOne(pair, 2, system, &c) && table[c] == PTEUnmapped) {
+                    table[c] = (uint16_t)((lead << 8) | trail);
+                }
+            }
+        }
+    }
+    if (encoding == PTEEncodingPC858) {
+        if (table[0x0131] == 0xD5) {
+            table[0x0131] = PTEUnmapped;
+        }
+        table[0x20AC] = 0xD5;
+    }
+    return data;
+}
+
+static NSData *PTETableForEncoding(CFStringEncoding encoding) {
+    static NSMutableDictionary<NSNumber *, NSData *> *tables = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        tables = [NSMutableDictionary dictionary];
+    });
+    @synchronized (tables) {
+        NSData *table = tables[@(encoding)];
+        if (table == nil) {
+            table = PTEBuildTable(encoding);
+            tables[@(encoding)] = table;
+        }
+        return table;
+    }
+}
+
+/// Length of the leading run of ASCII code units
+static size_t PTEASCIIPrefixLength(const UniChar *units, size_t length) {
+    size_t i = 0;
+#if defined(__aarch64__)
+    for (; i + 8 <= length; i += 8) {
+        if (vmaxvq_u16(vld1q_u16(units + i)) >= 0x80) {
+            break;
+        }
+    }
+#endif
+    for (; i + 4 <= length; i += 4) {
+        uint64_t word;
+        memcpy(&word, units + i, sizeof(word));
+        if (word & 0xFF80FF80FF80FF80ULL) {
+            break;
+        }
+    }
+    while (i < length && units[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+static BOOL PTEIsDirectEncoding(NSStringEncoding encoding) {
+    return encoding == NSUTF8StringEncoding ||
+           encoding == NSUnicodeStringEncoding ||
+           encoding == NSUTF16BigEndianStringEncoding ||
+           encoding == NSUTF16LittleEndianStringEncoding ||
+           encoding == NSUTF32StringEncoding ||
+           encoding == NSUTF32BigEndianStringEncoding ||
+           encoding == NSUTF32LittleEndianStringEncoding;
+}
+
+@implementation PrinterTextEncoder {
+    CFStringEncoding _cfEncoding;
+    NSData *_table;
+    BOOL _direct;
+    /// NO for UTF-16 and UTF-32, where ASCII characters are not single bytes
+    BOOL _asciiCompatible;
+}
+
++ (instancetype)encoderWithStringEncoding:(NSStringEncoding)encoding {
+    CFStringEncoding cfEncoding = CFStringConvertNSStringEncodingToEncoding(encoding);
+    if (cfEncoding == kCFStringEncodingInvalidId || !CFStringIsEncodingAvailable(cfEncoding)) {
+        return nil;
+    }
+    return [[self alloc] initWithCFEncoding:cfEncoding stringEncoding:encoding];
+}
+
++ (instancetype)encoderWithCodePage:(int)page {
+    switch (page) {
+        case 0:  return [self encoderWithCFEncoding:kCFStringEncodingDOSLatinUS];
+        case 2:  return [self encoderWithCFEncoding:kCFStringEncodingDOSLatin1];
+        case 3:  return [self encoderWithCFEncoding:kCFStringEncodingDOSPortuguese];
+        case 4:  return [self encoderWithCFEncoding:kCFStringEncodingDOSCanadianFrench];
+        case 5:  return [self encoderWithCFEncoding:kCFStringEncodingDOSNordic];
+        case 16: return [self encoderWithCFEncoding:kCFStringEncodingWindowsLatin1];
+        case 17: return [self encoderWithCFEncoding:kCFStringEncodingDOSRussian];
+        case 18: return [self encoderWithCFEncoding:kCFStringEncodingDOSLatin2];
+        case 19: return [self encoderWithCFEncoding:PTEEncodingPC858];
+    }
+    return nil;
+}
+
++ (instancetype)encoderWithCodePageName:(NSString *)name {
+    static NSDictionary<NSString *, NSNumber *> *pages = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        pages = @{
+            @"437": @(kCFStringEncodingDOSLatinUS),
+            @"850": @(kCFStringEncodingDOSLatin1),
+            @"852": @(kCFStringEncodingDOSLatin2),
+            @"857": @(kCFStringEncodingDOSTurkish),
+            @"858": @(PTEEncodingPC858),
+            @"860": @(kCFStringEncodingDOSPortuguese),
+            @"863": @(kCFStringEncodingDOSCanadianFrench),
+            @"865": @(kCFStringEncodingDOSNordic),
+            @"866": @(kCFStringEncodingDOSRussian),
+            @"932": @(kCFStringEncodingDOSJapanese),
+            @"936": @(kCFStringEncodingDOSChineseSimplif),
+            @"949": @(kCFStringEncodingDOSKorean),
+            @"950": @(kCFStringEncodingDOSChineseTrad),
+            @"1250": @(kCFStringEncodingWindowsLatin2),
+            @"1251": @(kCFStringEncodingWindowsCyrillic),
+            @"1252": @(kCFStringEncodingWindowsLatin1),
+            @"1253": @(kCFStringEncodingWindowsGreek),
+            @"1254": @(kCFStringEncodingWindowsLatin5),
+            @"1255": @(kCFStringEncodingWindowsHebrew),
+            @"1256": @(kCFStringEncodingWindowsArabic),
+            @"1257": @(kCFStringEncodingWindowsBalticRim),
+            @"UTF-8": @(kCFStringEncodingUTF8),
+        };
+    });
+    NSNumber *page = pages[name.uppercaseString];
+    return page ? [self encoderWithCFEncoding:(CFStringEncoding)page.unsignedIntValue] : nil;
+}
+
++ (instancetype)encoderWithCFEncoding:(CFStringEncoding)cfEncoding {
+    if (cfEncoding != PTEEncodingPC858 && !CFStringIsEncodingAvailable(cfEncoding)) {
+        return nil;
+    }
+    CFStringEncoding system = cfEncoding == PTEEncodingPC858 ? kCFStringEncodingDOSLatin1 : cfEncoding;
+    return [[self alloc] initWithCFEncoding:cfEncoding stringEncoding:CFStringConvertEncodingToNSStringEncoding(system)];
+}
+
+- (instancetype)initWithCFEncoding:(CFStringEncoding)cfEncoding stringEncoding:(NSStringEncoding)encoding {
+    self = [super init];
+    if (self) {
+        _cfEncoding = cfEncoding;
+        _stringEncoding = encoding;
+        _substitutionByte = '?';
+        _direct = PTEIsDirectEncoding(encoding);
+        _asciiCompatible = !_direct || encoding == NSUTF8StringEncoding;
+    }
+    return self;
+}
+
+- (const uint16_t *)table {
+    @synchronized (self) {
+        if (_table == nil) {
+            _table = PTETableForEncoding(_cfEncoding);
+        }
+        return _table.bytes;
+    }
+}
+
+/// Encodes one character the table does not cover (surrogate pairs, GB18030 four-byte sequences)
+/// with the system converter. Returns the number of bytes written to out (at most 8), 0 if unmappable.
+- (CFIndex)encodeFallback:(const UniChar *)units length:(CFIndex)length into:(uint8_t *)out {
+    if (_cfEncoding == PTEEncodingPC858) {
+        return 0;
+    }
+    CFStringRef string = CFStringCreateWithCharactersNoCopy(kCFAllocatorDefault, units, length, kCFAllocatorNull);
+    if (string == NULL) {
+        return 0;
+    }
+    CFIndex used = 0;
+    CFIndex converted = CFStringGetBytes(string, CFRangeMake(0, length), _cfEncoding, 0, false, out, 8, &used);
+    CFRelease(string);
+    return converted == length ? used : 0;
+}
+
+/// UTF-16 and UTF-32 go through the system converter; only unpaired surrogates cannot be encoded
+- (BOOL)appendWideString:(NSString *)string toData:(NSMutableData *)data unmappableRanges:(NSMutableArray<NSValue *> *)ranges baseOffset:(NSUInteger)base {
+    NSData *encoded = [string dataUsingEncoding:_stringEncoding allowLossyConversion:NO];
+    if (encoded) {
+        [data appendData:encoded];
+        return YES;
+    }
+    [data appendData:[string dataUsingEncoding:_stringEncoding allowLossyConversion:YES] ?: [NSData data]];
+    NSUInteger length = string.length;
+    for (NSUInteger i = 0; i < length; i++) {
+        unichar c = [string characterAtIndex:i];
+        if (CFStringIsSurrogateHighCharacter(c) && i + 1 < length && CFStringIsSurrogateLowCharacter([string characterAtIndex:i + 1])) {
+            i++;
+        } else if (CFStringIsSurrogateHighCharacter(c) || CFStringIsSurrogateLowCharacter(c)) {
+            [ranges addObject:[NSValue valueWithRange:NSMakeRange(base + i, 1)]];
+        }
+    }
+    return NO;
+}
+
+/// Appends the encoded string to data and the unmappable ranges (offset by base) to ranges.
+/// Returns YES if every character was mapped.
+- (BOOL)appendString:(NSString *)string toData:(NSMutableData *)data unmappableRanges:(NSMutableArray<NSValue *> *)ranges baseOffset:(NSUInteger)base {
+    CFStringRef cfString = (__bridge CFStringRef)string;
+    NSUInteger length = (NSUInteger)CFStringGetLength(cfString);
+    if (length == 0) {
+        return YES;
+    }
+
+    if (!_asciiCompatible) {
+        return [self appendWideString:string toData:data unmappableRanges:ranges baseOffset:base];
+    }
+
+    const char *ascii = CFStringGetCStringPtr(cfString, kCFStringEncodingASCII);
+    if (ascii != NULL) {
+        [data appendBytes:ascii length:length];
+        return YES;
+    }
+
+    if (_direct) {
+        NSData *encoded = [string dataUsingEncoding:_stringEncoding allowLossyConversion:NO];
+        if (encoded) {
+            [data appendData:encoded];
+            return YES;
+        }
+    }
+
+    const UniChar *units = CFStringGetCharactersPtr(cfString);
+    UniChar *copied = NULL;
+    if (units == NULL) {
+        copied = malloc(length * sizeof(UniChar));
+        if (copied == NULL) {
+            return NO;
+        }
+        CFStringGetCharacters(cfString, CFRangeMake(0, (CFIndex)length), copied);
+        units = copied;
+    }
+
+    // Worst case is a four-byte GB18030 sequence for every code unit
+    NSUInteger start = data.length;
+    [data setLength:start + length * 4];
+    uint8_t *out = (uint8_t *)data.mutableBytes + start;
+    size_t written = 0;
+    const uint16_t *table = _direct ? NULL : [self table];
+    BOOL mapped = YES;
+
+    size_t i = 0;
+    while (i < length) {
+        size_t run = PTEASCIIPrefixLength(units + i, length - i);
+        for (size_t k = 0; k < run; k++) {
+            out[written + k] = (uint8_t)units[i + k];
+        }
+        written += run;
+        i += run;
+        if (i >= length) {
+            break;
+        }
+
+        UniChar c = units[i];
+        uint16_t entry = table ? table[c] : PTEUnmapped;
+        if (entry != PTEUnmapped && !CFStringIsSurrogateHighCharacter(c) && !CFStringIsSurrogateLowCharacter(c)) {
+            if (entry < 0x100) {
+                out[written++] = (uint8_t)entry;
+            } else {
+                out[written++] = (uint8_t)(entry >> 8);
+                out[written++] = (uint8_t)(entry & 0xFF);
+            }
+            i++;
+            continue;
+        }
+
+        CFIndex span = (CFStringIsSurrogateHighCharacter(c) && i + 1 < length && CFStringIsSurrogateLowCharacter(units[i + 1])) ? 2 : 1;
+        uint8_t fallback[8];
+        CFIndex produced = [self encodeFallback:units + i length:span into:fallback];
+        if (produced > 0) {
+            memcpy(out + written, fallback, (size_t)produced);
+            written += (size_t)produced;
+        } else {
+            mapped = NO;
+            out[written++] = self.substitutionByte;
+            NSRange range = NSMakeRange(base + i, (NSUInteger)span);
+            NSValue *last = ranges.lastObject;
+            if (last && NSMaxRange(last.rangeValue) == range.location) {
+                NSRange merged = last.rangeValue;
+                merged.length += range.length;
+                ranges[ranges.count - 1] = [NSValue valueWithRange:merged];
+            } else if (ranges) {
+                [ranges addObject:[NSValue valueWithRange:range]];
+            }
+        }
+        i += (size_t)span;
+    }
+
+    [data setLength:start + written];
+    free(copied);
+    return mapped;
+}
+
+- (PrinterTextEncodingResult *)encodeString:(NSString *)string {
+    NSMutableData *data = [NSMutableData dataWithCapacity:string.length];
+    NSMutableArray<NSValue *> *ranges = [NSMutableArray array];
+    [self appendString:string toData:data unmappableRanges:ranges baseOffset:0];
+    return [[PrinterTextEncodingResult alloc] initWithData:data unmappableRanges:ranges];
+}
+
+- (NSData *)encodeLines:(NSArray<NSString *> *)lines terminator:(NSData *)terminator unmappableLines:(NSIndexSet **)unmappableLines {
+    NSUInteger capacity = 0;
+    for (NSString *line in lines) {
+        capacity += line.length + terminator.length;
+    }
+    NSMutableData *data = [NSMutableData dataWithCapacity:capacity];
+    NSMutableIndexSet *unmappable = [NSMutableIndexSet indexSet];
+    [lines enumerateObjectsUsingBlock:^(NSString *line, NSUInteger index, BOOL *stop) {
+        if (![self appendString:line toData:data unmappableRanges:nil baseOffset:0]) {
+            [unmappable addIndex:index];
+        }
+        if (terminator) {
+            [data appendData:terminator];
+        }
+    }];
+    if (unmappableLines != NULL) {
+        *unmappableLines = unmappable;
+    }
+    return data;
+}
+
+- (BOOL)canEncodeString:(NSString *)string {
+    NSMutableData *scratch = [NSMutableData dataWithCapacity:string.length];
+    return [self appendString:string toData:scratch unmappableRanges:nil baseOffset:0];
+}
+
+@end
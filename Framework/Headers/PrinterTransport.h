@@ -0,0 +1,141 @@
+//
+//  PrinterTransport.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Connection state of a transport
+typedef NS_ENUM(NSInteger, PrinterTransportState) {
+    PrinterTransportDisconnected = 0, ///< Not connected
+    PrinterTransportConnecting,       ///< Connect in progress
+    PrinterTransportConnected         ///< Ready for writes
+};
+
+/// Error domain of transport errors
+extern NSErrorDomain const PrinterTransportErrorDomain;
+
+/// Transport error codes
+typedef NS_ENUM(NSInteger, PrinterTransportError) {
+    PrinterTransportErrorNotConnected = 1, ///< Write or read without a connection
+    PrinterTransportErrorDisconnected,     ///< The connection was lost, pending writes failed
+    PrinterTransportErrorTimeout,          ///< Connect or read timed out
+    PrinterTransportErrorWriteFailed       ///< The link reported a failed write
+};
+
+/// Counters of a transport, updated as data moves
+@interface PrinterTransportMetrics : NSObject
+
+/// Bytes written successfully
+@property (nonatomic, readonly) NSUInteger bytesWritten;
+
+/// Bytes received
+@property (nonatomic, readonly) NSUInteger bytesRead;
+
+/// Writes completed successfully
+@property (nonatomic, readonly) NSUInteger writeCount;
+
+/// Writes that failed
+@property (nonatomic, readonly) NSUInteger failedWriteCount;
+
+/// Average time from handing a write to the link until its completion, in seconds
+@property (nonatomic, readonly) NSTimeInterval averageWriteLatency;
+
+/// Longest write, in seconds
+@property (nonatomic, readonly) NSTimeInterval maxWriteLatency;
+
+/// Write throughput since the connection was made, in bytes per second
+@property (nonatomic, readonly) double throughput;
+
+/// Time the current connection was made, nil when disconnected
+@property (nonatomic, strong, readonly, nullable) NSDate *connectedDate;
+
+/// Clears all counters
+- (void)reset;
+
+@end
+
+/// One interface for every link to a printer: BLE, WiFi or a plain TCP socket.
+/// Blocks are called on the transport's callback queue, the main queue unless set otherwise.
+/// Writes are queued and handed to the link one at a time in order; pendingBytes and the
+/// writable block let a producer stop above highWaterMark and resume once the queue drained.
+@protocol PrinterTransport <NSObject>
+
+/// Current state
+@property (nonatomic, readonly) PrinterTransportState state;
+
+/// Counters of this transport
+@property (nonatomic, strong, readonly) PrinterTransportMetrics *metrics;
+
+/// Largest write the link takes in one packet; larger writes are split by the link
+@property (nonatomic, readonly) NSUInteger maximumWriteLength;
+
+/// Bytes queued and not yet written
+@property (nonatomic, readonly) NSUInteger pendingBytes;
+
+/// Above this many pending bytes the producer should wait for the writable block (default: 64 KB)
+@property (nonatomic, assign) NSUInteger highWaterMark;
+
+/// Called on the callback queue when pendingBytes falls below half of highWaterMark after exceeding it
+@property (nonatomic, copy, nullable) void (^writableBlock)(void);
+
+/// Called on the callback queue with data received and not consumed by a read. While it is nil, such
+/// data (up to highWaterMark bytes) is kept and handed to the next read instead.
+@property (nonatomic, copy, nullable) void (^receiveBlock)(NSData *data);
+
+/// Called on the callback queue when the state changes
+@property (nonatomic, copy, nullable) void (^stateBlock)(PrinterTransportState state, NSError * _Nullable error);
+
+/// Connects the link
+- (void)connect;
+
+/// Disconnects the link and fails the pending writes and reads
+- (void)disconnect;
+
+/// Queues data for the printer
+/// @param data The data
+/// @param completion Called on the callback queue once the data was written or failed
+- (void)writeData:(NSData *)data completion:(nullable void (^)(BOOL success, NSError * _Nullable error))completion;
+
+/// Reads the next data the printer sends
+/// @param timeout Seconds to wait, 0 waits until the link closes
+/// @param completion Called on the callback queue with the data, or nil and an error
+- (void)readDataWithTimeout:(NSTimeInterval)timeout completion:(void (^)(NSData * _Nullable data, NSError * _Nullable error))completion;
+
+@end
+
+/// Shared plumbing for transports: write queue, reads, state and metrics.
+/// A subclass implements the three link methods below, which are called on the transport's serial
+/// queue, and reports back through the did methods, which may be called on any queue.
+@interface PrinterBaseTransport : NSObject <PrinterTransport>
+
+/// Queue the blocks are called on (default: main queue); set a private queue when no main run loop runs
+@property (nonatomic, strong) dispatch_queue_t callbackQueue;
+
+/// Opens the link; call didConnect or didDisconnectWithError: when done
+- (void)openLink;
+
+/// Closes the link
+- (void)closeLink;
+
+/// Writes one queued item; call done exactly once
+/// @param data The data
+/// @param done Completion of the write
+- (void)writeLinkData:(NSData *)data done:(void (^)(BOOL success, NSError * _Nullable error))done;
+
+/// Reports an open link
+- (void)didConnect;
+
+/// Reports a closed link
+/// @param error The reason, nil when closed on request
+- (void)didDisconnectWithError:(nullable NSError *)error;
+
+/// Reports data from the printer
+/// @param data The data
+- (void)didReceiveData:(NSData *)data;
+
+@end
+
+NS_ASSUME_NONNULL_END
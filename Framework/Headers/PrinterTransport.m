@@ -0,0 +1,332 @@
+//
+//  PrinterTransport.m
+//  Printer
+//
+
+#import "PrinterTransport.h"
+
+NSErrorDomain const PrinterTransportErrorDomain = @"PrinterTransportErrorDomain";
+
+static NSError *PrinterTransportMakeError(PrinterTransportError code, NSError *underlying) {
+    NSDictionary *userInfo = underlying ? @{NSUnderlyingErrorKey: underlying} : nil;
+    return [NSError errorWithDomain:PrinterTransportErrorDomain code:code userInfo:userInfo];
+}
+
+@interface PrinterTransportMetrics ()
+- (void)recordWriteOfLength:(NSUInteger)length latency:(NSTimeInterval)latency success:(BOOL)success;
+- (void)recordReadOfLength:(NSUInteger)length;
+- (void)setConnectedDate:(NSDate *)date;
+@end
+
+@implementation PrinterTransportMetrics {
+    NSTimeInterval _totalWriteLatency;
+}
+
+- (void)recordWriteOfLength:(NSUInteger)length latency:(NSTimeInterval)latency success:(BOOL)success {
+    if (!success) {
+        _failedWriteCount++;
+        return;
+    }
+    _bytesWritten += length;
+    _writeCount++;
+    _totalWriteLatency += latency;
+    _maxWriteLatency = MAX(_maxWriteLatency, latency);
+}
+
+- (void)recordReadOfLength:(NSUInteger)length {
+    _bytesRead += length;
+}
+
+- (void)setConnectedDate:(NSDate *)date {
+    _connectedDate = date;
+}
+
+- (NSTimeInterval)averageWriteLatency {
+    return _writeCount > 0 ? _totalWriteLatency / _writeCount : 0;
+}
+
+- (double)throughput {
+    NSTimeInterval elapsed = _connectedDate ? -[_connectedDate timeIntervalSinceNow] : 0;
+    return elapsed > 0 ? _bytesWritten / elapsed : 0;
+}
+
+- (void)reset {
+    _bytesWritten = 0;
+    _bytesRead = 0;
+    _writeCount = 0;
+    _failedWriteCount = 0;
+    _totalWriteLatency = 0;
+    _maxWriteLatency = 0;
+    if (_connectedDate) {
+        _connectedDate = [NSDate date];
+    }
+}
+
+@end
+
+/// A queued write
+@interface PrinterTransportWrite : NSObject
+@property (nonatomic, strong) NSData *data;
+@property (nonatomic, copy) void (^completion)(BOOL success, NSError *error);
+@end
+
+@implementation PrinterTransportWrite
+@end
+
+/// A waiting read
+@interface PrinterTransportRead : NSObject
+@property (nonatomic, copy) void (^completion)(NSData *data, NSError *error);
+@end
+
+@implementation PrinterTransportRead
+@end
+
+@implementation PrinterBaseTransport {
+    dispatch_queue_t _queue;
+    NSMutableArray<PrinterTransportWrite *> *_writes;
+    NSMutableArray<PrinterTransportRead *> *_reads;
+    /// Data that arrived with no read waiting and no receiveBlock, handed to the next read
+    NSMutableData *_unread;
+    BOOL _writing;
+    BOOL _aboveHighWaterMark;
+    /// Bumped on every disconnect so completions of an old connection are ignored
+    NSUInteger _generation;
+}
+
+@synthesize state = _state;
+@synthesize metrics = _metrics;
+@synthesize pendingBytes = _pendingBytes;
+@synthesize highWaterMark = _highWaterMark;
+@synthesize writableBlock = _writableBlock;
+@synthesize receiveBlock = _receiveBlock;
+@synthesize stateBlock = _stateBlock;
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _queue = dispatch_queue_create("com.printer.transport", DISPATCH_QUEUE_SERIAL);
+        _callbackQueue = dispatch_get_main_queue();
+        _writes = [NSMutableArray array];
+        _reads = [NSMutableArray array];
+        _unread = [NSMutableData data];
+        _metrics = [[PrinterTransportMetrics alloc] init];
+        _highWaterMark = 64 * 1024;
+    }
+    return self;
+}
+
+- (NSUInteger)maximumWriteLength {
+    return NSUIntegerMax;
+}
+
+#pragma mark - Link (subclasses)
+
+- (void)openLink {
+    [self didConnect];
+}
+
+- (void)closeLink {
+}
+
+- (void)writeLinkData:(NSData *)data done:(void (^)(BOOL, NSError *))done {
+    done(NO, PrinterTransportMakeError(PrinterTransportErrorWriteFailed, nil));
+}
+
+#pragma mark - PrinterTransport
+
+- (void)connect {
+    dispatch_async(_queue, ^{
+        if (self->_state != PrinterTransportDisconnected) {
+            return;
+        }
+        [self updateState:PrinterTransportConnecting error:nil];
+        [self openLink];
+    });
+}
+
+- (void)disconnect {
+    dispatch_async(_queue, ^{
+        if (self->_state == PrinterTransportDisconnected) {
+            return;
+        }
+        [self closeLink];
+        [self handleDisconnectWithError:nil];
+    });
+}
+
+- (void)writeData:(NSData *)data completion:(void (^)(BOOL, NSError *))completion {
+    PrinterTransportWrite *write = [[PrinterTransportWrite alloc] init];
+    write.data = [data copy];
+    write.completion = completion;
+    dispatch_async(_queue, ^{
+        if (self->_state != PrinterTransportConnected) {
+            [self completeWrite:write success:NO error:PrinterTransportMakeError(PrinterTransportErrorNotConnected, nil)];
+            return;
+        }
+        [self->_writes addObject:write];
+        self->_pendingBytes += write.data.length;
+        if (self->_pendingBytes > self.highWaterMark) {
+            self->_aboveHighWaterMark = YES;
+        }
+        [self writeNext];
+    });
+}
+
+- (void)readDataWithTimeout:(NSTimeInterval)timeout completion:(void (^)(NSData *, NSError *))completion {
+    PrinterTransportRead *read = [[PrinterTransportRead alloc] init];
+    read.completion = completion;
+    dispatch_async(_queue, ^{
+        if (self->_state != PrinterTransportConnected) {
+            [self completeRead:read data:nil error:PrinterTransportMakeError(PrinterTransportErrorNotConnected, nil)];
+            return;
+        }
+        if (self->_unread.length > 0) {
+            NSData *data = [self->_unread copy];
+            [self->_unread setLength:0];
+            [self completeRead:read data:data error:nil];
+            return;
+        }
+        [self->_reads addObject:read];
+        if (timeout <= 0) {
+            return;
+        }
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)), self->_queue, ^{
+            if ([self->_reads containsObject:read]) {
+                [self->_reads removeObject:read];
+                [self completeRead:read data:nil error:PrinterTransportMakeError(PrinterTransportErrorTimeout, nil)];
+            }
+        });
+    });
+}
+
+#pragma mark - Link events
+
+- (void)didConnect {
+    dispatch_async(_queue, ^{
+        if (self->_state != PrinterTransportConnecting) {
+            return;
+        }
+        [self->_metrics setConnectedDate:[NSDate date]];
+        [self updateState:PrinterTransportConnected error:nil];
+    });
+}
+
+- (void)didDisconnectWithError:(NSError *)error {
+    dispatch_async(_queue, ^{
+        [self handleDisconnectWithError:error];
+    });
+}
+
+- (void)didReceiveData:(NSData *)data {
+    if (data.length == 0) {
+        return;
+    }
+    dispatch_async(_queue, ^{
+        [self->_metrics recordReadOfLength:data.length];
+        PrinterTransportRead *read = self->_reads.firstObject;
+        if (read) {
+            [self->_reads removeObjectAtIndex:0];
+            [self completeRead:read data:data error:nil];
+            return;
+        }
+        void (^block)(NSData *) = self.receiveBlock;
+        if (block) {
+            dispatch_async(self.callbackQueue, ^{
+                block(data);
+            });
+        } else if (self->_unread.length + data.length <= self.highWaterMark) {
+            // Kept for a read posted a moment later, e.g. the next one of a multi-part reply
+            [self->_unread appendData:data];
+        }
+    });
+}
+
+#pragma mark - Private (transport queue)
+
+- (void)writeNext {
+    if (_writing || _writes.count == 0 || _state != PrinterTransportConnected) {
+        return;
+    }
+    _writing = YES;
+    PrinterTransportWrite *write = _writes.firstObject;
+    NSUInteger generation = _generation;
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    __block BOOL called = NO;
+    [self writeLinkData:write.data done:^(BOOL success, NSError *error) {
+        dispatch_async(self->_queue, ^{
+            if (called || generation != self->_generation) {
+                return;
+            }
+            called = YES;
+            [self finishWrite:write success:success error:error latency:CFAbsoluteTimeGetCurrent() - start];
+        });
+    }];
+}
+
+- (void)finishWrite:(PrinterTransportWrite *)write success:(BOOL)success error:(NSError *)error latency:(NSTimeInterval)latency {
+    [_writes removeObject:write];
+    _pendingBytes -= write.data.length;
+    _writing = NO;
+    [_metrics recordWriteOfLength:write.data.length latency:latency success:success];
+    [self completeWrite:write success:success error:success ? nil : PrinterTransportMakeError(PrinterTransportErrorWriteFailed, error)];
+
+    if (_aboveHighWaterMark && _pendingBytes <= self.highWaterMark / 2) {
+        _aboveHighWaterMark = NO;
+        void (^block)(void) = self.writableBlock;
+        if (block) {
+            dispatch_async(self.callbackQueue, block);
+        }
+    }
+    [self writeNext];
+}
+
+- (void)handleDisconnectWithError:(NSError *)error {
+    _generation++;
+    _writing = NO;
+    NSError *failure = PrinterTransportMakeError(PrinterTransportErrorDisconnected, error);
+    for (PrinterTransportWrite *write in _writes) {
+        [_metrics recordWriteOfLength:write.data.length latency:0 success:NO];
+        [self completeWrite:write success:NO error:failure];
+    }
+    for (PrinterTransportRead *read in _reads) {
+        [self completeRead:read data:nil error:failure];
+    }
+    [_writes removeAllObjects];
+    [_reads removeAllObjects];
+    [_unread setLength:0];
+    _pendingBytes = 0;
+    _aboveHighWaterMark = NO;
+    [_metrics setConnectedDate:nil];
+    [self updateState:PrinterTransportDisconnected error:error];
+}
+
+- (void)updateState:(PrinterTransportState)state error:(NSError *)error {
+    if (_state == state) {
+        return;
+    }
+    _state = state;
+    void (^block)(PrinterTransportState, NSError *) = self.stateBlock;
+    if (block) {
+        dispatch_async(self.callbackQueue, ^{
+            block(state, error);
+        });
+    }
+}
+
+- (void)completeWrite:(PrinterTransportWrite *)write success:(BOOL)success error:(NSError *)error {
+    void (^completion)(BOOL, NSError *) = write.completion;
+    if (completion) {
+        dispatch_async(self.callbackQueue, ^{
+            completion(success, error);
+        });
+    }
+}
+
+- (void)completeRead:(PrinterTransportRead *)read data:(NSData *)data error:(NSError *)error {
+    void (^completion)(NSData *, NSError *) = read.completion;
+    dispatch_async(self.callbackQueue, ^{
+        completion(data, error);
+    });
+}
+
+@end
@@ -0,0 +1,74 @@
+//
+//  PrinterTransportAdapters.h
+//  Printer
+//
+
+#import "PrinterTransport.h"
+#import "POSBLEManager.h"
+#import "TSCBLEManager.h"
+#import "POSWIFIManager.h"
+#import "TSCWIFIManager.h"
+#import "WIFIConnecter.h"
+#import "PrinterBLESessionManager.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// PrinterTransport over POSBLEManager or TSCBLEManager.
+/// The adapter becomes the manager's delegate while it is connected and writes through
+/// sendData:withPackageSize:completion:.
+@interface PrinterBLEManagerTransport : PrinterBaseTransport <POSBLEManagerDelegate, TSCBLEManagerDelegate>
+
+/// Bytes per BLE write (default: 20)
+@property (nonatomic, assign) NSUInteger packageSize;
+
+/// Peripheral connected by connect; nil adopts the peripheral the manager is connected to
+@property (nonatomic, strong, nullable) CBPeripheral *peripheral;
+
+/// Creates a transport over a receipt printer manager
+- (instancetype)initWithPOSManager:(POSBLEManager *)manager;
+
+/// Creates a transport over a label printer manager
+- (instancetype)initWithTSCManager:(TSCBLEManager *)manager;
+
+@end
+
+/// PrinterTransport over POSWIFIManager or TSCWIFIManager
+@interface PrinterWiFiManagerTransport : PrinterBaseTransport <POSWIFIManagerDelegate, TSCWIFIManagerDelegate>
+
+/// Printer address; nil adopts the connection the manager already has
+@property (nonatomic, copy, nullable) NSString *host;
+
+/// Printer port (default: 9100)
+@property (nonatomic, assign) UInt16 port;
+
+/// Creates a transport over a receipt printer manager
+- (instancetype)initWithPOSManager:(POSWIFIManager *)manager;
+
+/// Creates a transport over a label printer manager
+- (instancetype)initWithTSCManager:(TSCWIFIManager *)manager;
+
+@end
+
+/// PrinterTransport over a WIFIConnecter, one per printer
+@interface PrinterConnecterTransport : PrinterBaseTransport <WIFIConnecterDelegate>
+
+/// Printer address; nil adopts the connection the connecter already has
+@property (nonatomic, copy, nullable) NSString *host;
+
+/// Printer port (default: 9100)
+@property (nonatomic, assign) UInt16 port;
+
+/// Creates a transport
+- (instancetype)initWithConnecter:(WIFIConnecter *)connecter;
+
+@end
+
+/// PrinterTransport over a PrinterBLESession
+@interface PrinterBLESessionTransport : PrinterBaseTransport
+
+/// Creates a transport; the session's receive and state blocks are taken over by the transport
+- (instancetype)initWithSession:(PrinterBLESession *)session;
+
+@end
+
+NS_ASSUME_NONNULL_END
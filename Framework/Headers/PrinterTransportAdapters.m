@@ -0,0 +1,360 @@
+//
+//  PrinterTransportAdapters.m
+//  Printer
+//
+
+#import "PrinterTransportAdapters.h"
+
+#pragma mark - BLE managers
+
+@implementation PrinterBLEManagerTransport {
+    POSBLEManager *_posManager;
+    TSCBLEManager *_tscManager;
+}
+
+- (instancetype)initWithPOSManager:(POSBLEManager *)manager {
+    self = [super init];
+    if (self) {
+        _posManager = manager;
+        _packageSize = 20;
+    }
+    return self;
+}
+
+- (instancetype)initWithTSCManager:(TSCBLEManager *)manager {
+    self = [super init];
+    if (self) {
+        _tscManager = manager;
+        _packageSize = 20;
+    }
+    return self;
+}
+
+- (NSUInteger)maximumWriteLength {
+    return MAX(self.packageSize, 1);
+}
+
+- (void)openLink {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        BOOL connected;
+        if (self->_posManager) {
+            self->_posManager.delegate = self;
+            connected = [self->_posManager printerIsConnect];
+        } else {
+            self->_tscManager.delegate = self;
+            connected = self->_tscManager.isConnecting;
+        }
+        CBPeripheral *current = self->_posManager ? self->_posManager.writePeripheral : self->_tscManager.writePeripheral;
+        if (connected && (self.peripheral == nil || [current.identifier isEqual:self.peripheral.identifier])) {
+            [self didConnect];
+        } else if (self.peripheral) {
+            if (self->_posManager) {
+                [self->_posManager connectDevice:self.peripheral];
+            } else {
+                [self->_tscManager connectDevice:self.peripheral];
+            }
+        } else {
+            [self didDisconnectWithError:nil];
+        }
+    });
+}
+
+- (void)closeLink {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (self->_posManager) {
+            [self->_posManager removeDelegate:self];
+            [self->_posManager disconnectRootPeripheral];
+        } else {
+            [self->_tscManager removeDelegate:self];
+            [self->_tscManager disconnectRootPeripheral];
+        }
+    });
+}
+
+- (void)writeLinkData:(NSData *)data done:(void (^)(BOOL, NSError *))done {
+    NSUInteger length = data.length;
+    void (^completion)(BOOL, NSUInteger, NSUInteger, NSError *) = ^(BOOL success, NSUInteger totalBytesSent, NSUInteger currentPackageIndex, NSError *error) {
+        // Called per package; the write is done after the last one or the first failure
+        if (error || !success) {
+            done(NO, error);
+        } else if (totalBytesSent >= length) {
+            done(YES, nil);
+        }
+    };
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (self->_posManager) {
+            [self->_posManager sendData:data withPackageSize:self.maximumWriteLength completion:completion];
+        } else {
+            [self->_tscManager sendData:data withPackageSize:self.maximumWriteLength completion:completion];
+        }
+    });
+}
+
+#pragma mark - POSBLEManagerDelegate
+
+- (void)POSbleConnectPeripheral:(CBPeripheral *)peripheral {
+    [self didConnect];
+}
+
+- (void)POSbleFailToConnectPeripheral:(CBPeripheral *)peripheral error:(NSError *)error {
+    [self didDisconnectWithError:error];
+}
+
+- (void)POSbleDisconnectPeripheral:(CBPeripheral *)peripheral error:(NSError *)error {
+    [self didDisconnectWithError:error];
+}
+
+- (void)POSbleReceiveValueForCharacteristic:(CBCharacteristic *)characteristic error:(NSError *)error {
+    if (error == nil && characteristic.value) {
+        [self didReceiveData:characteristic.value];
+    }
+}
+
+#pragma mark - TSCBLEManagerDelegate
+
+- (void)TSCbleConnectPeripheral:(CBPeripheral *)peripheral {
+    [self didConnect];
+}
+
+- (void)TSCbleFailToConnectPeripheral:(CBPeripheral *)peripheral error:(NSError *)error {
+    [self didDisconnectWithError:error];
+}
+
+- (void)TSCbleDisconnectPeripheral:(CBPeripheral *)peripheral error:(NSError *)error {
+    [self didDisconnectWithError:error];
+}
+
+- (void)TSCbleReceiveValueForCharacteristic:(CBCharacteristic *)characteristic error:(NSError *)error {
+    if (error == nil && characteristic.value) {
+        [self didReceiveData:characteristic.value];
+    }
+}
+
+@end
+
+#pragma mark - WiFi managers
+
+@implementation PrinterWiFiManagerTransport {
+    POSWIFIManager *_posManager;
+    TSCWIFIManager *_tscManager;
+}
+
+- (instancetype)initWithPOSManager:(POSWIFIManager *)manager {
+    self = [super init];
+    if (self) {
+        _posManager = manager;
+        _port = 9100;
+    }
+    return self;
+}
+
+- (instancetype)initWithTSCManager:(TSCWIFIManager *)manager {
+    self = [super init];
+    if (self) {
+        _tscManager = manager;
+        _port = 9100;
+    }
+    return self;
+}
+
+- (void)openLink {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        BOOL connected;
+        NSString *currentHost;
+        if (self->_posManager) {
+            self->_posManager.delegate = self;
+            connected = [self->_posManager printerIsConnect];
+            currentHost = self->_posManager.hostStr;
+        } else {
+            self->_tscManager.delegate = self;
+            connected = self->_tscManager.isConnect;
+            currentHost = self->_tscManager.hostStr;
+        }
+        if (connected && (self.host == nil || [currentHost isEqualToString:self.host])) {
+            [self didConnect];
+        } else if (self.host) {
+            if (self->_posManager) {
+                [self->_posManager connectWithHost:self.host port:self.port];
+            } else {
+                [self->_tscManager connectWithHost:self.host port:self.port];
+            }
+        } else {
+            [self didDisconnectWithError:nil];
+        }
+    });
+}
+
+- (void)closeLink {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (self->_posManager) {
+            [self->_posManager removeDelegate:self];
+            [self->_posManager disconnect];
+        } else {
+            [self->_tscManager removeDelegate:self];
+            [self->_tscManager disconnect];
+        }
+    });
+}
+
+- (void)writeLinkData:(NSData *)data done:(void (^)(BOOL, NSError *))done {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (self->_posManager) {
+            [self->_posManager writeCommandWithData:data writeCallBack:^(BOOL success, NSError *error) {
+                done(success, error);
+            }];
+        } else {
+            // The label manager reports the tag of a completed write, never a failure
+            [self->_tscManager writeCommandWithData:data writeCallBack:^(long tag) {
+                done(YES, nil);
+            }];
+        }
+    });
+}
+
+#pragma mark - POSWIFIManagerDelegate
+
+- (void)POSwifiConnectedToHost:(NSString *)host port:(UInt16)port {
+    [self didConnect];
+}
+
+- (void)POSwifiDisconnectWithError:(NSError *)error {
+    [self didDisconnectWithError:error];
+}
+
+- (void)POSwifiReceiveValueForData:(NSData *)data {
+    [self didReceiveData:data];
+}
+
+#pragma mark - TSCWIFIManagerDelegate
+
+- (void)TSCwifiConnectedToHost:(NSString *)host port:(UInt16)port {
+    [self didConnect];
+}
+
+- (void)TSCwifiDisconnectWithError:(NSError *)error {
+    [self didDisconnectWithError:error];
+}
+
+- (void)TSCwifiReceiveValueForData:(NSData *)data {
+    [self didReceiveData:data];
+}
+
+@end
+
+#pragma mark - WIFIConnecter
+
+@implementation PrinterConnecterTransport {
+    WIFIConnecter *_connecter;
+}
+
+- (instancetype)initWithConnecter:(WIFIConnecter *)connecter {
+    self = [super init];
+    if (self) {
+        _connecter = connecter;
+        _port = 9100;
+    }
+    return self;
+}
+
+- (void)openLink {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        self->_connecter.delegate = self;
+        BOOL connected = [self->_connecter printerCheckWithMac];
+        if (connected && (self.host == nil || [self->_connecter.deviceIP isEqualToString:self.host])) {
+            [self didConnect];
+        } else if (self.host) {
+            [self->_connecter connectWithHost:self.host port:self.port];
+        } else {
+            [self didDisconnectWithError:nil];
+        }
+    });
+}
+
+- (void)closeLink {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [self->_connecter removeDelegate:self];
+        [self->_connecter disconnect];
+    });
+}
+
+- (void)writeLinkData:(NSData *)data done:(void (^)(BOOL, NSError *))done {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [self->_connecter writeCommandWithData:data writeCallBack:^(BOOL success, NSError *error) {
+            done(success, error);
+        }];
+    });
+}
+
+#pragma mark - WIFIConnecterDelegate
+
+- (void)wifiPOSConnectedToHost:(NSString *)ip port:(UInt16)port mac:(NSString *)mac {
+    [self didConnect];
+}
+
+- (void)wifiPOSDisconnectWithError:(NSError *)error mac:(NSString *)mac ip:(NSString *)ip {
+    [self didDisconnectWithError:error];
+}
+
+- (void)wifiPOSReceiveValueForData:(NSData *)data mac:(NSString *)mac ip:(NSString *)ip {
+    [self didReceiveData:data];
+}
+
+@end
+
+#pragma mark - BLE sessions
+
+@implementation PrinterBLESessionTransport {
+    PrinterBLESession *_session;
+}
+
+- (instancetype)initWithSession:(PrinterBLESession *)session {
+    self = [super init];
+    if (self) {
+        _session = session;
+        __weak PrinterBLESessionTransport *weakSelf = self;
+        session.receiveBlock = ^(NSData *data) {
+            [weakSelf didReceiveData:data];
+        };
+        session.stateBlock = ^(PrinterBLESessionState state, NSError *error) {
+            if (state == PrinterBLESessionReady) {
+                [weakSelf didConnect];
+            } else if (state == PrinterBLESessionDisconnected) {
+                [weakSelf didDisconnectWithError:error];
+            }
+        };
+    }
+    return self;
+}
+
+- (NSUInteger)maximumWriteLength {
+    CBCharacteristic *characteristic = _session.writeCharacteristic;
+    if (characteristic == nil) {
+        return 20;
+    }
+    CBCharacteristicWriteType type = (characteristic.properties & CBCharacteristicPropertyWriteWithoutResponse) ? CBCharacteristicWriteWithoutResponse : CBCharacteristicWriteWithResponse;
+    return MAX([_session.peripheral maximumWriteValueLengthForType:type], 20);
+}
+
+- (void)openLink {
+    switch (_session.state) {
+        case PrinterBLESessionReady:
+            [self didConnect];
+            break;
+        case PrinterBLESessionDisconnected:
+            [self didDisconnectWithError:nil];
+            break;
+        case PrinterBLESessionConnecting:
+            // The state block reports the outcome
+            break;
+    }
+}
+
+- (void)closeLink {
+    [_session close];
+}
+
+- (void)writeLinkData:(NSData *)data done:(void (^)(BOOL, NSError *))done {
+    [_session writeData:data completion:done];
+}
+
+@end
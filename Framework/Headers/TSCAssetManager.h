@@ -0,0 +1,93 @@
+//
+//  TSCAssetManager.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "PrinterTransport.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// A file kept in printer memory: font, form (.BAS program) or logo (.BMP/.PCX)
+@interface TSCAsset : NSObject
+
+/// File name on the printer, stored upper case
+@property (nonatomic, copy, readonly) NSString *name;
+
+/// File content
+@property (nonatomic, strong, readonly) NSData *data;
+
+/// Store in FLASH instead of DRAM, so the file survives a power cycle
+@property (nonatomic, assign) BOOL storeInFlash;
+
+/// SHA-256 of the content, hex encoded
+@property (nonatomic, copy, readonly) NSString *contentHash;
+
+/// Creates an asset
+/// @param name File name on the printer, e.g. "LOGO.BMP" or "FORM1.BAS"
+/// @param data File content
++ (instancetype)assetWithName:(NSString *)name data:(NSData *)data;
+
+/// DOWNLOAD command for the asset; .BAS files are downloaded as a program ending with EOP
+- (NSData *)downloadCommand;
+
+@end
+
+/// Tracks which assets each printer already holds, so only missing or changed files are sent.
+/// A manifest of name, size and content hash is kept per printer and persisted in the caches
+/// directory. Before a sync the printer's file listing (~!F) is compared with the manifest: files the
+/// printer lost (reset, formatted) drop out of the manifest and are sent again. Jobs then refer to
+/// the files with PUTBMP/PUTPCX (TSCCommand putBmpWithX:) or RUN (TSCCommand run:).
+@interface TSCAssetManager : NSObject
+
+/// Location of the manifest file (default: Caches/TSCAssetManifest.plist)
+@property (nonatomic, copy) NSString *manifestPath;
+
+/// Command that asks for the file listing (default: "~!F", the enquiry answered with the file names
+/// and a closing 0x1A). FILES is no substitute: it prints the listing on the media.
+@property (nonatomic, copy) NSData *listingCommand;
+
+/// Seconds of silence that end a listing reply without the closing 0x1A (default: 0.3)
+@property (nonatomic, assign) NSTimeInterval listingIdleTimeout;
+
+/// Returns the shared manager
++ (instancetype)sharedManager;
+
+/// File names in a listing reply, upper case
+/// @param listing The reply
++ (NSSet<NSString *> *)fileNamesInListing:(NSData *)listing;
+
+/// Drops manifest entries for files the printer no longer lists
+/// @param listing The printer's listing reply
+/// @param printerID Identifier of the printer, e.g. its MAC address
+- (void)updateWithFileListing:(NSData *)listing forPrinter:(NSString *)printerID;
+
+/// Assets the printer is missing or holds with different content
+/// @param assets Assets the jobs need
+/// @param printerID Identifier of the printer
+- (NSArray<TSCAsset *> *)staleAssets:(NSArray<TSCAsset *> *)assets forPrinter:(NSString *)printerID;
+
+/// Records assets as present on the printer
+/// @param assets Assets that were downloaded
+/// @param printerID Identifier of the printer
+- (void)markAssets:(NSArray<TSCAsset *> *)assets downloadedToPrinter:(NSString *)printerID;
+
+/// Forgets everything known about a printer
+/// @param printerID Identifier of the printer
+- (void)invalidatePrinter:(NSString *)printerID;
+
+/// Reads the file listing, then downloads the stale assets in one batch and records them.
+/// If the download write fails, the printer's manifest is dropped, since a partial DOWNLOAD can leave
+/// any of its files damaged.
+/// @param assets Assets the jobs need
+/// @param printerID Identifier of the printer
+/// @param transport A connected transport to the printer
+/// @param completion Called on the transport's callback queue with the names downloaded, or an error
+- (void)syncAssets:(NSArray<TSCAsset *> *)assets
+        forPrinter:(NSString *)printerID
+         transport:(id<PrinterTransport>)transport
+        completion:(void (^)(NSArray<NSString *> * _Nullable downloaded, NSError * _Nullable error))completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,259 @@
+//
+//  TSCAssetManager.m
+//  Printer
+//
+
+#import "TSCAssetManager.h"
+#import "TSCCommand.h"
+#import <CommonCrypto/CommonDigest.h>
+
+/// Seconds to wait for the first bytes of the listing reply
+static const NSTimeInterval TSCAssetListingFirstByteTimeout = 2;
+
+/// Ends the ~!F reply
+static const uint8_t TSCAssetListingEnd = 0x1A;
+
+/// Manifest keys
+static NSString *const TSCAssetHashKey = @"hash";
+static NSString *const TSCAssetLengthKey = @"length";
+
+@implementation TSCAsset
+
++ (instancetype)assetWithName:(NSString *)name data:(NSData *)data {
+    TSCAsset *asset = [[self alloc] init];
+    asset->_name = [name uppercaseString];
+    asset->_data = [data copy];
+    uint8_t digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(asset->_data.bytes, (CC_LONG)asset->_data.length, digest);
+    NSMutableString *hash = [NSMutableString stringWithCapacity:CC_SHA256_DIGEST_LENGTH * 2];
+    for (int i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+        [hash appendFormat:@"%02x", digest[i]];
+    }
+    asset->_contentHash = hash;
+    return asset;
+}
+
+- (NSData *)downloadCommand {
+    NSMutableData *command = [NSMutableData data];
+    NSString *memory = self.storeInFlash ? @"F," : @"";
+    if ([self.name hasSuffix:@".BAS"]) {
+        NSString *header = [NSString stringWithFormat:@"DOWNLOAD %@\"%@\"\r\n", memory, self.name];
+        [command appendData:[header dataUsingEncoding:NSASCIIStringEncoding]];
+        [command appendData:self.data];
+        [command appendData:[@"\r\n" dataUsingEncoding:NSASCIIStringEncoding]];
+        [command appendData:[TSCCommand eop]];
+    } else {
+        NSString *header = [NSString stringWithFormat:@"DOWNLOAD %@\"%@\",%lu,", memory, self.name, (unsigned long)self.data.length];
+        [command appendData:[header dataUsingEncoding:NSASCIIStringEncoding]];
+        [command appendData:self.data];
+        [command appendData:[@"\r\n" dataUsingEncoding:NSASCIIStringEncoding]];
+    }
+    return command;
+}
+
+@end
+
+@implementation TSCAssetManager {
+    NSMutableDictionary<NSString *, NSMutableDictionary<NSString *, NSDictionary *> *> *_manifest;
+    BOOL _manifestLoaded;
+}
+
++ (instancetype)sharedManager {
+    static TSCAssetManager *manager = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        manager = [[TSCAssetManager alloc] init];
+    });
+    return manager;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        NSString *caches = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject ?: NSTemporaryDirectory();
+        _manifestPath = [caches stringByAppendingPathComponent:@"TSCAssetManifest.plist"];
+        _listingCommand = [@"~!F" dataUsingEncoding:NSASCIIStringEncoding];
+        _listingIdleTimeout = 0.3;
+        _manifest = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (void)setManifestPath:(NSString *)manifestPath {
+    @synchronized (self) {
+        _manifestPath = [manifestPath copy];
+        _manifestLoaded = NO;
+    }
+}
+
+#pragma mark - Manifest
+
+- (NSMutableDictionary<NSString *, NSDictionary *> *)entriesForPrinter:(NSString *)printerID {
+    if (!_manifestLoaded) {
+        _manifestLoaded = YES;
+        [_manifest removeAllObjects];
+        NSDictionary *stored = [NSDictionary dictionaryWithContentsOfFile:self.manifestPath];
+        for (NSString *printer in stored) {
+            NSDictionary *entries = stored[printer];
+            if ([entries isKindOfClass:[NSDictionary class]]) {
+                _manifest[printer] = [entries mutableCopy];
+            }
+        }
+    }
+    NSMutableDictionary<NSString *, NSDictionary *> *entries = _manifest[printerID];
+    if (entries == nil) {
+        entries = [NSMutableDictionary dictionary];
+        _manifest[printerID] = entries;
+    }
+    return entries;
+}
+
+- (void)saveManifest {
+    [_manifest writeToFile:self.manifestPath atomically:YES];
+}
+
++ (NSSet<NSString *> *)fileNamesInListing:(NSData *)listing {
+    NSString *text = [[NSString alloc] initWithData:listing encoding:NSASCIIStringEncoding] ?: @"";
+    NSCharacterSet *separators = [NSCharacterSet characterSetWithCharactersInString:@"\r\n\x1a\0"];
+    NSCharacterSet *blanks = [NSCharacterSet whitespaceCharacterSet];
+    NSMutableSet<NSString *> *names = [NSMutableSet set];
+    for (NSString *line in [text componentsSeparatedByCharactersInSet:separators]) {
+        NSString *trimmed = [line stringByTrimmingCharactersInSet:blanks];
+        if (trimmed.length == 0) {
+            continue;
+        }
+        // Headers and totals ("DRAM FILE LIST", "FREE MEMORY ...") have no file extension
+        NSString *name = [[trimmed componentsSeparatedByCharactersInSet:blanks].firstObject stringByTrimmingCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@"\""]];
+        if ([name rangeOfString:@"."].location != NSNotFound && name.length <= 64) {
+            [names addObject:[name uppercaseString]];
+        }
+    }
+    return names;
+}
+
+- (void)updateWithFileListing:(NSData *)listing forPrinter:(NSString *)printerID {
+    NSSet<NSString *> *names = [[self class] fileNamesInListing:listing];
+    @synchronized (self) {
+        NSMutableDictionary<NSString *, NSDictionary *> *entries = [self entriesForPrinter:printerID];
+        NSUInteger count = entries.count;
+        for (NSString *name in entries.allKeys) {
+            if (![names containsObject:name]) {
+                [entries removeObjectForKey:name];
+            }
+        }
+        if (entries.count != count) {
+            [self saveManifest];
+        }
+    }
+}
+
+- (NSArray<TSCAsset *> *)staleAssets:(NSArray<TSCAsset *> *)assets forPrinter:(NSString *)printerID {
+    NSMutableArray<TSCAsset *> *stale = [NSMutableArray array];
+    @synchronized (self) {
+        NSMutableDictionary<NSString *, NSDictionary *> *entries = [self entriesForPrinter:printerID];
+        for (TSCAsset *asset in assets) {
+            NSDictionary *entry = entries[asset.name];
+            BOOL current = [entry[TSCAssetHashKey] isEqualToString:asset.contentHash] && [entry[TSCAssetLengthKey] unsignedIntegerValue] == asset.data.length;
+            if (!current) {
+                [stale addObject:asset];
+            }
+        }
+    }
+    return stale;
+}
+
+- (void)markAssets:(NSArray<TSCAsset *> *)assets downloadedToPrinter:(NSString *)printerID {
+    @synchronized (self) {
+        NSMutableDictionary<NSString *, NSDictionary *> *entries = [self entriesForPrinter:printerID];
+        for (TSCAsset *asset in assets) {
+            entries[asset.name] = @{TSCAssetHashKey: asset.contentHash, TSCAssetLengthKey: @(asset.data.length)};
+        }
+        [self saveManifest];
+    }
+}
+
+- (void)invalidatePrinter:(NSString *)printerID {
+    @synchronized (self) {
+        [[self entriesForPrinter:printerID] removeAllObjects];
+        [_manifest removeObjectForKey:printerID];
+        [self saveManifest];
+    }
+}
+
+#pragma mark - Sync
+
+- (void)syncAssets:(NSArray<TSCAsset *> *)assets
+        forPrinter:(NSString *)printerID
+         transport:(id<PrinterTransport>)transport
+        completion:(void (^)(NSArray<NSString *> *, NSError *))completion {
+    NSMutableData *listing = [NSMutableData data];
+    // The enquiry's write and the listing's read both have to finish; both report on the callback queue
+    __block NSUInteger pending = 2;
+    __block NSError *writeError = nil;
+    __block BOOL written = YES;
+    void (^finish)(void) = ^{
+        if (--pending > 0) {
+            return;
+        }
+        if (!written) {
+            completion(nil, writeError);
+            return;
+        }
+        // No reply says nothing about the printer's files, keep the manifest as it is
+        if (listing.length > 0) {
+            [self updateWithFileListing:listing forPrinter:printerID];
+        }
+        [self downloadAssets:[self staleAssets:assets forPrinter:printerID] forPrinter:printerID transport:transport completion:completion];
+    };
+    // Post the read before the enquiry goes out, so a fast reply reaches it instead of receiveBlock
+    [self readListing:listing transport:transport timeout:TSCAssetListingFirstByteTimeout completion:finish];
+    [transport writeData:self.listingCommand completion:^(BOOL success, NSError *error) {
+        written = success;
+        writeError = error;
+        finish();
+    }];
+}
+
+/// Collects the listing reply until its closing 0x1A, or until the printer stays silent for listingIdleTimeout
+- (void)readListing:(NSMutableData *)listing transport:(id<PrinterTransport>)transport timeout:(NSTimeInterval)timeout completion:(void (^)(void))completion {
+    [transport readDataWithTimeout:timeout completion:^(NSData *data, NSError *error) {
+        if (data == nil) {
+            completion();
+            return;
+        }
+        [listing appendData:data];
+        if (memchr(data.bytes, TSCAssetListingEnd, data.length) != NULL) {
+            completion();
+            return;
+        }
+        [self readListing:listing transport:transport timeout:self.listingIdleTimeout completion:completion];
+    }];
+}
+
+- (void)downloadAssets:(NSArray<TSCAsset *> *)stale
+            forPrinter:(NSString *)printerID
+             transport:(id<PrinterTransport>)transport
+            completion:(void (^)(NSArray<NSString *> *, NSError *))completion {
+    if (stale.count == 0) {
+        completion(@[], nil);
+        return;
+    }
+    // One write, so the transport streams all downloads back to back
+    NSMutableData *batch = [NSMutableData data];
+    NSMutableArray<NSString *> *names = [NSMutableArray arrayWithCapacity:stale.count];
+    for (TSCAsset *asset in stale) {
+        [batch appendData:[asset downloadCommand]];
+        [names addObject:asset.name];
+    }
+    [transport writeData:batch completion:^(BOOL success, NSError *error) {
+        if (!success) {
+            [self invalidatePrinter:printerID];
+            completion(nil, error);
+            return;
+        }
+        [self markAssets:stale downloadedToPrinter:printerID];
+        completion(names, nil);
+    }];
+}
+
+@end
@@ -0,0 +1,72 @@
+//
+//  TSCFormCompiler.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "TSCAssetManager.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Error domain of the form compiler
+extern NSErrorDomain const TSCFormCompilerErrorDomain;
+
+/// Form compiler error codes
+typedef NS_ENUM(NSInteger, TSCFormCompilerError) {
+    TSCFormCompilerErrorSyntax = 1,     ///< Unterminated quote or placeholder, or an invalid placeholder name
+    TSCFormCompilerErrorMissingValue,   ///< A record has no value for a placeholder
+    TSCFormCompilerErrorInvalidValue    ///< A value contains a line break, or a numeric placeholder got text
+};
+
+/// A label template compiled into a TSPL program
+@interface TSCCompiledForm : NSObject
+
+/// Program file name on the printer, e.g. "PRICE.BAS"
+@property (nonatomic, copy, readonly) NSString *name;
+
+/// Program body
+@property (nonatomic, strong, readonly) NSData *program;
+
+/// Placeholder names in order of first use
+@property (nonatomic, copy, readonly) NSArray<NSString *> *placeholders;
+
+/// Encoding of the program and the values
+@property (nonatomic, readonly) NSStringEncoding encoding;
+
+/// The program as an asset, for TSCAssetManager so it is only downloaded when it changed
+- (TSCAsset *)asset;
+
+/// Variable assignments and RUN for one label
+/// @param values Value for every placeholder
+/// @param error Set when a value is missing or invalid
+- (nullable NSData *)labelCommandWithValues:(NSDictionary<NSString *, NSString *> *)values error:(NSError **)error;
+
+/// Label commands for many labels, concatenated
+/// @param records One value dictionary per label
+/// @param error Set for the first invalid record
+- (nullable NSData *)batchCommandWithRecords:(NSArray<NSDictionary<NSString *, NSString *> *> *)records error:(NSError **)error;
+
+@end
+
+/// Compiles label templates into on-printer TSPL programs, so the layout is sent once and every
+/// label only carries its variable data.
+///
+/// A template is ordinary TSPL (SIZE, CLS, TEXT, BARCODE, PRINT ...) with {{name}} placeholders.
+/// Inside a quoted string a placeholder becomes a string variable joined to the literal parts
+/// ("Price: {{price}}" compiles to "Price: "+V1$); anywhere else it becomes a numeric variable.
+/// Each label is sent as the variable assignments followed by RUN "NAME.BAS".
+@interface TSCFormCompiler : NSObject
+
+/// Compiles a template
+/// @param source TSPL template with {{name}} placeholders; names are letters, digits and underscores
+/// @param name Program name, up to 8 characters without extension
+/// @param encoding Encoding of the template text and the values, e.g. GB18030 or Windows-1252
+/// @param error Set on a syntax error
++ (nullable TSCCompiledForm *)compileTemplate:(NSString *)source
+                                         name:(NSString *)name
+                                     encoding:(NSStringEncoding)encoding
+                                        error:(NSError **)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,205 @@
+//
+//  TSCFormCompiler.m
+//  Printer
+//
+
+#import "TSCFormCompiler.h"
+
+NSErrorDomain const TSCFormCompilerErrorDomain = @"TSCFormCompilerErrorDomain";
+
+/// How a placeholder is used in the program
+typedef NS_OPTIONS(NSUInteger, TSCFormVariableKind) {
+    TSCFormVariableString = 1 << 0,
+    TSCFormVariableNumber = 1 << 1
+};
+
+static NSError *TSCFormMakeError(TSCFormCompilerError code, NSString *description) {
+    return [NSError errorWithDomain:TSCFormCompilerErrorDomain code:code userInfo:@{NSLocalizedDescriptionKey: description}];
+}
+
+static BOOL TSCFormIsIdentifier(NSString *string, NSUInteger maxLength) {
+    if (string.length == 0 || string.length > maxLength) {
+        return NO;
+    }
+    NSMutableCharacterSet *allowed = [NSMutableCharacterSet alphanumericCharacterSet];
+    [allowed addCharactersInString:@"_"];
+    return [string rangeOfCharacterFromSet:[allowed invertedSet]].location == NSNotFound
+        && [string canBeConvertedToEncoding:NSASCIIStringEncoding];
+}
+
+@interface TSCCompiledForm ()
+- (instancetype)initWithName:(NSString *)name program:(NSData *)program placeholders:(NSArray<NSString *> *)placeholders kinds:(NSDictionary<NSString *, NSNumber *> *)kinds encoding:(NSStringEncoding)encoding;
+@end
+
+@implementation TSCCompiledForm {
+    NSDictionary<NSString *, NSNumber *> *_kinds;
+}
+
+- (instancetype)initWithName:(NSString *)name program:(NSData *)program placeholders:(NSArray<NSString *> *)placeholders kinds:(NSDictionary<NSString *, NSNumber *> *)kinds encoding:(NSStringEncoding)encoding {
+    self = [super init];
+    if (self) {
+        _name = [name copy];
+        _program = program;
+        _placeholders = [placeholders copy];
+        _kinds = [kinds copy];
+        _encoding = encoding;
+    }
+    return self;
+}
+
+- (TSCAsset *)asset {
+    return [TSCAsset assetWithName:self.name data:self.program];
+}
+
+- (NSData *)labelCommandWithValues:(NSDictionary<NSString *, NSString *> *)values error:(NSError **)error {
+    NSMutableString *command = [NSMutableString string];
+    __block BOOL failed = NO;
+    [self.placeholders enumerateObjectsUsingBlock:^(NSString *placeholder, NSUInteger index, BOOL *stop) {
+        id raw = values[placeholder];
+        NSString *value = [raw isKindOfClass:[NSString class]] ? raw : [raw description];
+        if (value == nil) {
+            if (error) {
+                *error = TSCFormMakeError(TSCFormCompilerErrorMissingValue, [NSString stringWithFormat:@"No value for {{%@}}", placeholder]);
+            }
+            failed = YES;
+            *stop = YES;
+            return;
+        }
+        TSCFormVariableKind kind = self->_kinds[placeholder].unsignedIntegerValue;
+        BOOL invalid = [value rangeOfCharacterFromSet:[NSCharacterSet newlineCharacterSet]].location != NSNotFound;
+        if (!invalid && (kind & TSCFormVariableNumber)) {
+            NSScanner *scanner = [NSScanner scannerWithString:value];
+            invalid = !([scanner scanDouble:NULL] && scanner.isAtEnd);
+        }
+        if (invalid) {
+            if (error) {
+                *error = TSCFormMakeError(TSCFormCompilerErrorInvalidValue, [NSString stringWithFormat:@"Invalid value for {{%@}}", placeholder]);
+            }
+            failed = YES;
+            *stop = YES;
+            return;
+        }
+        if (kind & TSCFormVariableString) {
+            // TSPL writes a double quote inside a string as \["]
+            NSString *escaped = [value stringByReplacingOccurrencesOfString:@"\"" withString:@"\\[\"]"];
+            [command appendFormat:@"V%lu$=\"%@\"\r\n", (unsigned long)index + 1, escaped];
+        }
+        if (kind & TSCFormVariableNumber) {
+            [command appendFormat:@"V%lu=%@\r\n", (unsigned long)index + 1, value];
+        }
+    }];
+    if (failed) {
+        return nil;
+    }
+    [command appendFormat:@"RUN \"%@\"\r\n", self.name];
+    NSData *data = [command dataUsingEncoding:self.encoding];
+    if (data == nil && error) {
+        *error = TSCFormMakeError(TSCFormCompilerErrorInvalidValue, @"Values cannot be encoded");
+    }
+    return data;
+}
+
+- (NSData *)batchCommandWithRecords:(NSArray<NSDictionary<NSString *, NSString *> *> *)records error:(NSError **)error {
+    NSMutableData *batch = [NSMutableData data];
+    for (NSDictionary<NSString *, NSString *> *record in records) {
+        NSData *label = [self labelCommandWithValues:record error:error];
+        if (label == nil) {
+            return nil;
+        }
+        [batch appendData:label];
+    }
+    return batch;
+}
+
+@end
+
+@implementation TSCFormCompiler
+
++ (TSCCompiledForm *)compileTemplate:(NSString *)source name:(NSString *)name encoding:(NSStringEncoding)encoding error:(NSError **)error {
+    if (!TSCFormIsIdentifier(name, 8)) {
+        if (error) {
+            *error = TSCFormMakeError(TSCFormCompilerErrorSyntax, @"Program names have 1 to 8 letters, digits or underscores");
+        }
+        return nil;
+    }
+    NSString *fileName = [[name uppercaseString] stringByAppendingString:@".BAS"];
+
+    NSMutableString *program = [NSMutableString stringWithCapacity:source.length];
+    NSMutableArray<NSString *> *placeholders = [NSMutableArray array];
+    NSMutableDictionary<NSString *, NSNumber *> *kinds = [NSMutableDictionary dictionary];
+    // Parts of the quoted string being compiled, joined with + when it closes
+    NSMutableArray<NSString *> *parts = nil;
+    NSMutableString *literal = [NSMutableString string];
+
+    NSUInteger length = source.length;
+    NSUInteger i = 0;
+    while (i < length) {
+        unichar c = [source characterAtIndex:i];
+        if (c == '{' && i + 1 < length && [source characterAtIndex:i + 1] == '{') {
+            NSRange close = [source rangeOfString:@"}}" options:0 range:NSMakeRange(i + 2, length - i - 2)];
+            NSString *placeholder = close.location == NSNotFound ? nil : [source substringWithRange:NSMakeRange(i + 2, close.location - i - 2)];
+            if (!TSCFormIsIdentifier(placeholder, 64)) {
+                if (error) {
+                    *error = TSCFormMakeError(TSCFormCompilerErrorSyntax, [NSString stringWithFormat:@"Invalid placeholder at offset %lu", (unsigned long)i]);
+                }
+                return nil;
+            }
+            NSUInteger index = [placeholders indexOfObject:placeholder];
+            if (index == NSNotFound) {
+                index = placeholders.count;
+                [placeholders addObject:placeholder];
+            }
+            TSCFormVariableKind kind = kinds[placeholder].unsignedIntegerValue;
+            if (parts) {
+                if (literal.length > 0) {
+                    [parts addObject:[NSString stringWithFormat:@"\"%@\"", literal]];
+                    [literal setString:@""];
+                }
+                [parts addObject:[NSString stringWithFormat:@"V%lu$", (unsigned long)index + 1]];
+                kind |= TSCFormVariableString;
+            } else {
+                [program appendFormat:@"V%lu", (unsigned long)index + 1];
+                kind |= TSCFormVariableNumber;
+            }
+            kinds[placeholder] = @(kind);
+            i = NSMaxRange(close);
+            continue;
+        }
+        if (c == '"') {
+            if (parts == nil) {
+                parts = [NSMutableArray array];
+            } else {
+                if (literal.length > 0 || parts.count == 0) {
+                    [parts addObject:[NSString stringWithFormat:@"\"%@\"", literal]];
+                    [literal setString:@""];
+                }
+                [program appendString:[parts componentsJoinedByString:@"+"]];
+                parts = nil;
+            }
+        } else if (parts) {
+            [literal appendFormat:@"%C", c];
+        } else {
+            [program appendFormat:@"%C", c];
+        }
+        i++;
+    }
+    if (parts) {
+        if (error) {
+            *error = TSCFormMakeError(TSCFormCompilerErrorSyntax, @"Unterminated string");
+        }
+        return nil;
+    }
+    if (![program hasSuffix:@"\n"]) {
+        [program appendString:@"\r\n"];
+    }
+    NSData *data = [program dataUsingEncoding:encoding];
+    if (data == nil) {
+        if (error) {
+            *error = TSCFormMakeError(TSCFormCompilerErrorSyntax, @"Template cannot be encoded");
+        }
+        return nil;
+    }
+    return [[TSCCompiledForm alloc] initWithName:fileName program:data placeholders:placeholders kinds:kinds encoding:encoding];
+}
+
+@end
@@ -9,8 +9,27 @@
 #import "TSCBLEManager.h"
 #import "TSCWIFIManager.h"
 #import "TSCCommand.h"
+#import "TSCZlibBitmapEncoder.h"
+#import "PrinterImagePreprocessor.h"
 #import "ZPLCommand.h"
+#import "BarcodeValidator.h"
+#import "PrinterSymbolRenderer.h"
+#import "PrinterTextEncoder.h"
+#import "PrinterSpool.h"
+#import "PrinterResumableTransfer.h"
+#import "PrinterPacketizer.h"
+#import "PrinterBLESessionManager.h"
+#import "PrinterTransport.h"
+#import "PrinterSocketTransport.h"
+#import "PrinterTransportAdapters.h"
+#import "PrinterGateway.h"
+#import "PrinterSendBatcher.h"
+#import "TSCSpeculativePrinter.h"
+#import "TSCAssetManager.h"
+#import "TSCFormCompiler.h"
+#import "ZPLFormatCache.h"
 #import "CPCLCommand.h"
+#import "CPCLImageEncoder.h"
 #import "KDS_Log.h"
 
 #endif
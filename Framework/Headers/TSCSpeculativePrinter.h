@@ -0,0 +1,76 @@
+//
+//  TSCSpeculativePrinter.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import "PrinterSDKCodeDefines.h"
+#import "PrinterTransportAdapters.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Queries the printer status; call reply with the status byte
+typedef void (^TSCStatusQuery)(void (^reply)(LabelPrinterStatus status));
+
+/// Prints TSPL labels without a status round trip before each job.
+///
+/// Jobs are sent as soon as they are queued, up to maxJobsInFlight ahead of the printer, while the
+/// status is polled in parallel. Every job is followed by `OUT "PSJ<n>"`, which the printer echoes
+/// once it has executed the job, so a job counts as printed only when its echo arrives.
+///
+/// When an error status arrives (cover open, paper end, jam, no ribbon, pause) sending stops. Once
+/// the printer reports ready again a sync marker is sent; jobs the printer still had buffered echo
+/// before it, and every job without an echo is sent again in its original order. No label is lost
+/// and none is printed twice, unless cancelAll drops jobs the printer already buffered.
+///
+/// Jobs queued before the transport is connected wait for it; they are sent once its state becomes
+/// PrinterTransportConnected, without pausing.
+@interface TSCSpeculativePrinter : NSObject
+
+/// Jobs sent but not yet echoed (default: 8)
+@property (nonatomic, assign) NSUInteger maxJobsInFlight;
+
+/// Seconds between status polls while jobs are in flight or printing is paused (default: 0.3)
+@property (nonatomic, assign) NSTimeInterval pollInterval;
+
+/// YES while an error stopped sending
+@property (nonatomic, readonly) BOOL paused;
+
+/// Last status received
+@property (nonatomic, readonly) LabelPrinterStatus lastStatus;
+
+/// Called on the main queue when printing stops on an error and again when it resumes with LabelPrinterReady
+@property (nonatomic, copy, nullable) void (^statusBlock)(LabelPrinterStatus status);
+
+/// Creates a printer over a transport; its receive and state blocks are taken over
+/// @param transport The transport, connected or connecting
+/// @param statusQuery Status poll, nil to rely on reportStatus: only
+- (instancetype)initWithTransport:(id<PrinterTransport>)transport statusQuery:(nullable TSCStatusQuery)statusQuery;
+
+/// Creates a printer over the BLE manager, polling with printerStatus:. Connects the manager's transport;
+/// jobs queued meanwhile are held until it is connected.
+- (instancetype)initWithBLEManager:(TSCBLEManager *)manager;
+
+/// Creates a printer over the WiFi manager, polling with printerStatus:. Connects the manager's transport;
+/// jobs queued meanwhile are held until it is connected.
+- (instancetype)initWithWiFiManager:(TSCWIFIManager *)manager;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/// Queues a label job
+/// @param job TSPL commands ending with PRINT
+/// @param completion Called on the main queue once the printer echoed the job, or with NO when cancelled
+- (void)printJob:(NSData *)job completion:(nullable void (^)(BOOL printed))completion;
+
+/// Feeds a status the printer reported on its own, e.g. with automatic status back
+/// @param status The status
+- (void)reportStatus:(LabelPrinterStatus)status;
+
+/// Drops all queued and unconfirmed jobs, completing them with NO.
+/// Jobs already sent but not yet echoed are in the printer's buffer and may still print even though
+/// their completion reports NO; TSPL has no command that clears the buffer of received jobs.
+- (void)cancelAll;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,291 @@
+//
+//  TSCSpeculativePrinter.m
+//  Printer
+//
+
+#import "TSCSpeculativePrinter.h"
+
+/// Seconds a status poll may stay unanswered before the next one is sent
+static const NSTimeInterval TSCSpeculativePollTimeout = 2;
+
+/// Seconds a sync marker may stay unanswered before it is sent again
+static const NSTimeInterval TSCSpeculativeSyncTimeout = 2;
+
+/// A queued label
+@interface TSCSpeculativeJob : NSObject
+@property (nonatomic, strong) NSData *data;
+@property (nonatomic, copy) void (^completion)(BOOL printed);
+/// Marker of the latest send, 0 while queued
+@property (nonatomic, assign) NSUInteger marker;
+@end
+
+@implementation TSCSpeculativeJob
+@end
+
+@implementation TSCSpeculativePrinter {
+    id<PrinterTransport> _transport;
+    TSCStatusQuery _statusQuery;
+    NSMutableArray<TSCSpeculativeJob *> *_pending;
+    NSMutableArray<TSCSpeculativeJob *> *_inFlight;
+    NSMutableData *_input;
+    NSUInteger _lastMarker;
+    NSUInteger _syncMarker;
+    CFAbsoluteTime _syncSentAt;
+    BOOL _pollScheduled;
+    BOOL _pollOutstanding;
+    CFAbsoluteTime _pollSentAt;
+}
+
+- (instancetype)initWithTransport:(id<PrinterTransport>)transport statusQuery:(TSCStatusQuery)statusQuery {
+    self = [super init];
+    if (self) {
+        _transport = transport;
+        _statusQuery = [statusQuery copy];
+        _maxJobsInFlight = 8;
+        _pollInterval = 0.3;
+        _pending = [NSMutableArray array];
+        _inFlight = [NSMutableArray array];
+        _input = [NSMutableData data];
+        __weak TSCSpeculativePrinter *weakSelf = self;
+        transport.receiveBlock = ^(NSData *data) {
+            [weakSelf didReceiveData:data];
+        };
+        transport.stateBlock = ^(PrinterTransportState state, NSError *error) {
+            [weakSelf transportDidChangeState:state];
+        };
+    }
+    return self;
+}
+
+- (instancetype)initWithBLEManager:(TSCBLEManager *)manager {
+    PrinterBLEManagerTransport *transport = [[PrinterBLEManagerTransport alloc] initWithTSCManager:manager];
+    self = [self initWithTransport:transport statusQuery:^(void (^reply)(LabelPrinterStatus)) {
+        [manager printerStatus:^(NSData *status) {
+            if (status.length > 0) {
+                reply(((const uint8_t *)status.bytes)[0]);
+            }
+        }];
+    }];
+    [transport connect];
+    return self;
+}
+
+- (instancetype)initWithWiFiManager:(TSCWIFIManager *)manager {
+    PrinterWiFiManagerTransport *transport = [[PrinterWiFiManagerTransport alloc] initWithTSCManager:manager];
+    self = [self initWithTransport:transport statusQuery:^(void (^reply)(LabelPrinterStatus)) {
+        [manager printerStatus:^(NSData *status) {
+            if (status.length > 0) {
+                reply(((const uint8_t *)status.bytes)[0]);
+            }
+        }];
+    }];
+    [transport connect];
+    return self;
+}
+
+/// Jobs queued while connecting were held back, not failed; send them now
+- (void)transportDidChangeState:(PrinterTransportState)state {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self transportDidChangeState:state];
+        });
+        return;
+    }
+    if (state == PrinterTransportConnected) {
+        [self sendJobs];
+    }
+}
+
+#pragma mark - Jobs
+
+- (void)printJob:(NSData *)job completion:(void (^)(BOOL))completion {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self printJob:job completion:completion];
+        });
+        return;
+    }
+    TSCSpeculativeJob *entry = [[TSCSpeculativeJob alloc] init];
+    entry.data = [job copy];
+    entry.completion = completion;
+    [_pending addObject:entry];
+    [self sendJobs];
+}
+
+- (void)cancelAll {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self cancelAll];
+        });
+        return;
+    }
+    NSArray<TSCSpeculativeJob *> *jobs = [_inFlight arrayByAddingObjectsFromArray:_pending];
+    [_inFlight removeAllObjects];
+    [_pending removeAllObjects];
+    for (TSCSpeculativeJob *job in jobs) {
+        if (job.completion) {
+            job.completion(NO);
+        }
+    }
+}
+
+- (void)sendJobs {
+    if (_transport.state != PrinterTransportConnected) {
+        return;
+    }
+    while (!_paused && _inFlight.count < MAX(self.maxJobsInFlight, 1) && _pending.count > 0) {
+        TSCSpeculativeJob *job = _pending.firstObject;
+        [_pending removeObjectAtIndex:0];
+        job.marker = ++_lastMarker;
+        [_inFlight addObject:job];
+
+        NSMutableData *data = [job.data mutableCopy];
+        [data appendData:[self markerCommand:@"PSJ" value:job.marker]];
+        [_transport writeData:data completion:^(BOOL success, NSError *error) {
+            if (!success) {
+                [self pauseWithStatus:self.lastStatus];
+            }
+        }];
+    }
+    [self schedulePoll];
+}
+
+/// OUT echoes its string once the commands before it were executed
+- (NSData *)markerCommand:(NSString *)prefix value:(NSUInteger)value {
+    return [[NSString stringWithFormat:@"\r\nOUT \"%@%lu;\"\r\n", prefix, (unsigned long)value] dataUsingEncoding:NSASCIIStringEncoding];
+}
+
+#pragma mark - Echoes
+
+- (void)didReceiveData:(NSData *)data {
+    [_input appendData:data];
+    const uint8_t *bytes = _input.bytes;
+    NSUInteger length = _input.length;
+    NSUInteger consumed = 0;
+    NSUInteger i = 0;
+    while (i + 2 < length) {
+        if (bytes[i] != 'P' || bytes[i + 1] != 'S' || (bytes[i + 2] != 'J' && bytes[i + 2] != 'S')) {
+            i++;
+            consumed = i;
+            continue;
+        }
+        NSUInteger j = i + 3;
+        NSUInteger value = 0;
+        while (j < length && bytes[j] >= '0' && bytes[j] <= '9') {
+            value = value * 10 + (bytes[j] - '0');
+            j++;
+        }
+        if (j == length) {
+            break;
+        }
+        if (bytes[j] == ';' && j > i + 3) {
+            if (bytes[i + 2] == 'J') {
+                [self didEchoJobMarker:value];
+            } else {
+                [self didEchoSyncMarker:value];
+            }
+        }
+        i = j + 1;
+        consumed = i;
+    }
+    // Keep an unfinished marker for the next chunk
+    [_input replaceBytesInRange:NSMakeRange(0, MIN(consumed, _input.length)) withBytes:NULL length:0];
+}
+
+- (void)didEchoJobMarker:(NSUInteger)marker {
+    // Markers echo in order, so every job up to this one was printed
+    while (_inFlight.count > 0 && _inFlight.firstObject.marker <= marker) {
+        TSCSpeculativeJob *job = _inFlight.firstObject;
+        [_inFlight removeObjectAtIndex:0];
+        if (job.completion) {
+            job.completion(YES);
+        }
+    }
+    [self sendJobs];
+}
+
+- (void)didEchoSyncMarker:(NSUInteger)marker {
+    if (!_paused || marker != _syncMarker) {
+        return;
+    }
+    // Everything the printer still had buffered has echoed, the rest never printed
+    NSIndexSet *front = [NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, _inFlight.count)];
+    [_pending insertObjects:_inFlight atIndexes:front];
+    [_inFlight removeAllObjects];
+    _syncMarker = 0;
+    _paused = NO;
+    if (self.statusBlock) {
+        self.statusBlock(LabelPrinterReady);
+    }
+    [self sendJobs];
+}
+
+#pragma mark - Status
+
+- (void)reportStatus:(LabelPrinterStatus)status {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self reportStatus:status];
+        });
+        return;
+    }
+    _lastStatus = status;
+    BOOL error = (status & (LabelPrinterCoverOpened | LabelPrinterPaperJam | LabelPrinterPaperEnd | LabelPrinterNoRibbon | LabelPrinterPause)) != 0;
+    if (error) {
+        [self pauseWithStatus:status];
+    } else if (_paused) {
+        [self sendSyncMarker];
+    }
+    [self schedulePoll];
+}
+
+- (void)pauseWithStatus:(LabelPrinterStatus)status {
+    _syncMarker = 0;
+    if (_paused) {
+        return;
+    }
+    _paused = YES;
+    if (self.statusBlock) {
+        self.statusBlock(status);
+    }
+    [self schedulePoll];
+}
+
+- (void)sendSyncMarker {
+    if (_syncMarker != 0 && CFAbsoluteTimeGetCurrent() - _syncSentAt < TSCSpeculativeSyncTimeout) {
+        return;
+    }
+    _syncMarker = ++_lastMarker;
+    _syncSentAt = CFAbsoluteTimeGetCurrent();
+    [_transport writeData:[self markerCommand:@"PSS" value:_syncMarker] completion:nil];
+}
+
+- (void)schedulePoll {
+    if (_pollScheduled || _statusQuery == nil || (!_paused && _inFlight.count == 0)) {
+        return;
+    }
+    _pollScheduled = YES;
+    __weak TSCSpeculativePrinter *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.pollInterval * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [weakSelf poll];
+    });
+}
+
+- (void)poll {
+    _pollScheduled = NO;
+    if (!_pollOutstanding || CFAbsoluteTimeGetCurrent() - _pollSentAt > TSCSpeculativePollTimeout) {
+        _pollOutstanding = YES;
+        _pollSentAt = CFAbsoluteTimeGetCurrent();
+        __weak TSCSpeculativePrinter *weakSelf = self;
+        _statusQuery(^(LabelPrinterStatus status) {
+            TSCSpeculativePrinter *strongSelf = weakSelf;
+            if (strongSelf) {
+                strongSelf->_pollOutstanding = NO;
+                [strongSelf reportStatus:status];
+            }
+        });
+    }
+    [self schedulePoll];
+}
+
+@end
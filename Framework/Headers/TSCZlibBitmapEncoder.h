@@ -0,0 +1,73 @@
+//
+//  TSCZlibBitmapEncoder.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+#import <UIKit/UIKit.h>
+#import "PrinterBitmap.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Deflate strategy, values match the zlib constants
+typedef NS_ENUM(NSInteger, TSCZlibStrategy) {
+    TSCZlibStrategyDefault = 0,     ///< Z_DEFAULT_STRATEGY
+    TSCZlibStrategyFiltered = 1,    ///< Z_FILTERED
+    TSCZlibStrategyHuffmanOnly = 2, ///< Z_HUFFMAN_ONLY
+    TSCZlibStrategyRLE = 3,         ///< Z_RLE, suits 1-bpp label graphics
+    TSCZlibStrategyFixed = 4        ///< Z_FIXED
+};
+
+/// Builds TSPL zlib BITMAP commands with a reusable deflate context.
+/// The deflate window and hash tables are allocated once and reset for every job,
+/// so an encoder should be kept alive across labels rather than created per call.
+@interface TSCZlibBitmapEncoder : NSObject
+
+/// Deflate level, 0-9 or -1 for the zlib default (default: 6)
+@property (nonatomic, assign) int compressionLevel;
+
+/// Deflate strategy (default: TSCZlibStrategyRLE)
+@property (nonatomic, assign) TSCZlibStrategy strategy;
+
+/// Height of the independently compressed bands in dots, 0 compresses the image as one band (default: 0).
+/// Each band is emitted as its own BITMAP command at the matching y-coordinate.
+@property (nonatomic, assign) int bandHeight;
+
+/// Maximum number of bands deflated in parallel, 1 compresses serially (default: 1)
+@property (nonatomic, assign) NSUInteger maxConcurrentBands;
+
+/// Returns the shared encoder
++ (instancetype)sharedEncoder;
+
+/// Draws a bitmap image with zlib compression.
+/// @param x The x-coordinate
+/// @param y The y-coordinate
+/// @param mode The graphic mode, 0-2 are mapped to their zlib variants 3-5
+///
+/// | Value | Description             |
+/// |-------|-------------------------|
+/// | 3     | OVERWRITE + zlib        |
+/// | 4     | OR + zlib               |
+/// | 5     | XOR + zlib              |
+///
+/// @param image The graphic you want to print
+/// @return Data command
+- (NSData *)zlibBitmapWithX:(int)x
+                       andY:(int)y
+                    andMode:(int)mode
+                   andImage:(UIImage *)image;
+
+/// Draws an already converted bitmap with zlib compression.
+/// @param x The x-coordinate
+/// @param y The y-coordinate
+/// @param mode The graphic mode (see zlibBitmapWithX:andY:andMode:andImage:)
+/// @param bitmap The bitmap you want to print
+/// @return Data command
+- (NSData *)zlibBitmapWithX:(int)x
+                       andY:(int)y
+                    andMode:(int)mode
+                  andBitmap:(PrinterBitmap *)bitmap;
+
+@end
+
+NS_ASSUME_NONNULL_END
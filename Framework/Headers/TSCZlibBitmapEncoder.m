@@ -0,0 +1,217 @@
+//
+//  TSCZlibBitmapEncoder.m
+//  Printer
+//
+
+#import "TSCZlibBitmapEncoder.h"
+#import <zlib.h>
+
+/// One deflate stream with its scratch buffers, reset between bands instead of reallocated
+typedef struct {
+    z_stream stream;
+    BOOL initialized;
+    int level;
+    int strategy;
+    uint8_t *input;
+    size_t inputCapacity;
+    uint8_t *output;
+    size_t outputCapacity;
+} TSCZlibContext;
+
+static BOOL TSCZlibReserve(uint8_t **buffer, size_t *capacity, size_t length) {
+    if (*capacity >= length) {
+        return YES;
+    }
+    uint8_t *grown = realloc(*buffer, length);
+    if (grown == NULL) {
+        return NO;
+    }
+    *buffer = grown;
+    *capacity = length;
+    return YES;
+}
+
+static void TSCZlibContextDestroy(TSCZlibContext *context) {
+    if (context == NULL) {
+        return;
+    }
+    if (context->initialized) {
+        deflateEnd(&context->stream);
+    }
+    free(context->input);
+    free(context->output);
+    free(context);
+}
+
+/// Deflates rows [firstRow, firstRow + rows) of the bitmap, inverted to the TSPL polarity (0 = black dot).
+static NSData *TSCZlibDeflateBand(TSCZlibContext *context, PrinterBitmap *bitmap, int firstRow, int rows, int level, int strategy) {
+    if (!context->initialized || context->level != level || context->strategy != strategy) {
+        if (context->initialized) {
+            deflateEnd(&context->stream);
+            context->initialized = NO;
+        }
+        memset(&context->stream, 0, sizeof(z_stream));
+        if (deflateInit2(&context->stream, level, Z_DEFLATED, MAX_WBITS, 8, strategy) != Z_OK) {
+            return nil;
+        }
+        context->initialized = YES;
+        context->level = level;
+        context->strategy = strategy;
+    } else if (deflateReset(&context->stream) != Z_OK) {
+        return nil;
+    }
+
+    size_t length = (size_t)bitmap.bytesPerRow * (size_t)rows;
+    if (!TSCZlibReserve(&context->input, &context->inputCapacity, length)) {
+        return nil;
+    }
+    const uint8_t *src = [bitmap bytesForRow:firstRow];
+    for (size_t i = 0; i < length; i++) {
+        context->input[i] = (uint8_t)~src[i];
+    }
+
+    size_t bound = deflateBound(&context->stream, (uLong)length);
+    if (!TSCZlibReserve(&context->output, &context->outputCapacity, bound)) {
+        return nil;
+    }
+    context->stream.next_in = context->input;
+    context->stream.avail_in = (uInt)length;
+    context->stream.next_out = context->output;
+    context->stream.avail_out = (uInt)bound;
+    if (deflate(&context->stream, Z_FINISH) != Z_STREAM_END) {
+        return nil;
+    }
+    return [NSData dataWithBytes:context->output length:context->stream.total_out];
+}
+
+@implementation TSCZlibBitmapEncoder {
+    TSCZlibContext **_contexts;
+    NSUInteger _contextCount;
+}
+
++ (instancetype)sharedEncoder {
+    static TSCZlibBitmapEncoder *encoder = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        encoder = [[TSCZlibBitmapEncoder alloc] init];
+    });
+    return encoder;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _compressionLevel = 6;
+        _strategy = TSCZlibStrategyRLE;
+        _bandHeight = 0;
+        _maxConcurrentBands = 1;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    for (NSUInteger i = 0; i < _contextCount; i++) {
+        TSCZlibContextDestroy(_contexts[i]);
+    }
+    free(_contexts);
+}
+
+- (BOOL)reserveContexts:(NSUInteger)count {
+    if (count <= _contextCount) {
+        return YES;
+    }
+    TSCZlibContext **grown = realloc(_contexts, count * sizeof(TSCZlibContext *));
+    if (grown == NULL) {
+        return NO;
+    }
+    _contexts = grown;
+    for (NSUInteger i = _contextCount; i < count; i++) {
+        _contexts[i] = calloc(1, sizeof(TSCZlibContext));
+        if (_contexts[i] == NULL) {
+            _contextCount = i;
+            return NO;
+        }
+    }
+    _contextCount = count;
+    return YES;
+}
+
+- (NSData *)zlibBitmapWithX:(int)x andY:(int)y andMode:(int)mode andImage:(UIImage *)image {
+    PrinterBitmap *bitmap = [PrinterBitmap bitmapWithImage:image];
+    if (bitmap == nil) {
+        return [NSData data];
+    }
+    return [self zlibBitmapWithX:x andY:y andMode:mode andBitmap:bitmap];
+}
+
+- (NSData *)zlibBitmapWithX:(int)x andY:(int)y andMode:(int)mode andBitmap:(PrinterBitmap *)bitmap {
+    if (bitmap.width == 0 || bitmap.height == 0) {
+        return [NSData data];
+    }
+    int zlibMode = mode < 3 ? mode + 3 : mode;
+    int level = MIN(MAX(self.compressionLevel, Z_DEFAULT_COMPRESSION), Z_BEST_COMPRESSION);
+    int strategy = (int)self.strategy;
+    int bandHeight = self.bandHeight > 0 ? MIN(self.bandHeight, bitmap.height) : bitmap.height;
+    NSUInteger bandCount = (NSUInteger)((bitmap.height + bandHeight - 1) / bandHeight);
+    NSUInteger workers = MIN(MAX(self.maxConcurrentBands, (NSUInteger)1), bandCount);
+
+    NSMutableArray *bands = [NSMutableArray arrayWithCapacity:bandCount];
+    for (NSUInteger i = 0; i < bandCount; i++) {
+        [bands addObject:[NSNull null]];
+    }
+
+    @synchronized (self) {
+        if (![self reserveContexts:workers]) {
+            workers = MAX(_contextCount, (NSUInteger)1);
+            if (![self reserveContexts:workers]) {
+                return [NSData data];
+            }
+        }
+        TSCZlibContext **contexts = _contexts;
+        void (^deflateWorker)(size_t) = ^(size_t worker) {
+            for (NSUInteger band = worker; band < bandCount; band += workers) {
+                int firstRow = (int)band * bandHeight;
+                int rows = MIN(bandHeight, bitmap.height - firstRow);
+                NSData *compressed = TSCZlibDeflateBand(contexts[worker], bitmap, firstRow, rows, level, strategy);
+                if (compressed != nil) {
+                    @synchronized (bands) {
+                        bands[band] = compressed;
+                    }
+                }
+            }
+        };
+        if (workers > 1) {
+            dispatch_apply(workers, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), deflateWorker);
+        } else {
+            deflateWorker(0);
+        }
+    }
+
+    NSMutableData *command = [NSMutableData data];
+    for (NSUInteger band = 0; band < bandCount; band++) {
+        int firstRow = (int)band * bandHeight;
+        int rows = MIN(bandHeight, bitmap.height - firstRow);
+        NSData *compressed = bands[band];
+        NSString *header = nil;
+        if ([compressed isKindOfClass:[NSData class]]) {
+            header = [NSString stringWithFormat:@"BITMAP %d,%d,%d,%d,%d,%lu,", x, y + firstRow, bitmap.bytesPerRow, rows, zlibMode, (unsigned long)compressed.length];
+            [command appendData:[header dataUsingEncoding:NSASCIIStringEncoding]];
+            [command appendData:compressed];
+        } else {
+            // Deflate failed for this band, fall back to the plain BITMAP command
+            header = [NSString stringWithFormat:@"BITMAP %d,%d,%d,%d,%d,", x, y + firstRow, bitmap.bytesPerRow, rows, zlibMode - 3];
+            [command appendData:[header dataUsingEncoding:NSASCIIStringEncoding]];
+            size_t length = (size_t)bitmap.bytesPerRow * (size_t)rows;
+            NSMutableData *plain = [NSMutableData dataWithBytes:[bitmap bytesForRow:firstRow] length:length];
+            uint8_t *bytes = plain.mutableBytes;
+            for (size_t i = 0; i < length; i++) {
+                bytes[i] = (uint8_t)~bytes[i];
+            }
+            [command appendData:plain];
+        }
+        [command appendBytes:"\r\n" length:2];
+    }
+    return command;
+}
+
+@end
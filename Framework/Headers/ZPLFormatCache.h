@@ -0,0 +1,82 @@
+//
+//  ZPLFormatCache.h
+//  Printer
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// A label layout stored on the printer with ^DF and recalled with ^XF.
+/// Build it from ZPLCommand drawing calls; wherever a field varies per label, pass {{name}} as
+/// its content, e.g. [ZPLCommand drawBarcodeWithx:20 y:40 codeType:CODE_128 text:@"{{sku}}"].
+/// Each ^FD holding a placeholder is stored as a numbered ^FN field.
+@interface ZPLFormat : NSObject
+
+/// Format name, up to 16 letters and digits, stored as <name>.ZPL
+@property (nonatomic, copy, readonly) NSString *name;
+
+/// Placeholder names in field number order (^FN1, ^FN2, ...)
+@property (nonatomic, readonly) NSArray<NSString *> *placeholders;
+
+/// Encoding of the field values, should match ZPLCommand setStringEncoding: (default: UTF-8)
+@property (nonatomic, assign) NSStringEncoding encoding;
+
+/// Creates an empty format
+/// @param name Format name
++ (nullable instancetype)formatWithName:(NSString *)name;
+
+/// Appends commands; ^XA and ^XZ are dropped since the format supplies its own
+/// @param command Output of a ZPLCommand call
+- (void)appendCommand:(NSData *)command;
+
+/// The ^DF command storing the format
+/// @param device Storage device, "R" for DRAM or "E" for flash
+- (NSData *)storeCommandOnDevice:(NSString *)device;
+
+/// The ^XF label recalling the format with field data
+/// @param values Value for every placeholder, missing ones print empty
+/// @param device Storage device the format was stored on
+/// @param copies Labels to print, 1 for one
+- (NSData *)recallCommandWithValues:(NSDictionary<NSString *, NSString *> *)values device:(NSString *)device copies:(NSUInteger)copies;
+
+@end
+
+/// Tracks the formats stored on each printer, most recently used first, so repeated labels only
+/// send ^XF and their field data. The format is stored the first time it is used on a printer,
+/// or again after its layout changed. When more than capacity formats are stored, the least
+/// recently used one is deleted with ^ID.
+@interface ZPLFormatCache : NSObject
+
+/// Formats kept per printer (default: 16)
+@property (nonatomic, assign) NSUInteger capacity;
+
+/// Storage device (default: "R", DRAM)
+@property (nonatomic, copy) NSString *device;
+
+/// Returns the shared cache
++ (instancetype)sharedCache;
+
+/// Commands printing one or more labels: ^ID for evicted formats, ^DF when the printer lacks
+/// the format, then the ^XF recall
+/// @param format The format
+/// @param values Field data
+/// @param copies Labels to print
+/// @param printerID Identifier of the printer, e.g. its MAC address
+- (NSData *)labelDataWithFormat:(ZPLFormat *)format
+                         values:(NSDictionary<NSString *, NSString *> *)values
+                         copies:(NSUInteger)copies
+                      printerID:(NSString *)printerID;
+
+/// Returns whether the printer holds the current version of a format
+/// @param format The format
+/// @param printerID Identifier of the printer
+- (BOOL)isFormat:(ZPLFormat *)format storedOnPrinter:(NSString *)printerID;
+
+/// Forgets a printer's formats, e.g. after a failed write or a power cycle
+/// @param printerID Identifier of the printer
+- (void)invalidatePrinter:(NSString *)printerID;
+
+@end
+
+NS_ASSUME_NONNULL_END
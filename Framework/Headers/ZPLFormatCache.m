@@ -0,0 +1,284 @@
+//
+//  ZPLFormatCache.m
+//  Printer
+//
+
+#import "ZPLFormatCache.h"
+
+static NSData *ZPLFormatASCII(NSString *string) {
+    return [string dataUsingEncoding:NSASCIIStringEncoding];
+}
+
+/// Index of a byte sequence at or after start, NSNotFound if absent
+static NSUInteger ZPLFormatFind(NSData *data, const char *token, NSUInteger start) {
+    size_t length = strlen(token);
+    if (data.length < length || start > data.length - length) {
+        return NSNotFound;
+    }
+    NSData *needle = [NSData dataWithBytesNoCopy:(void *)token length:length freeWhenDone:NO];
+    NSRange range = [data rangeOfData:needle options:0 range:NSMakeRange(start, data.length - start)];
+    return range.location;
+}
+
+@implementation ZPLFormat {
+    NSMutableData *_source;
+    /// Format body with the placeholder fields replaced by ^FN
+    NSData *_body;
+    /// Per field number: NSData literal parts and NSString placeholder names
+    NSArray<NSArray *> *_fields;
+    NSArray<NSString *> *_placeholders;
+}
+
++ (instancetype)formatWithName:(NSString *)name {
+    NSCharacterSet *invalid = [[NSCharacterSet alphanumericCharacterSet] invertedSet];
+    if (name.length == 0 || name.length > 16 || ![name canBeConvertedToEncoding:NSASCIIStringEncoding] || [name rangeOfCharacterFromSet:invalid].location != NSNotFound) {
+        return nil;
+    }
+    ZPLFormat *format = [[self alloc] init];
+    format->_name = [name uppercaseString];
+    format->_source = [NSMutableData data];
+    format->_encoding = NSUTF8StringEncoding;
+    return format;
+}
+
+- (void)appendCommand:(NSData *)command {
+    const uint8_t *bytes = command.bytes;
+    NSUInteger start = 0;
+    for (NSUInteger i = 0; i + 2 < command.length; i++) {
+        if (bytes[i] == '^' && bytes[i + 1] == 'X' && (bytes[i + 2] == 'A' || bytes[i + 2] == 'Z')) {
+            [_source appendBytes:bytes + start length:i - start];
+            start = i + 3;
+            i += 2;
+        }
+    }
+    [_source appendBytes:bytes + start length:command.length - start];
+    _body = nil;
+}
+
+- (NSArray<NSString *> *)placeholders {
+    [self compile];
+    return _placeholders;
+}
+
+/// Replaces every ^FD...^FS holding a placeholder with a numbered ^FN field
+- (void)compile {
+    if (_body) {
+        return;
+    }
+    NSMutableData *body = [NSMutableData dataWithCapacity:_source.length];
+    NSMutableArray<NSArray *> *fields = [NSMutableArray array];
+    NSMutableArray<NSString *> *placeholders = [NSMutableArray array];
+    NSUInteger position = 0;
+    while (position < _source.length) {
+        NSUInteger fd = ZPLFormatFind(_source, "^FD", position);
+        NSUInteger fs = fd == NSNotFound ? NSNotFound : ZPLFormatFind(_source, "^FS", fd + 3);
+        if (fs == NSNotFound) {
+            break;
+        }
+        NSData *content = [_source subdataWithRange:NSMakeRange(fd + 3, fs - fd - 3)];
+        NSArray *parts = [self partsOfFieldData:content placeholders:placeholders];
+        if (parts == nil) {
+            [body appendData:[_source subdataWithRange:NSMakeRange(position, fs - position)]];
+        } else {
+            [body appendData:[_source subdataWithRange:NSMakeRange(position, fd - position)]];
+            [fields addObject:parts];
+            [body appendData:ZPLFormatASCII([NSString stringWithFormat:@"^FN%lu", (unsigned long)fields.count])];
+        }
+        position = fs;
+    }
+    [body appendData:[_source subdataWithRange:NSMakeRange(position, _source.length - position)]];
+    _body = body;
+    _fields = fields;
+    _placeholders = placeholders;
+}
+
+/// Splits field data at {{name}} placeholders, nil when it has none
+- (NSArray *)partsOfFieldData:(NSData *)content placeholders:(NSMutableArray<NSString *> *)placeholders {
+    NSMutableArray *parts = [NSMutableArray array];
+    NSUInteger position = 0;
+    BOOL found = NO;
+    while (position < content.length) {
+        NSUInteger open = ZPLFormatFind(content, "{{", position);
+        NSUInteger close = open == NSNotFound ? NSNotFound : ZPLFormatFind(content, "}}", open + 2);
+        if (close == NSNotFound) {
+            break;
+        }
+        NSString *name = [[NSString alloc] initWithData:[content subdataWithRange:NSMakeRange(open + 2, close - open - 2)] encoding:NSASCIIStringEncoding];
+        if (name.length == 0) {
+            break;
+        }
+        if (open > position) {
+            [parts addObject:[content subdataWithRange:NSMakeRange(position, open - position)]];
+        }
+        [parts addObject:name];
+        if (![placeholders containsObject:name]) {
+            [placeholders addObject:name];
+        }
+        found = YES;
+        position = close + 2;
+    }
+    if (!found) {
+        return nil;
+    }
+    if (position < content.length) {
+        [parts addObject:[content subdataWithRange:NSMakeRange(position, content.length - position)]];
+    }
+    return parts;
+}
+
+- (NSData *)body {
+    [self compile];
+    return _body;
+}
+
+- (NSData *)storeCommandOnDevice:(NSString *)device {
+    NSMutableData *command = [ZPLFormatASCII([NSString stringWithFormat:@"^XA^DF%@:%@.ZPL^FS", device, self.name]) mutableCopy];
+    [command appendData:[self body]];
+    [command appendData:ZPLFormatASCII(@"^XZ")];
+    return command;
+}
+
+- (NSData *)recallCommandWithValues:(NSDictionary<NSString *, NSString *> *)values device:(NSString *)device copies:(NSUInteger)copies {
+    [self compile];
+    NSMutableData *command = [ZPLFormatASCII([NSString stringWithFormat:@"^XA^XF%@:%@.ZPL^FS", device, self.name]) mutableCopy];
+    [_fields enumerateObjectsUsingBlock:^(NSArray *parts, NSUInteger index, BOOL *stop) {
+        NSMutableData *data = [NSMutableData data];
+        for (id part in parts) {
+            if ([part isKindOfClass:[NSData class]]) {
+                [data appendData:part];
+            } else {
+                [data appendData:[values[part] dataUsingEncoding:self.encoding allowLossyConversion:YES] ?: [NSData data]];
+            }
+        }
+        [command appendData:ZPLFormatASCII([NSString stringWithFormat:@"^FN%lu", (unsigned long)index + 1])];
+        [command appendData:[self escapedFieldData:data]];
+        [command appendData:ZPLFormatASCII(@"^FS")];
+    }];
+    if (copies > 1) {
+        [command appendData:ZPLFormatASCII([NSString stringWithFormat:@"^PQ%lu", (unsigned long)copies])];
+    }
+    [command appendData:ZPLFormatASCII(@"^XZ")];
+    return command;
+}
+
+/// ^FD with the data; caret and tilde would start a command, so such data is hex escaped with ^FH
+- (NSData *)escapedFieldData:(NSData *)data {
+    const uint8_t *bytes = data.bytes;
+    BOOL escape = NO;
+    for (NSUInteger i = 0; i < data.length && !escape; i++) {
+        escape = bytes[i] == '^' || bytes[i] == '~';
+    }
+    if (!escape) {
+        NSMutableData *field = [ZPLFormatASCII(@"^FD") mutableCopy];
+        [field appendData:data];
+        return field;
+    }
+    NSMutableData *field = [ZPLFormatASCII(@"^FH_^FD") mutableCopy];
+    for (NSUInteger i = 0; i < data.length; i++) {
+        uint8_t byte = bytes[i];
+        if (byte == '^' || byte == '~' || byte == '_') {
+            char hex[4];
+            snprintf(hex, sizeof(hex), "_%02X", byte);
+            [field appendBytes:hex length:3];
+        } else {
+            [field appendBytes:&byte length:1];
+        }
+    }
+    return field;
+}
+
+@end
+
+/// A format stored on a printer
+@interface ZPLFormatEntry : NSObject
+@property (nonatomic, copy) NSString *name;
+@property (nonatomic, strong) NSData *body;
+@end
+
+@implementation ZPLFormatEntry
+@end
+
+@implementation ZPLFormatCache {
+    /// Most recently used first
+    NSMutableDictionary<NSString *, NSMutableArray<ZPLFormatEntry *> *> *_printers;
+}
+
++ (instancetype)sharedCache {
+    static ZPLFormatCache *cache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        cache = [[ZPLFormatCache alloc] init];
+    });
+    return cache;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _capacity = 16;
+        _device = @"R";
+        _printers = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (NSMutableArray<ZPLFormatEntry *> *)entriesForPrinter:(NSString *)printerID {
+    NSMutableArray<ZPLFormatEntry *> *entries = _printers[printerID];
+    if (entries == nil) {
+        entries = [NSMutableArray array];
+        _printers[printerID] = entries;
+    }
+    return entries;
+}
+
+- (ZPLFormatEntry *)entryNamed:(NSString *)name in:(NSArray<ZPLFormatEntry *> *)entries {
+    for (ZPLFormatEntry *entry in entries) {
+        if ([entry.name isEqualToString:name]) {
+            return entry;
+        }
+    }
+    return nil;
+}
+
+- (NSData *)labelDataWithFormat:(ZPLFormat *)format values:(NSDictionary<NSString *, NSString *> *)values copies:(NSUInteger)copies printerID:(NSString *)printerID {
+    NSMutableData *data = [NSMutableData data];
+    NSData *body = [format body];
+    @synchronized (self) {
+        NSMutableArray<ZPLFormatEntry *> *entries = [self entriesForPrinter:printerID];
+        ZPLFormatEntry *entry = [self entryNamed:format.name in:entries];
+        if (entry) {
+            [entries removeObject:entry];
+        }
+        if (entry == nil || ![entry.body isEqualToData:body]) {
+            // ^DF replaces a stored format of the same name
+            entry = [[ZPLFormatEntry alloc] init];
+            entry.name = format.name;
+            entry.body = body;
+            while (entries.count >= MAX(self.capacity, 1)) {
+                ZPLFormatEntry *evicted = entries.lastObject;
+                [entries removeLastObject];
+                [data appendData:ZPLFormatASCII([NSString stringWithFormat:@"^XA^ID%@:%@.ZPL^FS^XZ", self.device, evicted.name])];
+            }
+            [data appendData:[format storeCommandOnDevice:self.device]];
+        }
+        [entries insertObject:entry atIndex:0];
+    }
+    [data appendData:[format recallCommandWithValues:values device:self.device copies:copies]];
+    return data;
+}
+
+- (BOOL)isFormat:(ZPLFormat *)format storedOnPrinter:(NSString *)printerID {
+    NSData *body = [format body];
+    @synchronized (self) {
+        ZPLFormatEntry *entry = [self entryNamed:format.name in:_printers[printerID]];
+        return entry != nil && [entry.body isEqualToData:body];
+    }
+}
+
+- (void)invalidatePrinter:(NSString *)printerID {
+    @synchronized (self) {
+        [_printers removeObjectForKey:printerID];
+    }
+}
+
+@end